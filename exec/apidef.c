@@ -148,7 +148,8 @@ static struct corosync_api_v1 apidef_corosync_api_v1 = {
 	.state_dump = corosync_state_dump,
 	.poll_handle_get = cs_poll_handle_get,
 	.poll_dispatch_add = cs_poll_dispatch_add,
-	.poll_dispatch_delete = cs_poll_dispatch_delete
+	.poll_dispatch_delete = cs_poll_dispatch_delete,
+	.totem_mcast_batch = main_mcast_batch
 };
 
 void apidef_init (struct objdb_iface_ver0 *objdb) {
@@ -181,6 +182,7 @@ void apidef_init (struct objdb_iface_ver0 *objdb) {
 	apidef_corosync_api_v1.object_key_create_typed = objdb->object_key_create_typed;
 	apidef_corosync_api_v1.object_key_get_typed = objdb->object_key_get_typed;
 	apidef_corosync_api_v1.object_key_iter_typed = objdb->object_key_iter_typed;
+	apidef_corosync_api_v1.object_key_create_virtual = objdb->object_key_create_virtual;
 }
 
 struct corosync_api_v1 *apidef_get (void)
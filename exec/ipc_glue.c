@@ -50,6 +50,7 @@
 #include <corosync/swab.h>
 #include <corosync/corotypes.h>
 #include <corosync/corodefs.h>
+#include <corosync/statshm.h>
 #include <corosync/totem/totempg.h>
 #include <corosync/engine/objdb.h>
 #include <corosync/engine/config.h>
@@ -79,12 +80,89 @@ struct cs_ipcs_mapper {
 	char name[256];
 };
 
-struct outq_item {
-	void *msg;
-	size_t mlen;
+/*
+ * Events that do not fit into the client's event ring are copied into a
+ * per-connection byte ring of 8 byte aligned records.  The ring starts
+ * small, doubles on demand and never grows past outq_size_max, at which
+ * point outq_policy decides what happens to the connection.
+ */
+#define CS_IPCS_OUTQ_SIZE_DEFAULT	(16 * 1024 * 1024)
+#define CS_IPCS_OUTQ_SIZE_MIN		(2 * 1024 * 1024)
+#define CS_IPCS_OUTQ_SIZE_INITIAL	(64 * 1024)
+#define CS_IPCS_OUTQ_FLUSH_BATCH	64
+#define CS_IPCS_OUTQ_RETRY_MSEC		1
+#define CS_IPCS_OUTQ_REC_WRAP		0xffffffff
+#define CS_IPCS_OUTQ_ALIGN(size)	(((size) + 7) & ~7)
+
+enum cs_ipcs_outq_policy {
+	CS_IPCS_OUTQ_POLICY_DISCONNECT,
+	CS_IPCS_OUTQ_POLICY_DROP_OLDEST,
+	CS_IPCS_OUTQ_POLICY_BACKPRESSURE
+};
+
+struct outq_rec {
+	uint32_t len;
+	uint32_t pad;
+};
+
+struct cs_ipcs_outq {
+	char *buf;
+	size_t size;
+	size_t head;
+	size_t tail;
+	size_t used;
+	uint32_t count;
+};
+
+static size_t outq_size_max = CS_IPCS_OUTQ_SIZE_DEFAULT;
+static enum cs_ipcs_outq_policy outq_policy = CS_IPCS_OUTQ_POLICY_BACKPRESSURE;
+
+/*
+ * Memory held by the outbound queues of all connections
+ */
+static struct {
+	uint64_t memory;
+	uint64_t memory_peak;
+	uint64_t queued;
+	uint64_t dropped;
+	uint64_t disconnects;
+	uint64_t backpressure;
+} outq_stats;
+
+/*
+ * Requests that go out through totem are admitted per connection from a
+ * token bucket refilled at fq_rate bytes per second per unit of weight.
+ * Requests that find the bucket empty are copied onto the connection's
+ * deferred list and fed to the services later, a weighted round robin
+ * over the connections at a time, so a runaway client cannot take over
+ * the new message queue.  fq_rate 0 disables the scheduler.
+ */
+#define CS_IPCS_FQ_QUEUE_SIZE_DEFAULT	(4 * 1024 * 1024)
+#define CS_IPCS_FQ_BURST_MIN		(64 * 1024)
+#define CS_IPCS_FQ_TICK_MSEC		1
+#define CS_IPCS_FQ_CLIENT_MAX		32
+#define CS_IPCS_FQ_WEIGHT_MAX		100
+
+struct fq_client_weight {
+	char name[32];
+	uint32_t weight;
+};
+
+struct fq_request {
 	struct list_head list;
+	size_t size;
+	char data[1];
 };
 
+static uint64_t fq_rate = 0;
+static uint64_t fq_burst = 0;
+static size_t fq_queue_size = CS_IPCS_FQ_QUEUE_SIZE_DEFAULT;
+static struct fq_client_weight fq_client_weights[CS_IPCS_FQ_CLIENT_MAX];
+static uint32_t fq_client_weight_count = 0;
+static DECLARE_LIST_INIT(fq_active_head);
+static qb_loop_timer_handle fq_timer;
+static int32_t fq_timer_armed = QB_FALSE;
+
 static struct cs_ipcs_mapper ipcs_mapper[SERVICE_HANDLER_MAXIMUM_COUNT];
 
 static int32_t cs_ipcs_job_add(enum qb_loop_priority p,	void *data, qb_loop_job_dispatch_fn fn);
@@ -281,22 +359,178 @@ static char * pid_to_name (pid_t pid, char *out_name, size_t name_len)
 }
 
 
+enum cs_ipcs_stats_key_id {
+	CS_IPCS_STATS_CLIENT_PID,
+	CS_IPCS_STATS_RESPONSES,
+	CS_IPCS_STATS_DISPATCHED,
+	CS_IPCS_STATS_REQUESTS,
+	CS_IPCS_STATS_SEND_RETRIES,
+	CS_IPCS_STATS_RECV_RETRIES,
+	CS_IPCS_STATS_FLOW_CONTROL,
+	CS_IPCS_STATS_FLOW_CONTROL_COUNT,
+	CS_IPCS_STATS_QUEUE_SIZE,
+	CS_IPCS_STATS_QUEUE_BYTES,
+	CS_IPCS_STATS_QUEUE_DROPPED,
+	CS_IPCS_STATS_INVALID_REQUEST,
+	CS_IPCS_STATS_OVERLOAD,
+	CS_IPCS_STATS_FQ_WEIGHT,
+	CS_IPCS_STATS_FQ_ADMITTED,
+	CS_IPCS_STATS_FQ_DEFERRED,
+	CS_IPCS_STATS_FQ_REJECTED,
+	CS_IPCS_STATS_KEY_MAX
+};
+
+struct cs_ipcs_conn_context;
+
+struct cs_ipcs_stats_key {
+	struct cs_ipcs_conn_context *cnx;
+	enum cs_ipcs_stats_key_id id;
+};
+
 struct cs_ipcs_conn_context {
 	qb_handle_t stats_handle;
-	struct list_head outq_head;
-	int32_t queuing;
+	qb_ipcs_connection_t *conn;
+	char name[42];
+	struct cs_ipcs_stats_key stats_keys[CS_IPCS_STATS_KEY_MAX];
+	struct cs_ipcs_outq outq;
+	int32_t flush_scheduled;
+	int32_t disconnecting;
+	qb_loop_timer_handle flush_timer;
 	uint32_t queued;
 	uint64_t invalid_request;
 	uint64_t overload;
+	uint64_t dropped;
 	uint32_t sent;
+	struct list_head fq_list;
+	struct list_head fq_deferred_head;
+	uint32_t fq_deferred_count;
+	size_t fq_deferred_bytes;
+	uint32_t fq_weight;
+	int64_t fq_tokens;
+	uint64_t fq_refill_time;
+	uint64_t fq_admitted;
+	uint64_t fq_deferred;
+	uint64_t fq_rejected;
 	char data[1];
 };
 
+/*
+ * The per-connection keys are virtual: they are filled in from libqb and
+ * the connection context whenever somebody reads them through objdb
+ */
+static void cs_ipcs_stats_key_get (void *value, size_t value_len, void *priv_data_pt)
+{
+	struct cs_ipcs_stats_key *key = priv_data_pt;
+	struct cs_ipcs_conn_context *cnx = key->cnx;
+	struct qb_ipcs_connection_stats stats;
+	int32_t client_pid;
+	uint32_t flow_control;
+	uint64_t queue_bytes;
+
+	if (key->id == CS_IPCS_STATS_QUEUE_SIZE) {
+		memcpy (value, &cnx->queued, value_len);
+		return;
+	}
+	if (key->id == CS_IPCS_STATS_QUEUE_BYTES) {
+		queue_bytes = cnx->outq.used;
+		memcpy (value, &queue_bytes, value_len);
+		return;
+	}
+	if (key->id == CS_IPCS_STATS_QUEUE_DROPPED) {
+		memcpy (value, &cnx->dropped, value_len);
+		return;
+	}
+	if (key->id == CS_IPCS_STATS_FQ_WEIGHT) {
+		memcpy (value, &cnx->fq_weight, value_len);
+		return;
+	}
+	if (key->id == CS_IPCS_STATS_FQ_ADMITTED) {
+		memcpy (value, &cnx->fq_admitted, value_len);
+		return;
+	}
+	if (key->id == CS_IPCS_STATS_FQ_DEFERRED) {
+		memcpy (value, &cnx->fq_deferred, value_len);
+		return;
+	}
+	if (key->id == CS_IPCS_STATS_FQ_REJECTED) {
+		memcpy (value, &cnx->fq_rejected, value_len);
+		return;
+	}
+	if (key->id == CS_IPCS_STATS_INVALID_REQUEST) {
+		memcpy (value, &cnx->invalid_request, value_len);
+		return;
+	}
+	if (key->id == CS_IPCS_STATS_OVERLOAD) {
+		memcpy (value, &cnx->overload, value_len);
+		return;
+	}
+
+	qb_ipcs_connection_stats_get (cnx->conn, &stats, QB_FALSE);
+
+	switch (key->id) {
+	case CS_IPCS_STATS_CLIENT_PID:
+		client_pid = stats.client_pid;
+		memcpy (value, &client_pid, value_len);
+		break;
+	case CS_IPCS_STATS_RESPONSES:
+		memcpy (value, &stats.responses, value_len);
+		break;
+	case CS_IPCS_STATS_DISPATCHED:
+		memcpy (value, &stats.events, value_len);
+		break;
+	case CS_IPCS_STATS_REQUESTS:
+		memcpy (value, &stats.requests, value_len);
+		break;
+	case CS_IPCS_STATS_SEND_RETRIES:
+		memcpy (value, &stats.send_retries, value_len);
+		break;
+	case CS_IPCS_STATS_RECV_RETRIES:
+		memcpy (value, &stats.recv_retries, value_len);
+		break;
+	case CS_IPCS_STATS_FLOW_CONTROL:
+		flow_control = stats.flow_control_state;
+		memcpy (value, &flow_control, value_len);
+		break;
+	case CS_IPCS_STATS_FLOW_CONTROL_COUNT:
+		memcpy (value, &stats.flow_control_count, value_len);
+		break;
+	default:
+		memset (value, 0, value_len);
+		break;
+	}
+}
+
+static void cs_ipcs_stats_key_create (
+	struct cs_ipcs_conn_context *context,
+	enum cs_ipcs_stats_key_id id,
+	const char *key_name,
+	size_t value_len,
+	objdb_value_types_t type)
+{
+	context->stats_keys[id].cnx = context;
+	context->stats_keys[id].id = id;
+
+	api->object_key_create_virtual (context->stats_handle,
+		key_name, value_len, type,
+		cs_ipcs_stats_key_get, &context->stats_keys[id]);
+}
+
+static uint32_t fq_client_weight_get (const char *proc_name)
+{
+	uint32_t i;
+
+	for (i = 0; i < fq_client_weight_count; i++) {
+		if (strcmp (fq_client_weights[i].name, proc_name) == 0) {
+			return (fq_client_weights[i].weight);
+		}
+	}
+	return (1);
+}
+
 static void cs_ipcs_connection_created(qb_ipcs_connection_t *c)
 {
 	int32_t service = 0;
 	uint32_t zero_32 = 0;
-	uint64_t zero_64 = 0;
 	unsigned int key_incr_dummy;
 	qb_handle_t object_handle;
 	struct cs_ipcs_conn_context *context;
@@ -312,10 +546,14 @@ static void cs_ipcs_connection_created(qb_ipcs_connection_t *c)
 	size += ais_service[service]->private_data_size;
 	context = calloc(1, size);
 
-	list_init(&context->outq_head);
-	context->queuing = QB_FALSE;
 	context->queued = 0;
 	context->sent = 0;
+	context->conn = c;
+	list_init (&context->fq_list);
+	list_init (&context->fq_deferred_head);
+	context->fq_weight = 1;
+	context->fq_tokens = fq_burst;
+	context->fq_refill_time = qb_util_nano_current_get ();
 
 	qb_ipcs_context_set(c, context);
 
@@ -329,6 +567,8 @@ static void cs_ipcs_connection_created(qb_ipcs_connection_t *c)
 
 	if (stats.client_pid > 0) {
 		if (pid_to_name (stats.client_pid, proc_name, sizeof(proc_name))) {
+			context->fq_weight = fq_client_weight_get (proc_name);
+			context->fq_tokens = fq_burst * context->fq_weight;
 			snprintf (conn_name,
 				sizeof(conn_name),
 				"%s:%d:%p", proc_name,
@@ -350,105 +590,238 @@ static void cs_ipcs_connection_created(qb_ipcs_connection_t *c)
 		conn_name,
 		strlen (conn_name));
 	context->stats_handle = object_handle;
+	memcpy (context->name, conn_name, sizeof (context->name));
 
 	api->object_key_create_typed (object_handle,
 		"service_id",
 		&zero_32, sizeof (zero_32),
 		OBJDB_VALUETYPE_UINT32);
 
-	api->object_key_create_typed (object_handle,
-		"client_pid",
-		&zero_32, sizeof (zero_32),
-		OBJDB_VALUETYPE_INT32);
+	cs_ipcs_stats_key_create (context, CS_IPCS_STATS_CLIENT_PID,
+		"client_pid", sizeof (int32_t), OBJDB_VALUETYPE_INT32);
+	cs_ipcs_stats_key_create (context, CS_IPCS_STATS_RESPONSES,
+		"responses", sizeof (uint64_t), OBJDB_VALUETYPE_UINT64);
+	cs_ipcs_stats_key_create (context, CS_IPCS_STATS_DISPATCHED,
+		"dispatched", sizeof (uint64_t), OBJDB_VALUETYPE_UINT64);
+	cs_ipcs_stats_key_create (context, CS_IPCS_STATS_REQUESTS,
+		"requests", sizeof (int64_t), OBJDB_VALUETYPE_INT64);
+	cs_ipcs_stats_key_create (context, CS_IPCS_STATS_SEND_RETRIES,
+		"send_retries", sizeof (uint64_t), OBJDB_VALUETYPE_UINT64);
+	cs_ipcs_stats_key_create (context, CS_IPCS_STATS_RECV_RETRIES,
+		"recv_retries", sizeof (uint64_t), OBJDB_VALUETYPE_UINT64);
+	cs_ipcs_stats_key_create (context, CS_IPCS_STATS_FLOW_CONTROL,
+		"flow_control", sizeof (uint32_t), OBJDB_VALUETYPE_UINT32);
+	cs_ipcs_stats_key_create (context, CS_IPCS_STATS_FLOW_CONTROL_COUNT,
+		"flow_control_count", sizeof (uint64_t), OBJDB_VALUETYPE_UINT64);
+	cs_ipcs_stats_key_create (context, CS_IPCS_STATS_QUEUE_SIZE,
+		"queue_size", sizeof (uint32_t), OBJDB_VALUETYPE_UINT32);
+	cs_ipcs_stats_key_create (context, CS_IPCS_STATS_QUEUE_BYTES,
+		"queue_bytes", sizeof (uint64_t), OBJDB_VALUETYPE_UINT64);
+	cs_ipcs_stats_key_create (context, CS_IPCS_STATS_QUEUE_DROPPED,
+		"queue_dropped", sizeof (uint64_t), OBJDB_VALUETYPE_UINT64);
+	cs_ipcs_stats_key_create (context, CS_IPCS_STATS_INVALID_REQUEST,
+		"invalid_request", sizeof (uint64_t), OBJDB_VALUETYPE_UINT64);
+	cs_ipcs_stats_key_create (context, CS_IPCS_STATS_OVERLOAD,
+		"overload", sizeof (uint64_t), OBJDB_VALUETYPE_UINT64);
+	cs_ipcs_stats_key_create (context, CS_IPCS_STATS_FQ_WEIGHT,
+		"fq_weight", sizeof (uint32_t), OBJDB_VALUETYPE_UINT32);
+	cs_ipcs_stats_key_create (context, CS_IPCS_STATS_FQ_ADMITTED,
+		"fq_admitted", sizeof (uint64_t), OBJDB_VALUETYPE_UINT64);
+	cs_ipcs_stats_key_create (context, CS_IPCS_STATS_FQ_DEFERRED,
+		"fq_deferred", sizeof (uint64_t), OBJDB_VALUETYPE_UINT64);
+	cs_ipcs_stats_key_create (context, CS_IPCS_STATS_FQ_REJECTED,
+		"fq_rejected", sizeof (uint64_t), OBJDB_VALUETYPE_UINT64);
+}
 
-	api->object_key_create_typed (object_handle,
-		"responses",
-		&zero_64, sizeof (zero_64),
-		OBJDB_VALUETYPE_UINT64);
+void cs_ipc_refcnt_inc(void *conn)
+{
+	qb_ipcs_connection_ref(conn);
+}
 
-	api->object_key_create_typed (object_handle,
-		"dispatched",
-		&zero_64, sizeof (zero_64),
-		OBJDB_VALUETYPE_UINT64);
+void cs_ipc_refcnt_dec(void *conn)
+{
+	qb_ipcs_connection_unref(conn);
+}
 
-	api->object_key_create_typed (object_handle,
-		"requests",
-		&zero_64, sizeof (zero_64),
-		OBJDB_VALUETYPE_INT64);
+void *cs_ipcs_private_data_get(void *conn)
+{
+	struct cs_ipcs_conn_context *cnx;
+	cnx = qb_ipcs_context_get(conn);
+	return &cnx->data[0];
+}
 
-	api->object_key_create_typed (object_handle,
-		"send_retries",
-		&zero_64, sizeof (zero_64),
-		OBJDB_VALUETYPE_UINT64);
+static void outq_free (struct cs_ipcs_outq *q)
+{
+	outq_stats.memory -= q->size;
+	outq_stats.queued -= q->count;
+	free (q->buf);
+	memset (q, 0, sizeof (*q));
+}
 
-	api->object_key_create_typed (object_handle,
-		"recv_retries",
-		&zero_64, sizeof (zero_64),
-		OBJDB_VALUETYPE_UINT64);
+/*
+ * Move the queued records into a larger buffer, dropping the wrap
+ * marker so the live records start at offset 0
+ */
+static int outq_grow (struct cs_ipcs_outq *q, size_t rec_len)
+{
+	size_t new_size;
+	size_t offset = 0;
+	size_t len;
+	uint32_t i;
+	struct outq_rec *rec;
+	char *buf;
+
+	new_size = q->size ? q->size * 2 : CS_IPCS_OUTQ_SIZE_INITIAL;
+	while (new_size < q->used + rec_len) {
+		new_size *= 2;
+	}
+	if (new_size > outq_size_max) {
+		new_size = outq_size_max;
+	}
+	assert ((new_size & 7) == 0);
+	if (new_size <= q->size || new_size < q->used + rec_len) {
+		return (-1);
+	}
 
-	api->object_key_create_typed (object_handle,
-		"flow_control",
-		&zero_32, sizeof (zero_32),
-		OBJDB_VALUETYPE_UINT32);
+	buf = malloc (new_size);
+	if (buf == NULL) {
+		return (-1);
+	}
 
-	api->object_key_create_typed (object_handle,
-		"flow_control_count",
-		&zero_64, sizeof (zero_64),
-		OBJDB_VALUETYPE_UINT64);
+	for (i = 0; i < q->count; i++) {
+		rec = (struct outq_rec *)(q->buf + q->head);
+		if (rec->len == CS_IPCS_OUTQ_REC_WRAP) {
+			q->head = 0;
+			rec = (struct outq_rec *)q->buf;
+		}
+		len = sizeof (struct outq_rec) + CS_IPCS_OUTQ_ALIGN (rec->len);
+		memcpy (buf + offset, rec, len);
+		offset += len;
+		q->head += len;
+		if (q->head == q->size) {
+			q->head = 0;
+		}
+	}
 
-	api->object_key_create_typed (object_handle,
-		"queue_size",
-		&zero_32, sizeof (zero_32),
-		OBJDB_VALUETYPE_UINT32);
+	free (q->buf);
+	outq_stats.memory += new_size - q->size;
+	if (outq_stats.memory > outq_stats.memory_peak) {
+		outq_stats.memory_peak = outq_stats.memory;
+	}
+	q->buf = buf;
+	q->size = new_size;
+	q->head = 0;
+	q->tail = offset;
+	q->used = offset;
+	return (0);
+}
 
-	api->object_key_create_typed (object_handle,
-		"invalid_request",
-		&zero_64, sizeof (zero_64),
-		OBJDB_VALUETYPE_UINT64);
+/*
+ * Returns contiguous space for a record of rec_len bytes at the tail of
+ * the ring, or NULL if the ring has no room for it
+ */
+static struct outq_rec *outq_space (struct cs_ipcs_outq *q, size_t rec_len)
+{
+	struct outq_rec *wrap;
 
-	api->object_key_create_typed (object_handle,
-		"overload",
-		&zero_64, sizeof (zero_64),
-		OBJDB_VALUETYPE_UINT64);
+	if (q->size == 0 || q->used + rec_len > q->size) {
+		return (NULL);
+	}
+	if (q->tail >= q->head) {
+		if (q->size - q->tail >= rec_len) {
+			return ((struct outq_rec *)(q->buf + q->tail));
+		}
+		if (q->head < rec_len) {
+			return (NULL);
+		}
+		wrap = (struct outq_rec *)(q->buf + q->tail);
+		wrap->len = CS_IPCS_OUTQ_REC_WRAP;
+		q->used += q->size - q->tail;
+		q->tail = 0;
+		return ((struct outq_rec *)q->buf);
+	}
+	if (q->head - q->tail >= rec_len) {
+		return ((struct outq_rec *)(q->buf + q->tail));
+	}
+	return (NULL);
 }
 
-void cs_ipc_refcnt_inc(void *conn)
+static void outq_push (struct cs_ipcs_outq *q, size_t rec_len)
 {
-	qb_ipcs_connection_ref(conn);
+	q->tail += rec_len;
+	if (q->tail == q->size) {
+		q->tail = 0;
+	}
+	q->used += rec_len;
+	q->count++;
+	outq_stats.queued++;
 }
 
-void cs_ipc_refcnt_dec(void *conn)
+static struct outq_rec *outq_first (struct cs_ipcs_outq *q)
 {
-	qb_ipcs_connection_unref(conn);
+	struct outq_rec *rec;
+
+	if (q->count == 0) {
+		return (NULL);
+	}
+	rec = (struct outq_rec *)(q->buf + q->head);
+	if (rec->len == CS_IPCS_OUTQ_REC_WRAP) {
+		q->used -= q->size - q->head;
+		q->head = 0;
+		rec = (struct outq_rec *)q->buf;
+	}
+	return (rec);
 }
 
-void *cs_ipcs_private_data_get(void *conn)
+static void outq_pop (struct cs_ipcs_outq *q)
 {
-	struct cs_ipcs_conn_context *cnx;
-	cnx = qb_ipcs_context_get(conn);
-	return &cnx->data[0];
+	struct outq_rec *rec = outq_first (q);
+	size_t rec_len = sizeof (struct outq_rec) + CS_IPCS_OUTQ_ALIGN (rec->len);
+
+	q->head += rec_len;
+	if (q->head == q->size) {
+		q->head = 0;
+	}
+	q->used -= rec_len;
+	q->count--;
+	outq_stats.queued--;
+	if (q->count == 0) {
+		q->head = 0;
+		q->tail = 0;
+		q->used = 0;
+	}
+}
+
+/*
+ * Deferred requests of a closing connection must never reach its
+ * service after lib_exit_fn
+ */
+static void fq_purge (struct cs_ipcs_conn_context *context)
+{
+	struct fq_request *req;
+
+	while (!list_empty (&context->fq_deferred_head)) {
+		req = list_entry (context->fq_deferred_head.next,
+			struct fq_request, list);
+		list_del (&req->list);
+		free (req);
+	}
+	context->fq_deferred_count = 0;
+	context->fq_deferred_bytes = 0;
+	list_del (&context->fq_list);
+	list_init (&context->fq_list);
 }
 
 static void cs_ipcs_connection_destroyed (qb_ipcs_connection_t *c)
 {
 	struct cs_ipcs_conn_context *context;
-	struct list_head *list, *list_next;
-	struct outq_item *outq_item;
 
 	log_printf(LOG_INFO, "%s() ", __func__);
 
 	context = qb_ipcs_context_get(c);
 	if (context) {
-		for (list = context->outq_head.next;
-			list != &context->outq_head; list = list_next) {
-
-			list_next = list->next;
-			outq_item = list_entry (list, struct outq_item, list);
-
-			list_del (list);
-			free (outq_item->msg);
-			free (outq_item);
-		}
+		fq_purge (context);
+		outq_free (&context->outq);
 		free(context);
 	}
 }
@@ -461,6 +834,10 @@ static int32_t cs_ipcs_connection_closed (qb_ipcs_connection_t *c)
 	int32_t service = qb_ipcs_service_id_get(c);
 
 	log_printf(LOG_INFO, "%s() ", __func__);
+	cnx = qb_ipcs_context_get(c);
+	if (cnx) {
+		fq_purge (cnx);
+	}
 	res = ais_service[service]->lib_exit_fn(c);
 	if (res != 0) {
 		return res;
@@ -499,43 +876,91 @@ int cs_ipcs_response_send(void *conn, const void *msg, size_t mlen)
 	return rc;
 }
 
+static void outq_flush (void *data);
+
+/*
+ * Holds a reference on the connection until outq_flush runs.  When the
+ * client's event ring was full, retry from a timer instead of a job so a
+ * stalled client does not keep the main loop spinning.
+ */
+static void outq_flush_schedule (qb_ipcs_connection_t *conn,
+	struct cs_ipcs_conn_context *context,
+	int32_t backoff)
+{
+	if (context->flush_scheduled) {
+		return;
+	}
+	context->flush_scheduled = QB_TRUE;
+	qb_ipcs_connection_ref(conn);
+	if (backoff) {
+		qb_loop_timer_add(cs_poll_handle_get(), QB_LOOP_HIGH,
+			CS_IPCS_OUTQ_RETRY_MSEC * QB_TIME_NS_IN_MSEC,
+			conn, outq_flush, &context->flush_timer);
+	} else {
+		qb_loop_job_add(cs_poll_handle_get(), QB_LOOP_HIGH, conn, outq_flush);
+	}
+}
+
 static void outq_flush (void *data)
 {
 	qb_ipcs_connection_t *conn = data;
-	struct list_head *list, *list_next;
-	struct outq_item *outq_item;
-	int32_t rc;
+	struct outq_rec *rec;
+	int32_t rc = 0;
+	int32_t i;
 	struct cs_ipcs_conn_context *context = qb_ipcs_context_get(conn);
 
-	for (list = context->outq_head.next;
-		list != &context->outq_head; list = list_next) {
+	context->flush_scheduled = QB_FALSE;
 
-		list_next = list->next;
-		outq_item = list_entry (list, struct outq_item, list);
-
-		rc = qb_ipcs_event_send(conn, outq_item->msg, outq_item->mlen);
-		if (rc != outq_item->mlen) {
+	for (i = 0; i < CS_IPCS_OUTQ_FLUSH_BATCH && !context->disconnecting; i++) {
+		rec = outq_first (&context->outq);
+		if (rec == NULL) {
+			break;
+		}
+		rc = qb_ipcs_event_send(conn, rec + 1, rec->len);
+		if (rc != rec->len) {
 			break;
 		}
 		context->sent++;
 		context->queued--;
-
-		list_del (list);
-		free (outq_item->msg);
-		free (outq_item);
+		outq_pop (&context->outq);
 	}
-	if (list_empty (&context->outq_head)) {
-		context->queuing = QB_FALSE;
+
+	if (context->disconnecting) {
+		outq_free (&context->outq);
+		qb_ipcs_disconnect(conn);
+	} else if (context->outq.count == 0) {
 		log_printf(LOGSYS_LEVEL_INFO, "Q empty, queued:%d sent:%d.",
 			context->queued, context->sent);
 		context->queued = 0;
 		context->sent = 0;
-		return;
-	}
-	qb_loop_job_add(cs_poll_handle_get(), QB_LOOP_HIGH, conn, outq_flush);
-	if (rc < 0 && rc != -EAGAIN) {
+		outq_free (&context->outq);
+	} else if (rc == -EAGAIN) {
+		outq_flush_schedule (conn, context, QB_TRUE);
+	} else if (rc >= 0) {
+		outq_flush_schedule (conn, context, QB_FALSE);
+	} else {
 		log_printf(LOGSYS_LEVEL_ERROR, "event_send retuned %d!", rc);
 	}
+	qb_ipcs_connection_unref(conn);
+}
+
+/*
+ * Called from the send path, which may be in the middle of walking
+ * service state that closing the connection would free, so the actual
+ * disconnect is left to outq_flush
+ */
+static void outq_disconnect (qb_ipcs_connection_t *conn,
+	struct cs_ipcs_conn_context *context,
+	size_t bytes_msg)
+{
+	log_printf(LOGSYS_LEVEL_WARNING,
+		"Outbound queue of %s is full (%u events, %zu bytes) "
+		"dropping connection", context->name,
+		context->outq.count, context->outq.used + bytes_msg);
+	outq_stats.disconnects++;
+	context->disconnecting = QB_TRUE;
+	outq_free (&context->outq);
+	outq_flush_schedule (conn, context, QB_FALSE);
 }
 
 static void msg_send_or_queue(qb_ipcs_connection_t *conn, const struct iovec *iov, uint32_t iov_len)
@@ -543,52 +968,62 @@ static void msg_send_or_queue(qb_ipcs_connection_t *conn, const struct iovec *io
 	int32_t rc = 0;
 	int32_t i;
 	int32_t bytes_msg = 0;
-	struct outq_item *outq_item;
-	char *write_buf = 0;
+	size_t rec_len;
+	struct outq_rec *rec;
+	char *write_buf;
 	struct cs_ipcs_conn_context *context = qb_ipcs_context_get(conn);
 
+	if (context->disconnecting) {
+		return;
+	}
+
 	for (i = 0; i < iov_len; i++) {
 		bytes_msg += iov[i].iov_len;
 	}
 
-	if (!context->queuing) {
-		assert(list_empty (&context->outq_head));
+	if (context->outq.count == 0) {
 		rc = qb_ipcs_event_sendv(conn, iov, iov_len);
 		if (rc == bytes_msg) {
 			context->sent++;
 			return;
 		}
-		if (rc == -EAGAIN) {
-			context->queued = 0;
-			context->sent = 0;
-			context->queuing = QB_TRUE;
-			qb_loop_job_add(cs_poll_handle_get(), QB_LOOP_HIGH, conn, outq_flush);
-		} else {
+		if (rc != -EAGAIN) {
 			log_printf(LOGSYS_LEVEL_ERROR, "event_send retuned %d, expected %d!", rc, bytes_msg);
 			return;
 		}
+		context->queued = 0;
+		context->sent = 0;
 	}
-	outq_item = malloc (sizeof (struct outq_item));
-	if (outq_item == NULL) {
-		qb_ipcs_disconnect(conn);
-		return;
-	}
-	outq_item->msg = malloc (bytes_msg);
-	if (outq_item->msg == NULL) {
-		free (outq_item);
-		qb_ipcs_disconnect(conn);
+
+	rec_len = sizeof (struct outq_rec) + CS_IPCS_OUTQ_ALIGN (bytes_msg);
+	while ((rec = outq_space (&context->outq, rec_len)) == NULL) {
+		if (outq_grow (&context->outq, rec_len) == 0) {
+			continue;
+		}
+		if (outq_policy == CS_IPCS_OUTQ_POLICY_DROP_OLDEST &&
+			context->outq.count > 0) {
+
+			outq_pop (&context->outq);
+			context->queued--;
+			context->dropped++;
+			outq_stats.dropped++;
+			continue;
+		}
+		outq_disconnect (conn, context, bytes_msg);
 		return;
 	}
 
-	write_buf = outq_item->msg;
+	rec->len = bytes_msg;
+	rec->pad = 0;
+	write_buf = (char *)(rec + 1);
 	for (i = 0; i < iov_len; i++) {
 		memcpy (write_buf, iov[i].iov_base, iov[i].iov_len);
 		write_buf += iov[i].iov_len;
 	}
-	outq_item->mlen = bytes_msg;
-	list_init (&outq_item->list);
-	list_add_tail (&outq_item->list, &context->outq_head);
+	outq_push (&context->outq, rec_len);
 	context->queued++;
+
+	outq_flush_schedule (conn, context, rc == -EAGAIN);
 }
 
 int cs_ipcs_dispatch_send(void *conn, const void *msg, size_t mlen)
@@ -608,8 +1043,27 @@ int cs_ipcs_dispatch_iov_send (void *conn,
 	return 0;
 }
 
-static int32_t cs_ipcs_msg_process(qb_ipcs_connection_t *c,
-		void *data, size_t size)
+/*
+ * With the backpressure policy requests are refused once the outbound
+ * queue is three quarters of the way to its budget
+ */
+static int32_t outq_backpressure (qb_ipcs_connection_t *c)
+{
+	struct cs_ipcs_conn_context *cnx = qb_ipcs_context_get(c);
+
+	if (outq_policy != CS_IPCS_OUTQ_POLICY_BACKPRESSURE || cnx == NULL) {
+		return (QB_FALSE);
+	}
+	return (cnx->outq.used > outq_size_max / 4 * 3);
+}
+
+static int32_t cs_ipcs_is_async_call (int32_t service, int32_t id)
+{
+	return (service == CPG_SERVICE && id == 2);
+}
+
+static int32_t cs_ipcs_request_process (qb_ipcs_connection_t *c,
+		void *data)
 {
 	struct qb_ipc_response_header response;
 	struct qb_ipc_request_header *request_pt = (struct qb_ipc_request_header *)data;
@@ -620,12 +1074,34 @@ static int32_t cs_ipcs_msg_process(qb_ipcs_connection_t *c,
 	int sending_allowed_private_data;
 	struct cs_ipcs_conn_context *cnx;
 
+	/*
+	 * Requests newer than this daemon are refused rather than looked up
+	 * past the end of the service's lib_engine
+	 */
+	if (request_pt->id < 0 ||
+		request_pt->id >= ais_service[service]->lib_engine_count) {
+
+		cnx = qb_ipcs_context_get(c);
+		if (cnx) {
+			cnx->invalid_request++;
+		}
+		log_printf(LOGSYS_LEVEL_DEBUG, "Unknown request %d for service %d",
+			request_pt->id, service);
+		response.size = sizeof (response);
+		response.id = 0;
+		response.error = CS_ERR_NOT_SUPPORTED;
+		qb_ipcs_response_send (c,
+			&response,
+			sizeof (response));
+		return (-EINVAL);
+	}
+
 	send_ok = corosync_sending_allowed (service,
 			request_pt->id,
 			request_pt,
 			&sending_allowed_private_data);
 
-	is_async_call = (service == CPG_SERVICE && request_pt->id == 2);
+	is_async_call = cs_ipcs_is_async_call (service, request_pt->id);
 
 	/*
 	 * This happens when the message contains some kind of invalid
@@ -672,6 +1148,20 @@ static int32_t cs_ipcs_msg_process(qb_ipcs_connection_t *c,
 				is_async_call, strerror(-send_ok));
 		}
 		res = -ENOBUFS;
+	} else if (!is_async_call && outq_backpressure (c)) {
+		/*
+		 * The client is not reading its events fast enough, hold
+		 * back its requests until the outbound queue drains
+		 */
+		outq_stats.backpressure++;
+		response.size = sizeof (response);
+		response.id = 0;
+		response.error = CS_ERR_TRY_AGAIN;
+		qb_ipcs_response_send (c,
+			&response,
+			sizeof (response));
+		send_ok = 0;
+		res = -ENOBUFS;
 	}
 
 	if (send_ok) {
@@ -682,6 +1172,226 @@ static int32_t cs_ipcs_msg_process(qb_ipcs_connection_t *c,
 	return res;
 }
 
+static int32_t fq_flow_controlled (qb_ipcs_connection_t *c,
+	const struct qb_ipc_request_header *request_pt)
+{
+	int32_t service = qb_ipcs_service_id_get(c);
+
+	if (request_pt->id < 0 ||
+		request_pt->id >= ais_service[service]->lib_engine_count) {
+		return (QB_FALSE);
+	}
+	return (ais_service[service]->lib_engine[request_pt->id].flow_control ==
+		CS_LIB_FLOW_CONTROL_REQUIRED);
+}
+
+/*
+ * A deferred request has already been taken off the connection, and an
+ * async one acknowledged, so it stays at the head of the list for as long
+ * as sync, quorum or totem would refuse it instead of being dropped by
+ * cs_ipcs_request_process.  Invalid requests are still passed on so that
+ * they get their error.
+ */
+static int32_t fq_sending_allowed (qb_ipcs_connection_t *c,
+	const struct qb_ipc_request_header *request_pt)
+{
+	int32_t service = qb_ipcs_service_id_get(c);
+	int sending_allowed_private_data;
+	int32_t send_ok;
+
+	send_ok = corosync_sending_allowed (service, request_pt->id,
+		request_pt, &sending_allowed_private_data);
+	corosync_sending_allowed_release (&sending_allowed_private_data);
+
+	return (send_ok >= 0 || send_ok == -EINVAL);
+}
+
+static void fq_refill (struct cs_ipcs_conn_context *cnx, uint64_t now)
+{
+	uint64_t elapsed_usec;
+	uint64_t tokens;
+	int64_t burst = fq_burst * cnx->fq_weight;
+
+	elapsed_usec = (now - cnx->fq_refill_time) / QB_TIME_NS_IN_USEC;
+	if (elapsed_usec > QB_TIME_US_IN_SEC) {
+		elapsed_usec = QB_TIME_US_IN_SEC;
+	}
+	tokens = fq_rate * cnx->fq_weight * elapsed_usec / QB_TIME_US_IN_SEC;
+	if (tokens == 0) {
+		return;
+	}
+	cnx->fq_refill_time = now;
+	cnx->fq_tokens += tokens;
+	if (cnx->fq_tokens > burst) {
+		cnx->fq_tokens = burst;
+	}
+}
+
+static void fq_schedule (void *data);
+
+static void fq_timer_arm (void)
+{
+	if (fq_timer_armed) {
+		return;
+	}
+	fq_timer_armed = QB_TRUE;
+	qb_loop_timer_add(cs_poll_handle_get(), QB_LOOP_MED,
+		CS_IPCS_FQ_TICK_MSEC * QB_TIME_NS_IN_MSEC,
+		NULL, fq_schedule, &fq_timer);
+}
+
+/*
+ * Serve the connections with deferred requests round robin, up to
+ * fq_weight requests each per turn, for as long as they have tokens,
+ * totem has room for new messages and their service may send
+ */
+static void fq_schedule (void *data)
+{
+	DECLARE_LIST_INIT (waiting_head);
+	struct cs_ipcs_conn_context *cnx;
+	struct fq_request *req;
+	uint64_t now = qb_util_nano_current_get ();
+	uint32_t served;
+	int32_t flow_controlled;
+
+	fq_timer_armed = QB_FALSE;
+
+	while (!list_empty (&fq_active_head) &&
+		cs_ipcs_q_level_get() != TOTEM_Q_LEVEL_CRITICAL) {
+
+		cnx = list_entry (fq_active_head.next,
+			struct cs_ipcs_conn_context, fq_list);
+		fq_refill (cnx, now);
+
+		qb_ipcs_connection_ref(cnx->conn);
+		for (served = 0; served < cnx->fq_weight &&
+			cnx->fq_deferred_count > 0; served++) {
+
+			req = list_entry (cnx->fq_deferred_head.next,
+				struct fq_request, list);
+			flow_controlled = fq_flow_controlled (cnx->conn,
+				(struct qb_ipc_request_header *)req->data);
+			if (flow_controlled && cnx->fq_tokens <= 0) {
+				break;
+			}
+			if (!fq_sending_allowed (cnx->conn,
+				(struct qb_ipc_request_header *)req->data)) {
+				break;
+			}
+			if (flow_controlled) {
+				cnx->fq_tokens -= req->size;
+			}
+			list_del (&req->list);
+			cnx->fq_deferred_count--;
+			cnx->fq_deferred_bytes -= req->size;
+			cnx->fq_admitted++;
+			cs_ipcs_request_process (cnx->conn, req->data);
+			free (req);
+		}
+
+		/*
+		 * The request may have closed the connection, which purges it
+		 */
+		list_del (&cnx->fq_list);
+		list_init (&cnx->fq_list);
+		if (cnx->fq_deferred_count > 0) {
+			if (served == 0) {
+				list_add_tail (&cnx->fq_list, &waiting_head);
+			} else {
+				list_add_tail (&cnx->fq_list, &fq_active_head);
+			}
+		}
+		qb_ipcs_connection_unref(cnx->conn);
+	}
+
+	if (!list_empty (&waiting_head)) {
+		list_splice (&waiting_head, fq_active_head.prev);
+	}
+	if (!list_empty (&fq_active_head)) {
+		fq_timer_arm ();
+	}
+}
+
+static int32_t fq_defer (qb_ipcs_connection_t *c,
+	struct cs_ipcs_conn_context *cnx,
+	void *data,
+	size_t size)
+{
+	struct qb_ipc_request_header *request_pt = data;
+	struct qb_ipc_response_header response;
+	struct fq_request *req = NULL;
+	int32_t service = qb_ipcs_service_id_get(c);
+
+	/*
+	 * A connection may always defer at least one request, however large
+	 */
+	if (cnx->fq_deferred_count == 0 ||
+		cnx->fq_deferred_bytes + size <= fq_queue_size) {
+
+		req = malloc (sizeof (struct fq_request) + size);
+	}
+	if (req == NULL) {
+		cnx->fq_rejected++;
+		if (cs_ipcs_is_async_call (service, request_pt->id)) {
+			log_printf(LOGSYS_LEVEL_WARNING,
+				"*** %s() %s has %u requests deferred, dropping",
+				__func__, cnx->name, cnx->fq_deferred_count);
+		} else {
+			response.size = sizeof (response);
+			response.id = 0;
+			response.error = CS_ERR_TRY_AGAIN;
+			qb_ipcs_response_send (c,
+				&response,
+				sizeof (response));
+		}
+		return (-ENOBUFS);
+	}
+
+	memcpy (req->data, data, size);
+	req->size = size;
+	list_init (&req->list);
+	list_add_tail (&req->list, &cnx->fq_deferred_head);
+	cnx->fq_deferred_count++;
+	cnx->fq_deferred_bytes += size;
+	cnx->fq_deferred++;
+
+	if (list_empty (&cnx->fq_list)) {
+		list_add_tail (&cnx->fq_list, &fq_active_head);
+	}
+	fq_timer_arm ();
+	return (0);
+}
+
+static int32_t cs_ipcs_msg_process(qb_ipcs_connection_t *c,
+		void *data, size_t size)
+{
+	struct cs_ipcs_conn_context *cnx = qb_ipcs_context_get(c);
+	int32_t flow_controlled;
+
+	if (fq_rate == 0 || cnx == NULL) {
+		return (cs_ipcs_request_process (c, data));
+	}
+
+	/*
+	 * Once anything is deferred, every later request of the connection
+	 * queues up behind it to keep them in order
+	 */
+	if (cnx->fq_deferred_count > 0) {
+		return (fq_defer (c, cnx, data, size));
+	}
+
+	flow_controlled = fq_flow_controlled (c, data);
+	if (flow_controlled) {
+		fq_refill (cnx, qb_util_nano_current_get ());
+		if (cnx->fq_tokens <= 0) {
+			return (fq_defer (c, cnx, data, size));
+		}
+		cnx->fq_tokens -= size;
+	}
+	cnx->fq_admitted++;
+	return (cs_ipcs_request_process (c, data));
+}
+
 
 static int32_t cs_ipcs_job_add(enum qb_loop_priority p,	void *data, qb_loop_job_dispatch_fn fn)
 {
@@ -778,65 +1488,52 @@ void cs_ipcs_sync_state_changed(int32_t sync_in_process)
 	cs_ipcs_check_for_flow_control();
 }
 
-void cs_ipcs_stats_update(void)
+/*
+ * Copy the per-connection statistics for the shared memory segment,
+ * returns the total number of connections
+ */
+uint32_t cs_ipcs_statshm_fill(struct statshm_conn *conn,
+	uint32_t conn_max, uint32_t *conn_count)
 {
 	int32_t i;
-	struct qb_ipcs_stats srv_stats;
+	uint32_t total = 0;
 	struct qb_ipcs_connection_stats stats;
 	qb_ipcs_connection_t *c;
 	struct cs_ipcs_conn_context *cnx;
+	struct statshm_conn *dst;
 
+	*conn_count = 0;
 	for (i = 0; i < SERVICE_HANDLER_MAXIMUM_COUNT; i++) {
 		if (ais_service[i] == NULL || ipcs_mapper[i].inst == NULL) {
 			continue;
 		}
-		qb_ipcs_stats_get(ipcs_mapper[i].inst, &srv_stats, QB_FALSE);
-
 		for (c = qb_ipcs_connection_first_get(ipcs_mapper[i].inst); c;
 		     c = qb_ipcs_connection_next_get(ipcs_mapper[i].inst, c)) {
 
+			total++;
 			cnx = qb_ipcs_context_get(c);
-			if (cnx == NULL) continue;
+			if (cnx == NULL || *conn_count == conn_max) {
+				qb_ipcs_connection_unref(c);
+				continue;
+			}
 
 			qb_ipcs_connection_stats_get(c, &stats, QB_FALSE);
 
-			api->object_key_replace(cnx->stats_handle,
-				"client_pid", strlen("client_pid"),
-				&stats.client_pid, sizeof(uint32_t));
-
-			api->object_key_replace(cnx->stats_handle,
-				"requests", strlen("requests"),
-				&stats.requests, sizeof(uint64_t));
-			api->object_key_replace(cnx->stats_handle,
-				"responses", strlen("responses"),
-				&stats.responses, sizeof(uint64_t));
-			api->object_key_replace(cnx->stats_handle,
-				"dispatched", strlen("dispatched"),
-				&stats.events, sizeof(uint64_t));
-			api->object_key_replace(cnx->stats_handle,
-				"send_retries", strlen("send_retries"),
-				&stats.send_retries, sizeof(uint64_t));
-			api->object_key_replace(cnx->stats_handle,
-				"recv_retries", strlen("recv_retries"),
-				&stats.recv_retries, sizeof(uint64_t));
-			api->object_key_replace(cnx->stats_handle,
-				"flow_control", strlen("flow_control"),
-				&stats.flow_control_state, sizeof(uint32_t));
-			api->object_key_replace(cnx->stats_handle,
-				"flow_control_count", strlen("flow_control_count"),
-				&stats.flow_control_count, sizeof(uint64_t));
-			api->object_key_replace(cnx->stats_handle,
-				"queue_size", strlen("queue_size"),
-				&cnx->queued, sizeof(uint32_t));
-			api->object_key_replace(cnx->stats_handle,
-				"invalid_request", strlen("invalid_request"),
-				&cnx->invalid_request, sizeof(uint64_t));
-			api->object_key_replace(cnx->stats_handle,
-				"overload", strlen("overload"),
-				&cnx->overload, sizeof(uint64_t));
+			dst = &conn[(*conn_count)++];
+			memcpy(dst->name, cnx->name, sizeof(cnx->name));
+			dst->client_pid = stats.client_pid;
+			dst->service_id = i;
+			dst->queue_size = cnx->queued;
+			dst->flow_control = stats.flow_control_state;
+			dst->requests = stats.requests;
+			dst->responses = stats.responses;
+			dst->dispatched = stats.events;
+			dst->invalid_request = cnx->invalid_request;
+			dst->overload = cnx->overload;
 			qb_ipcs_connection_unref(c);
 		}
 	}
+	return (total);
 }
 
 void cs_ipcs_service_init(struct corosync_service_engine *service)
@@ -864,6 +1561,152 @@ void cs_ipcs_service_init(struct corosync_service_engine *service)
 	qb_ipcs_run(ipcs_mapper[service->id].inst);
 }
 
+static void cs_ipcs_fq_config_read (hdb_handle_t object_ipc_handle)
+{
+	hdb_handle_t object_find_handle;
+	hdb_handle_t object_client_handle;
+	struct fq_client_weight *client;
+	char *value;
+
+	if (!api->object_key_get (object_ipc_handle,
+		"fq_rate", strlen ("fq_rate"),
+		(void *)&value, NULL)) {
+
+		fq_rate = strtoull (value, NULL, 10);
+	}
+	if (!api->object_key_get (object_ipc_handle,
+		"fq_burst", strlen ("fq_burst"),
+		(void *)&value, NULL)) {
+
+		fq_burst = strtoull (value, NULL, 10);
+	}
+	if (fq_burst == 0) {
+		fq_burst = fq_rate / 10;
+	}
+	if (fq_burst < CS_IPCS_FQ_BURST_MIN) {
+		fq_burst = CS_IPCS_FQ_BURST_MIN;
+	}
+	if (!api->object_key_get (object_ipc_handle,
+		"fq_queue_size", strlen ("fq_queue_size"),
+		(void *)&value, NULL)) {
+
+		fq_queue_size = strtoul (value, NULL, 10);
+	}
+
+	api->object_find_create (
+		object_ipc_handle,
+		"client",
+		strlen ("client"),
+		&object_find_handle);
+
+	while (api->object_find_next (
+		object_find_handle,
+		&object_client_handle) == 0) {
+
+		if (fq_client_weight_count == CS_IPCS_FQ_CLIENT_MAX) {
+			log_printf (LOGSYS_LEVEL_WARNING,
+				"ipc supports at most %d client entries",
+				CS_IPCS_FQ_CLIENT_MAX);
+			break;
+		}
+		client = &fq_client_weights[fq_client_weight_count];
+		if (api->object_key_get (object_client_handle,
+			"name", strlen ("name"),
+			(void *)&value, NULL)) {
+
+			log_printf (LOGSYS_LEVEL_WARNING,
+				"ipc client entry without a name ignored");
+			continue;
+		}
+		strncpy (client->name, value, sizeof (client->name) - 1);
+		client->weight = 1;
+		if (!api->object_key_get (object_client_handle,
+			"weight", strlen ("weight"),
+			(void *)&value, NULL)) {
+
+			client->weight = strtoul (value, NULL, 10);
+		}
+		if (client->weight == 0 ||
+			client->weight > CS_IPCS_FQ_WEIGHT_MAX) {
+
+			log_printf (LOGSYS_LEVEL_WARNING,
+				"ipc client %s weight must be 1 to %d, using 1",
+				client->name, CS_IPCS_FQ_WEIGHT_MAX);
+			client->weight = 1;
+		}
+		fq_client_weight_count++;
+	}
+
+	api->object_find_destroy (object_find_handle);
+
+	if (fq_rate) {
+		log_printf (LOGSYS_LEVEL_NOTICE,
+			"IPC fair queuing at %llu bytes/s, burst %llu bytes per unit of weight",
+			(unsigned long long)fq_rate, (unsigned long long)fq_burst);
+	}
+}
+
+static void cs_ipcs_config_read (void)
+{
+	hdb_handle_t object_find_handle;
+	hdb_handle_t object_ipc_handle;
+	char *value;
+
+	api->object_find_create (
+		OBJECT_PARENT_HANDLE,
+		"ipc",
+		strlen ("ipc"),
+		&object_find_handle);
+
+	if (api->object_find_next (
+		object_find_handle,
+		&object_ipc_handle) == 0) {
+
+		if (!api->object_key_get (object_ipc_handle,
+			"outq_size", strlen ("outq_size"),
+			(void *)&value, NULL)) {
+
+			outq_size_max = strtoul (value, NULL, 10);
+			if (outq_size_max < CS_IPCS_OUTQ_SIZE_MIN) {
+				log_printf (LOGSYS_LEVEL_WARNING,
+					"ipc outq_size %zu is too small, using %d",
+					outq_size_max, CS_IPCS_OUTQ_SIZE_MIN);
+				outq_size_max = CS_IPCS_OUTQ_SIZE_MIN;
+			}
+			/*
+			 * Records sit at 8 byte aligned offsets, a ring that
+			 * isn't a multiple of 8 would leave the wrap marker
+			 * hanging off its end
+			 */
+			outq_size_max &= ~(size_t)7;
+		}
+		if (!api->object_key_get (object_ipc_handle,
+			"outq_policy", strlen ("outq_policy"),
+			(void *)&value, NULL)) {
+
+			if (strcmp (value, "disconnect") == 0) {
+				outq_policy = CS_IPCS_OUTQ_POLICY_DISCONNECT;
+			} else if (strcmp (value, "drop_oldest") == 0) {
+				outq_policy = CS_IPCS_OUTQ_POLICY_DROP_OLDEST;
+			} else if (strcmp (value, "backpressure") == 0) {
+				outq_policy = CS_IPCS_OUTQ_POLICY_BACKPRESSURE;
+			} else {
+				log_printf (LOGSYS_LEVEL_WARNING,
+					"ipc outq_policy %s is unknown, using backpressure",
+					value);
+			}
+		}
+		cs_ipcs_fq_config_read (object_ipc_handle);
+	}
+
+	api->object_find_destroy (object_find_handle);
+}
+
+static void cs_ipcs_outq_stats_key_get (void *value, size_t value_len, void *priv_data_pt)
+{
+	memcpy (value, priv_data_pt, value_len);
+}
+
 void cs_ipcs_init(void)
 {
 	qb_handle_t object_find_handle;
@@ -872,6 +1715,8 @@ void cs_ipcs_init(void)
 
 	api = apidef_get ();
 
+	cs_ipcs_config_read ();
+
 	qb_loop_poll_low_fds_event_set(cs_poll_handle_get(), cs_ipcs_low_fds_event);
 
 	api->quorum_register_callback (cs_ipcs_fc_quorum_changed, NULL);
@@ -898,5 +1743,24 @@ void cs_ipcs_init(void)
 	api->object_key_create_typed (object_connection_handle,
 		"closed", &zero_64, sizeof (zero_64),
 		OBJDB_VALUETYPE_UINT64);
+
+	api->object_key_create_virtual (object_connection_handle,
+		"outq_memory", sizeof (uint64_t), OBJDB_VALUETYPE_UINT64,
+		cs_ipcs_outq_stats_key_get, &outq_stats.memory);
+	api->object_key_create_virtual (object_connection_handle,
+		"outq_memory_peak", sizeof (uint64_t), OBJDB_VALUETYPE_UINT64,
+		cs_ipcs_outq_stats_key_get, &outq_stats.memory_peak);
+	api->object_key_create_virtual (object_connection_handle,
+		"outq_queued", sizeof (uint64_t), OBJDB_VALUETYPE_UINT64,
+		cs_ipcs_outq_stats_key_get, &outq_stats.queued);
+	api->object_key_create_virtual (object_connection_handle,
+		"outq_dropped", sizeof (uint64_t), OBJDB_VALUETYPE_UINT64,
+		cs_ipcs_outq_stats_key_get, &outq_stats.dropped);
+	api->object_key_create_virtual (object_connection_handle,
+		"outq_disconnects", sizeof (uint64_t), OBJDB_VALUETYPE_UINT64,
+		cs_ipcs_outq_stats_key_get, &outq_stats.disconnects);
+	api->object_key_create_virtual (object_connection_handle,
+		"outq_backpressure", sizeof (uint64_t), OBJDB_VALUETYPE_UINT64,
+		cs_ipcs_outq_stats_key_get, &outq_stats.backpressure);
 }
 
@@ -124,6 +124,8 @@
 #include "service.h"
 #include "schedwrk.h"
 #include "evil.h"
+#include "statshm.h"
+#include "totemhist.h"
 
 #ifdef HAVE_SMALL_MEMORY_FOOTPRINT
 #define IPC_LOGSYS_SIZE			1024*64
@@ -164,8 +166,6 @@ struct sched_param global_sched_param;
 
 static hdb_handle_t object_memb_handle;
 
-static corosync_timer_handle_t corosync_stats_timer_handle;
-
 static const char *corosync_lock_file = LOCALSTATEDIR"/run/corosync.pid";
 
 qb_loop_t *cs_poll_handle_get (void)
@@ -204,7 +204,7 @@ void corosync_state_dump (void)
 
 static void unlink_all_completed (void)
 {
-	api->timer_delete (corosync_stats_timer_handle);
+	statshm_exit ();
 	qb_loop_stop (corosync_poll_handle);
 }
 
@@ -536,148 +536,167 @@ static void corosync_mlockall (void)
 }
 
 
-static void corosync_totem_stats_updater (void *data)
+/*
+ * The runtime.totem keys are virtual: objdb asks for their value when
+ * they are read, so nothing has to be pushed on a timer
+ */
+static void stats_key_create (
+	hdb_handle_t object_handle,
+	const char *key_name,
+	void *counter,
+	size_t counter_len,
+	objdb_value_types_t type)
 {
-	totempg_stats_t * stats;
-	uint32_t mtt_rx_token;
-	uint32_t total_mtt_rx_token;
-	uint32_t avg_backlog_calc;
-	uint32_t total_backlog_calc;
-	uint32_t avg_token_holdtime;
-	uint32_t total_token_holdtime;
-	int t, prev;
-	int32_t token_count;
+	objdb->object_key_create_virtual (object_handle, key_name,
+		counter_len, type, service_stats_key_get, counter);
+}
+
+static void stats_mtt_rx_token_get (void *value, size_t value_len, void *priv_data_pt)
+{
+	totemsrp_stats_t *srp = priv_data_pt;
+	uint32_t mtt_rx_token = 0;
+
+	if (srp->token_count) {
+		mtt_rx_token = srp->token_mtt_rx_total / srp->token_count;
+	}
+	memcpy (value, &mtt_rx_token, value_len);
+}
+
+static void stats_avg_token_workload_get (void *value, size_t value_len, void *priv_data_pt)
+{
+	totemsrp_stats_t *srp = priv_data_pt;
+	uint32_t avg_token_holdtime = 0;
+
+	if (srp->token_count) {
+		avg_token_holdtime = srp->token_holdtime_total / srp->token_count;
+	}
+	memcpy (value, &avg_token_holdtime, value_len);
+}
+
+static void stats_avg_backlog_calc_get (void *value, size_t value_len, void *priv_data_pt)
+{
+	totemsrp_stats_t *srp = priv_data_pt;
+	uint32_t avg_backlog_calc = 0;
+
+	if (srp->token_count) {
+		avg_backlog_calc = srp->token_backlog_total / srp->token_count;
+	}
+	memcpy (value, &avg_backlog_calc, value_len);
+}
+
+static void stats_firewall_enabled_or_nic_failure_get (void *value, size_t value_len, void *priv_data_pt)
+{
+	totemsrp_stats_t *srp = priv_data_pt;
 	uint32_t firewall_enabled_or_nic_failure;
 
-	stats = api->totem_get_stats();
+	firewall_enabled_or_nic_failure = (srp->continuous_gather > MAX_NO_CONT_GATHER ? 1 : 0);
+	memcpy (value, &firewall_enabled_or_nic_failure, value_len);
+}
 
-	objdb->object_key_replace (stats->hdr.handle,
-		"msg_reserved", strlen("msg_reserved"),
-		&stats->msg_reserved, sizeof (stats->msg_reserved));
-	objdb->object_key_replace (stats->hdr.handle,
-		"msg_queue_avail", strlen("msg_queue_avail"),
-		&stats->msg_queue_avail, sizeof (stats->msg_queue_avail));
-
-	objdb->object_key_replace (stats->mrp->srp->hdr.handle,
-		"orf_token_tx", strlen("orf_token_tx"),
-		&stats->mrp->srp->orf_token_tx, sizeof (stats->mrp->srp->orf_token_tx));
-	objdb->object_key_replace (stats->mrp->srp->hdr.handle,
-		"orf_token_rx", strlen("orf_token_rx"),
-		&stats->mrp->srp->orf_token_rx, sizeof (stats->mrp->srp->orf_token_rx));
-	objdb->object_key_replace (stats->mrp->srp->hdr.handle,
-		"memb_merge_detect_tx", strlen("memb_merge_detect_tx"),
-		&stats->mrp->srp->memb_merge_detect_tx, sizeof (stats->mrp->srp->memb_merge_detect_tx));
-	objdb->object_key_replace (stats->mrp->srp->hdr.handle,
-		"memb_merge_detect_rx", strlen("memb_merge_detect_rx"),
-		&stats->mrp->srp->memb_merge_detect_rx, sizeof (stats->mrp->srp->memb_merge_detect_rx));
-	objdb->object_key_replace (stats->mrp->srp->hdr.handle,
-		"memb_join_tx", strlen("memb_join_tx"),
-		&stats->mrp->srp->memb_join_tx, sizeof (stats->mrp->srp->memb_join_tx));
-	objdb->object_key_replace (stats->mrp->srp->hdr.handle,
-		"memb_join_rx", strlen("memb_join_rx"),
-		&stats->mrp->srp->memb_join_rx, sizeof (stats->mrp->srp->memb_join_rx));
-	objdb->object_key_replace (stats->mrp->srp->hdr.handle,
-		"mcast_tx", strlen("mcast_tx"),
-		&stats->mrp->srp->mcast_tx,	sizeof (stats->mrp->srp->mcast_tx));
-	objdb->object_key_replace (stats->mrp->srp->hdr.handle,
-		"mcast_retx", strlen("mcast_retx"),
-		&stats->mrp->srp->mcast_retx, sizeof (stats->mrp->srp->mcast_retx));
-	objdb->object_key_replace (stats->mrp->srp->hdr.handle,
-		"mcast_rx", strlen("mcast_rx"),
-		&stats->mrp->srp->mcast_rx, sizeof (stats->mrp->srp->mcast_rx));
-	objdb->object_key_replace (stats->mrp->srp->hdr.handle,
-		"memb_commit_token_tx", strlen("memb_commit_token_tx"),
-		&stats->mrp->srp->memb_commit_token_tx, sizeof (stats->mrp->srp->memb_commit_token_tx));
-	objdb->object_key_replace (stats->mrp->srp->hdr.handle,
-		"memb_commit_token_rx", strlen("memb_commit_token_rx"),
-		&stats->mrp->srp->memb_commit_token_rx, sizeof (stats->mrp->srp->memb_commit_token_rx));
-	objdb->object_key_replace (stats->mrp->srp->hdr.handle,
-		"token_hold_cancel_tx", strlen("token_hold_cancel_tx"),
-		&stats->mrp->srp->token_hold_cancel_tx, sizeof (stats->mrp->srp->token_hold_cancel_tx));
-	objdb->object_key_replace (stats->mrp->srp->hdr.handle,
-		"token_hold_cancel_rx", strlen("token_hold_cancel_rx"),
-		&stats->mrp->srp->token_hold_cancel_rx, sizeof (stats->mrp->srp->token_hold_cancel_rx));
-	objdb->object_key_replace (stats->mrp->srp->hdr.handle,
-		"operational_entered", strlen("operational_entered"),
-		&stats->mrp->srp->operational_entered, sizeof (stats->mrp->srp->operational_entered));
-	objdb->object_key_replace (stats->mrp->srp->hdr.handle,
-		"operational_token_lost", strlen("operational_token_lost"),
-		&stats->mrp->srp->operational_token_lost, sizeof (stats->mrp->srp->operational_token_lost));
-	objdb->object_key_replace (stats->mrp->srp->hdr.handle,
-		"gather_entered", strlen("gather_entered"),
-		&stats->mrp->srp->gather_entered, sizeof (stats->mrp->srp->gather_entered));
-	objdb->object_key_replace (stats->mrp->srp->hdr.handle,
-		"gather_token_lost", strlen("gather_token_lost"),
-		&stats->mrp->srp->gather_token_lost, sizeof (stats->mrp->srp->gather_token_lost));
-	objdb->object_key_replace (stats->mrp->srp->hdr.handle,
-		"commit_entered", strlen("commit_entered"),
-		&stats->mrp->srp->commit_entered, sizeof (stats->mrp->srp->commit_entered));
-	objdb->object_key_replace (stats->mrp->srp->hdr.handle,
-		"commit_token_lost", strlen("commit_token_lost"),
-		&stats->mrp->srp->commit_token_lost, sizeof (stats->mrp->srp->commit_token_lost));
-	objdb->object_key_replace (stats->mrp->srp->hdr.handle,
-		"recovery_entered", strlen("recovery_entered"),
-		&stats->mrp->srp->recovery_entered, sizeof (stats->mrp->srp->recovery_entered));
-	objdb->object_key_replace (stats->mrp->srp->hdr.handle,
-		"recovery_token_lost", strlen("recovery_token_lost"),
-		&stats->mrp->srp->recovery_token_lost, sizeof (stats->mrp->srp->recovery_token_lost));
-	objdb->object_key_replace (stats->mrp->srp->hdr.handle,
-		"consensus_timeouts", strlen("consensus_timeouts"),
-		&stats->mrp->srp->consensus_timeouts, sizeof (stats->mrp->srp->consensus_timeouts));
-	objdb->object_key_replace (stats->mrp->srp->hdr.handle,
-		"rx_msg_dropped", strlen("rx_msg_dropped"),
-		&stats->mrp->srp->rx_msg_dropped, sizeof (stats->mrp->srp->rx_msg_dropped));
-	objdb->object_key_replace (stats->mrp->srp->hdr.handle,
-		"continuous_gather", strlen("continuous_gather"),
-		&stats->mrp->srp->continuous_gather, sizeof (stats->mrp->srp->continuous_gather));
-
-	firewall_enabled_or_nic_failure = (stats->mrp->srp->continuous_gather > MAX_NO_CONT_GATHER ? 1 : 0);
-	objdb->object_key_replace (stats->mrp->srp->hdr.handle,
-		"firewall_enabled_or_nic_failure", strlen("firewall_enabled_or_nic_failure"),
-		&firewall_enabled_or_nic_failure, sizeof (firewall_enabled_or_nic_failure));
-
-	total_mtt_rx_token = 0;
-	total_token_holdtime = 0;
-	total_backlog_calc = 0;
-	token_count = 0;
-	t = stats->mrp->srp->latest_token;
-	while (1) {
-		if (t == 0)
-			prev = TOTEM_TOKEN_STATS_MAX - 1;
-		else
-			prev = t - 1;
-		if (prev == stats->mrp->srp->earliest_token)
-			break;
-		/* if tx == 0, then dropped token (not ours) */
-		if (stats->mrp->srp->token[t].tx != 0 ||
-			(stats->mrp->srp->token[t].rx - stats->mrp->srp->token[prev].rx) > 0 ) {
-			total_mtt_rx_token += (stats->mrp->srp->token[t].rx - stats->mrp->srp->token[prev].rx);
-			total_token_holdtime += (stats->mrp->srp->token[t].tx - stats->mrp->srp->token[t].rx);
-			total_backlog_calc += stats->mrp->srp->token[t].backlog_calc;
-			token_count++;
+/*
+ * Latency histograms are exported as percentiles, worked out from the
+ * buckets when they are read
+ */
+#define STATS_HISTOGRAM_PERCENTILES 4
+
+static const struct {
+	const char *name;
+	unsigned int per_mille;
+} stats_histogram_percentiles[STATS_HISTOGRAM_PERCENTILES] = {
+	{ "p50", 500 },
+	{ "p90", 900 },
+	{ "p99", 990 },
+	{ "p999", 999 }
+};
+
+struct stats_histogram_key {
+	totem_histogram_t *histogram;
+	unsigned int per_mille;
+};
+
+#define STATS_HISTOGRAMS 4
+
+static struct stats_histogram_key stats_histogram_keys[STATS_HISTOGRAMS][STATS_HISTOGRAM_PERCENTILES];
+
+static totem_histogram_t *stats_histograms[STATS_HISTOGRAMS];
+
+static void stats_histogram_percentile_get (void *value, size_t value_len, void *priv_data_pt)
+{
+	struct stats_histogram_key *key = priv_data_pt;
+	uint64_t percentile;
+
+	percentile = totem_histogram_percentile (key->histogram, key->per_mille);
+	memcpy (value, &percentile, value_len);
+}
+
+static void stats_histogram_mean_get (void *value, size_t value_len, void *priv_data_pt)
+{
+	totem_histogram_t *histogram = priv_data_pt;
+	uint64_t mean = 0;
+
+	if (histogram->count) {
+		mean = histogram->sum / histogram->count;
+	}
+	memcpy (value, &mean, value_len);
+}
+
+static void stats_histogram_reset_notify_fn (
+	object_change_type_t change_type,
+	hdb_handle_t parent_object_handle,
+	hdb_handle_t object_handle,
+	const void *object_name_pt, size_t object_name_len,
+	const void *key_name_pt, size_t key_len,
+	const void *key_value_pt, size_t key_value_len,
+	void *priv_data_pt)
+{
+	int i;
+
+	if (key_len == strlen ("reset") &&
+		memcmp ("reset", key_name_pt, key_len) == 0) {
+
+		for (i = 0; i < STATS_HISTOGRAMS; i++) {
+			totem_histogram_reset (stats_histograms[i]);
 		}
-		t = prev;
-	}
-	if (token_count) {
-		mtt_rx_token = (total_mtt_rx_token / token_count);
-		avg_backlog_calc = (total_backlog_calc / token_count);
-		avg_token_holdtime = (total_token_holdtime / token_count);
-		objdb->object_key_replace (stats->mrp->srp->hdr.handle,
-			"mtt_rx_token", strlen("mtt_rx_token"),
-			&mtt_rx_token, sizeof (mtt_rx_token));
-		objdb->object_key_replace (stats->mrp->srp->hdr.handle,
-			"avg_token_workload", strlen("avg_token_workload"),
-			&avg_token_holdtime, sizeof (avg_token_holdtime));
-		objdb->object_key_replace (stats->mrp->srp->hdr.handle,
-			"avg_backlog_calc", strlen("avg_backlog_calc"),
-			&avg_backlog_calc, sizeof (avg_backlog_calc));
-	}
-
-	cs_ipcs_stats_update();
-
-	api->timer_add_duration (1500 * MILLI_2_NANO_SECONDS, NULL,
-		corosync_totem_stats_updater,
-		&corosync_stats_timer_handle);
+	}
+}
+
+static void stats_histogram_create (
+	hdb_handle_t parent_handle,
+	int index,
+	const char *name,
+	totem_histogram_t *histogram)
+{
+	hdb_handle_t object_handle;
+	int i;
+
+	stats_histograms[index] = histogram;
+
+	objdb->object_create (parent_handle, &object_handle,
+		name, strlen (name));
+
+	stats_key_create (object_handle,
+		"count", &histogram->count,
+		sizeof (histogram->count), OBJDB_VALUETYPE_UINT64);
+	stats_key_create (object_handle,
+		"min", &histogram->min,
+		sizeof (histogram->min), OBJDB_VALUETYPE_UINT64);
+	stats_key_create (object_handle,
+		"max", &histogram->max,
+		sizeof (histogram->max), OBJDB_VALUETYPE_UINT64);
+	objdb->object_key_create_virtual (object_handle,
+		"mean", sizeof (uint64_t), OBJDB_VALUETYPE_UINT64,
+		stats_histogram_mean_get, histogram);
+
+	for (i = 0; i < STATS_HISTOGRAM_PERCENTILES; i++) {
+		stats_histogram_keys[index][i].histogram = histogram;
+		stats_histogram_keys[index][i].per_mille =
+			stats_histogram_percentiles[i].per_mille;
+		objdb->object_key_create_virtual (object_handle,
+			stats_histogram_percentiles[i].name,
+			sizeof (uint64_t), OBJDB_VALUETYPE_UINT64,
+			stats_histogram_percentile_get,
+			&stats_histogram_keys[index][i]);
+	}
 }
 
 static void corosync_totem_stats_init (void)
@@ -686,8 +705,10 @@ static void corosync_totem_stats_init (void)
 	hdb_handle_t object_find_handle;
 	hdb_handle_t object_runtime_handle;
 	hdb_handle_t object_totem_handle;
-	uint32_t zero_32 = 0;
-	uint64_t zero_64 = 0;
+	hdb_handle_t object_histogram_handle;
+	totemnet_stats_t *net;
+	char iface_name[16];
+	int i;
 
 	stats = api->totem_get_stats();
 
@@ -713,112 +734,242 @@ static void corosync_totem_stats_init (void)
 			&stats->mrp->srp->hdr.handle,
 			"srp", strlen ("srp"));
 
-		objdb->object_key_create_typed (stats->hdr.handle,
+		stats_key_create (stats->hdr.handle,
 			"msg_reserved", &stats->msg_reserved,
 			sizeof (stats->msg_reserved), OBJDB_VALUETYPE_UINT32);
-		objdb->object_key_create_typed (stats->hdr.handle,
+		stats_key_create (stats->hdr.handle,
 			"msg_queue_avail", &stats->msg_queue_avail,
 			sizeof (stats->msg_queue_avail), OBJDB_VALUETYPE_UINT32);
+		stats_key_create (stats->hdr.handle,
+			"compress_active", &stats->compress_active,
+			sizeof (stats->compress_active), OBJDB_VALUETYPE_UINT32);
+		stats_key_create (stats->hdr.handle,
+			"compress_ratio", &stats->compress_ratio,
+			sizeof (stats->compress_ratio), OBJDB_VALUETYPE_UINT32);
+		stats_key_create (stats->hdr.handle,
+			"compress_tx_msgs", &stats->compress_tx_msgs,
+			sizeof (stats->compress_tx_msgs), OBJDB_VALUETYPE_UINT64);
+		stats_key_create (stats->hdr.handle,
+			"compress_tx_skipped", &stats->compress_tx_skipped,
+			sizeof (stats->compress_tx_skipped), OBJDB_VALUETYPE_UINT64);
+		stats_key_create (stats->hdr.handle,
+			"compress_tx_bytes_in", &stats->compress_tx_bytes_in,
+			sizeof (stats->compress_tx_bytes_in), OBJDB_VALUETYPE_UINT64);
+		stats_key_create (stats->hdr.handle,
+			"compress_tx_bytes_out", &stats->compress_tx_bytes_out,
+			sizeof (stats->compress_tx_bytes_out), OBJDB_VALUETYPE_UINT64);
+		stats_key_create (stats->hdr.handle,
+			"compress_tx_cpu_ns", &stats->compress_tx_cpu_ns,
+			sizeof (stats->compress_tx_cpu_ns), OBJDB_VALUETYPE_UINT64);
+		stats_key_create (stats->hdr.handle,
+			"compress_rx_msgs", &stats->compress_rx_msgs,
+			sizeof (stats->compress_rx_msgs), OBJDB_VALUETYPE_UINT64);
+		stats_key_create (stats->hdr.handle,
+			"compress_rx_errors", &stats->compress_rx_errors,
+			sizeof (stats->compress_rx_errors), OBJDB_VALUETYPE_UINT64);
+		stats_key_create (stats->hdr.handle,
+			"compress_rx_cpu_ns", &stats->compress_rx_cpu_ns,
+			sizeof (stats->compress_rx_cpu_ns), OBJDB_VALUETYPE_UINT64);
 
 		/* Members object */
 		objdb->object_create (stats->mrp->srp->hdr.handle,
 			&object_memb_handle,
 			"members", strlen ("members"));
 
-		objdb->object_key_create_typed (stats->mrp->srp->hdr.handle,
-			"orf_token_tx",	&stats->mrp->srp->orf_token_tx,
-			sizeof (stats->mrp->srp->orf_token_tx),	OBJDB_VALUETYPE_UINT64);
-		objdb->object_key_create_typed (stats->mrp->srp->hdr.handle,
+		stats_key_create (stats->mrp->srp->hdr.handle,
+			"orf_token_tx", &stats->mrp->srp->orf_token_tx,
+			sizeof (stats->mrp->srp->orf_token_tx), OBJDB_VALUETYPE_UINT64);
+		stats_key_create (stats->mrp->srp->hdr.handle,
 			"orf_token_rx", &stats->mrp->srp->orf_token_rx,
 			sizeof (stats->mrp->srp->orf_token_rx), OBJDB_VALUETYPE_UINT64);
-		objdb->object_key_create_typed (stats->mrp->srp->hdr.handle,
+		stats_key_create (stats->mrp->srp->hdr.handle,
 			"memb_merge_detect_tx", &stats->mrp->srp->memb_merge_detect_tx,
 			sizeof (stats->mrp->srp->memb_merge_detect_tx), OBJDB_VALUETYPE_UINT64);
-		objdb->object_key_create_typed (stats->mrp->srp->hdr.handle,
+		stats_key_create (stats->mrp->srp->hdr.handle,
 			"memb_merge_detect_rx", &stats->mrp->srp->memb_merge_detect_rx,
 			sizeof (stats->mrp->srp->memb_merge_detect_rx), OBJDB_VALUETYPE_UINT64);
-		objdb->object_key_create_typed (stats->mrp->srp->hdr.handle,
+		stats_key_create (stats->mrp->srp->hdr.handle,
 			"memb_join_tx", &stats->mrp->srp->memb_join_tx,
 			sizeof (stats->mrp->srp->memb_join_tx), OBJDB_VALUETYPE_UINT64);
-		objdb->object_key_create_typed (stats->mrp->srp->hdr.handle,
+		stats_key_create (stats->mrp->srp->hdr.handle,
 			"memb_join_rx", &stats->mrp->srp->memb_join_rx,
 			sizeof (stats->mrp->srp->memb_join_rx), OBJDB_VALUETYPE_UINT64);
-		objdb->object_key_create_typed (stats->mrp->srp->hdr.handle,
+		stats_key_create (stats->mrp->srp->hdr.handle,
 			"mcast_tx", &stats->mrp->srp->mcast_tx,
 			sizeof (stats->mrp->srp->mcast_tx), OBJDB_VALUETYPE_UINT64);
-		objdb->object_key_create_typed (stats->mrp->srp->hdr.handle,
+		stats_key_create (stats->mrp->srp->hdr.handle,
 			"mcast_retx", &stats->mrp->srp->mcast_retx,
 			sizeof (stats->mrp->srp->mcast_retx), OBJDB_VALUETYPE_UINT64);
-		objdb->object_key_create_typed (stats->mrp->srp->hdr.handle,
+		stats_key_create (stats->mrp->srp->hdr.handle,
 			"mcast_rx", &stats->mrp->srp->mcast_rx,
 			sizeof (stats->mrp->srp->mcast_rx), OBJDB_VALUETYPE_UINT64);
-		objdb->object_key_create_typed (stats->mrp->srp->hdr.handle,
+		stats_key_create (stats->mrp->srp->hdr.handle,
 			"memb_commit_token_tx", &stats->mrp->srp->memb_commit_token_tx,
 			sizeof (stats->mrp->srp->memb_commit_token_tx), OBJDB_VALUETYPE_UINT64);
-		objdb->object_key_create_typed (stats->mrp->srp->hdr.handle,
+		stats_key_create (stats->mrp->srp->hdr.handle,
 			"memb_commit_token_rx", &stats->mrp->srp->memb_commit_token_rx,
 			sizeof (stats->mrp->srp->memb_commit_token_rx), OBJDB_VALUETYPE_UINT64);
-		objdb->object_key_create_typed (stats->mrp->srp->hdr.handle,
+		stats_key_create (stats->mrp->srp->hdr.handle,
 			"token_hold_cancel_tx", &stats->mrp->srp->token_hold_cancel_tx,
 			sizeof (stats->mrp->srp->token_hold_cancel_tx), OBJDB_VALUETYPE_UINT64);
-		objdb->object_key_create_typed (stats->mrp->srp->hdr.handle,
+		stats_key_create (stats->mrp->srp->hdr.handle,
 			"token_hold_cancel_rx", &stats->mrp->srp->token_hold_cancel_rx,
 			sizeof (stats->mrp->srp->token_hold_cancel_rx), OBJDB_VALUETYPE_UINT64);
-		objdb->object_key_create_typed (stats->mrp->srp->hdr.handle,
+		stats_key_create (stats->mrp->srp->hdr.handle,
 			"operational_entered", &stats->mrp->srp->operational_entered,
 			sizeof (stats->mrp->srp->operational_entered), OBJDB_VALUETYPE_UINT64);
-		objdb->object_key_create_typed (stats->mrp->srp->hdr.handle,
+		stats_key_create (stats->mrp->srp->hdr.handle,
 			"operational_token_lost", &stats->mrp->srp->operational_token_lost,
 			sizeof (stats->mrp->srp->operational_token_lost), OBJDB_VALUETYPE_UINT64);
-		objdb->object_key_create_typed (stats->mrp->srp->hdr.handle,
+		stats_key_create (stats->mrp->srp->hdr.handle,
 			"gather_entered", &stats->mrp->srp->gather_entered,
 			sizeof (stats->mrp->srp->gather_entered), OBJDB_VALUETYPE_UINT64);
-		objdb->object_key_create_typed (stats->mrp->srp->hdr.handle,
+		stats_key_create (stats->mrp->srp->hdr.handle,
 			"gather_token_lost", &stats->mrp->srp->gather_token_lost,
 			sizeof (stats->mrp->srp->gather_token_lost), OBJDB_VALUETYPE_UINT64);
-		objdb->object_key_create_typed (stats->mrp->srp->hdr.handle,
+		stats_key_create (stats->mrp->srp->hdr.handle,
 			"commit_entered", &stats->mrp->srp->commit_entered,
 			sizeof (stats->mrp->srp->commit_entered), OBJDB_VALUETYPE_UINT64);
-		objdb->object_key_create_typed (stats->mrp->srp->hdr.handle,
+		stats_key_create (stats->mrp->srp->hdr.handle,
 			"commit_token_lost", &stats->mrp->srp->commit_token_lost,
 			sizeof (stats->mrp->srp->commit_token_lost), OBJDB_VALUETYPE_UINT64);
-		objdb->object_key_create_typed (stats->mrp->srp->hdr.handle,
+		stats_key_create (stats->mrp->srp->hdr.handle,
 			"recovery_entered", &stats->mrp->srp->recovery_entered,
 			sizeof (stats->mrp->srp->recovery_entered), OBJDB_VALUETYPE_UINT64);
-		objdb->object_key_create_typed (stats->mrp->srp->hdr.handle,
+		stats_key_create (stats->mrp->srp->hdr.handle,
 			"recovery_token_lost", &stats->mrp->srp->recovery_token_lost,
 			sizeof (stats->mrp->srp->recovery_token_lost), OBJDB_VALUETYPE_UINT64);
-		objdb->object_key_create_typed (stats->mrp->srp->hdr.handle,
+		stats_key_create (stats->mrp->srp->hdr.handle,
 			"consensus_timeouts", &stats->mrp->srp->consensus_timeouts,
 			sizeof (stats->mrp->srp->consensus_timeouts), OBJDB_VALUETYPE_UINT64);
-		objdb->object_key_create_typed (stats->mrp->srp->hdr.handle,
-			"mtt_rx_token", &zero_32,
-			sizeof (zero_32), OBJDB_VALUETYPE_UINT32);
-		objdb->object_key_create_typed (stats->mrp->srp->hdr.handle,
-			"avg_token_workload", &zero_32,
-			sizeof (zero_32), OBJDB_VALUETYPE_UINT32);
-		objdb->object_key_create_typed (stats->mrp->srp->hdr.handle,
-			"avg_backlog_calc", &zero_32,
-			sizeof (zero_32), OBJDB_VALUETYPE_UINT32);
-		objdb->object_key_create_typed (stats->mrp->srp->hdr.handle,
-			"rx_msg_dropped", &zero_64,
-			sizeof (zero_64), OBJDB_VALUETYPE_UINT64);
-		objdb->object_key_create_typed (stats->mrp->srp->hdr.handle,
-			"continuous_gather", &zero_32,
-			sizeof (zero_32), OBJDB_VALUETYPE_UINT32);
-		objdb->object_key_create_typed (stats->mrp->srp->hdr.handle,
-			"firewall_enabled_or_nic_failure", &zero_32,
-			sizeof (zero_32), OBJDB_VALUETYPE_UINT32);
-
-	}
-	/* start stats timer */
-	api->timer_add_duration (1500 * MILLI_2_NANO_SECONDS, NULL,
-		corosync_totem_stats_updater,
-		&corosync_stats_timer_handle);
+		objdb->object_key_create_virtual (stats->mrp->srp->hdr.handle,
+			"mtt_rx_token", sizeof (uint32_t), OBJDB_VALUETYPE_UINT32,
+			stats_mtt_rx_token_get, stats->mrp->srp);
+		objdb->object_key_create_virtual (stats->mrp->srp->hdr.handle,
+			"avg_token_workload", sizeof (uint32_t), OBJDB_VALUETYPE_UINT32,
+			stats_avg_token_workload_get, stats->mrp->srp);
+		objdb->object_key_create_virtual (stats->mrp->srp->hdr.handle,
+			"avg_backlog_calc", sizeof (uint32_t), OBJDB_VALUETYPE_UINT32,
+			stats_avg_backlog_calc_get, stats->mrp->srp);
+		stats_key_create (stats->mrp->srp->hdr.handle,
+			"rx_msg_dropped", &stats->mrp->srp->rx_msg_dropped,
+			sizeof (stats->mrp->srp->rx_msg_dropped), OBJDB_VALUETYPE_UINT64);
+		stats_key_create (stats->mrp->srp->hdr.handle,
+			"continuous_gather", &stats->mrp->srp->continuous_gather,
+			sizeof (stats->mrp->srp->continuous_gather), OBJDB_VALUETYPE_UINT32);
+		objdb->object_key_create_virtual (stats->mrp->srp->hdr.handle,
+			"firewall_enabled_or_nic_failure", sizeof (uint32_t), OBJDB_VALUETYPE_UINT32,
+			stats_firewall_enabled_or_nic_failure_get, stats->mrp->srp);
+		stats_key_create (stats->mrp->srp->hdr.handle,
+			"fcc_window", &stats->mrp->srp->fcc_window,
+			sizeof (stats->mrp->srp->fcc_window), OBJDB_VALUETYPE_UINT32);
+		stats_key_create (stats->mrp->srp->hdr.handle,
+			"fcc_max_messages", &stats->mrp->srp->fcc_max_messages,
+			sizeof (stats->mrp->srp->fcc_max_messages), OBJDB_VALUETYPE_UINT32);
+		stats_key_create (stats->mrp->srp->hdr.handle,
+			"fcc_window_increases", &stats->mrp->srp->fcc_window_increases,
+			sizeof (stats->mrp->srp->fcc_window_increases), OBJDB_VALUETYPE_UINT64);
+		stats_key_create (stats->mrp->srp->hdr.handle,
+			"fcc_window_decreases", &stats->mrp->srp->fcc_window_decreases,
+			sizeof (stats->mrp->srp->fcc_window_decreases), OBJDB_VALUETYPE_UINT64);
+
+		/* Latency histograms in microseconds, reset by writing reset */
+		objdb->object_create (stats->mrp->srp->hdr.handle,
+			&object_histogram_handle,
+			"histogram", strlen ("histogram"));
+		stats_histogram_create (object_histogram_handle, 0,
+			"token_rotation", &stats->mrp->srp->token_rotation_hist);
+		stats_histogram_create (object_histogram_handle, 1,
+			"token_hold", &stats->mrp->srp->token_hold_hist);
+		stats_histogram_create (object_histogram_handle, 2,
+			"mcast_deliver", &stats->mrp->srp->mcast_deliver_hist);
+		stats_histogram_create (object_histogram_handle, 3,
+			"recv_deliver", &stats->mrp->srp->recv_deliver_hist);
+		objdb->object_key_create_typed (object_histogram_handle,
+			"reset", "no", strlen ("no"),
+			OBJDB_VALUETYPE_STRING);
+		objdb->object_track_start (object_histogram_handle,
+			OBJECT_TRACK_DEPTH_ONE,
+			stats_histogram_reset_notify_fn,
+			NULL, NULL, NULL, NULL);
 
+		/* Per interface network stats */
+		objdb->object_create (stats->mrp->hdr.handle,
+			&stats->mrp->srp->rrp->hdr.handle,
+			"rrp", strlen ("rrp"));
+
+		for (i = 0; i < stats->mrp->srp->rrp->interface_count; i++) {
+			net = &stats->mrp->srp->rrp->net[i];
+			snprintf (iface_name, sizeof (iface_name), "%d", i);
+			objdb->object_create (stats->mrp->srp->rrp->hdr.handle,
+				&net->hdr.handle,
+				iface_name, strlen (iface_name));
+
+			stats_key_create (net->hdr.handle,
+				"iface_changes", &net->iface_changes,
+				sizeof (net->iface_changes), OBJDB_VALUETYPE_UINT32);
+			stats_key_create (net->hdr.handle,
+				"rx_batches", &net->rx_batches,
+				sizeof (net->rx_batches), OBJDB_VALUETYPE_UINT64);
+			stats_key_create (net->hdr.handle,
+				"rx_frames", &net->rx_frames,
+				sizeof (net->rx_frames), OBJDB_VALUETYPE_UINT64);
+			stats_key_create (net->hdr.handle,
+				"rx_batch_max", &net->rx_batch_max,
+				sizeof (net->rx_batch_max), OBJDB_VALUETYPE_UINT32);
+			stats_key_create (net->hdr.handle,
+				"tx_batches", &net->tx_batches,
+				sizeof (net->tx_batches), OBJDB_VALUETYPE_UINT64);
+			stats_key_create (net->hdr.handle,
+				"tx_frames", &net->tx_frames,
+				sizeof (net->tx_frames), OBJDB_VALUETYPE_UINT64);
+			stats_key_create (net->hdr.handle,
+				"frame_pool_hits", &net->frame_pool.hits,
+				sizeof (net->frame_pool.hits), OBJDB_VALUETYPE_UINT64);
+			stats_key_create (net->hdr.handle,
+				"frame_pool_misses", &net->frame_pool.misses,
+				sizeof (net->frame_pool.misses), OBJDB_VALUETYPE_UINT64);
+			stats_key_create (net->hdr.handle,
+				"frame_pool_in_use", &net->frame_pool.in_use,
+				sizeof (net->frame_pool.in_use), OBJDB_VALUETYPE_UINT32);
+			stats_key_create (net->hdr.handle,
+				"frame_pool_high_water", &net->frame_pool.high_water,
+				sizeof (net->frame_pool.high_water), OBJDB_VALUETYPE_UINT32);
+			stats_key_create (net->hdr.handle,
+				"frame_pool_free", &net->frame_pool.free,
+				sizeof (net->frame_pool.free), OBJDB_VALUETYPE_UINT32);
+		}
+	}
 }
 
 
+/*
+ * Services with an exec_deliver_batch_end_fn that got messages in the
+ * current run
+ */
+static int32_t deliver_batch_services[SERVICE_HANDLER_MAXIMUM_COUNT];
+
+static int deliver_batch_service_count;
+
+static int deliver_batch_service_pending[SERVICE_HANDLER_MAXIMUM_COUNT];
+
+static void deliver_batch_end_fn (void)
+{
+	int32_t service;
+	int i;
+
+	for (i = 0; i < deliver_batch_service_count; i++) {
+		service = deliver_batch_services[i];
+		deliver_batch_service_pending[service] = 0;
+		if (ais_service[service] &&
+			ais_service[service]->exec_deliver_batch_end_fn) {
+
+			ais_service[service]->exec_deliver_batch_end_fn ();
+		}
+	}
+	deliver_batch_service_count = 0;
+}
+
 static void deliver_fn (
 	unsigned int nodeid,
 	const void *msg,
@@ -829,7 +980,6 @@ static void deliver_fn (
 	int32_t service;
 	int32_t fn_id;
 	uint32_t id;
-	uint32_t key_incr_dummy;
 
 	header = msg;
 	if (endian_conversion_required) {
@@ -858,9 +1008,7 @@ static void deliver_fn (
 		return;
 	}
 
-	objdb->object_key_increment (service_stats_handle[service][fn_id],
-		"rx", strlen("rx"),
-		&key_incr_dummy);
+	service_stats[service][fn_id].rx++;
 
 	if (endian_conversion_required) {
 		assert(ais_service[service]->exec_engine[fn_id].exec_endian_convert_fn != NULL);
@@ -870,6 +1018,14 @@ static void deliver_fn (
 
 	ais_service[service]->exec_engine[fn_id].exec_handler_fn
 		(msg, nodeid);
+
+	if (ais_service[service] &&
+		ais_service[service]->exec_deliver_batch_end_fn &&
+		deliver_batch_service_pending[service] == 0) {
+
+		deliver_batch_service_pending[service] = 1;
+		deliver_batch_services[deliver_batch_service_count++] = service;
+	}
 }
 
 void main_get_config_modules(struct config_iface_ver0 ***modules, int *num)
@@ -886,19 +1042,49 @@ int main_mcast (
 	const struct qb_ipc_request_header *req = iovec->iov_base;
 	int32_t service;
 	int32_t fn_id;
-	uint32_t key_incr_dummy;
 
 	service = req->id >> 16;
 	fn_id = req->id & 0xffff;
 
 	if (ais_service[service]) {
-		objdb->object_key_increment (service_stats_handle[service][fn_id],
-			"tx", strlen("tx"), &key_incr_dummy);
+		service_stats[service][fn_id].tx++;
 	}
 
 	return (totempg_groups_mcast_joined (corosync_group_handle, iovec, iov_len, guarantee));
 }
 
+int main_mcast_batch (
+	const struct iovec *iovec,
+	const unsigned int *msg_iov_len,
+	unsigned int msg_count,
+	unsigned int guarantee)
+{
+	const struct qb_ipc_request_header *req;
+	int32_t service;
+	int32_t fn_id;
+	unsigned int i;
+	unsigned int iov_base;
+	int res;
+
+	res = totempg_groups_mcast_joined_batch (corosync_group_handle,
+		iovec, msg_iov_len, msg_count, guarantee);
+	if (res < 0) {
+		return (res);
+	}
+
+	for (i = 0, iov_base = 0; i < msg_count; i++) {
+		req = iovec[iov_base].iov_base;
+		iov_base += msg_iov_len[i];
+
+		service = req->id >> 16;
+		fn_id = req->id & 0xffff;
+		if (ais_service[service]) {
+			service_stats[service][fn_id].tx++;
+		}
+	}
+	return (res);
+}
+
 static qb_loop_timer_handle recheck_the_q_level_timer;
 void corosync_recheck_the_q_level(void *data)
 {
@@ -926,6 +1112,11 @@ int corosync_sending_allowed (
 	struct qb_ipc_request_header *header = (struct qb_ipc_request_header *)msg;
 	int sending_allowed;
 
+	if (id >= ais_service[service]->lib_engine_count) {
+		pd->reserved_msgs = -1;
+		return -EINVAL;
+	}
+
 	reserve_iovec.iov_base = (char *)header;
 	reserve_iovec.iov_len = header->size;
 
@@ -1127,6 +1318,7 @@ static void main_service_ready (void)
 	evil_init (api);
 	cs_ipcs_init();
 	corosync_totem_stats_init ();
+	statshm_init (api);
 	corosync_fplay_control_init ();
 	if (minimum_sync_mode == CS_SYNC_V2) {
 		log_printf (LOGSYS_LEVEL_NOTICE, "Compatibility mode set to none.  Using V2 of the synchronization engine.\n");
@@ -1480,9 +1672,13 @@ int main (int argc, char **argv, char **envp)
 	 * Join multicast group and setup delivery
 	 *  and configuration change functions
 	 */
-	totempg_initialize (
+	if (totempg_initialize (
 		corosync_poll_handle,
-		&totem_config);
+		&totem_config) != 0) {
+
+		log_printf (LOGSYS_LEVEL_ERROR, "Can't initialize TOTEM layer");
+		corosync_exit_error (AIS_DONE_FATAL_ERR);
+	}
 
 	totempg_service_ready_register (
 		main_service_ready);
@@ -1492,6 +1688,10 @@ int main (int argc, char **argv, char **envp)
 		deliver_fn,
 		confchg_fn);
 
+	totempg_groups_deliver_batch_end_register (
+		corosync_group_handle,
+		deliver_batch_end_fn);
+
 	totempg_groups_join (
 		corosync_group_handle,
 		&corosync_group,
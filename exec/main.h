@@ -61,6 +61,12 @@ extern int main_mcast (
 	unsigned int iov_len,
 	unsigned int guarantee);
 
+extern int main_mcast_batch (
+	const struct iovec *iovec,
+	const unsigned int *msg_iov_len,
+	unsigned int msg_count,
+	unsigned int guarantee);
+
 extern void message_source_set (mar_message_source_t *source, void *conn);
 
 extern int message_source_is_local (const mar_message_source_t *source);
@@ -99,10 +105,13 @@ extern void cs_ipcs_init(void);
 
 extern void cs_ipcs_service_init(struct corosync_service_engine *service);
 
-extern void cs_ipcs_stats_update(void);
-
 extern int32_t cs_ipcs_service_destroy(int32_t service_id);
 
+struct statshm_conn;
+
+extern uint32_t cs_ipcs_statshm_fill(struct statshm_conn *conn,
+	uint32_t conn_max, uint32_t *conn_count);
+
 extern int32_t cs_ipcs_q_level_get(void);
 
 extern int cs_ipcs_dispatch_send(void *conn, const void *msg, size_t mlen);
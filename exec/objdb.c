@@ -59,6 +59,8 @@ struct object_key {
 	void *value;
 	size_t value_len;
 	objdb_value_types_t value_type;
+	object_key_value_get_fn_t value_get_fn;
+	void *value_get_priv;
 	struct list_head list;
 };
 
@@ -108,6 +110,17 @@ DECLARE_HDB_DATABASE (object_instance_database,NULL);
 
 DECLARE_HDB_DATABASE (object_find_instance_database,NULL);
 
+/*
+ * Virtual keys have their value filled in on every read
+ */
+static inline void object_key_value_refresh (struct object_key *object_key)
+{
+	if (object_key->value_get_fn) {
+		object_key->value_get_fn (object_key->value,
+			object_key->value_len, object_key->value_get_priv);
+	}
+}
+
 static int objdb_init (void)
 {
 	hdb_handle_t handle;
@@ -599,6 +612,8 @@ static int object_key_create_typed(
 	object_key->key_len = key_len;
 	object_key->value_len = value_len;
 	object_key->value_type = value_type;
+	object_key->value_get_fn = NULL;
+	object_key->value_get_priv = NULL;
 
 	object_key_changed_notification(object_handle, key_name, key_len,
 		value, value_len, OBJECT_KEY_CREATED);
@@ -618,6 +633,55 @@ error_exit:
 	return (-1);
 }
 
+static int object_key_create_virtual (
+	hdb_handle_t object_handle,
+	const char *key_name,
+	size_t value_len,
+	objdb_value_types_t value_type,
+	object_key_value_get_fn_t value_get_fn,
+	void *priv_data_pt)
+{
+	struct object_instance *instance;
+	struct object_key *object_key;
+	struct list_head *list;
+	size_t key_len = strlen(key_name);
+	void *value;
+	int res;
+
+	value = calloc (1, value_len);
+	if (value == NULL) {
+		return (-1);
+	}
+	res = object_key_create_typed (object_handle, key_name,
+		value, value_len, value_type);
+	free (value);
+	if (res != 0) {
+		return (-1);
+	}
+
+	res = hdb_handle_get (&object_instance_database,
+		object_handle, (void *)&instance);
+	if (res != 0) {
+		return (-1);
+	}
+	res = -1;
+	for (list = instance->key_head.next;
+		list != &instance->key_head; list = list->next) {
+
+		object_key = list_entry (list, struct object_key, list);
+
+		if ((object_key->key_len == key_len) &&
+			(memcmp (object_key->key_name, key_name, key_len) == 0)) {
+			object_key->value_get_fn = value_get_fn;
+			object_key->value_get_priv = priv_data_pt;
+			res = 0;
+			break;
+		}
+	}
+	hdb_handle_put (&object_instance_database, object_handle);
+	return (res);
+}
+
 static int object_key_create (
 	hdb_handle_t object_handle,
 	const void *key_name,
@@ -982,6 +1046,7 @@ static int object_key_get_typed (
 		}
 	}
 	if (found) {
+		object_key_value_refresh (object_key);
 		*value = object_key->value;
 		if (value_len) {
 			*value_len = object_key->value_len;
@@ -1399,6 +1464,7 @@ static int _dump_object(struct object_instance *instance, FILE *file, int depth)
 		memcpy(stringbuf1, object_key->key_name, object_key->key_len);
 		stringbuf1[object_key->key_len] = '\0';
 
+		object_key_value_refresh (object_key);
 		switch (object_key->value_type) {
 		case OBJDB_VALUETYPE_INT16:
 			snprintf (stringbuf2, sizeof(int), "%hd",
@@ -1500,6 +1566,7 @@ static int object_key_iter_typed (hdb_handle_t parent_object_handle,
 	}
 	instance->iter_key_list = list;
 	if (found) {
+		object_key_value_refresh (find_key);
 		*key_name = find_key->key_name;
 		*value = find_key->value;
 		*type = find_key->value_type;
@@ -1569,6 +1636,7 @@ static int object_key_iter_from(hdb_handle_t parent_object_handle,
 	}
 
 	if (found) {
+		object_key_value_refresh (find_key);
 		*key_name = find_key->key_name;
 		if (key_len)
 			*key_len = find_key->key_len;
@@ -1812,6 +1880,7 @@ struct objdb_iface_ver0 objdb_iface = {
 	.object_key_create_typed	= object_key_create_typed,
 	.object_key_get_typed		= object_key_get_typed,
 	.object_key_iter_typed		= object_key_iter_typed,
+	.object_key_create_virtual	= object_key_create_virtual,
 };
 
 struct lcr_iface objdb_iface_ver0[1] = {
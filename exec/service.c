@@ -116,6 +116,8 @@ struct corosync_service_engine *ais_service[SERVICE_HANDLER_MAXIMUM_COUNT];
 
 hdb_handle_t service_stats_handle[SERVICE_HANDLER_MAXIMUM_COUNT][64];
 
+struct service_fn_stats service_stats[SERVICE_HANDLER_MAXIMUM_COUNT][64] __attribute__((aligned(64)));
+
 int ais_service_exiting[SERVICE_HANDLER_MAXIMUM_COUNT];
 
 static hdb_handle_t object_internal_configuration_handle;
@@ -124,6 +126,11 @@ static hdb_handle_t object_stats_services_handle;
 
 static void (*service_unlink_all_complete) (void) = NULL;
 
+void service_stats_key_get (void *value, size_t value_len, void *priv_data_pt)
+{
+	memcpy (value, priv_data_pt, value_len);
+}
+
 static unsigned int default_services_requested (struct corosync_api_v1 *corosync_api)
 {
 	hdb_handle_t object_service_handle;
@@ -175,7 +182,6 @@ unsigned int corosync_service_link_and_init (
 	int fn;
 	char object_name[32];
 	char *name_sufix;
-	uint64_t zero_64 = 0;
 	void* _start;
 	void* _stop;
 
@@ -262,6 +268,8 @@ unsigned int corosync_service_link_and_init (
 		&service->id, sizeof (service->id),
 		OBJDB_VALUETYPE_INT16);
 
+	memset (service_stats[service->id], 0, sizeof (service_stats[service->id]));
+
 	for (fn = 0; fn < service->exec_engine_count; fn++) {
 
 		snprintf (object_name, 32, "%d", fn);
@@ -269,15 +277,13 @@ unsigned int corosync_service_link_and_init (
 			&service_stats_handle[service->id][fn],
 			object_name, strlen (object_name));
 
-		corosync_api->object_key_create_typed (service_stats_handle[service->id][fn],
-			"tx",
-			&zero_64, sizeof (zero_64),
-			OBJDB_VALUETYPE_UINT64);
+		corosync_api->object_key_create_virtual (service_stats_handle[service->id][fn],
+			"tx", sizeof (uint64_t), OBJDB_VALUETYPE_UINT64,
+			service_stats_key_get, &service_stats[service->id][fn].tx);
 
-		corosync_api->object_key_create_typed (service_stats_handle[service->id][fn],
-			"rx",
-			&zero_64, sizeof (zero_64),
-			OBJDB_VALUETYPE_UINT64);
+		corosync_api->object_key_create_virtual (service_stats_handle[service->id][fn],
+			"rx", sizeof (uint64_t), OBJDB_VALUETYPE_UINT64,
+			service_stats_key_get, &service_stats[service->id][fn].rx);
 	}
 
 	log_printf (LOGSYS_LEVEL_NOTICE,
@@ -74,4 +74,23 @@ extern int ais_service_exiting[];
 
 extern hdb_handle_t service_stats_handle[SERVICE_HANDLER_MAXIMUM_COUNT][64];
 
+/*
+ * Message counters for each service exec handler.  They are bumped with
+ * plain increments on the delivery and mcast paths (both run on the main
+ * loop thread) and read through the virtual objdb tx/rx keys.
+ */
+struct service_fn_stats {
+	uint64_t tx;
+	uint64_t rx;
+};
+
+extern struct service_fn_stats service_stats[SERVICE_HANDLER_MAXIMUM_COUNT][64];
+
+/*
+ * Value callback for virtual objdb keys that copies the counter
+ * priv_data_pt points to
+ */
+extern void service_stats_key_get (void *value, size_t value_len,
+	void *priv_data_pt);
+
 #endif /* SERVICE_H_DEFINED */
@@ -0,0 +1,379 @@
+/*
+ * Copyright (c) 2012 Red Hat, Inc.
+ *
+ * All rights reserved.
+ *
+ * This software licensed under BSD license, the text of which follows:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * - Neither the name of the MontaVista Software, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Publishes the runtime statistics into a shared memory segment so that
+ * monitoring tools can read them with lib/statshm.c instead of walking
+ * runtime.* over confdb.
+ *
+ * The segment is rewritten from a main loop timer.  Writers bump seq to
+ * an odd value, copy the counters and bump it back to even, readers retry
+ * until they see the same even value before and after their copy.
+ *
+ * Publishing is off unless stats.shm is on.  The per-connection IPC
+ * stats cost a walk over every connection, so they are only filled in
+ * when stats.shm_ipc is on as well.
+ */
+
+#include <config.h>
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <qb/qbutil.h>
+
+#include <corosync/corotypes.h>
+#include <corosync/corodefs.h>
+#include <corosync/statshm.h>
+#include <corosync/totem/totem.h>
+#include <corosync/engine/objdb.h>
+#include <corosync/engine/coroapi.h>
+#include <corosync/engine/logsys.h>
+
+#include "main.h"
+#include "service.h"
+#include "statshm.h"
+#include "totemhist.h"
+
+LOGSYS_DECLARE_SUBSYS ("MAIN");
+
+#define STATSHM_INTERVAL_DEFAULT	1000
+
+static struct corosync_api_v1 *api;
+
+static struct statshm_segment *segment = NULL;
+
+static unsigned int statshm_interval = STATSHM_INTERVAL_DEFAULT;
+
+static int statshm_ipc = 0;
+
+static corosync_timer_handle_t statshm_timer_handle;
+
+static void statshm_config_read (int *enabled)
+{
+	hdb_handle_t object_find_handle;
+	hdb_handle_t object_stats_handle;
+	char *value;
+
+	*enabled = 0;
+
+	api->object_find_create (
+		OBJECT_PARENT_HANDLE,
+		"stats",
+		strlen ("stats"),
+		&object_find_handle);
+
+	if (api->object_find_next (
+		object_find_handle,
+		&object_stats_handle) == 0) {
+
+		if (!api->object_key_get (object_stats_handle,
+			"shm", strlen ("shm"),
+			(void *)&value, NULL)) {
+
+			if (strcmp (value, "on") == 0) {
+				*enabled = 1;
+			}
+		}
+		if (!api->object_key_get (object_stats_handle,
+			"shm_ipc", strlen ("shm_ipc"),
+			(void *)&value, NULL)) {
+
+			if (strcmp (value, "on") == 0) {
+				statshm_ipc = 1;
+			}
+		}
+		if (!api->object_key_get (object_stats_handle,
+			"shm_interval", strlen ("shm_interval"),
+			(void *)&value, NULL)) {
+
+			statshm_interval = strtoul (value, NULL, 10);
+			if (statshm_interval == 0) {
+				statshm_interval = STATSHM_INTERVAL_DEFAULT;
+			}
+		}
+	}
+
+	api->object_find_destroy (object_find_handle);
+}
+
+static void statshm_histogram_copy (
+	struct statshm_histogram *dst,
+	const totem_histogram_t *src)
+{
+	dst->count = src->count;
+	dst->min = src->min;
+	dst->max = src->max;
+	dst->mean = 0;
+	if (src->count) {
+		dst->mean = src->sum / src->count;
+	}
+	dst->p50 = totem_histogram_percentile (src, 500);
+	dst->p90 = totem_histogram_percentile (src, 900);
+	dst->p99 = totem_histogram_percentile (src, 990);
+	dst->p999 = totem_histogram_percentile (src, 999);
+}
+
+static void statshm_srp_copy (
+	struct statshm_srp *dst,
+	const totemsrp_stats_t *src)
+{
+	int i;
+
+	dst->orf_token_tx = src->orf_token_tx;
+	dst->orf_token_rx = src->orf_token_rx;
+	dst->memb_merge_detect_tx = src->memb_merge_detect_tx;
+	dst->memb_merge_detect_rx = src->memb_merge_detect_rx;
+	dst->memb_join_tx = src->memb_join_tx;
+	dst->memb_join_rx = src->memb_join_rx;
+	dst->mcast_tx = src->mcast_tx;
+	dst->mcast_retx = src->mcast_retx;
+	dst->mcast_rx = src->mcast_rx;
+	dst->memb_commit_token_tx = src->memb_commit_token_tx;
+	dst->memb_commit_token_rx = src->memb_commit_token_rx;
+	dst->token_hold_cancel_tx = src->token_hold_cancel_tx;
+	dst->token_hold_cancel_rx = src->token_hold_cancel_rx;
+	dst->operational_entered = src->operational_entered;
+	dst->operational_token_lost = src->operational_token_lost;
+	dst->gather_entered = src->gather_entered;
+	dst->gather_token_lost = src->gather_token_lost;
+	dst->commit_entered = src->commit_entered;
+	dst->commit_token_lost = src->commit_token_lost;
+	dst->recovery_entered = src->recovery_entered;
+	dst->recovery_token_lost = src->recovery_token_lost;
+	dst->consensus_timeouts = src->consensus_timeouts;
+	dst->rx_msg_dropped = src->rx_msg_dropped;
+	dst->fcc_window_increases = src->fcc_window_increases;
+	dst->fcc_window_decreases = src->fcc_window_decreases;
+	dst->fcc_window = src->fcc_window;
+	dst->fcc_max_messages = src->fcc_max_messages;
+	dst->continuous_gather = src->continuous_gather;
+	dst->firewall_enabled_or_nic_failure =
+		(src->continuous_gather > MAX_NO_CONT_GATHER ? 1 : 0);
+
+	dst->mtt_rx_token = 0;
+	dst->avg_token_workload = 0;
+	dst->avg_backlog_calc = 0;
+	if (src->token_count) {
+		dst->mtt_rx_token = src->token_mtt_rx_total / src->token_count;
+		dst->avg_token_workload = src->token_holdtime_total / src->token_count;
+		dst->avg_backlog_calc = src->token_backlog_total / src->token_count;
+	}
+
+	statshm_histogram_copy (&dst->token_rotation_hist,
+		&src->token_rotation_hist);
+	statshm_histogram_copy (&dst->token_hold_hist,
+		&src->token_hold_hist);
+	statshm_histogram_copy (&dst->mcast_deliver_hist,
+		&src->mcast_deliver_hist);
+	statshm_histogram_copy (&dst->recv_deliver_hist,
+		&src->recv_deliver_hist);
+
+	dst->earliest_token = src->earliest_token;
+	dst->latest_token = src->latest_token;
+	for (i = 0; i < TOTEM_TOKEN_STATS_MAX && i < STATSHM_TOKEN_MAX; i++) {
+		dst->token[i].rx = src->token[i].rx;
+		dst->token[i].tx = src->token[i].tx;
+		dst->token[i].backlog_calc = src->token[i].backlog_calc;
+	}
+}
+
+static void statshm_iface_copy (
+	struct statshm_segment *seg,
+	const totemrrp_stats_t *rrp)
+{
+	const totemnet_stats_t *net;
+	uint32_t i;
+
+	seg->iface_count = 0;
+	for (i = 0; i < rrp->interface_count && i < STATSHM_IFACE_MAX; i++) {
+		net = &rrp->net[i];
+		seg->iface[i].rx_batches = net->rx_batches;
+		seg->iface[i].rx_frames = net->rx_frames;
+		seg->iface[i].tx_batches = net->tx_batches;
+		seg->iface[i].tx_frames = net->tx_frames;
+		seg->iface[i].iface_changes = net->iface_changes;
+		seg->iface[i].rx_batch_max = net->rx_batch_max;
+		seg->iface_count++;
+	}
+}
+
+static void statshm_service_copy (struct statshm_segment *seg)
+{
+	struct statshm_service *service;
+	int i;
+	uint32_t fn;
+
+	seg->service_count = 0;
+	for (i = 0; i < SERVICE_HANDLER_MAXIMUM_COUNT; i++) {
+		if (ais_service[i] == NULL ||
+			seg->service_count == STATSHM_SERVICE_MAX) {
+			continue;
+		}
+		service = &seg->service[seg->service_count++];
+
+		strncpy (service->name, ais_service[i]->name,
+			sizeof (service->name) - 1);
+		service->name[sizeof (service->name) - 1] = '\0';
+		service->id = i;
+		service->fn_count = ais_service[i]->exec_engine_count;
+		if (service->fn_count > STATSHM_SERVICE_FN_MAX) {
+			service->fn_count = STATSHM_SERVICE_FN_MAX;
+		}
+		for (fn = 0; fn < service->fn_count; fn++) {
+			service->fn[fn].tx = service_stats[i][fn].tx;
+			service->fn[fn].rx = service_stats[i][fn].rx;
+		}
+	}
+}
+
+static void statshm_update (void *data)
+{
+	totempg_stats_t *stats;
+
+	stats = api->totem_get_stats ();
+
+	segment->seq++;
+	__sync_synchronize ();
+
+	segment->update_time = qb_util_nano_current_get ();
+	segment->msg_reserved = stats->msg_reserved;
+	segment->msg_queue_avail = stats->msg_queue_avail;
+	segment->compress_active = stats->compress_active;
+	segment->compress_ratio = stats->compress_ratio;
+	segment->compress_tx_msgs = stats->compress_tx_msgs;
+	segment->compress_tx_skipped = stats->compress_tx_skipped;
+	segment->compress_tx_bytes_in = stats->compress_tx_bytes_in;
+	segment->compress_tx_bytes_out = stats->compress_tx_bytes_out;
+	segment->compress_tx_cpu_ns = stats->compress_tx_cpu_ns;
+	segment->compress_rx_msgs = stats->compress_rx_msgs;
+	segment->compress_rx_errors = stats->compress_rx_errors;
+	segment->compress_rx_cpu_ns = stats->compress_rx_cpu_ns;
+	statshm_srp_copy (&segment->srp, stats->mrp->srp);
+	statshm_iface_copy (segment, stats->mrp->srp->rrp);
+	statshm_service_copy (segment);
+	if (statshm_ipc) {
+		segment->conn_total = cs_ipcs_statshm_fill (segment->conn,
+			STATSHM_CONN_MAX, &segment->conn_count);
+	}
+
+	__sync_synchronize ();
+	segment->seq++;
+
+	api->timer_add_duration (
+		(unsigned long long)statshm_interval * MILLI_2_NANO_SECONDS,
+		NULL, statshm_update, &statshm_timer_handle);
+}
+
+void statshm_init (struct corosync_api_v1 *corosync_api)
+{
+	int enabled;
+	int fd;
+	void *addr;
+
+	api = corosync_api;
+
+	statshm_config_read (&enabled);
+	if (!enabled) {
+		return;
+	}
+
+	/*
+	 * A previous instance may have left its segment behind
+	 */
+	shm_unlink (STATSHM_NAME);
+
+	/*
+	 * Monitoring agents usually do not run as root.  The segment holds
+	 * counters only, so it is readable by everyone regardless of umask.
+	 */
+	fd = shm_open (STATSHM_NAME, O_RDWR | O_CREAT | O_EXCL,
+		S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	if (fd == -1) {
+		LOGSYS_PERROR (errno, LOGSYS_LEVEL_WARNING,
+			"Could not create statistics segment %s", STATSHM_NAME);
+		return;
+	}
+	if (fchmod (fd, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH) == -1) {
+		LOGSYS_PERROR (errno, LOGSYS_LEVEL_WARNING,
+			"Could not make statistics segment %s readable", STATSHM_NAME);
+	}
+	if (ftruncate (fd, sizeof (struct statshm_segment)) == -1) {
+		LOGSYS_PERROR (errno, LOGSYS_LEVEL_WARNING,
+			"Could not size statistics segment %s", STATSHM_NAME);
+		goto error_unlink;
+	}
+	addr = mmap (NULL, sizeof (struct statshm_segment),
+		PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (addr == MAP_FAILED) {
+		LOGSYS_PERROR (errno, LOGSYS_LEVEL_WARNING,
+			"Could not map statistics segment %s", STATSHM_NAME);
+		goto error_unlink;
+	}
+	close (fd);
+
+	segment = addr;
+	segment->seq = 0;
+	segment->magic = STATSHM_MAGIC;
+	segment->version = STATSHM_VERSION;
+	segment->size = sizeof (struct statshm_segment);
+	segment->update_interval = statshm_interval;
+	segment->pid = getpid ();
+
+	statshm_update (NULL);
+
+	log_printf (LOGSYS_LEVEL_NOTICE,
+		"Publishing statistics to shared memory segment %s every %u ms\n",
+		STATSHM_NAME, statshm_interval);
+	return;
+
+error_unlink:
+	close (fd);
+	shm_unlink (STATSHM_NAME);
+}
+
+void statshm_exit (void)
+{
+	if (segment == NULL) {
+		return;
+	}
+	api->timer_delete (statshm_timer_handle);
+	munmap (segment, sizeof (struct statshm_segment));
+	segment = NULL;
+	shm_unlink (STATSHM_NAME);
+}
@@ -79,7 +79,12 @@
 #define MAX_NETWORK_DELAY			50
 #define WINDOW_SIZE				50
 #define MAX_MESSAGES				17
+#define WINDOW_SIZE_MIN				10
+#define WINDOW_SIZE_MAX				300
+#define WINDOW_SIZE_LIMIT			4096
 #define MISS_COUNT_CONST			5
+#define COMPRESS_THRESHOLD			2048
+#define COMPRESS_THRESHOLD_MIN			256
 #define RRP_PROBLEM_COUNT_TIMEOUT		2000
 #define RRP_PROBLEM_COUNT_THRESHOLD_DEFAULT	10
 #define RRP_PROBLEM_COUNT_THRESHOLD_MIN		2
@@ -226,7 +231,13 @@ static void totem_volatile_config_read (
 
 	objdb_get_int (objdb,object_totem_handle, "max_messages", &totem_config->max_messages);
 
+	objdb_get_int (objdb,object_totem_handle, "window_size_min", &totem_config->window_size_min);
+
+	objdb_get_int (objdb,object_totem_handle, "window_size_max", &totem_config->window_size_max);
+
 	objdb_get_int (objdb,object_totem_handle, "miss_count_const", &totem_config->miss_count_const);
+
+	objdb_get_int (objdb,object_totem_handle, "compress_threshold", &totem_config->compress_threshold);
 }
 
 
@@ -264,6 +275,11 @@ static void totem_get_crypto_type(
 			totem_config->crypto_type = TOTEM_CRYPTO_NSS;
 
 		}
+#endif
+#if defined(HAVE_LIBNSS) && defined(CKM_AES_GCM)
+		if (strcmp(str, "aes_gcm") == 0) {
+			totem_config->crypto_type = TOTEM_CRYPTO_AES_GCM;
+		}
 #endif
 	}
 }
@@ -340,6 +356,27 @@ printf ("couldn't find totem handle\n");
 		}
 	}
 
+	totem_config->send_coalesce = 0;
+	if (!objdb_get_string (objdb,object_totem_handle, "send_coalesce", &str)) {
+		if (strcmp (str, "yes") == 0) {
+			totem_config->send_coalesce = 1;
+		}
+	}
+
+	totem_config->adaptive_window = 0;
+	if (!objdb_get_string (objdb,object_totem_handle, "adaptive_window", &str)) {
+		if (strcmp (str, "yes") == 0) {
+			totem_config->adaptive_window = 1;
+		}
+	}
+
+	totem_config->compress_type = TOTEM_COMPRESS_NONE;
+	if (!objdb_get_string (objdb,object_totem_handle, "compress", &str)) {
+		if (strcmp (str, "lz4") == 0) {
+			totem_config->compress_type = TOTEM_COMPRESS_LZ4;
+		}
+	}
+
 	objdb_get_int (objdb,object_totem_handle, "threads", &totem_config->threads);
 
 
@@ -564,10 +601,51 @@ int totem_config_validate (
 		totem_config->max_messages = MAX_MESSAGES;
 	}
 
+	if (totem_config->window_size_min == 0) {
+		totem_config->window_size_min = WINDOW_SIZE_MIN;
+	}
+
+	if (totem_config->window_size_max == 0) {
+		totem_config->window_size_max = WINDOW_SIZE_MAX;
+	}
+
+	if (totem_config->window_size_min > totem_config->window_size_max) {
+		snprintf (local_error_reason, sizeof(local_error_reason),
+			"The window_size_min parameter (%d messages) may not be greater then window_size_max (%d messages).",
+			totem_config->window_size_min, totem_config->window_size_max);
+		goto parse_error;
+	}
+
+	if (totem_config->window_size_max > WINDOW_SIZE_LIMIT) {
+		snprintf (local_error_reason, sizeof(local_error_reason),
+			"The window_size_max parameter (%d messages) may not be greater then (%d messages).",
+			totem_config->window_size_max, WINDOW_SIZE_LIMIT);
+		goto parse_error;
+	}
+
 	if (totem_config->miss_count_const == 0) {
 		totem_config->miss_count_const = MISS_COUNT_CONST;
 	}
 
+#ifndef HAVE_LZ4
+	if (totem_config->compress_type == TOTEM_COMPRESS_LZ4) {
+		snprintf (local_error_reason, sizeof(local_error_reason),
+			"The compress parameter is lz4 but corosync was built without LZ4 support.");
+		goto parse_error;
+	}
+#endif
+
+	if (totem_config->compress_threshold == 0) {
+		totem_config->compress_threshold = COMPRESS_THRESHOLD;
+	}
+
+	if (totem_config->compress_threshold < COMPRESS_THRESHOLD_MIN) {
+		snprintf (local_error_reason, sizeof(local_error_reason),
+			"The compress_threshold parameter (%d bytes) may not be less then (%d bytes).",
+			totem_config->compress_threshold, COMPRESS_THRESHOLD_MIN);
+		goto parse_error;
+	}
+
 	if (totem_config->token_timeout < MINIMUM_TIMEOUT) {
 		snprintf (local_error_reason, sizeof(local_error_reason),
 			"The token timeout parameter (%d ms) may not be less then (%d ms).",
@@ -0,0 +1,219 @@
+/*
+ * Copyright (c) 2012 Red Hat, Inc.
+ *
+ * All rights reserved.
+ *
+ * This software licensed under BSD license, the text of which follows:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * - Neither the name of the Red Hat, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "totemframe.h"
+
+static const size_t totemframe_class_size[TOTEMFRAME_CLASS_MAX] = {
+	256, 1024, 2048, FRAME_SIZE_MAX
+};
+
+static unsigned int totemframe_class_get (size_t size)
+{
+	unsigned int i;
+
+	for (i = 0; i < TOTEMFRAME_CLASS_MAX - 1; i++) {
+		if (size <= totemframe_class_size[i]) {
+			break;
+		}
+	}
+	return (i);
+}
+
+static struct totemframe_header *totemframe_header_alloc (
+	struct totemframe_pool *pool,
+	unsigned int size_class)
+{
+	struct totemframe_header *header;
+
+	header = malloc (sizeof (struct totemframe_header) +
+		pool->class[size_class].size);
+	if (header == NULL) {
+		return (NULL);
+	}
+	header->pool = pool;
+	header->next = NULL;
+	header->refcount = 0;
+	header->size_class = size_class;
+
+	return (header);
+}
+
+static void totemframe_class_push (
+	struct totemframe_pool *pool,
+	struct totemframe_header *header)
+{
+	struct totemframe_class *class = &pool->class[header->size_class];
+
+	header->next = class->free_head;
+	class->free_head = header;
+	class->free_count += 1;
+	pool->stats->free += 1;
+}
+
+/*
+ * The preallocation is deferred until the first allocation, only the
+ * interface totemrrp allocates from ever needs the frames
+ */
+static void totemframe_pool_prealloc (struct totemframe_pool *pool)
+{
+	struct totemframe_header *header;
+	unsigned int i;
+
+	for (i = 0; i < pool->prealloc_count; i++) {
+		header = totemframe_header_alloc (pool, pool->prealloc_class);
+		if (header == NULL) {
+			break;
+		}
+		totemframe_class_push (pool, header);
+	}
+	pool->prealloc_count = 0;
+}
+
+struct totemframe_pool *totemframe_pool_create (
+	size_t prealloc_size,
+	unsigned int prealloc_count,
+	totemframe_pool_stats_t *stats)
+{
+	struct totemframe_pool *pool;
+	unsigned int i;
+
+	pool = malloc (sizeof (struct totemframe_pool));
+	if (pool == NULL) {
+		return (NULL);
+	}
+	memset (pool, 0, sizeof (struct totemframe_pool));
+
+	for (i = 0; i < TOTEMFRAME_CLASS_MAX; i++) {
+		pool->class[i].size = totemframe_class_size[i];
+	}
+	pool->stats = stats ? stats : &pool->stats_local;
+	memset (pool->stats, 0, sizeof (totemframe_pool_stats_t));
+	pool->prealloc_class = totemframe_class_get (prealloc_size);
+	pool->prealloc_count = prealloc_count;
+
+	return (pool);
+}
+
+static void totemframe_pool_free_lists (struct totemframe_pool *pool)
+{
+	struct totemframe_header *header;
+	unsigned int i;
+
+	for (i = 0; i < TOTEMFRAME_CLASS_MAX; i++) {
+		while ((header = pool->class[i].free_head) != NULL) {
+			pool->class[i].free_head = header->next;
+			free (header);
+		}
+		pool->class[i].free_count = 0;
+	}
+	pool->stats->free = 0;
+}
+
+/*
+ * Frames still referenced (for example by a transmit queue) keep the
+ * pool alive until they are released
+ */
+void totemframe_pool_destroy (struct totemframe_pool *pool)
+{
+	if (pool == NULL) {
+		return;
+	}
+	totemframe_pool_free_lists (pool);
+	pool->stats = &pool->stats_local;
+	pool->destroyed = 1;
+	if (pool->in_use == 0) {
+		free (pool);
+	}
+}
+
+void *totemframe_alloc (struct totemframe_pool *pool, size_t size)
+{
+	struct totemframe_class *class;
+	struct totemframe_header *header;
+	unsigned int size_class;
+
+	assert (size <= FRAME_SIZE_MAX);
+
+	if (pool->prealloc_count) {
+		totemframe_pool_prealloc (pool);
+	}
+
+	size_class = totemframe_class_get (size);
+	class = &pool->class[size_class];
+
+	header = class->free_head;
+	if (header != NULL) {
+		class->free_head = header->next;
+		class->free_count -= 1;
+		pool->stats->free -= 1;
+		pool->stats->hits += 1;
+	} else {
+		header = totemframe_header_alloc (pool, size_class);
+		if (header == NULL) {
+			return (NULL);
+		}
+		pool->stats->misses += 1;
+	}
+
+	header->next = NULL;
+	header->refcount = 1;
+
+	pool->in_use += 1;
+	pool->stats->in_use = pool->in_use;
+	if (pool->in_use > pool->stats->high_water) {
+		pool->stats->high_water = pool->in_use;
+	}
+
+	return (header + 1);
+}
+
+void totemframe_free (struct totemframe_header *header)
+{
+	struct totemframe_pool *pool = header->pool;
+
+	pool->in_use -= 1;
+	pool->stats->in_use = pool->in_use;
+
+	if (pool->destroyed) {
+		free (header);
+		if (pool->in_use == 0) {
+			free (pool);
+		}
+		return;
+	}
+	totemframe_class_push (pool, header);
+}
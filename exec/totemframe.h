@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) 2012 Red Hat, Inc.
+ *
+ * All rights reserved.
+ *
+ * This software licensed under BSD license, the text of which follows:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * - Neither the name of the Red Hat, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef TOTEMFRAME_H_DEFINED
+#define TOTEMFRAME_H_DEFINED
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <assert.h>
+
+#include <corosync/totem/totem.h>
+
+/*
+ * Reference counted frame buffers
+ *
+ * A frame is allocated once by totemsrp (through the transport's
+ * buffer_alloc) and the same memory is then passed by reference down
+ * through totemrrp and the transport.  Anything that needs to keep the
+ * frame past the call that handed it over (such as the transmit
+ * coalescing queue) takes a reference instead of copying the payload.
+ *
+ * Frames come from a per transport instance pool with a few size
+ * classes.  Released frames go back on their class free list instead
+ * of to malloc, so the pool grows to the peak number of frames in flight
+ * and then stays there.  The header remembers the owning pool, so a
+ * frame can be released through any interface.
+ *
+ * All frame operations happen on the totem main loop, so neither the
+ * reference count nor the pool are locked.
+ */
+#define TOTEMFRAME_CLASS_MAX	4
+
+struct totemframe_pool;
+
+struct totemframe_header {
+	struct totemframe_pool *pool;
+	struct totemframe_header *next;
+	unsigned int refcount;
+	unsigned int size_class;
+};
+
+struct totemframe_class {
+	size_t size;
+	struct totemframe_header *free_head;
+	unsigned int free_count;
+};
+
+struct totemframe_pool {
+	struct totemframe_class class[TOTEMFRAME_CLASS_MAX];
+	totemframe_pool_stats_t *stats;
+	totemframe_pool_stats_t stats_local;
+	unsigned int prealloc_class;
+	unsigned int prealloc_count;
+	unsigned int in_use;
+	int destroyed;
+};
+
+extern struct totemframe_pool *totemframe_pool_create (
+	size_t prealloc_size,
+	unsigned int prealloc_count,
+	totemframe_pool_stats_t *stats);
+
+extern void totemframe_pool_destroy (struct totemframe_pool *pool);
+
+extern void *totemframe_alloc (struct totemframe_pool *pool, size_t size);
+
+extern void totemframe_free (struct totemframe_header *header);
+
+static inline void totemframe_ref (void *frame)
+{
+	struct totemframe_header *header = (struct totemframe_header *)frame - 1;
+
+	assert (header->refcount > 0);
+	header->refcount += 1;
+}
+
+static inline void totemframe_release (void *frame)
+{
+	struct totemframe_header *header;
+
+	if (frame == NULL) {
+		return;
+	}
+
+	header = (struct totemframe_header *)frame - 1;
+	assert (header->refcount > 0);
+	if (--header->refcount == 0) {
+		totemframe_free (header);
+	}
+}
+
+#endif /* TOTEMFRAME_H_DEFINED */
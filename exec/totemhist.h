@@ -0,0 +1,141 @@
+/*
+ * Copyright (c) 2012 Red Hat, Inc.
+ *
+ * All rights reserved.
+ *
+ * This software licensed under BSD license, the text of which follows:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * - Neither the name of the Red Hat, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef TOTEMHIST_H_DEFINED
+#define TOTEMHIST_H_DEFINED
+
+#include <stdint.h>
+#include <string.h>
+
+#include <corosync/totem/totem.h>
+
+/*
+ * Log bucketed latency histograms
+ *
+ * Values are recorded in microseconds.  Values below
+ * TOTEM_HISTOGRAM_SUB_BUCKETS get a bucket of their own.  Above that each
+ * power of two is split into TOTEM_HISTOGRAM_SUB_BUCKETS buckets, so a
+ * bucket is never wider than 1/TOTEM_HISTOGRAM_SUB_BUCKETS of the values
+ * in it.  Recording is a few shifts and an increment, percentiles are
+ * only worked out when somebody reads them.
+ */
+
+static inline unsigned int totem_histogram_bucket (uint64_t value)
+{
+	unsigned int msb;
+	unsigned int bucket;
+
+	if (value < TOTEM_HISTOGRAM_SUB_BUCKETS) {
+		return (value);
+	}
+
+	msb = 63 - __builtin_clzll (value);
+	bucket = (msb - TOTEM_HISTOGRAM_SUB_BITS + 1) * TOTEM_HISTOGRAM_SUB_BUCKETS +
+		((value >> (msb - TOTEM_HISTOGRAM_SUB_BITS)) &
+		(TOTEM_HISTOGRAM_SUB_BUCKETS - 1));
+	if (bucket >= TOTEM_HISTOGRAM_BUCKETS) {
+		bucket = TOTEM_HISTOGRAM_BUCKETS - 1;
+	}
+	return (bucket);
+}
+
+/*
+ * Largest value that lands in bucket
+ */
+static inline uint64_t totem_histogram_bucket_max (unsigned int bucket)
+{
+	unsigned int shift;
+
+	if (bucket < TOTEM_HISTOGRAM_SUB_BUCKETS * 2) {
+		return (bucket);
+	}
+
+	shift = bucket / TOTEM_HISTOGRAM_SUB_BUCKETS - 1;
+	return ((((uint64_t)(bucket % TOTEM_HISTOGRAM_SUB_BUCKETS) +
+		TOTEM_HISTOGRAM_SUB_BUCKETS + 1) << shift) - 1);
+}
+
+static inline void totem_histogram_add (
+	totem_histogram_t *histogram,
+	uint64_t value)
+{
+	if (histogram->count == 0 || value < histogram->min) {
+		histogram->min = value;
+	}
+	if (value > histogram->max) {
+		histogram->max = value;
+	}
+	histogram->count++;
+	histogram->sum += value;
+	histogram->buckets[totem_histogram_bucket (value)]++;
+}
+
+static inline void totem_histogram_reset (totem_histogram_t *histogram)
+{
+	memset (histogram, 0, sizeof (totem_histogram_t));
+}
+
+/*
+ * Value below which per_mille thousandths of the recorded values fall,
+ * rounded up to the end of its bucket
+ */
+static inline uint64_t totem_histogram_percentile (
+	const totem_histogram_t *histogram,
+	unsigned int per_mille)
+{
+	uint64_t rank;
+	uint64_t seen = 0;
+	uint64_t value;
+	unsigned int i;
+
+	if (histogram->count == 0) {
+		return (0);
+	}
+
+	rank = (histogram->count * per_mille + 999) / 1000;
+	if (rank == 0) {
+		rank = 1;
+	}
+	for (i = 0; i < TOTEM_HISTOGRAM_BUCKETS; i++) {
+		seen += histogram->buckets[i];
+		if (seen >= rank) {
+			break;
+		}
+	}
+
+	value = totem_histogram_bucket_max (i);
+	if (value > histogram->max) {
+		value = histogram->max;
+	}
+	return (value);
+}
+
+#endif /* TOTEMHIST_H_DEFINED */
@@ -1282,6 +1282,7 @@ int totemiba_initialize (
 	qb_loop_t *qb_poll_handle,
 	void **iba_context,
 	struct totem_config *totem_config,
+	totemnet_stats_t *stats,
 	int interface_no,
 	void *context,
 
@@ -1335,12 +1336,12 @@ int totemiba_initialize (
 	return (res);
 }
 
-void *totemiba_buffer_alloc (void)
+void *totemiba_buffer_alloc (void *iba_context, size_t size)
 {
 	return malloc (MAX_MTU_SIZE);
 }
 
-void totemiba_buffer_release (void *ptr)
+void totemiba_buffer_release (void *iba_context, void *ptr)
 {
 	return free (ptr);
 }
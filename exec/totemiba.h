@@ -48,6 +48,7 @@ extern int totemiba_initialize (
 	qb_loop_t* qb_poll_handle,
 	void **iba_handle,
 	struct totem_config *totem_config,
+	totemnet_stats_t *stats,
 	int interface_no,
 	void *context,
 
@@ -63,9 +64,9 @@ extern int totemiba_initialize (
 	void (*target_set_completed) (
 		void *context));
 
-extern void *totemiba_buffer_alloc (void);
+extern void *totemiba_buffer_alloc (void *iba_context, size_t size);
 
-extern void totemiba_buffer_release (void *ptr);
+extern void totemiba_buffer_release (void *iba_context, void *ptr);
 
 extern int totemiba_processor_count_set (
 	void *iba_context,
@@ -172,6 +172,15 @@ int totemmrp_avail (void)
 	return (totemsrp_avail (totemsrp_context));
 }
 
+void totemmrp_new_message_queue_requeue (
+	void (*requeue_fn) (
+		const void *msg,
+		unsigned int msg_len,
+		int guarantee))
+{
+	totemsrp_new_message_queue_requeue (totemsrp_context, requeue_fn);
+}
+
 int totemmrp_callback_token_create (
 	void **handle_out,
 	enum totem_callback_token_type type,
@@ -238,6 +247,16 @@ extern int totemmrp_ring_reenable (void)
 	return (res);
 }
 
+void totemmrp_deliver_batch_register (
+	void (*deliver_batch_fn) (
+		const struct totem_deliver_item *items,
+		unsigned int item_count))
+{
+	totemsrp_deliver_batch_register (
+		totemsrp_context,
+		deliver_batch_fn);
+}
+
 extern void totemmrp_service_ready_register (
         void (*totem_service_ready) (void))
 {
@@ -91,6 +91,15 @@ extern int totemmrp_mcast (
  */
 extern int totemmrp_avail (void);
 
+/**
+ * Pass every message not yet sent to requeue_fn and drop it from the queue
+ */
+extern void totemmrp_new_message_queue_requeue (
+	void (*requeue_fn) (
+		const void *msg,
+		unsigned int msg_len,
+		int guarantee));
+
 extern int totemmrp_callback_token_create (
 	void **handle_out,
 	enum totem_callback_token_type type,
@@ -117,6 +126,11 @@ extern int totemmrp_crypto_set (unsigned int);
 
 extern int totemmrp_ring_reenable (void);
 
+extern void totemmrp_deliver_batch_register (
+	void (*deliver_batch_fn) (
+		const struct totem_deliver_item *items,
+		unsigned int item_count));
+
 extern void totemmrp_service_ready_register (
         void (*totem_service_ready) (void));
 
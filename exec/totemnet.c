@@ -55,6 +55,7 @@ struct transport {
 		qb_loop_t *loop_pt,
 		void **transport_instance,
 		struct totem_config *totem_config,
+		totemnet_stats_t *stats,
 		int interface_no,
 		void *context,
 
@@ -70,9 +71,9 @@ struct transport {
 		void (*target_set_completed) (
 			void *context));
 
-	void *(*buffer_alloc) (void);
+	void *(*buffer_alloc) (void *transport_context, size_t size);
 
-	void (*buffer_release) (void *ptr);
+	void (*buffer_release) (void *transport_context, void *ptr);
 
 	int (*processor_count_set) (
 		void *transport_context,
@@ -269,6 +270,7 @@ int totemnet_initialize (
 	qb_loop_t *loop_pt,
 	void **net_context,
 	struct totem_config *totem_config,
+	totemnet_stats_t *stats,
 	int interface_no,
 	void *context,
 
@@ -294,7 +296,7 @@ int totemnet_initialize (
 	totemnet_instance_initialize (instance, totem_config);
 
 	res = instance->transport->initialize (loop_pt,
-		&instance->transport_context, totem_config,
+		&instance->transport_context, totem_config, stats,
 		interface_no, context, deliver_fn, iface_change_fn, target_set_completed);
 
 	if (res == -1) {
@@ -309,12 +311,12 @@ error_destroy:
 	return (-1);
 }
 
-void *totemnet_buffer_alloc (void *net_context)
+void *totemnet_buffer_alloc (void *net_context, size_t size)
 {
 	struct totemnet_instance *instance = net_context;
 	assert (instance != NULL);
 	assert (instance->transport != NULL);
-	return instance->transport->buffer_alloc();
+	return instance->transport->buffer_alloc (instance->transport_context, size);
 }
 
 void totemnet_buffer_release (void *net_context, void *ptr)
@@ -322,7 +324,7 @@ void totemnet_buffer_release (void *net_context, void *ptr)
 	struct totemnet_instance *instance = net_context;
 	assert (instance != NULL);
 	assert (instance->transport != NULL);
-	instance->transport->buffer_release (ptr);
+	instance->transport->buffer_release (instance->transport_context, ptr);
 }
 
 int totemnet_processor_count_set (
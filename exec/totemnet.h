@@ -58,6 +58,7 @@ extern int totemnet_initialize (
 	qb_loop_t *poll_handle,
 	void **net_context,
 	struct totem_config *totem_config,
+	totemnet_stats_t *stats,
 	int interface_no,
 	void *context,
 
@@ -73,7 +74,7 @@ extern int totemnet_initialize (
 	void (*target_set_completed) (
 		void *context));
 
-extern void *totemnet_buffer_alloc (void *net_context);
+extern void *totemnet_buffer_alloc (void *net_context, size_t size);
 
 extern void totemnet_buffer_release (void *net_context, void *ptr);
 
@@ -91,6 +92,10 @@ extern int totemnet_mcast_flush_send (
 	const void *msg,
 	unsigned int msg_len);
 
+/*
+ * msg must be a frame from totemnet_buffer_alloc, the transport may keep
+ * a reference on it until the next send_flush
+ */
 extern int totemnet_mcast_noflush_send (
 	void *net_context,
 	const void *msg,
@@ -80,6 +80,37 @@
  * if msg_count = 1 and fragmented
  *	do nothing
  *
+ * When no fragment from the sender is pending, the complete messages are
+ * delivered straight out of the packet and only a trailing fragment is
+ * copied.  The assembly data buffer is allocated on the first fragment
+ * and grows in ASSEMBLY_CHUNK_SIZE steps as needed.  Idle buffers are
+ * freed on the next configuration change.
+ */
+
+/*
+ * COMPRESSION:
+ *
+ * With compress set, a message of compress_threshold bytes or more is
+ * compressed as a whole, group header included, before it is packed and
+ * fragmented.  The result is sent to the compression group with a
+ * totempg_compress_header in front and is decompressed and delivered
+ * again after assembly.  Processors that never heard of the compression
+ * group, such as older versions, find no subscriber for it and drop it.
+ *
+ * Compression is negotiated per ring.  On every regular configuration
+ * change each processor that has it configured multicasts a caps message
+ * naming the ring and its codecs.  Once the caps of every member of the
+ * ring are delivered, compression is switched on.  Caps are delivered in
+ * agreed order, so every member switches at the same point and any
+ * configuration change switches it off again.
+ *
+ * A compressed message always fills frames of its own.  Its frames may
+ * still wait in the totemsrp new message queue when the ring changes, and
+ * the new ring may hold a processor that cannot read them.  So on every
+ * regular configuration change, before anything is sent in the new ring,
+ * the queue is rebuilt in order with these messages decompressed and
+ * packed again.  The queue slots this needs are held back from the time
+ * a message is compressed until it is delivered back to this processor.
  */
 
 #include <config.h>
@@ -96,9 +127,14 @@
 #include <pthread.h>
 #include <errno.h>
 #include <limits.h>
+#include <time.h>
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
 
 #include <corosync/swab.h>
 #include <corosync/list.h>
+#include <corosync/jhash.h>
 #include <qb/qbloop.h>
 #include <qb/qbipcs.h>
 #include <corosync/totem/totempg.h>
@@ -193,9 +229,12 @@ enum throw_away_mode {
 	THROW_AWAY_ACTIVE
 };
 
+#define ASSEMBLY_CHUNK_SIZE	(64 * 1024)
+
 struct assembly {
 	unsigned int nodeid;
-	unsigned char data[MESSAGE_SIZE_MAX];
+	unsigned char *data;
+	size_t data_size;
 	int index;
 	unsigned char last_frag_num;
 	enum throw_away_mode throw_away_mode;
@@ -213,6 +252,11 @@ DECLARE_LIST_INIT(assembly_list_free);
 
 DECLARE_LIST_INIT(totempg_groups_list);
 
+/*
+ * Group instances that received messages since the last batch end
+ */
+DECLARE_LIST_INIT(totempg_batch_pending_list);
+
 /*
  * Staging buffer for packed messages.  Messages are staged in this buffer
  * before sending.  Multiple messages may fit which cuts down on the
@@ -231,6 +275,83 @@ static int fragment_continuation = 0;
 
 static struct iovec iov_delv;
 
+#define TOTEMPG_COMPRESS_CAPS		0
+#define TOTEMPG_COMPRESS_DATA		1
+
+#define TOTEMPG_COMPRESS_CODEC_LZ4	(1 << 0)
+
+struct totempg_compress_header {
+	unsigned char type;
+	unsigned char codec;
+	unsigned short reserved;
+	/*
+	 * Uncompressed length for data, zero for caps
+	 */
+	unsigned int msg_len;
+	/*
+	 * Ring the caps are for, ring the message was compressed in for data
+	 */
+	unsigned long long ring_seq;
+} __attribute__((packed));
+
+static const char totempg_compress_group[] = "\001totempg_compress";
+
+#define TOTEMPG_COMPRESS_GROUP_LEN (sizeof (totempg_compress_group) - 1)
+
+static unsigned short totempg_compress_group_len[2] = {
+	1, TOTEMPG_COMPRESS_GROUP_LEN };
+
+/*
+ * Codec this processor offers, zero when compression is not configured
+ */
+static unsigned char compress_codec = 0;
+
+static int compress_active = 0;
+
+static unsigned long long compress_ring_seq;
+
+static unsigned int compress_members[PROCESSOR_COUNT_MAX];
+
+static unsigned char compress_caps_seen[PROCESSOR_COUNT_MAX];
+
+static unsigned int compress_member_entries;
+
+static unsigned int compress_caps_entries;
+
+/*
+ * Queue slots held back for sending the queued compressed messages of
+ * this processor uncompressed
+ */
+static int compress_reserved = 0;
+
+/*
+ * Set while the staging buffer holds the end of a compressed message
+ */
+static int compress_tail_staged = 0;
+
+#ifdef HAVE_LZ4
+/*
+ * Bytes of the compressed message being collected by compress_requeue_fn
+ */
+static size_t compress_requeue_size = 0;
+
+static unsigned int compress_requeue_msgs;
+
+static int decompress_busy = 0;
+
+static unsigned char *compress_in_buf;
+
+static size_t compress_in_size;
+
+static unsigned char *compress_out_buf;
+
+static size_t compress_out_size;
+
+static unsigned char *decompress_buf;
+
+static size_t decompress_size;
+#endif
+
 struct totempg_group_instance {
 	void (*deliver_fn) (
 		unsigned int nodeid,
@@ -250,9 +371,48 @@ struct totempg_group_instance {
 	int groups_cnt;
 	int32_t q_level;
 
+	unsigned int deliver_seq;
+
+	void (*deliver_batch_end_fn) (void);
+
+	int batch_pending;
+
+	struct list_head batch_list;
+
 	struct list_head list;
 };
 
+/*
+ * Group name -> subscribed instances, so a delivered message only visits
+ * the instances that joined one of the groups in its header
+ */
+#define GROUP_HASH_SIZE 64
+
+/*
+ * An instance may join a group more than once, refcount matches the
+ * number of times the group is in its groups array
+ */
+struct group_subscriber {
+	struct totempg_group_instance *instance;
+	unsigned int refcount;
+	struct list_head list;
+};
+
+struct group_hash_entry {
+	struct list_head list;
+	struct list_head subscribers;
+	size_t group_len;
+	char group[0];
+};
+
+static struct list_head group_hash[GROUP_HASH_SIZE];
+
+/*
+ * Bumped for every delivered message so an instance subscribed to more
+ * than one of the message's groups only gets it once
+ */
+static unsigned int group_deliver_seq = 0;
+
 DECLARE_HDB_DATABASE (totempg_groups_instance_database,NULL);
 
 static unsigned char next_fragment = 1;
@@ -275,14 +435,28 @@ static int msg_count_send_ok (int msg_count);
 
 static int byte_count_send_ok (int byte_count);
 
-static struct assembly *assembly_ref (unsigned int nodeid)
+static int mcast_msg (
+	struct iovec *iovec_in,
+	unsigned int iov_len,
+	int guarantee);
+
+static int mcast_packed_flush (void);
+
+#ifdef HAVE_LZ4
+static void compress_requeue (void);
+#endif
+
+static inline void app_deliver_fn (
+	unsigned int nodeid,
+	void *msg,
+	unsigned int msg_len,
+	int endian_conversion_required);
+
+static struct assembly *assembly_find (unsigned int nodeid)
 {
 	struct assembly *assembly;
 	struct list_head *list;
 
-	/*
-	 * Search inuse list for node id and return assembly buffer if found
-	 */
 	for (list = assembly_list_inuse.next;
 		list != &assembly_list_inuse;
 		list = list->next) {
@@ -293,6 +467,20 @@ static struct assembly *assembly_ref (unsigned int nodeid)
 			return (assembly);
 		}
 	}
+	return (NULL);
+}
+
+static struct assembly *assembly_ref (unsigned int nodeid)
+{
+	struct assembly *assembly;
+
+	/*
+	 * Search inuse list for node id and return assembly buffer if found
+	 */
+	assembly = assembly_find (nodeid);
+	if (assembly) {
+		return (assembly);
+	}
 
 	/*
 	 * Nothing found in inuse list get one from free list if available
@@ -317,7 +505,8 @@ static struct assembly *assembly_ref (unsigned int nodeid)
 	 */
 	assert (assembly);
 	assembly->nodeid = nodeid;
-	assembly->data[0] = 0;
+	assembly->data = NULL;
+	assembly->data_size = 0;
 	assembly->index = 0;
 	assembly->last_frag_num = 0;
 	assembly->throw_away_mode = THROW_AWAY_INACTIVE;
@@ -333,6 +522,227 @@ static void assembly_deref (struct assembly *assembly)
 	list_add (&assembly->list, &assembly_list_free);
 }
 
+/*
+ * Make room for size bytes of assembled data, returns -1 if the
+ * message would be too large or the buffer can't be grown
+ */
+static int assembly_data_reserve (struct assembly *assembly, size_t size)
+{
+	size_t data_size;
+	unsigned char *data;
+
+	if (size <= assembly->data_size) {
+		return (0);
+	}
+	if (size > MESSAGE_SIZE_MAX) {
+		return (-1);
+	}
+
+	data_size = (size + ASSEMBLY_CHUNK_SIZE - 1) & ~(ASSEMBLY_CHUNK_SIZE - 1);
+	if (data_size > MESSAGE_SIZE_MAX) {
+		data_size = MESSAGE_SIZE_MAX;
+	}
+	data = realloc (assembly->data, data_size);
+	if (data == NULL) {
+		return (-1);
+	}
+	assembly->data = data;
+	assembly->data_size = data_size;
+	return (0);
+}
+
+/*
+ * The frame couldn't be assembled, drop it and throw away the rest of
+ * the fragmented message it belongs to
+ */
+static void assembly_frame_drop (
+	struct assembly *assembly,
+	const struct totempg_mcast *mcast,
+	size_t size)
+{
+	log_printf (totempg_log_level_warning,
+		"Dropping frame from node %u, can't assemble %zu bytes",
+		assembly->nodeid, size);
+
+	assembly->index = 0;
+	if (mcast->fragmented == 0) {
+		assembly->last_frag_num = 0;
+		assembly->throw_away_mode = THROW_AWAY_INACTIVE;
+		assembly_deref (assembly);
+	} else {
+		assembly->last_frag_num = mcast->fragmented;
+		assembly->throw_away_mode = THROW_AWAY_ACTIVE;
+	}
+}
+
+#ifdef HAVE_LZ4
+static unsigned long long compress_cpu_nsec (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_THREAD_CPUTIME_ID, &ts);
+	return ((unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+/*
+ * Make room for size bytes in a compression buffer
+ */
+static int compress_buf_reserve (
+	unsigned char **buf,
+	size_t *buf_size,
+	size_t size)
+{
+	unsigned char *data;
+	size_t data_size;
+
+	if (size <= *buf_size) {
+		return (0);
+	}
+
+	data_size = (size + ASSEMBLY_CHUNK_SIZE - 1) & ~(ASSEMBLY_CHUNK_SIZE - 1);
+	data = realloc (*buf, data_size);
+	if (data == NULL) {
+		return (-1);
+	}
+	*buf = data;
+	*buf_size = data_size;
+	return (0);
+}
+
+/*
+ * Queue slots a message of size bytes takes uncompressed, plus one for
+ * the frame flushed in front of it
+ */
+static int compress_frames (unsigned int size)
+{
+	return ((size / (totempg_totem_config->net_mtu -
+		sizeof (struct totempg_mcast) - 16)) + 2);
+}
+
+/*
+ * Replace the message in iovec by its compressed form, addressed to the
+ * compression group.  Returns -1 and leaves iovec alone when the message
+ * does not shrink.
+ */
+static int compress_msg (
+	struct iovec *iovec,
+	unsigned int *iov_len,
+	int *total_size)
+{
+	struct totempg_compress_header header;
+	unsigned long long cpu_start;
+	unsigned int i;
+	size_t offset;
+	int bound;
+	int res;
+
+	bound = LZ4_compressBound (*total_size);
+	if (compress_buf_reserve (&compress_in_buf, &compress_in_size,
+			*total_size) == -1 ||
+		compress_buf_reserve (&compress_out_buf, &compress_out_size,
+			sizeof (struct totempg_compress_header) + bound) == -1) {
+
+		totempg_stats.compress_tx_skipped++;
+		return (-1);
+	}
+
+	cpu_start = compress_cpu_nsec ();
+	for (offset = 0, i = 0; i < *iov_len; i++) {
+		memcpy (&compress_in_buf[offset], iovec[i].iov_base,
+			iovec[i].iov_len);
+		offset += iovec[i].iov_len;
+	}
+	res = LZ4_compress_default ((const char *)compress_in_buf,
+		(char *)&compress_out_buf[sizeof (struct totempg_compress_header)],
+		*total_size, bound);
+	totempg_stats.compress_tx_cpu_ns += compress_cpu_nsec () - cpu_start;
+
+	if (res <= 0 ||
+		sizeof (totempg_compress_group_len) + TOTEMPG_COMPRESS_GROUP_LEN +
+		sizeof (struct totempg_compress_header) + res >= *total_size) {
+
+		totempg_stats.compress_tx_skipped++;
+		return (-1);
+	}
+
+	memset (&header, 0, sizeof (header));
+	header.type = TOTEMPG_COMPRESS_DATA;
+	header.codec = TOTEMPG_COMPRESS_CODEC_LZ4;
+	header.msg_len = *total_size;
+	header.ring_seq = compress_ring_seq;
+	memcpy (compress_out_buf, &header, sizeof (header));
+
+	iovec[0].iov_base = (void *)totempg_compress_group_len;
+	iovec[0].iov_len = sizeof (totempg_compress_group_len);
+	iovec[1].iov_base = (void *)totempg_compress_group;
+	iovec[1].iov_len = TOTEMPG_COMPRESS_GROUP_LEN;
+	iovec[2].iov_base = (void *)compress_out_buf;
+	iovec[2].iov_len = sizeof (struct totempg_compress_header) + res;
+	*iov_len = 3;
+
+	totempg_stats.compress_tx_msgs++;
+	totempg_stats.compress_tx_bytes_in += *total_size;
+	*total_size = iovec[0].iov_len + iovec[1].iov_len + iovec[2].iov_len;
+	totempg_stats.compress_tx_bytes_out += *total_size;
+	totempg_stats.compress_ratio = totempg_stats.compress_tx_bytes_in * 100 /
+		totempg_stats.compress_tx_bytes_out;
+	return (0);
+}
+#endif /* HAVE_LZ4 */
+
+/*
+ * Start negotiating compression for a new ring by telling the members
+ * which codec this processor offers
+ */
+static void compress_caps_send (
+	const unsigned int *member_list,
+	size_t member_list_entries,
+	const struct memb_ring_id *ring_id)
+{
+	struct totempg_compress_header header;
+	struct iovec iovec[3];
+
+	memcpy (compress_members, member_list,
+		member_list_entries * sizeof (unsigned int));
+	memset (compress_caps_seen, 0, sizeof (compress_caps_seen));
+	compress_member_entries = member_list_entries;
+	compress_caps_entries = 0;
+	compress_ring_seq = ring_id->seq;
+
+	memset (&header, 0, sizeof (header));
+	header.type = TOTEMPG_COMPRESS_CAPS;
+	header.codec = compress_codec;
+	header.ring_seq = ring_id->seq;
+
+	iovec[0].iov_base = (void *)totempg_compress_group_len;
+	iovec[0].iov_len = sizeof (totempg_compress_group_len);
+	iovec[1].iov_base = (void *)totempg_compress_group;
+	iovec[1].iov_len = TOTEMPG_COMPRESS_GROUP_LEN;
+	iovec[2].iov_base = (void *)&header;
+	iovec[2].iov_len = sizeof (header);
+
+	if (mcast_msg (iovec, 3, TOTEMPG_AGREED) == -1) {
+		log_printf (totempg_log_level_warning,
+			"Unable to send compression caps, compression stays off for ring %llu",
+			compress_ring_seq);
+	}
+}
+
+/*
+ * Give the memory of every idle assembly back to the system
+ */
+static void assembly_free_list_reclaim (void)
+{
+	struct assembly *assembly;
+
+	while (list_empty (&assembly_list_free) == 0) {
+		assembly = list_entry (assembly_list_free.next, struct assembly, list);
+		list_del (&assembly->list);
+		free (assembly->data);
+		free (assembly);
+	}
+}
+
 static inline void app_confchg_fn (
 	enum totem_configuration_type configuration_type,
 	const unsigned int *member_list, size_t member_list_entries,
@@ -351,10 +761,12 @@ static inline void app_confchg_fn (
 	 * In the leaving processor's assembly buffer.
 	 */
 	for (i = 0; i < left_list_entries; i++) {
-		assembly = assembly_ref (left_list[i]);
-		list_del (&assembly->list);
-		list_add (&assembly->list, &assembly_list_free);
+		assembly = assembly_find (left_list[i]);
+		if (assembly) {
+			assembly_deref (assembly);
+		}
 	}
+	assembly_free_list_reclaim ();
 
 	for (list = totempg_groups_list.next;
 		list != &totempg_groups_list;
@@ -409,63 +821,250 @@ static inline void group_endian_convert (
 	}
 }
 
-static inline int group_matches (
-	struct iovec *iovec,
-	unsigned int iov_len,
-	struct totempg_group *groups_b,
-	unsigned int group_b_cnt,
-	unsigned int *adjust_iovec)
+static inline struct list_head *group_hash_bucket (
+	const void *group,
+	size_t group_len)
 {
-	unsigned short *group_len;
-	char *group_name;
-	int i;
-	int j;
-#ifdef TOTEMPG_NEED_ALIGN
-        struct iovec iovec_aligned = { NULL, 0 };
-#endif
+	return (&group_hash[jhash (group, group_len, 0) & (GROUP_HASH_SIZE - 1)]);
+}
 
-	assert (iov_len == 1);
+static struct group_hash_entry *group_hash_find (
+	const void *group,
+	size_t group_len)
+{
+	struct list_head *bucket;
+	struct list_head *list;
+	struct group_hash_entry *entry;
 
-#ifdef TOTEMPG_NEED_ALIGN
-	/*
-	 * Align data structure for not i386 or x86_64
-	 */
-	if ((size_t)iovec->iov_base % 4 != 0) {
-		iovec_aligned.iov_base = alloca(iovec->iov_len);
-		memcpy(iovec_aligned.iov_base, iovec->iov_base, iovec->iov_len);
-		iovec_aligned.iov_len = iovec->iov_len;
-		iovec = &iovec_aligned;
+	bucket = group_hash_bucket (group, group_len);
+	for (list = bucket->next; list != bucket; list = list->next) {
+		entry = list_entry (list, struct group_hash_entry, list);
+		if (entry->group_len == group_len &&
+			memcmp (entry->group, group, group_len) == 0) {
+
+			return (entry);
+		}
 	}
-#endif
+	return (NULL);
+}
 
-	group_len = (unsigned short *)iovec->iov_base;
-	group_name = ((char *)iovec->iov_base) +
-		sizeof (unsigned short) * (group_len[0] + 1);
+static int group_subscribe (
+	struct totempg_group_instance *instance,
+	const struct totempg_group *group)
+{
+	struct group_hash_entry *entry;
+	struct group_subscriber *subscriber;
+	struct list_head *list;
 
+	entry = group_hash_find (group->group, group->group_len);
+	if (entry == NULL) {
+		entry = malloc (sizeof (struct group_hash_entry) + group->group_len);
+		if (entry == NULL) {
+			return (-1);
+		}
+		list_init (&entry->subscribers);
+		entry->group_len = group->group_len;
+		memcpy (entry->group, group->group, group->group_len);
+		list_add (&entry->list, group_hash_bucket (group->group, group->group_len));
+	}
 
-	/*
-	 * Calculate amount to adjust the iovec by before delivering to app
-	 */
-	*adjust_iovec = sizeof (unsigned short) * (group_len[0] + 1);
-	for (i = 1; i < group_len[0] + 1; i++) {
-		*adjust_iovec += group_len[i];
+	for (list = entry->subscribers.next; list != &entry->subscribers; list = list->next) {
+		subscriber = list_entry (list, struct group_subscriber, list);
+		if (subscriber->instance == instance) {
+			subscriber->refcount += 1;
+			return (0);
+		}
 	}
 
-	/*
-	 * Determine if this message should be delivered to this instance
-	 */
-	for (i = 1; i < group_len[0] + 1; i++) {
-		for (j = 0; j < group_b_cnt; j++) {
-			if ((group_len[i] == groups_b[j].group_len) &&
-				(memcmp (groups_b[j].group, group_name, group_len[i]) == 0)) {
-				return (1);
-			}
+	subscriber = malloc (sizeof (struct group_subscriber));
+	if (subscriber == NULL) {
+		if (list_empty (&entry->subscribers)) {
+			list_del (&entry->list);
+			free (entry);
 		}
-		group_name += group_len[i];
+		return (-1);
 	}
+	subscriber->instance = instance;
+	subscriber->refcount = 1;
+	list_add_tail (&subscriber->list, &entry->subscribers);
 	return (0);
 }
 
+static void group_unsubscribe (
+	struct totempg_group_instance *instance,
+	const struct totempg_group *group)
+{
+	struct group_hash_entry *entry;
+	struct group_subscriber *subscriber;
+	struct list_head *list;
+
+	entry = group_hash_find (group->group, group->group_len);
+	if (entry == NULL) {
+		return;
+	}
+
+	for (list = entry->subscribers.next; list != &entry->subscribers; list = list->next) {
+		subscriber = list_entry (list, struct group_subscriber, list);
+		if (subscriber->instance == instance) {
+			subscriber->refcount -= 1;
+			if (subscriber->refcount == 0) {
+				list_del (&subscriber->list);
+				free (subscriber);
+			}
+			break;
+		}
+	}
+
+	if (list_empty (&entry->subscribers)) {
+		list_del (&entry->list);
+		free (entry);
+	}
+}
+
+/*
+ * Tell the instances that received messages that the run is over.  Message
+ * memory handed to deliver_fn stays valid until then.
+ */
+static void app_deliver_batch_end (void)
+{
+	struct totempg_group_instance *instance;
+
+	while (!list_empty (&totempg_batch_pending_list)) {
+		instance = list_entry (totempg_batch_pending_list.next,
+			struct totempg_group_instance, batch_list);
+		list_del (&instance->batch_list);
+		instance->batch_pending = 0;
+
+		instance->deliver_batch_end_fn ();
+	}
+}
+
+static void compress_caps_receive (
+	unsigned int nodeid,
+	const struct totempg_compress_header *header)
+{
+	unsigned int i;
+
+	if (compress_codec == 0 || compress_active ||
+		header->ring_seq != compress_ring_seq) {
+
+		return;
+	}
+
+	for (i = 0; i < compress_member_entries; i++) {
+		if (compress_members[i] == nodeid) {
+			break;
+		}
+	}
+	if (i == compress_member_entries || compress_caps_seen[i]) {
+		return;
+	}
+
+	if ((header->codec & compress_codec) == 0) {
+		log_printf (totempg_log_level_notice,
+			"Node %u does not offer our codec, compression stays off for ring %llu",
+			nodeid, compress_ring_seq);
+		return;
+	}
+
+	compress_caps_seen[i] = 1;
+	compress_caps_entries += 1;
+	if (compress_caps_entries == compress_member_entries) {
+		compress_active = 1;
+		totempg_stats.compress_active = 1;
+		log_printf (totempg_log_level_debug,
+			"Compression enabled for ring %llu", compress_ring_seq);
+	}
+}
+
+/*
+ * Handle a message sent to the compression group
+ */
+static void compress_msg_deliver (
+	unsigned int nodeid,
+	const void *msg,
+	unsigned int msg_len,
+	int endian_conversion_required)
+{
+	struct totempg_compress_header header;
+#ifdef HAVE_LZ4
+	unsigned long long cpu_start;
+	int res;
+#endif
+
+	if (msg_len < sizeof (struct totempg_compress_header)) {
+		totempg_stats.compress_rx_errors++;
+		return;
+	}
+
+	memcpy (&header, msg, sizeof (struct totempg_compress_header));
+	if (endian_conversion_required) {
+		header.msg_len = swab32 (header.msg_len);
+		header.ring_seq = swab64 (header.ring_seq);
+	}
+
+	if (header.type == TOTEMPG_COMPRESS_CAPS) {
+		compress_caps_receive (nodeid, &header);
+		return;
+	}
+
+#ifdef HAVE_LZ4
+	if (header.type == TOTEMPG_COMPRESS_DATA &&
+		header.ring_seq == compress_ring_seq &&
+		nodeid == totemmrp_my_nodeid_get ()) {
+
+		/*
+		 * Our own message has left the queue
+		 */
+		if (totempg_threaded_mode == 1) {
+			pthread_mutex_lock (&mcast_msg_mutex);
+		}
+		compress_reserved -= compress_frames (header.msg_len);
+		if (compress_reserved < 0) {
+			compress_reserved = 0;
+		}
+		if (totempg_threaded_mode == 1) {
+			pthread_mutex_unlock (&mcast_msg_mutex);
+		}
+	}
+
+	if (header.type == TOTEMPG_COMPRESS_DATA &&
+		header.codec == TOTEMPG_COMPRESS_CODEC_LZ4 &&
+		header.msg_len <= MESSAGE_SIZE_MAX &&
+		decompress_busy == 0 &&
+		compress_buf_reserve (&decompress_buf, &decompress_size,
+			header.msg_len) == 0) {
+
+		cpu_start = compress_cpu_nsec ();
+		res = LZ4_decompress_safe (
+			(const char *)msg + sizeof (struct totempg_compress_header),
+			(char *)decompress_buf,
+			msg_len - sizeof (struct totempg_compress_header),
+			header.msg_len);
+		totempg_stats.compress_rx_cpu_ns += compress_cpu_nsec () - cpu_start;
+
+		if (res == (int)header.msg_len) {
+			totempg_stats.compress_rx_msgs++;
+
+			decompress_busy = 1;
+			app_deliver_fn (nodeid, decompress_buf, header.msg_len,
+				endian_conversion_required);
+			decompress_busy = 0;
+
+			/*
+			 * decompress_buf is reused by the next compressed message
+			 */
+			app_deliver_batch_end ();
+			return;
+		}
+	}
+#endif
+
+	totempg_stats.compress_rx_errors++;
+	log_printf (totempg_log_level_warning,
+		"Discarding compressed message from node %u that could not be decompressed",
+		nodeid);
+}
 
 static inline void app_deliver_fn (
 	unsigned int nodeid,
@@ -474,10 +1073,15 @@ static inline void app_deliver_fn (
 	int endian_conversion_required)
 {
 	struct totempg_group_instance *instance;
+	struct group_hash_entry *entry;
+	struct group_subscriber *subscriber;
 	struct iovec stripped_iovec;
 	unsigned int adjust_iovec;
+	unsigned short *group_len;
+	char *group_name;
 	struct iovec *iovec;
 	struct list_head *list;
+	int i;
 
         struct iovec aligned_iovec = { NULL, 0 };
 
@@ -505,37 +1109,94 @@ static inline void app_deliver_fn (
 
 	iovec = &aligned_iovec;
 
-	for (list = totempg_groups_list.next;
-		list != &totempg_groups_list;
-		list = list->next) {
+	group_len = (unsigned short *)iovec->iov_base;
+	group_name = ((char *)iovec->iov_base) +
+		sizeof (unsigned short) * (group_len[0] + 1);
 
-		instance = list_entry (list, struct totempg_group_instance, list);
-		if (group_matches (iovec, 1, instance->groups, instance->groups_cnt, &adjust_iovec)) {
-			stripped_iovec.iov_len = iovec->iov_len - adjust_iovec;
-			stripped_iovec.iov_base = (char *)iovec->iov_base + adjust_iovec;
+	/*
+	 * Calculate amount to adjust the iovec by before delivering to app
+	 */
+	adjust_iovec = sizeof (unsigned short) * (group_len[0] + 1);
+	for (i = 1; i < group_len[0] + 1; i++) {
+		adjust_iovec += group_len[i];
+	}
+
+	stripped_iovec.iov_len = iovec->iov_len - adjust_iovec;
+	stripped_iovec.iov_base = (char *)iovec->iov_base + adjust_iovec;
 
 #ifdef TOTEMPG_NEED_ALIGN
-			/*
-			 * Align data structure for not i386 or x86_64
-			 */
-			if ((char *)iovec->iov_base + adjust_iovec % 4 != 0) {
-				/*
-				 * Deal with misalignment
-				 */
-				stripped_iovec.iov_base =
-					alloca (stripped_iovec.iov_len);
-				memcpy (stripped_iovec.iov_base,
-					 (char *)iovec->iov_base + adjust_iovec,
-					stripped_iovec.iov_len);
-			}
+	/*
+	 * Align data structure for not i386 or x86_64
+	 */
+	if ((char *)iovec->iov_base + adjust_iovec % 4 != 0) {
+		/*
+		 * Deal with misalignment
+		 */
+		stripped_iovec.iov_base =
+			alloca (stripped_iovec.iov_len);
+		memcpy (stripped_iovec.iov_base,
+			 (char *)iovec->iov_base + adjust_iovec,
+			stripped_iovec.iov_len);
+	}
 #endif
+
+	if (group_len[0] == 1 &&
+		group_len[1] == TOTEMPG_COMPRESS_GROUP_LEN &&
+		memcmp (group_name, totempg_compress_group,
+			TOTEMPG_COMPRESS_GROUP_LEN) == 0) {
+
+		compress_msg_deliver (nodeid,
+			stripped_iovec.iov_base,
+			stripped_iovec.iov_len,
+			endian_conversion_required);
+		return;
+	}
+
+	group_deliver_seq++;
+
+	/*
+	 * Deliver to the subscribers of each group named in the message
+	 */
+	for (i = 1; i < group_len[0] + 1; i++) {
+		entry = group_hash_find (group_name, group_len[i]);
+		group_name += group_len[i];
+		if (entry == NULL) {
+			continue;
+		}
+
+		for (list = entry->subscribers.next;
+			list != &entry->subscribers;
+			list = list->next) {
+
+			subscriber = list_entry (list, struct group_subscriber, list);
+			instance = subscriber->instance;
+			if (instance->deliver_seq == group_deliver_seq) {
+				continue;
+			}
+			instance->deliver_seq = group_deliver_seq;
+
 			instance->deliver_fn (
 				nodeid,
 				stripped_iovec.iov_base,
 				stripped_iovec.iov_len,
 				endian_conversion_required);
+
+			if (instance->deliver_batch_end_fn &&
+				instance->batch_pending == 0) {
+
+				instance->batch_pending = 1;
+				list_add_tail (&instance->batch_list,
+					&totempg_batch_pending_list);
+			}
 		}
 	}
+
+#ifdef TOTEMPG_NEED_ALIGN
+	/*
+	 * The aligned copies live on this stack frame
+	 */
+	app_deliver_batch_end ();
+#endif
 }
 
 static void totempg_confchg_fn (
@@ -545,15 +1206,67 @@ static void totempg_confchg_fn (
 	const unsigned int *joined_list, size_t joined_list_entries,
 	const struct memb_ring_id *ring_id)
 {
+	compress_active = 0;
+	totempg_stats.compress_active = 0;
+
+#ifdef HAVE_LZ4
+	if (configuration_type == TOTEM_CONFIGURATION_REGULAR) {
+		compress_requeue ();
+	}
+#endif
+
 // TODO optimize this
 	app_confchg_fn (configuration_type,
 		member_list, member_list_entries,
 		left_list, left_list_entries,
 		joined_list, joined_list_entries,
 		ring_id);
+
+	if (compress_codec &&
+		configuration_type == TOTEM_CONFIGURATION_REGULAR) {
+
+		compress_caps_send (member_list, member_list_entries, ring_id);
+	}
 }
 
-static void totempg_deliver_fn (
+/*
+ * Deliver the complete messages of a packet in place.  A trailing
+ * fragment starts a new assembly for the sender.
+ */
+static void totempg_deliver_direct (
+	unsigned int nodeid,
+	struct totempg_mcast *mcast)
+{
+	unsigned short *msg_lens;
+	struct assembly *assembly;
+	unsigned char *data;
+	int msg_count;
+	int i;
+
+	msg_lens = (unsigned short *)((char *)mcast + sizeof (struct totempg_mcast));
+	data = (unsigned char *)&msg_lens[mcast->msg_count];
+
+	msg_count = mcast->fragmented ? mcast->msg_count - 1 : mcast->msg_count;
+	for (i = 0; i < msg_count; i++) {
+		app_deliver_fn (nodeid, data, msg_lens[i], 0);
+		data += msg_lens[i];
+	}
+
+	if (mcast->fragmented == 0) {
+		return;
+	}
+
+	assembly = assembly_ref (nodeid);
+	if (assembly_data_reserve (assembly, msg_lens[msg_count]) == -1) {
+		assembly_frame_drop (assembly, mcast, msg_lens[msg_count]);
+		return;
+	}
+	memcpy (assembly->data, data, msg_lens[msg_count]);
+	assembly->index = msg_lens[msg_count];
+	assembly->last_frag_num = mcast->fragmented;
+}
+
+static void totempg_frame_deliver (
 	unsigned int nodeid,
 	const void *msg,
 	unsigned int msg_len,
@@ -570,6 +1283,21 @@ static void totempg_deliver_fn (
 	const char *data;
 	int datasize;
 
+	mcast = (struct totempg_mcast *)msg;
+	if (endian_conversion_required) {
+		mcast->msg_count = swab16 (mcast->msg_count);
+	}
+
+	/*
+	 * Nothing pending from this sender, deliver without copying
+	 */
+	if (endian_conversion_required == 0 && mcast->continuation == 0 &&
+		assembly_find (nodeid) == NULL) {
+
+		totempg_deliver_direct (nodeid, mcast);
+		return;
+	}
+
 	assembly = assembly_ref (nodeid);
 	assert (assembly);
 
@@ -578,11 +1306,6 @@ static void totempg_deliver_fn (
 	 * assemble the packet contents into one block of data to simplify delivery
 	 */
 
-	mcast = (struct totempg_mcast *)msg;
-	if (endian_conversion_required) {
-		mcast->msg_count = swab16 (mcast->msg_count);
-	}
-
 	msg_count = mcast->msg_count;
 	datasize = sizeof (struct totempg_mcast) +
 		msg_count * sizeof (unsigned short);
@@ -597,6 +1320,13 @@ static void totempg_deliver_fn (
 		}
 	}
 
+	if (assembly_data_reserve (assembly,
+		assembly->index + msg_len - datasize) == -1) {
+
+		assembly_frame_drop (assembly, mcast,
+			assembly->index + msg_len - datasize);
+		return;
+	}
 	memcpy (&assembly->data[assembly->index], &data[datasize],
 		msg_len - datasize);
 
@@ -646,6 +1376,13 @@ static void totempg_deliver_fn (
 					iov_delv.iov_len = msg_lens[i + 1];
 				}
 			}
+			/*
+			 * The assembly buffer is reused below, so the
+			 * messages delivered from it end the batch
+			 */
+			if (msg_count > start) {
+				app_deliver_batch_end ();
+			}
 		} else {
 			assembly->throw_away_mode = THROW_AWAY_ACTIVE;
 		}
@@ -667,10 +1404,34 @@ static void totempg_deliver_fn (
 				&assembly->data[assembly->index],
 				msg_lens[msg_count]);
 
-			assembly->index = 0;
-		}
-		assembly->index += msg_lens[msg_count];
+			assembly->index = 0;
+		}
+		assembly->index += msg_lens[msg_count];
+	}
+}
+
+static void totempg_deliver_fn (
+	unsigned int nodeid,
+	const void *msg,
+	unsigned int msg_len,
+	int endian_conversion_required)
+{
+	totempg_frame_deliver (nodeid, msg, msg_len,
+		endian_conversion_required);
+	app_deliver_batch_end ();
+}
+
+static void totempg_deliver_batch_fn (
+	const struct totem_deliver_item *items,
+	unsigned int item_count)
+{
+	unsigned int i;
+
+	for (i = 0; i < item_count; i++) {
+		totempg_frame_deliver (items[i].nodeid, items[i].msg,
+			items[i].msg_len, items[i].endian_conversion_required);
 	}
+	app_deliver_batch_end ();
 }
 
 /*
@@ -680,26 +1441,20 @@ static void totempg_deliver_fn (
 
 void *callback_token_received_handle;
 
-int callback_token_received_fn (enum totem_callback_token_type type,
-				const void *data)
+/*
+ * Send the messages staged in the fragmentation buffer as a frame of
+ * their own.  Called with mcast_msg_mutex held.
+ */
+static int mcast_packed_flush (void)
 {
 	struct totempg_mcast mcast;
 	struct iovec iovecs[3];
 
-	if (totempg_threaded_mode == 1) {
-		pthread_mutex_lock (&mcast_msg_mutex);
-	}
 	if (mcast_packed_msg_count == 0) {
-		if (totempg_threaded_mode == 1) {
-			pthread_mutex_unlock (&mcast_msg_mutex);
-		}
 		return (0);
 	}
 	if (totemmrp_avail() == 0) {
-		if (totempg_threaded_mode == 1) {
-			pthread_mutex_unlock (&mcast_msg_mutex);
-		}
-		return (0);
+		return (-1);
 	}
 	mcast.header.version = 0;
 	mcast.header.type = 0;
@@ -710,7 +1465,6 @@ int callback_token_received_fn (enum totem_callback_token_type type,
 	 * fragmented message?
 	 */
 	mcast.continuation = fragment_continuation;
-	fragment_continuation = 0;
 
 	mcast.msg_count = mcast_packed_msg_count;
 
@@ -720,10 +1474,26 @@ int callback_token_received_fn (enum totem_callback_token_type type,
 	iovecs[1].iov_len = mcast_packed_msg_count * sizeof (unsigned short);
 	iovecs[2].iov_base = (void *)&fragmentation_data[0];
 	iovecs[2].iov_len = fragment_size;
-	(void)totemmrp_mcast (iovecs, 3, 0);
+	if (totemmrp_mcast (iovecs, 3, 0) == -1) {
+		return (-1);
+	}
 
+	fragment_continuation = 0;
 	mcast_packed_msg_count = 0;
 	fragment_size = 0;
+	compress_tail_staged = 0;
+
+	return (0);
+}
+
+int callback_token_received_fn (enum totem_callback_token_type type,
+				const void *data)
+{
+	if (totempg_threaded_mode == 1) {
+		pthread_mutex_lock (&mcast_msg_mutex);
+	}
+
+	(void)mcast_packed_flush ();
 
 	if (totempg_threaded_mode == 1) {
 		pthread_mutex_unlock (&mcast_msg_mutex);
@@ -739,6 +1509,7 @@ int totempg_initialize (
 	struct totem_config *totem_config)
 {
 	int res;
+	int i;
 
 	totempg_totem_config = totem_config;
 	totempg_log_level_security = totem_config->totem_logging_configuration.log_level_security;
@@ -754,6 +1525,10 @@ int totempg_initialize (
 		return (-1);
 	}
 
+	if (totem_config->compress_type == TOTEM_COMPRESS_LZ4) {
+		compress_codec = TOTEMPG_COMPRESS_CODEC_LZ4;
+	}
+
 	totemsrp_net_mtu_adjust (totem_config);
 
 	res = totemmrp_initialize (
@@ -762,6 +1537,11 @@ int totempg_initialize (
 		&totempg_stats,
 		totempg_deliver_fn,
 		totempg_confchg_fn);
+	if (res == -1) {
+		return (-1);
+	}
+
+	totemmrp_deliver_batch_register (totempg_deliver_batch_fn);
 
 	totemmrp_callback_token_create (
 		&callback_token_received_handle,
@@ -775,6 +1555,9 @@ int totempg_initialize (
 		sizeof (struct totempg_mcast) - 16);
 
 	list_init (&totempg_groups_list);
+	for (i = 0; i < GROUP_HASH_SIZE; i++) {
+		list_init (&group_hash[i]);
+	}
 
 	return (res);
 }
@@ -791,12 +1574,16 @@ void totempg_finalize (void)
 }
 
 /*
- * Multicast a message
+ * Packs one message into the fragmentation buffer, sending out full
+ * frames as it goes.  Called with mcast_msg_mutex held.  When
+ * space_checked is set the caller already made sure the new message
+ * queue has room for the message.
  */
-static int mcast_msg (
+static int mcast_msg_pack (
 	struct iovec *iovec_in,
 	unsigned int iov_len,
-	int guarantee)
+	int guarantee,
+	int space_checked)
 {
 	int res = 0;
 	struct totempg_mcast mcast;
@@ -808,11 +1595,9 @@ static int mcast_msg (
 	int copy_len = 0;
 	int copy_base = 0;
 	int total_size = 0;
-
-	if (totempg_threaded_mode == 1) {
-		pthread_mutex_lock (&mcast_msg_mutex);
-	}
-	totemmrp_event_signal (TOTEM_EVENT_NEW_MSG, 1);
+#ifdef HAVE_LZ4
+	int plain_size = 0;
+#endif
 
 	/*
 	 * Remove zero length iovectors from the list
@@ -826,6 +1611,33 @@ static int mcast_msg (
 	}
 	iov_len = dest;
 
+	for (i = 0; i < iov_len; i++) {
+		total_size += iovec[i].iov_len;
+	}
+
+#ifdef HAVE_LZ4
+	/*
+	 * Nothing may share a frame with the end of a compressed message
+	 */
+	if (compress_tail_staged && mcast_packed_flush () == -1) {
+		return (-1);
+	}
+
+	/*
+	 * A compressed message starts a frame of its own
+	 */
+	if (compress_active &&
+		total_size >= totempg_totem_config->compress_threshold &&
+		byte_count_send_ok (total_size + TOTEMPG_PACKET_SIZE) &&
+		mcast_packed_flush () == 0) {
+
+		plain_size = total_size;
+		if (compress_msg (iovec, &iov_len, &total_size) == -1) {
+			plain_size = 0;
+		}
+	}
+#endif
+
 	max_packet_size = TOTEMPG_PACKET_SIZE -
 		(sizeof (unsigned short) * (mcast_packed_msg_count + 1));
 
@@ -834,16 +1646,10 @@ static int mcast_msg (
 	/*
 	 * Check if we would overwrite new message queue
 	 */
-	for (i = 0; i < iov_len; i++) {
-		total_size += iovec[i].iov_len;
-	}
-
-	if (byte_count_send_ok (total_size + sizeof(unsigned short) *
+	if (space_checked == 0 &&
+		byte_count_send_ok (total_size + sizeof(unsigned short) *
 		(mcast_packed_msg_count)) == 0) {
 
-		if (totempg_threaded_mode == 1) {
-			pthread_mutex_unlock (&mcast_msg_mutex);
-		}
 		return(-1);
 	}
 
@@ -879,6 +1685,11 @@ static int mcast_msg (
 			unsigned char *data_ptr;
 
 			copy_len = min(copy_len, max_packet_size - fragment_size);
+			/*
+			 * A full sized fragment goes straight from the caller's
+			 * iovec into the totemsrp frame without staging it in
+			 * fragmentation_data first
+			 */
 			if( copy_len == max_packet_size )
 				data_ptr = (unsigned char *)iovec[i].iov_base + copy_base;
 			else {
@@ -887,8 +1698,6 @@ static int mcast_msg (
 				(unsigned char *)iovec[i].iov_base + copy_base, copy_len);
 			}
 
-			memcpy (&fragmentation_data[fragment_size],
-				(unsigned char *)iovec[i].iov_base + copy_base, copy_len);
 			mcast_packed_msg_lens[mcast_packed_msg_count] += copy_len;
 
 			/*
@@ -960,13 +1769,209 @@ static int mcast_msg (
 			mcast_packed_msg_count++;
 	}
 
+#ifdef HAVE_LZ4
+	if (plain_size) {
+		compress_reserved += compress_frames (plain_size);
+		if (mcast_packed_flush () == -1) {
+			compress_tail_staged = 1;
+		}
+	}
+#endif
+
 error_exit:
+	return (res);
+}
+
+/*
+ * Multicast a message
+ */
+static int mcast_msg (
+	struct iovec *iovec_in,
+	unsigned int iov_len,
+	int guarantee)
+{
+	int res;
+
+	if (totempg_threaded_mode == 1) {
+		pthread_mutex_lock (&mcast_msg_mutex);
+	}
+	totemmrp_event_signal (TOTEM_EVENT_NEW_MSG, 1);
+
+	res = mcast_msg_pack (iovec_in, iov_len, guarantee, 0);
+
 	if (totempg_threaded_mode == 1) {
 		pthread_mutex_unlock (&mcast_msg_mutex);
 	}
 	return (res);
 }
 
+#ifdef HAVE_LZ4
+/*
+ * Check if data starts a message to the compression group carrying
+ * compressed data
+ */
+static int compress_data_starts (
+	const unsigned char *data,
+	unsigned int len)
+{
+	struct totempg_compress_header header;
+	size_t offset;
+
+	offset = sizeof (totempg_compress_group_len) + TOTEMPG_COMPRESS_GROUP_LEN;
+	if (len < offset + sizeof (struct totempg_compress_header) ||
+		memcmp (data, totempg_compress_group_len,
+			sizeof (totempg_compress_group_len)) != 0 ||
+		memcmp (data + sizeof (totempg_compress_group_len),
+			totempg_compress_group, TOTEMPG_COMPRESS_GROUP_LEN) != 0) {
+
+		return (0);
+	}
+
+	memcpy (&header, data + offset, sizeof (struct totempg_compress_header));
+	return (header.type == TOTEMPG_COMPRESS_DATA);
+}
+
+/*
+ * Queue the compressed message collected in compress_in_buf again,
+ * decompressed if possible
+ */
+static void compress_requeue_msg (int guarantee)
+{
+	struct totempg_compress_header header;
+	struct iovec iovec;
+	size_t offset;
+	int res = -1;
+
+	offset = sizeof (totempg_compress_group_len) + TOTEMPG_COMPRESS_GROUP_LEN;
+	memcpy (&header, &compress_in_buf[offset],
+		sizeof (struct totempg_compress_header));
+	offset += sizeof (struct totempg_compress_header);
+
+	if (compress_buf_reserve (&compress_out_buf, &compress_out_size,
+		header.msg_len) == 0) {
+
+		res = LZ4_decompress_safe (
+			(const char *)&compress_in_buf[offset],
+			(char *)compress_out_buf,
+			compress_requeue_size - offset,
+			header.msg_len);
+	}
+
+	if (res == (int)header.msg_len) {
+		iovec.iov_base = (void *)compress_out_buf;
+		iovec.iov_len = header.msg_len;
+		compress_requeue_msgs++;
+	} else {
+		log_printf (totempg_log_level_error,
+			"Unable to decompress a queued message, it is sent compressed");
+		iovec.iov_base = (void *)compress_in_buf;
+		iovec.iov_len = compress_requeue_size;
+	}
+
+	if (mcast_msg_pack (&iovec, 1, guarantee, 1) == -1 ||
+		mcast_packed_flush () == -1) {
+
+		log_printf (totempg_log_level_error,
+			"Unable to queue a formerly compressed message again");
+	}
+}
+
+/*
+ * Called for every frame of the new message queue in order.  Frames of
+ * compressed messages are collected and the message is queued again
+ * decompressed, all others are queued again as they are.
+ */
+static void compress_requeue_fn (
+	const void *msg,
+	unsigned int msg_len,
+	int guarantee)
+{
+	const struct totempg_mcast *mcast = (const struct totempg_mcast *)msg;
+	const unsigned short *msg_lens;
+	const unsigned char *data;
+	struct iovec iovec;
+
+	msg_lens = (const unsigned short *)((const char *)msg +
+		sizeof (struct totempg_mcast));
+	data = (const unsigned char *)&msg_lens[mcast->msg_count];
+
+	if (compress_requeue_size == 0 &&
+		(mcast->continuation != 0 || mcast->msg_count != 1 ||
+		compress_data_starts (data, msg_lens[0]) == 0)) {
+
+		iovec.iov_base = (void *)msg;
+		iovec.iov_len = msg_len;
+		if (totemmrp_mcast (&iovec, 1, guarantee) == -1) {
+			log_printf (totempg_log_level_error,
+				"Unable to queue a message again");
+		}
+		return;
+	}
+
+	if (compress_buf_reserve (&compress_in_buf, &compress_in_size,
+		compress_requeue_size + msg_lens[0]) == -1) {
+
+		log_printf (totempg_log_level_error,
+			"Unable to collect a queued compressed message");
+		compress_requeue_size = 0;
+		return;
+	}
+	memcpy (&compress_in_buf[compress_requeue_size], data, msg_lens[0]);
+	compress_requeue_size += msg_lens[0];
+
+	if (mcast->fragmented == 0) {
+		compress_requeue_msg (guarantee);
+		compress_requeue_size = 0;
+	}
+}
+
+/*
+ * Before anything is sent in a new ring, replace the compressed messages
+ * still queued by their uncompressed form.  Members of the new ring may
+ * not be able to read them.
+ */
+static void compress_requeue (void)
+{
+	if (totempg_threaded_mode == 1) {
+		pthread_mutex_lock (&mcast_msg_mutex);
+	}
+
+	if (compress_reserved == 0) {
+		goto out;
+	}
+
+	/*
+	 * Staged messages follow the queued ones
+	 */
+	if (mcast_packed_flush () == -1) {
+		log_printf (totempg_log_level_error,
+			"Unable to flush staged messages, compressed messages stay queued");
+		goto out;
+	}
+
+	compress_requeue_msgs = 0;
+	compress_requeue_size = 0;
+	totemmrp_new_message_queue_requeue (compress_requeue_fn);
+
+	if (compress_requeue_size) {
+		log_printf (totempg_log_level_error,
+			"Discarding the incomplete compressed message at the end of the queue");
+		compress_requeue_size = 0;
+	}
+	if (compress_requeue_msgs) {
+		log_printf (totempg_log_level_debug,
+			"Queued %u compressed messages again uncompressed",
+			compress_requeue_msgs);
+	}
+	compress_reserved = 0;
+
+out:
+	if (totempg_threaded_mode == 1) {
+		pthread_mutex_unlock (&mcast_msg_mutex);
+	}
+}
+#endif /* HAVE_LZ4 */
+
 /*
  * Determine if a message of msg_size could be queued
  */
@@ -978,7 +1983,7 @@ static int msg_count_send_ok (
 	avail = totemmrp_avail ();
 	totempg_stats.msg_queue_avail = avail;
 
-	return ((avail - totempg_reserved) > msg_count);
+	return ((avail - totempg_reserved - compress_reserved) > msg_count);
 }
 
 static int byte_count_send_ok (
@@ -987,11 +1992,11 @@ static int byte_count_send_ok (
 	unsigned int msg_count = 0;
 	int avail = 0;
 
-	avail = totemmrp_avail ();
+	avail = totemmrp_avail () - compress_reserved;
 
 	msg_count = (byte_count / (totempg_totem_config->net_mtu - sizeof (struct totempg_mcast) - 16)) + 1;
 
-	return (avail >= msg_count);
+	return (avail >= (int)msg_count);
 }
 
 static int send_reserve (
@@ -1080,6 +2085,10 @@ int totempg_groups_initialize (
 	instance->groups = 0;
 	instance->groups_cnt = 0;
 	instance->q_level = QB_LOOP_MED;
+	instance->deliver_seq = 0;
+	instance->deliver_batch_end_fn = NULL;
+	instance->batch_pending = 0;
+	list_init (&instance->batch_list);
 	list_init (&instance->list);
 	list_add (&instance->list, &totempg_groups_list);
 
@@ -1096,6 +2105,24 @@ error_exit:
 	return (-1);
 }
 
+int totempg_groups_deliver_batch_end_register (
+	void *totempg_groups_instance,
+	void (*deliver_batch_end_fn) (void))
+{
+	struct totempg_group_instance *instance = (struct totempg_group_instance *)totempg_groups_instance;
+
+	if (totempg_threaded_mode == 1) {
+		pthread_mutex_lock (&totempg_mutex);
+	}
+
+	instance->deliver_batch_end_fn = deliver_batch_end_fn;
+
+	if (totempg_threaded_mode == 1) {
+		pthread_mutex_unlock (&totempg_mutex);
+	}
+	return (0);
+}
+
 int totempg_groups_join (
 	void *totempg_groups_instance,
 	const struct totempg_group *groups,
@@ -1104,6 +2131,7 @@ int totempg_groups_join (
 	struct totempg_group_instance *instance = (struct totempg_group_instance *)totempg_groups_instance;
 	struct totempg_group *new_groups;
 	unsigned int res = 0;
+	int i;
 
 	if (totempg_threaded_mode == 1) {
 		pthread_mutex_lock (&totempg_mutex);
@@ -1116,9 +2144,22 @@ int totempg_groups_join (
 		res = ENOMEM;
 		goto error_exit;
 	}
+	instance->groups = new_groups;
+
+	/*
+	 * Unsubscribing drops only the references taken by this call
+	 */
+	for (i = 0; i < group_cnt; i++) {
+		if (group_subscribe (instance, &groups[i]) != 0) {
+			while (--i >= 0) {
+				group_unsubscribe (instance, &groups[i]);
+			}
+			res = ENOMEM;
+			goto error_exit;
+		}
+	}
 	memcpy (&new_groups[instance->groups_cnt],
 		groups, group_cnt * sizeof (struct totempg_group));
-	instance->groups = new_groups;
 	instance->groups_cnt += group_cnt;
 
 error_exit:
@@ -1133,10 +2174,28 @@ int totempg_groups_leave (
 	const struct totempg_group *groups,
 	size_t group_cnt)
 {
+	struct totempg_group_instance *instance = (struct totempg_group_instance *)totempg_groups_instance;
+	int i, j;
+
 	if (totempg_threaded_mode == 1) {
 		pthread_mutex_lock (&totempg_mutex);
 	}
 
+	for (i = 0; i < group_cnt; i++) {
+		for (j = 0; j < instance->groups_cnt; j++) {
+			if (instance->groups[j].group_len == groups[i].group_len &&
+				memcmp (instance->groups[j].group, groups[i].group,
+				groups[i].group_len) == 0) {
+
+				memmove (&instance->groups[j], &instance->groups[j + 1],
+					(instance->groups_cnt - j - 1) * sizeof (struct totempg_group));
+				instance->groups_cnt -= 1;
+				group_unsubscribe (instance, &groups[i]);
+				break;
+			}
+		}
+	}
+
 	if (totempg_threaded_mode == 1) {
 		pthread_mutex_unlock (&totempg_mutex);
 	}
@@ -1187,6 +2246,94 @@ int totempg_groups_mcast_joined (
 	return (res);
 }
 
+/*
+ * Multicasts msg_count messages in one go.  The iovecs of all messages
+ * follow each other in iovec, msg_iov_len[i] of them belong to message i.
+ * Either the whole batch is queued or nothing is.  Returns -1 if the new
+ * message queue can't take all of it now and -2 if it never can.
+ */
+int totempg_groups_mcast_joined_batch (
+	void *totempg_groups_instance,
+	const struct iovec *iovec,
+	const unsigned int *msg_iov_len,
+	unsigned int msg_count,
+	int guarantee)
+{
+	struct totempg_group_instance *instance = (struct totempg_group_instance *)totempg_groups_instance;
+	unsigned short group_len[MAX_GROUPS_PER_MSG + 1];
+	struct iovec iovec_mcast[MAX_GROUPS_PER_MSG + 1 + MAX_IOVECS_FROM_APP];
+	unsigned int groups_size;
+	unsigned int total_size;
+	unsigned int msg;
+	unsigned int iov_base;
+	int i;
+	int res = 0;
+
+	if (totempg_threaded_mode == 1) {
+		pthread_mutex_lock (&totempg_mutex);
+		pthread_mutex_lock (&mcast_msg_mutex);
+	}
+
+	/*
+	 * The group header is the same for every message of the batch
+	 */
+	group_len[0] = instance->groups_cnt;
+	groups_size = (instance->groups_cnt + 1) * sizeof (unsigned short);
+	for (i = 0; i < instance->groups_cnt; i++) {
+		group_len[i + 1] = instance->groups[i].group_len;
+		iovec_mcast[i + 1].iov_len = instance->groups[i].group_len;
+		iovec_mcast[i + 1].iov_base = (void *) instance->groups[i].group;
+		groups_size += instance->groups[i].group_len;
+	}
+	iovec_mcast[0].iov_len = (instance->groups_cnt + 1) * sizeof (unsigned short);
+	iovec_mcast[0].iov_base = group_len;
+
+	total_size = 0;
+	for (msg = 0, iov_base = 0; msg < msg_count; msg++) {
+		assert (msg_iov_len[msg] <= MAX_IOVECS_FROM_APP);
+		total_size += groups_size + sizeof (unsigned short);
+		for (i = 0; i < msg_iov_len[msg]; i++) {
+			total_size += iovec[iov_base + i].iov_len;
+		}
+		iov_base += msg_iov_len[msg];
+	}
+
+	if (total_size >= totempg_size_limit) {
+		res = -2;
+		goto error_exit;
+	}
+
+	if (byte_count_send_ok (total_size + sizeof(unsigned short) *
+		(mcast_packed_msg_count)) == 0) {
+
+		res = -1;
+		goto error_exit;
+	}
+
+	totemmrp_event_signal (TOTEM_EVENT_NEW_MSG, 1);
+
+	for (msg = 0, iov_base = 0; msg < msg_count; msg++) {
+		for (i = 0; i < msg_iov_len[msg]; i++) {
+			iovec_mcast[i + instance->groups_cnt + 1] =
+				iovec[iov_base + i];
+		}
+		iov_base += msg_iov_len[msg];
+
+		res = mcast_msg_pack (iovec_mcast,
+			msg_iov_len[msg] + instance->groups_cnt + 1, guarantee, 1);
+		if (res == -1) {
+			break;
+		}
+	}
+
+error_exit:
+	if (totempg_threaded_mode == 1) {
+		pthread_mutex_unlock (&mcast_msg_mutex);
+		pthread_mutex_unlock (&totempg_mutex);
+	}
+	return (res);
+}
+
 static void check_q_level(
 	void *totempg_groups_instance)
 {
@@ -249,6 +249,8 @@ struct totemrrp_instance {
 	void *deliver_fn_context[INTERFACE_MAX];
 
 	qb_loop_timer_handle timer_active_test_ring_timeout[INTERFACE_MAX];
+
+	totemrrp_stats_t stats;
 };
 
 /*
@@ -1766,6 +1768,7 @@ void rrp_iface_change_fn (
 	struct deliver_fn_context *deliver_fn_context = (struct deliver_fn_context *)context;
 
 	deliver_fn_context->instance->my_nodeid = iface_addr->nodeid;
+	deliver_fn_context->instance->stats.net[deliver_fn_context->iface_no].iface_changes++;
 	deliver_fn_context->instance->totemrrp_iface_change_fn (
 		deliver_fn_context->context,
 		iface_addr,
@@ -1804,6 +1807,7 @@ int totemrrp_initialize (
 	qb_loop_t *poll_handle,
 	void **rrp_context,
 	struct totem_config *totem_config,
+	totemsrp_stats_t *stats,
 	void *context,
 
 	void (*deliver_fn) (
@@ -1874,6 +1878,13 @@ int totemrrp_initialize (
 
 	instance->net_handles = malloc (sizeof (void *) * totem_config->interface_count);
 
+	instance->stats.net = calloc (totem_config->interface_count,
+		sizeof (totemnet_stats_t));
+	assert (instance->stats.net);
+	instance->stats.interface_count = totem_config->interface_count;
+	instance->stats.algo_name = (char *)instance->rrp_algo->name;
+	stats->rrp = &instance->stats;
+
 	instance->context = context;
 
 	instance->poll_handle = poll_handle;
@@ -1888,15 +1899,19 @@ int totemrrp_initialize (
 		deliver_fn_context->iface_no = i;
 		instance->deliver_fn_context[i] = (void *)deliver_fn_context;
 
-		totemnet_initialize (
+		res = totemnet_initialize (
 			poll_handle,
 			&instance->net_handles[i],
 			totem_config,
+			&instance->stats.net[i],
 			i,
 			(void *)deliver_fn_context,
 			rrp_deliver_fn,
 			rrp_iface_change_fn,
 			rrp_target_set_completed);
+		if (res == -1) {
+			goto error_destroy;
+		}
 
 		totemnet_net_mtu_adjust (instance->net_handles[i], totem_config);
 	}
@@ -1909,11 +1924,11 @@ error_destroy:
 	return (res);
 }
 
-void *totemrrp_buffer_alloc (void *rrp_context)
+void *totemrrp_buffer_alloc (void *rrp_context, size_t size)
 {
 	struct totemrrp_instance *instance = rrp_context;
 	assert (instance != NULL);
-	return totemnet_buffer_alloc (instance->net_handles[0]);
+	return totemnet_buffer_alloc (instance->net_handles[0], size);
 }
 
 void totemrrp_buffer_release (void *rrp_context, void *ptr)
@@ -58,6 +58,7 @@ extern int totemrrp_initialize (
 	qb_loop_t *poll_handle,
 	void **rrp_context,
 	struct totem_config *totem_config,
+	totemsrp_stats_t *stats,
 	void *context,
 
 	void (*deliver_fn) (
@@ -82,7 +83,8 @@ extern int totemrrp_initialize (
 	);
 
 extern void *totemrrp_buffer_alloc (
-	void *rrp_context);
+	void *rrp_context,
+	size_t size);
 
 extern void totemrrp_buffer_release (
 	void *rrp_context,
@@ -97,6 +99,10 @@ extern int totemrrp_token_send (
 	const void *msg,
 	unsigned int msg_len);
 
+/*
+ * msg must be a frame from totemrrp_buffer_alloc, the transport may keep
+ * a reference on it until the next send_flush
+ */
 extern int totemrrp_mcast_noflush_send (
 	void *rrp_context,
 	const void *msg,
@@ -81,6 +81,7 @@
 #include <corosync/swab.h>
 #include <corosync/sq.h>
 #include <corosync/list.h>
+#include <corosync/jhash.h>
 
 #define LOGSYS_UTILS_ONLY 1
 #include <corosync/engine/logsys.h>
@@ -91,6 +92,7 @@
 
 #include "crypto.h"
 #include "cs_queue.h"
+#include "totemhist.h"
 
 #define LOCALHOST_IP				inet_addr("127.0.0.1")
 #define QUEUE_RTR_ITEMS_SIZE_MAX		16384 /* allow 16384 retransmit items */
@@ -98,6 +100,17 @@
 #define RECEIVED_MESSAGE_QUEUE_SIZE_MAX		500 /* allow 500 messages to be queued */
 #define MAXIOVS					5
 #define RETRANSMIT_ENTRIES_MAX			30
+#define RETRANSMIT_RANGES_MAX			30
+#define DELIVER_BATCH_MAX			64 /* messages handed up per call */
+#define ARU_RANGE_MAX				1024 /* aru only moves while fewer are outstanding */
+#define MEMB_INDEX_MAX				(PROCESSOR_COUNT_MAX * 4)
+#define MEMB_INDEX_HASH_SIZE			4096 /* power of two above MEMB_INDEX_MAX * 2 */
+#define MEMB_BITS_PER_WORD			(sizeof (unsigned long) * CHAR_BIT)
+#define MEMB_BITMAP_WORDS			((MEMB_INDEX_MAX + MEMB_BITS_PER_WORD - 1) / MEMB_BITS_PER_WORD)
+/*
+ * Set operations this small compare every pair, larger ones use bitmaps
+ */
+#define MEMB_SET_SMALL(a, b)			((a) * (b) <= 64)
 #define TOKEN_SIZE_MAX				64000 /* bytes */
 #define LEAVE_DUMMY_NODEID                      0
 
@@ -128,6 +141,14 @@
  * #define TEST_RECOVERY_MSG_COUNT 300
  */
 
+/*
+ * These can be used to measure the time to recover from a burst loss:
+ * TEST_DROP_MCAST_BURST consecutive multicasts are dropped once every
+ * TEST_DROP_MCAST_BURST_INTERVAL multicasts received
+ * #define TEST_DROP_MCAST_BURST 500
+ * #define TEST_DROP_MCAST_BURST_INTERVAL 100000
+ */
+
 /*
  * we compare incoming messages to determine if their endian is
  * different - if so convert them
@@ -163,6 +184,19 @@ struct consensus_list_item {
 	int set;
 };
 
+/*
+ * Interned addresses, hash holds the index + 1 of each address
+ */
+struct memb_index {
+	unsigned short hash[MEMB_INDEX_HASH_SIZE];
+	struct totem_ip_address addr[MEMB_INDEX_MAX];
+	unsigned int entries;
+};
+
+struct memb_bitmap {
+	unsigned long words[MEMB_BITMAP_WORDS];
+};
+
 
 struct token_callback_instance {
 	struct list_head list;
@@ -202,6 +236,30 @@ struct rtr_item  {
 	unsigned int seq;
 }__attribute__((packed));
 
+struct rtr_range {
+	unsigned int seq;
+	unsigned int count;
+}__attribute__((packed));
+
+struct rtr_range_list {
+	struct memb_ring_id ring_id;
+	struct rtr_range ranges[0];
+}__attribute__((packed));
+
+/*
+ * The encapsulated byte of the orf token header has never been used, so
+ * it carries the format of the retransmit list that follows the token.
+ * TOKEN_FORMAT_RTR_ITEMS is a list of struct rtr_item, one per missing
+ * message.  TOKEN_FORMAT_RTR_RANGES is one struct rtr_range_list holding
+ * runs of missing messages of the ring named once.  Every processor
+ * advertises the highest format it understands in the encapsulated byte
+ * of its join messages and the representative starts the ring with the
+ * highest format all new members advertised.
+ */
+#define TOKEN_FORMAT_RTR_ITEMS			0
+#define TOKEN_FORMAT_RTR_RANGES			1
+#define TOKEN_FORMAT_MAX			TOKEN_FORMAT_RTR_RANGES
+
 
 struct orf_token {
 	struct message_header header;
@@ -217,6 +275,11 @@ struct orf_token {
 	struct rtr_item rtr_list[0];
 }__attribute__((packed));
 
+struct token_format_entry {
+	unsigned int nodeid;
+	unsigned char format;
+};
+
 
 struct memb_join {
 	struct message_header header;
@@ -273,11 +336,18 @@ struct memb_commit_token {
 struct message_item {
 	struct mcast *mcast;
 	unsigned int msg_len;
+	uint64_t enqueue_time;
 };
 
+/*
+ * enqueue_time is only set for messages from this processor, recv_time
+ * is zero for messages carried over from the old ring
+ */
 struct sort_queue_item {
 	struct mcast *mcast;
 	unsigned int msg_len;
+	uint64_t enqueue_time;
+	uint64_t recv_time;
 };
 
 struct orf_token_mcast_thread_state {
@@ -310,6 +380,10 @@ struct totemsrp_instance {
 
 	int consensus_list_entries;
 
+	struct memb_bitmap consensus_bitmap;
+
+	struct memb_index memb_index;
+
 	struct srp_addr my_id;
 
 	struct srp_addr my_proc_list[PROCESSOR_COUNT_MAX];
@@ -394,6 +468,13 @@ struct totemsrp_instance {
 
 	int orf_token_retransmit_size;
 
+	/*
+	 * Token format advertised by each processor we received a join from
+	 */
+	struct token_format_entry token_formats[PROCESSOR_COUNT_MAX];
+
+	int token_formats_entries;
+
 	unsigned int my_token_seq;
 
 	/*
@@ -461,6 +542,14 @@ struct totemsrp_instance {
 		const unsigned int *joined_list, size_t joined_list_entries,
 		const struct memb_ring_id *ring_id);
 
+	void (*totemsrp_deliver_batch_fn) (
+		const struct totem_deliver_item *items,
+		unsigned int item_count);
+
+	struct totem_deliver_item deliver_batch[DELIVER_BATCH_MAX];
+
+	unsigned int deliver_batch_entries;
+
         void (*totemsrp_service_ready_fn) (void);
 
 	int global_seqno;
@@ -495,6 +584,18 @@ struct totemsrp_instance {
 
 	unsigned int my_cbl;
 
+	/*
+	 * Adaptive flow control state
+	 */
+	uint64_t fcc_token_timestamp;
+
+	uint64_t fcc_mcast_retx;
+
+	/*
+	 * Last operational token receipt, for the token histograms
+	 */
+	uint64_t hist_token_rx;
+
 	uint64_t pause_timestamp;
 
 	struct memb_commit_token *commit_token;
@@ -610,7 +711,7 @@ static void timer_function_heartbeat_timeout (void *data);
 static void timer_function_token_retransmit_timeout (void *data);
 static void timer_function_token_hold_retransmit_timeout (void *data);
 static void timer_function_merge_detect_timeout (void *data);
-static void *totemsrp_buffer_alloc (struct totemsrp_instance *instance);
+static void *totemsrp_buffer_alloc (struct totemsrp_instance *instance, size_t size);
 static void totemsrp_buffer_release (struct totemsrp_instance *instance, void *ptr);
 
 void main_deliver_fn (
@@ -724,6 +825,51 @@ static int pause_flush (struct totemsrp_instance *instance)
 	return (res);
 }
 
+static void token_stats_forget (
+	totemsrp_stats_t *stats,
+	totemsrp_token_stats_t *token)
+{
+	if (token->counted) {
+		stats->token_mtt_rx_total -= token->mtt_rx;
+		stats->token_holdtime_total -= token->tx - token->rx;
+		stats->token_backlog_total -= token->backlog_calc;
+		stats->token_count--;
+	}
+	token->rx = 0;
+	token->tx = 0;
+	token->backlog_calc = 0;
+	token->mtt_rx = 0;
+	token->counted = 0;
+}
+
+/*
+ * Add the token just forwarded to the running totals.  As before, a token
+ * whose predecessor is the oldest (cleared) slot has no rotation time
+ * and is left out.
+ */
+static void token_stats_count (totemsrp_stats_t *stats)
+{
+	totemsrp_token_stats_t *token = &stats->token[stats->latest_token];
+	int prev;
+
+	if (stats->latest_token == 0) {
+		prev = TOTEM_TOKEN_STATS_MAX - 1;
+	} else {
+		prev = stats->latest_token - 1;
+	}
+	if (token->counted || prev == stats->earliest_token ||
+		stats->latest_token == stats->earliest_token) {
+		return;
+	}
+
+	token->mtt_rx = token->rx - stats->token[prev].rx;
+	token->counted = 1;
+	stats->token_mtt_rx_total += token->mtt_rx;
+	stats->token_holdtime_total += token->tx - token->rx;
+	stats->token_backlog_total += token->backlog_calc;
+	stats->token_count++;
+}
+
 static int token_event_stats_collector (enum totem_callback_token_type type, const void *void_instance)
 {
 	struct totemsrp_instance *instance = (struct totemsrp_instance *)void_instance;
@@ -732,6 +878,21 @@ static int token_event_stats_collector (enum totem_callback_token_type type, con
 
 	time_now = (nano_secs / QB_TIME_NS_IN_MSEC);
 
+	if (instance->memb_state != MEMB_STATE_OPERATIONAL) {
+		instance->hist_token_rx = 0;
+	} else
+	if (type == TOTEM_CALLBACK_TOKEN_RECEIVED) {
+		if (instance->hist_token_rx) {
+			totem_histogram_add (&instance->stats.token_rotation_hist,
+				(nano_secs - instance->hist_token_rx) / QB_TIME_NS_IN_USEC);
+		}
+		instance->hist_token_rx = nano_secs;
+	} else
+	if (instance->hist_token_rx) {
+		totem_histogram_add (&instance->stats.token_hold_hist,
+			(nano_secs - instance->hist_token_rx) / QB_TIME_NS_IN_USEC);
+	}
+
 	if (type == TOTEM_CALLBACK_TOKEN_RECEIVED) {
 		/* incr latest token the index */
 		if (instance->stats.latest_token == (TOTEM_TOKEN_STATS_MAX - 1))
@@ -746,15 +907,17 @@ static int token_event_stats_collector (enum totem_callback_token_type type, con
 			else
 				instance->stats.earliest_token++;
 
-			instance->stats.token[instance->stats.earliest_token].rx = 0;
-			instance->stats.token[instance->stats.earliest_token].tx = 0;
-			instance->stats.token[instance->stats.earliest_token].backlog_calc = 0;
+			token_stats_forget (&instance->stats,
+				&instance->stats.token[instance->stats.earliest_token]);
 		}
 
+		token_stats_forget (&instance->stats,
+			&instance->stats.token[instance->stats.latest_token]);
 		instance->stats.token[instance->stats.latest_token].rx = time_now;
 		instance->stats.token[instance->stats.latest_token].tx = 0; /* in case we drop the token */
 	} else {
 		instance->stats.token[instance->stats.latest_token].tx = time_now;
+		token_stats_count (&instance->stats);
 	}
 	return 0;
 }
@@ -812,6 +975,9 @@ int totemsrp_initialize (
 
 	instance->totem_config = totem_config;
 
+	instance->stats.fcc_window = totem_config->window_size;
+	instance->stats.fcc_max_messages = totem_config->max_messages;
+
 	/*
 	 * Configure logging
 	 */
@@ -853,13 +1019,18 @@ int totemsrp_initialize (
 	log_printf (instance->totemsrp_log_level_debug,
 		"window size per rotation (%d messages) maximum messages per rotation (%d messages)\n",
 		totem_config->window_size, totem_config->max_messages);
+	if (totem_config->adaptive_window) {
+		log_printf (instance->totemsrp_log_level_debug,
+			"adaptive window between (%d messages) and (%d messages)\n",
+			totem_config->window_size_min, totem_config->window_size_max);
+	}
 
 	log_printf (instance->totemsrp_log_level_debug,
 		"missed count const (%d messages)\n",
 		totem_config->miss_count_const);
 
 	log_printf (instance->totemsrp_log_level_debug,
-		"send threads (%d threads)\n", totem_config->threads);
+		"crypto threads (%d threads)\n", totem_config->threads);
 	log_printf (instance->totemsrp_log_level_debug,
 		"RRP token expired timeout (%d ms)\n",
 		totem_config->rrp_token_expired_timeout);
@@ -930,16 +1101,20 @@ int totemsrp_initialize (
 		}
 	}
 
-	totemrrp_initialize (
+	if (totemrrp_initialize (
 		poll_handle,
 		&instance->totemrrp_context,
 		totem_config,
+		&instance->stats,
 		instance,
 		main_deliver_fn,
 		main_iface_change_fn,
 		main_token_seqid_get,
 		main_msgs_missing,
-		target_set_completed);
+		target_set_completed) == -1) {
+
+		goto error_destroy;
+	}
 
 	/*
 	 * Must have net_mtu adjusted by totemrrp_initialize first
@@ -1120,34 +1295,147 @@ static void srp_addr_copy_endian_convert (struct srp_addr *out, const struct srp
 	}
 }
 
+/*
+ * Addresses are interned to small node indexes so the set operations below
+ * can work on bitmaps instead of comparing every pair of entries.  Only
+ * addr[0] takes part, the same as in srp_addr_equal.
+ */
+static unsigned int memb_index_hash (const struct totem_ip_address *addr)
+{
+	unsigned int addrlen;
+
+	addrlen = addr->family == AF_INET6 ?
+		sizeof (struct in6_addr) : sizeof (struct in_addr);
+
+	return (jhash (addr->addr, addrlen, addr->family) &
+		(MEMB_INDEX_HASH_SIZE - 1));
+}
+
+/*
+ * Returns the index of addr, or -1 when it was never interned and insert
+ * is not set
+ */
+static int memb_index_find (
+	struct totemsrp_instance *instance,
+	const struct srp_addr *addr,
+	int insert)
+{
+	struct memb_index *memb_index = &instance->memb_index;
+	unsigned int slot;
+	unsigned int idx;
+
+	slot = memb_index_hash (&addr->addr[0]);
+	while (memb_index->hash[slot] != 0) {
+		idx = memb_index->hash[slot] - 1;
+		if (totemip_equal (&memb_index->addr[idx], &addr->addr[0])) {
+			return (idx);
+		}
+		slot = (slot + 1) & (MEMB_INDEX_HASH_SIZE - 1);
+	}
+	if (insert == 0) {
+		return (-1);
+	}
+
+	assert (memb_index->entries < MEMB_INDEX_MAX);
+	idx = memb_index->entries++;
+	totemip_copy (&memb_index->addr[idx], &addr->addr[0]);
+	memb_index->hash[slot] = idx + 1;
+	return (idx);
+}
+
+static inline int memb_bitmap_test (const struct memb_bitmap *bitmap, int idx)
+{
+	return ((bitmap->words[idx / MEMB_BITS_PER_WORD] >>
+		(idx % MEMB_BITS_PER_WORD)) & 1);
+}
+
+static inline void memb_bitmap_set (struct memb_bitmap *bitmap, int idx)
+{
+	bitmap->words[idx / MEMB_BITS_PER_WORD] |=
+		1UL << (idx % MEMB_BITS_PER_WORD);
+}
+
+static void memb_bitmap_build (
+	struct totemsrp_instance *instance,
+	struct memb_bitmap *bitmap,
+	const struct srp_addr *list,
+	int list_entries)
+{
+	int i;
+
+	memset (bitmap, 0, sizeof (struct memb_bitmap));
+	for (i = 0; i < list_entries; i++) {
+		memb_bitmap_set (bitmap, memb_index_find (instance, &list[i], 1));
+	}
+}
+
+/*
+ * Makes room for entries more addresses.  When the table is full it is
+ * started over, only the consensus bitmap lives across operations.
+ */
+static void memb_index_reserve (
+	struct totemsrp_instance *instance,
+	unsigned int entries)
+{
+	int i;
+
+	if (instance->memb_index.entries + entries <= MEMB_INDEX_MAX) {
+		return;
+	}
+
+	memset (instance->memb_index.hash, 0, sizeof (instance->memb_index.hash));
+	instance->memb_index.entries = 0;
+	memset (&instance->consensus_bitmap, 0, sizeof (struct memb_bitmap));
+	for (i = 0; i < instance->consensus_list_entries; i++) {
+		memb_bitmap_set (&instance->consensus_bitmap,
+			memb_index_find (instance, &instance->consensus_list[i].addr, 1));
+	}
+}
+
 static void memb_consensus_reset (struct totemsrp_instance *instance)
 {
 	instance->consensus_list_entries = 0;
+	memset (&instance->consensus_bitmap, 0, sizeof (struct memb_bitmap));
 }
 
 static void memb_set_subtract (
+	struct totemsrp_instance *instance,
         struct srp_addr *out_list, int *out_list_entries,
         struct srp_addr *one_list, int one_list_entries,
         struct srp_addr *two_list, int two_list_entries)
 {
+	struct memb_bitmap two_bitmap;
 	int found = 0;
 	int i;
 	int j;
 
 	*out_list_entries = 0;
 
-	for (i = 0; i < one_list_entries; i++) {
-		for (j = 0; j < two_list_entries; j++) {
-			if (srp_addr_equal (&one_list[i], &two_list[j])) {
-				found = 1;
-				break;
+	if (MEMB_SET_SMALL (one_list_entries, two_list_entries)) {
+		for (i = 0; i < one_list_entries; i++) {
+			for (j = 0; j < two_list_entries; j++) {
+				if (srp_addr_equal (&one_list[i], &two_list[j])) {
+					found = 1;
+					break;
+				}
 			}
+			if (found == 0) {
+				srp_addr_copy (&out_list[*out_list_entries], &one_list[i]);
+				*out_list_entries = *out_list_entries + 1;
+			}
+			found = 0;
 		}
-		if (found == 0) {
+		return;
+	}
+
+	memb_index_reserve (instance, one_list_entries + two_list_entries);
+	memb_bitmap_build (instance, &two_bitmap, two_list, two_list_entries);
+	for (i = 0; i < one_list_entries; i++) {
+		j = memb_index_find (instance, &one_list[i], 0);
+		if (j == -1 || memb_bitmap_test (&two_bitmap, j) == 0) {
 			srp_addr_copy (&out_list[*out_list_entries], &one_list[i]);
 			*out_list_entries = *out_list_entries + 1;
 		}
-		found = 0;
 	}
 }
 
@@ -1158,24 +1446,20 @@ static void memb_consensus_set (
 	struct totemsrp_instance *instance,
 	const struct srp_addr *addr)
 {
-	int found = 0;
-	int i;
+	int idx;
 
 	if (addr->addr[0].nodeid == LEAVE_DUMMY_NODEID)
 	        return;
 
-	for (i = 0; i < instance->consensus_list_entries; i++) {
-		if (srp_addr_equal(addr, &instance->consensus_list[i].addr)) {
-			found = 1;
-			break; /* found entry */
-		}
-	}
-	srp_addr_copy (&instance->consensus_list[i].addr, addr);
-	instance->consensus_list[i].set = 1;
-	if (found == 0) {
-		instance->consensus_list_entries++;
+	memb_index_reserve (instance, 1);
+	idx = memb_index_find (instance, addr, 1);
+	if (memb_bitmap_test (&instance->consensus_bitmap, idx)) {
+		return;
 	}
-	return;
+	memb_bitmap_set (&instance->consensus_bitmap, idx);
+	srp_addr_copy (&instance->consensus_list[instance->consensus_list_entries].addr, addr);
+	instance->consensus_list[instance->consensus_list_entries].set = 1;
+	instance->consensus_list_entries++;
 }
 
 /*
@@ -1185,14 +1469,13 @@ static int memb_consensus_isset (
 	struct totemsrp_instance *instance,
 	const struct srp_addr *addr)
 {
-	int i;
+	int idx;
 
-	for (i = 0; i < instance->consensus_list_entries; i++) {
-		if (srp_addr_equal (addr, &instance->consensus_list[i].addr)) {
-			return (instance->consensus_list[i].set);
-		}
+	idx = memb_index_find (instance, addr, 0);
+	if (idx == -1) {
+		return (0);
 	}
-	return (0);
+	return (memb_bitmap_test (&instance->consensus_bitmap, idx));
 }
 
 /*
@@ -1201,22 +1484,30 @@ static int memb_consensus_isset (
 static int memb_consensus_agreed (
 	struct totemsrp_instance *instance)
 {
-	struct srp_addr token_memb[PROCESSOR_COUNT_MAX];
-	int token_memb_entries = 0;
+	struct memb_bitmap proc_bitmap;
+	struct memb_bitmap failed_bitmap;
+	unsigned long token_memb_words = 0;
 	int agreed = 1;
 	int i;
 
-	memb_set_subtract (token_memb, &token_memb_entries,
-		instance->my_proc_list, instance->my_proc_list_entries,
+	memb_index_reserve (instance,
+		instance->my_proc_list_entries + instance->my_failed_list_entries);
+	memb_bitmap_build (instance, &proc_bitmap,
+		instance->my_proc_list, instance->my_proc_list_entries);
+	memb_bitmap_build (instance, &failed_bitmap,
 		instance->my_failed_list, instance->my_failed_list_entries);
 
-	for (i = 0; i < token_memb_entries; i++) {
-		if (memb_consensus_isset (instance, &token_memb[i]) == 0) {
+	/*
+	 * Every processor not failed has to be in the consensus bitmap
+	 */
+	for (i = 0; i < MEMB_BITMAP_WORDS; i++) {
+		proc_bitmap.words[i] &= ~failed_bitmap.words[i];
+		token_memb_words |= proc_bitmap.words[i];
+		if (proc_bitmap.words[i] & ~instance->consensus_bitmap.words[i]) {
 			agreed = 0;
-			break;
 		}
 	}
-	assert (token_memb_entries >= 1);
+	assert (token_memb_words != 0);
 
 	return (agreed);
 }
@@ -1244,9 +1535,11 @@ static void memb_consensus_notset (
  * Is set1 equal to set2 Entries can be in different orders
  */
 static int memb_set_equal (
+	struct totemsrp_instance *instance,
 	struct srp_addr *set1, int set1_entries,
 	struct srp_addr *set2, int set2_entries)
 {
+	struct memb_bitmap set1_bitmap;
 	int i;
 	int j;
 
@@ -1255,17 +1548,29 @@ static int memb_set_equal (
 	if (set1_entries != set2_entries) {
 		return (0);
 	}
-	for (i = 0; i < set2_entries; i++) {
-		for (j = 0; j < set1_entries; j++) {
-			if (srp_addr_equal (&set1[j], &set2[i])) {
-				found = 1;
-				break;
+	if (MEMB_SET_SMALL (set1_entries, set2_entries)) {
+		for (i = 0; i < set2_entries; i++) {
+			for (j = 0; j < set1_entries; j++) {
+				if (srp_addr_equal (&set1[j], &set2[i])) {
+					found = 1;
+					break;
+				}
+			}
+			if (found == 0) {
+				return (0);
 			}
+			found = 0;
 		}
-		if (found == 0) {
+		return (1);
+	}
+
+	memb_index_reserve (instance, set1_entries);
+	memb_bitmap_build (instance, &set1_bitmap, set1, set1_entries);
+	for (i = 0; i < set2_entries; i++) {
+		j = memb_index_find (instance, &set2[i], 0);
+		if (j == -1 || memb_bitmap_test (&set1_bitmap, j) == 0) {
 			return (0);
 		}
-		found = 0;
 	}
 	return (1);
 }
@@ -1274,9 +1579,11 @@ static int memb_set_equal (
  * Is subset fully contained in fullset
  */
 static int memb_set_subset (
+	struct totemsrp_instance *instance,
 	const struct srp_addr *subset, int subset_entries,
 	const struct srp_addr *fullset, int fullset_entries)
 {
+	struct memb_bitmap fullset_bitmap;
 	int i;
 	int j;
 	int found = 0;
@@ -1284,16 +1591,29 @@ static int memb_set_subset (
 	if (subset_entries > fullset_entries) {
 		return (0);
 	}
-	for (i = 0; i < subset_entries; i++) {
-		for (j = 0; j < fullset_entries; j++) {
-			if (srp_addr_equal (&subset[i], &fullset[j])) {
-				found = 1;
+	if (MEMB_SET_SMALL (subset_entries, fullset_entries)) {
+		for (i = 0; i < subset_entries; i++) {
+			for (j = 0; j < fullset_entries; j++) {
+				if (srp_addr_equal (&subset[i], &fullset[j])) {
+					found = 1;
+					break;
+				}
 			}
+			if (found == 0) {
+				return (0);
+			}
+			found = 0;
 		}
-		if (found == 0) {
+		return (1);
+	}
+
+	memb_index_reserve (instance, fullset_entries);
+	memb_bitmap_build (instance, &fullset_bitmap, fullset, fullset_entries);
+	for (i = 0; i < subset_entries; i++) {
+		j = memb_index_find (instance, &subset[i], 0);
+		if (j == -1 || memb_bitmap_test (&fullset_bitmap, j) == 0) {
 			return (0);
 		}
-		found = 0;
 	}
 	return (1);
 }
@@ -1301,30 +1621,47 @@ static int memb_set_subset (
  * merge subset into fullset taking care not to add duplicates
  */
 static void memb_set_merge (
+	struct totemsrp_instance *instance,
 	const struct srp_addr *subset, int subset_entries,
 	struct srp_addr *fullset, int *fullset_entries)
 {
+	struct memb_bitmap fullset_bitmap;
 	int found = 0;
 	int i;
 	int j;
 
-	for (i = 0; i < subset_entries; i++) {
-		for (j = 0; j < *fullset_entries; j++) {
-			if (srp_addr_equal (&fullset[j], &subset[i])) {
-				found = 1;
-				break;
+	if (MEMB_SET_SMALL (subset_entries, *fullset_entries)) {
+		for (i = 0; i < subset_entries; i++) {
+			for (j = 0; j < *fullset_entries; j++) {
+				if (srp_addr_equal (&fullset[j], &subset[i])) {
+					found = 1;
+					break;
+				}
+			}
+			if (found == 0) {
+				srp_addr_copy (&fullset[*fullset_entries], &subset[i]);
+				*fullset_entries = *fullset_entries + 1;
 			}
+			found = 0;
 		}
-		if (found == 0) {
+		return;
+	}
+
+	memb_index_reserve (instance, subset_entries + *fullset_entries);
+	memb_bitmap_build (instance, &fullset_bitmap, fullset, *fullset_entries);
+	for (i = 0; i < subset_entries; i++) {
+		j = memb_index_find (instance, &subset[i], 1);
+		if (memb_bitmap_test (&fullset_bitmap, j) == 0) {
+			memb_bitmap_set (&fullset_bitmap, j);
 			srp_addr_copy (&fullset[*fullset_entries], &subset[i]);
 			*fullset_entries = *fullset_entries + 1;
 		}
-		found = 0;
 	}
 	return;
 }
 
 static void memb_set_and_with_ring_id (
+	struct totemsrp_instance *instance,
 	struct srp_addr *set1,
 	struct memb_ring_id *set1_ring_ids,
 	int set1_entries,
@@ -1334,26 +1671,37 @@ static void memb_set_and_with_ring_id (
 	struct srp_addr *and,
 	int *and_entries)
 {
+	struct memb_bitmap set1_bitmap;
+	unsigned short set1_pos[MEMB_INDEX_MAX];
 	int i;
 	int j;
-	int found = 0;
+	int idx;
 
 	*and_entries = 0;
 
+	/*
+	 * Remember where each address first shows up in set1
+	 */
+	memb_index_reserve (instance, set1_entries);
+	memset (&set1_bitmap, 0, sizeof (struct memb_bitmap));
+	for (j = 0; j < set1_entries; j++) {
+		idx = memb_index_find (instance, &set1[j], 1);
+		if (memb_bitmap_test (&set1_bitmap, idx) == 0) {
+			memb_bitmap_set (&set1_bitmap, idx);
+			set1_pos[idx] = j;
+		}
+	}
+
 	for (i = 0; i < set2_entries; i++) {
-		for (j = 0; j < set1_entries; j++) {
-			if (srp_addr_equal (&set1[j], &set2[i])) {
-				if (memcmp (&set1_ring_ids[j], old_ring_id, sizeof (struct memb_ring_id)) == 0) {
-					found = 1;
-				}
-				break;
-			}
+		idx = memb_index_find (instance, &set2[i], 0);
+		if (idx == -1 || memb_bitmap_test (&set1_bitmap, idx) == 0) {
+			continue;
 		}
-		if (found) {
+		j = set1_pos[idx];
+		if (memcmp (&set1_ring_ids[j], old_ring_id, sizeof (struct memb_ring_id)) == 0) {
 			srp_addr_copy (&and[*and_entries], &set1[j]);
 			*and_entries = *and_entries + 1;
 		}
-		found = 0;
 	}
 	return;
 }
@@ -1378,10 +1726,10 @@ static void memb_set_print (
 }
 #endif
 
-static void *totemsrp_buffer_alloc (struct totemsrp_instance *instance)
+static void *totemsrp_buffer_alloc (struct totemsrp_instance *instance, size_t size)
 {
 	assert (instance != NULL);
-	return totemrrp_buffer_alloc (instance->totemrrp_context);
+	return totemrrp_buffer_alloc (instance->totemrrp_context, size);
 }
 
 static void totemsrp_buffer_release (struct totemsrp_instance *instance, void *ptr)
@@ -1539,7 +1887,7 @@ static void memb_state_consensus_timeout_expired (
 			instance->my_proc_list,
 			instance->my_proc_list_entries);
 
-		memb_set_merge (no_consensus_list, no_consensus_list_entries,
+		memb_set_merge (instance, no_consensus_list, no_consensus_list_entries,
 			instance->my_failed_list, &instance->my_failed_list_entries);
 		memb_state_gather_enter (instance, 0);
 	}
@@ -1683,6 +2031,8 @@ static void deliver_messages_from_recovery_to_regular (struct totemsrp_instance
 			 * Message is a recovery message encapsulated
 			 * in a new ring message
 			 */
+			memset (&regular_message_item, 0,
+				sizeof (struct sort_queue_item));
 			regular_message_item.mcast =
 				(struct mcast *)(((char *)recovery_message_item->mcast) + sizeof (struct mcast));
 			regular_message_item.msg_len =
@@ -1741,6 +2091,8 @@ static void memb_state_operational_enter (struct totemsrp_instance *instance)
 
 	old_ring_state_reset (instance);
 
+	instance->fcc_token_timestamp = 0;
+
 	deliver_messages_from_recovery_to_regular (instance);
 
 	log_printf (instance->totemsrp_log_level_debug,
@@ -1755,12 +2107,12 @@ static void memb_state_operational_enter (struct totemsrp_instance *instance)
 	/*
 	 * Calculate joined and left list
 	 */
-	memb_set_subtract (instance->my_left_memb_list,
+	memb_set_subtract (instance, instance->my_left_memb_list,
 		&instance->my_left_memb_entries,
 		instance->my_memb_list, instance->my_memb_entries,
 		instance->my_trans_memb_list, instance->my_trans_memb_entries);
 
-	memb_set_subtract (joined_list, &joined_list_entries,
+	memb_set_subtract (instance, joined_list, &joined_list_entries,
 		instance->my_new_memb_list, instance->my_new_memb_entries,
 		instance->my_trans_memb_list, instance->my_trans_memb_entries);
 
@@ -1864,7 +2216,7 @@ static void memb_state_operational_enter (struct totemsrp_instance *instance)
 			struct sort_queue_item *regular_message;
 
 			regular_message = ptr;
-			free (regular_message->mcast);
+			totemsrp_buffer_release (instance, regular_message->mcast);
 		}
 	}
 	sq_items_release (&instance->regular_sort_queue, instance->my_high_delivered);
@@ -1901,6 +2253,7 @@ static void memb_state_gather_enter (
 	instance->orf_token_discard = 1;
 
 	memb_set_merge (
+		instance,
 		&instance->my_id, 1,
 		instance->my_proc_list, &instance->my_proc_list_entries);
 
@@ -2067,6 +2420,7 @@ static void memb_state_recovery_enter (
 			sizeof (struct memb_ring_id));
 	}
 	memb_set_and_with_ring_id (
+		instance,
 		instance->my_new_memb_list,
 		my_new_memb_ring_id_list,
 		instance->my_new_memb_entries,
@@ -2100,7 +2454,7 @@ static void memb_state_recovery_enter (
 	 * Determine if any received flag is false
 	 */
 	for (i = 0; i < commit_token->addr_entries; i++) {
-		if (memb_set_subset (&instance->my_new_memb_list[i], 1,
+		if (memb_set_subset (instance, &instance->my_new_memb_list[i], 1,
 			instance->my_trans_memb_list, instance->my_trans_memb_entries) &&
 
 			memb_list[i].received_flg == 0) {
@@ -2119,7 +2473,7 @@ static void memb_state_recovery_enter (
 	 * Calculate my_low_ring_aru, instance->my_high_ring_delivered for the transitional membership
 	 */
 	for (i = 0; i < commit_token->addr_entries; i++) {
-		if (memb_set_subset (&instance->my_new_memb_list[i], 1,
+		if (memb_set_subset (instance, &instance->my_new_memb_list[i], 1,
 			instance->my_deliver_memb_list,
 			 instance->my_deliver_memb_entries) &&
 
@@ -2168,7 +2522,8 @@ static void memb_state_recovery_enter (
 		messages_originated++;
 		memset (&message_item, 0, sizeof (struct message_item));
 	// TODO	 LEAK
-		message_item.mcast = totemsrp_buffer_alloc (instance);
+		message_item.mcast = totemsrp_buffer_alloc (instance,
+			sort_queue_item->msg_len + sizeof (struct mcast));
 		assert (message_item.mcast);
 		message_item.mcast->header.type = MESSAGE_TYPE_MCAST;
 		srp_addr_copy (&message_item.mcast->system_from, &instance->my_id);
@@ -2230,6 +2585,7 @@ int totemsrp_mcast (
 	struct message_item message_item;
 	char *addr;
 	unsigned int addr_idx;
+	size_t msg_len;
 
 	if (cs_queue_is_full (&instance->new_message_queue)) {
 		log_printf (instance->totemsrp_log_level_debug, "queue full\n");
@@ -2238,10 +2594,15 @@ int totemsrp_mcast (
 
 	memset (&message_item, 0, sizeof (struct message_item));
 
+	msg_len = sizeof (struct mcast);
+	for (i = 0; i < iov_len; i++) {
+		msg_len += iovec[i].iov_len;
+	}
+
 	/*
 	 * Allocate pending item
 	 */
-	message_item.mcast = totemsrp_buffer_alloc (instance);
+	message_item.mcast = totemsrp_buffer_alloc (instance, msg_len);
 	if (message_item.mcast == 0) {
 		goto error_mcast;
 	}
@@ -2267,6 +2628,7 @@ int totemsrp_mcast (
 	}
 
 	message_item.msg_len = addr_idx;
+	message_item.enqueue_time = qb_util_nano_current_get ();
 
 	log_printf (instance->totemsrp_log_level_debug, "mcasted message added to pending queue\n");
 	instance->stats.mcast_tx++;
@@ -2291,6 +2653,37 @@ int totemsrp_avail (void *srp_context)
 	return (avail);
 }
 
+/*
+ * Hand every message waiting in the new message queue to requeue_fn in
+ * queue order and drop it from the queue.  requeue_fn may queue messages
+ * again, those are not handed back.
+ */
+void totemsrp_new_message_queue_requeue (
+	void *srp_context,
+	void (*requeue_fn) (
+		const void *msg,
+		unsigned int msg_len,
+		int guarantee))
+{
+	struct totemsrp_instance *instance = (struct totemsrp_instance *)srp_context;
+	struct message_item *message_item;
+	int used;
+
+	for (used = cs_queue_used (&instance->new_message_queue);
+		used > 0; used--) {
+
+		message_item = (struct message_item *)cs_queue_item_get (
+			&instance->new_message_queue);
+
+		requeue_fn ((char *)message_item->mcast + sizeof (struct mcast),
+			message_item->msg_len - sizeof (struct mcast),
+			message_item->mcast->guarantee);
+
+		totemsrp_buffer_release (instance, message_item->mcast);
+		cs_queue_item_remove (&instance->new_message_queue);
+	}
+}
+
 /*
  * ORF Token Management
  */
@@ -2395,14 +2788,62 @@ static void messages_free (
 	}
 }
 
+#ifdef TEST_DROP_MCAST_BURST
+static unsigned int test_burst_received;
+
+static unsigned int test_burst_dropped;
+
+static unsigned int test_burst_last_seq;
+
+static int test_burst_active;
+
+static unsigned long long test_burst_start;
+
+static uint64_t test_burst_orf_token_rx;
+
+static int test_burst_drop (
+	struct totemsrp_instance *instance,
+	unsigned int seq)
+{
+	if (test_burst_active == 0 &&
+		++test_burst_received % TEST_DROP_MCAST_BURST_INTERVAL == 0) {
+
+		test_burst_active = 1;
+		test_burst_dropped = 0;
+		test_burst_start = qb_util_nano_current_get ();
+		test_burst_orf_token_rx = instance->stats.orf_token_rx;
+	}
+	if (test_burst_active && test_burst_dropped < TEST_DROP_MCAST_BURST) {
+		test_burst_dropped += 1;
+		test_burst_last_seq = seq;
+		return (1);
+	}
+	return (0);
+}
+
+static void test_burst_recovered (struct totemsrp_instance *instance)
+{
+	if (test_burst_active == 0 ||
+		test_burst_dropped < TEST_DROP_MCAST_BURST ||
+		sq_lt_compare (instance->my_aru, test_burst_last_seq)) {
+
+		return;
+	}
+	log_printf (instance->totemsrp_log_level_notice,
+		"Recovered from a burst loss of %d messages in %0.3f ms "
+		"and %llu tokens\n", TEST_DROP_MCAST_BURST,
+		(float)(qb_util_nano_current_get () - test_burst_start) / 1000000.0,
+		(unsigned long long)(instance->stats.orf_token_rx -
+			test_burst_orf_token_rx));
+	test_burst_active = 0;
+}
+#endif
+
 static void update_aru (
 	struct totemsrp_instance *instance)
 {
-	unsigned int i;
-	int res;
 	struct sq *sort_queue;
 	unsigned int range;
-	unsigned int my_aru_saved = 0;
 
 	if (instance->memb_state == MEMB_STATE_RECOVERY) {
 		sort_queue = &instance->recovery_sort_queue;
@@ -2411,25 +2852,20 @@ static void update_aru (
 	}
 
 	range = instance->my_high_seq_received - instance->my_aru;
-	if (range > 1024) {
+	if (range > ARU_RANGE_MAX) {
 		return;
 	}
 
-	my_aru_saved = instance->my_aru;
-	for (i = 1; i <= range; i++) {
+	/*
+	 * Advance the aru up to the first hole
+	 */
+	instance->my_aru += sq_first_hole (sort_queue, instance->my_aru + 1,
+		range);
 
-		void *ptr;
-
-		res = sq_item_get (sort_queue, my_aru_saved + i, &ptr);
-		/*
-		 * If hole, stop updating aru
-		 */
-		if (res != 0) {
-			break;
-		}
-	}
-	instance->my_aru += i - 1;
-}
+#ifdef TEST_DROP_MCAST_BURST
+	test_burst_recovered (instance);
+#endif
+}
 
 /*
  * Multicasts pending messages onto the ring (requires orf_token possession)
@@ -2445,6 +2881,7 @@ static int orf_token_mcast (
 	struct sort_queue_item sort_queue_item;
 	struct mcast *mcast;
 	unsigned int fcc_mcast_current;
+	uint64_t now = 0;
 
 	if (instance->memb_state == MEMB_STATE_RECOVERY) {
 		mcast_queue = &instance->retrans_message_queue;
@@ -2470,6 +2907,11 @@ static int orf_token_mcast (
 		memset (&sort_queue_item, 0, sizeof (struct sort_queue_item));
 		sort_queue_item.mcast = message_item->mcast;
 		sort_queue_item.msg_len = message_item->msg_len;
+		if (now == 0) {
+			now = qb_util_nano_current_get ();
+		}
+		sort_queue_item.enqueue_time = message_item->enqueue_time;
+		sort_queue_item.recv_time = now;
 
 		mcast = sort_queue_item.mcast;
 
@@ -2508,7 +2950,7 @@ static int orf_token_mcast (
  * Remulticasts messages in orf_token's retransmit list (requires orf_token)
  * Modify's orf_token's rtr to include retransmits required by this process
  */
-static int orf_token_rtr (
+static int orf_token_rtr_items (
 	struct totemsrp_instance *instance,
 	struct orf_token *orf_token,
 	unsigned int *fcc_allowed)
@@ -2589,6 +3031,15 @@ static int orf_token_rtr (
 	for (i = 1; (orf_token->rtr_list_entries < RETRANSMIT_ENTRIES_MAX) &&
 		(i <= range); i++) {
 
+		/*
+		 * Skip over the messages this processor already has
+		 */
+		i += sq_first_hole (sort_queue, instance->my_aru + i,
+			range - i + 1);
+		if (i > range) {
+			break;
+		}
+
 		/*
 		 * Ensure message is within the sort queue range
 		 */
@@ -2598,47 +3049,257 @@ static int orf_token_rtr (
 		}
 
 		/*
-		 * Find if a message is missing from this processor
+		 * Determine how many times we have missed receiving
+		 * this sequence number.  sq_item_miss_count increments
+		 * a counter for the sequence number.  The miss count
+		 * will be returned and compared.  This allows time for
+		 * delayed multicast messages to be received before
+		 * declaring the message is missing and requesting a
+		 * retransmit.
 		 */
-		res = sq_item_inuse (sort_queue, instance->my_aru + i);
-		if (res == 0) {
+		res = sq_item_miss_count (sort_queue, instance->my_aru + i);
+		if (res < instance->totem_config->miss_count_const) {
+			continue;
+		}
+
+		/*
+		 * Determine if missing message is already in retransmit list
+		 */
+		found = 0;
+		for (j = 0; j < orf_token->rtr_list_entries; j++) {
+			if (instance->my_aru + i == rtr_list[j].seq) {
+				found = 1;
+			}
+		}
+		if (found == 0) {
 			/*
-			 * Determine how many times we have missed receiving
-			 * this sequence number.  sq_item_miss_count increments
-			 * a counter for the sequence number.  The miss count
-			 * will be returned and compared.  This allows time for
-			 * delayed multicast messages to be received before
-			 * declaring the message is missing and requesting a
-			 * retransmit.
+			 * Missing message not found in current retransmit list so add it
 			 */
-			res = sq_item_miss_count (sort_queue, instance->my_aru + i);
-			if (res < instance->totem_config->miss_count_const) {
+			memcpy (&rtr_list[orf_token->rtr_list_entries].ring_id,
+				&instance->my_ring_id, sizeof (struct memb_ring_id));
+			rtr_list[orf_token->rtr_list_entries].seq = instance->my_aru + i;
+			orf_token->rtr_list_entries++;
+		}
+	}
+	return (instance->fcc_remcast_current);
+}
+
+/*
+ * Add the run of count messages starting at seq to a retransmit range list
+ * kept sorted by sequence number, merging it with the ranges it overlaps
+ * or touches.  Returns -1 if the list is full.
+ */
+static int rtr_range_add (
+	struct rtr_range *ranges,
+	int *entries,
+	unsigned int seq,
+	unsigned int count)
+{
+	unsigned int end = seq + count;
+	unsigned int range_end;
+	int i, j;
+
+	for (i = 0; i < *entries; i++) {
+		if (sq_lt_compare (ranges[i].seq + ranges[i].count, seq) == 0) {
+			break;
+		}
+	}
+
+	if (i < *entries && sq_lte_compare (ranges[i].seq, end)) {
+		range_end = ranges[i].seq + ranges[i].count;
+		if (sq_lt_compare (range_end, end)) {
+			range_end = end;
+		}
+		if (sq_lt_compare (seq, ranges[i].seq)) {
+			ranges[i].seq = seq;
+		}
+		for (j = i + 1; j < *entries &&
+			sq_lte_compare (ranges[j].seq, range_end); j++) {
+
+			if (sq_lt_compare (range_end,
+				ranges[j].seq + ranges[j].count)) {
+
+				range_end = ranges[j].seq + ranges[j].count;
+			}
+		}
+		ranges[i].count = range_end - ranges[i].seq;
+		memmove (&ranges[i + 1], &ranges[j],
+			sizeof (struct rtr_range) * (*entries - j));
+		*entries -= j - i - 1;
+		return (0);
+	}
+
+	if (*entries == RETRANSMIT_RANGES_MAX) {
+		return (-1);
+	}
+	memmove (&ranges[i + 1], &ranges[i],
+		sizeof (struct rtr_range) * (*entries - i));
+	ranges[i].seq = seq;
+	ranges[i].count = count;
+	*entries += 1;
+	return (0);
+}
+
+/*
+ * Same as orf_token_rtr_items for a token carrying retransmit ranges.
+ * Whole ranges are served per rotation, only the messages this processor
+ * does not have stay on the list, and every hole this processor has
+ * missed often enough is requested as one range.
+ */
+static int orf_token_rtr_ranges (
+	struct totemsrp_instance *instance,
+	struct orf_token *orf_token,
+	unsigned int *fcc_allowed)
+{
+	struct rtr_range_list *rtr_range_list;
+	struct rtr_range *ranges;
+	struct rtr_range pending[RETRANSMIT_RANGES_MAX];
+	int pending_entries = 0;
+	struct sq *sort_queue;
+	unsigned int range;
+	unsigned int seq;
+	unsigned int end;
+	unsigned int missing_seq = 0;
+	unsigned int missing = 0;
+	unsigned int hole;
+	unsigned int i, j;
+	char retransmit_msg[1024];
+	char value[64];
+
+	if (instance->memb_state == MEMB_STATE_RECOVERY) {
+		sort_queue = &instance->recovery_sort_queue;
+	} else {
+		sort_queue = &instance->regular_sort_queue;
+	}
+
+	rtr_range_list = (struct rtr_range_list *)orf_token->rtr_list;
+	ranges = rtr_range_list->ranges;
+
+	strcpy (retransmit_msg, "Retransmit List: ");
+	if (orf_token->rtr_list_entries) {
+		log_printf (instance->totemsrp_log_level_debug,
+			"Retransmit List %d\n", orf_token->rtr_list_entries);
+		for (i = 0; i < orf_token->rtr_list_entries; i++) {
+			sprintf (value, "%x-%x ", ranges[i].seq,
+				ranges[i].seq + ranges[i].count - 1);
+			strcat (retransmit_msg, value);
+		}
+		strcat (retransmit_msg, "\n");
+		log_printf (instance->totemsrp_log_level_notice,
+			"%s", retransmit_msg);
+	}
+
+	/*
+	 * Requests from another configuration can't be served by anyone
+	 * on this ring
+	 */
+	if (memcmp (&rtr_range_list->ring_id, &instance->my_ring_id,
+		sizeof (struct memb_ring_id)) != 0) {
+
+		memcpy (&rtr_range_list->ring_id, &instance->my_ring_id,
+			sizeof (struct memb_ring_id));
+		orf_token->rtr_list_entries = 0;
+	}
+
+	/*
+	 * Retransmit the requested ranges, keeping whatever could not be sent.
+	 * If the kept pieces don't all fit, the processors missing the rest
+	 * request them again on their next visit.
+	 */
+	instance->fcc_remcast_current = 0;
+	for (i = 0; i < orf_token->rtr_list_entries; i++) {
+		seq = ranges[i].seq;
+		end = ranges[i].seq + ranges[i].count;
+		missing = 0;
+
+		for (; seq != end &&
+			instance->fcc_remcast_current < *fcc_allowed; seq++) {
+
+			if (orf_token_remcast (instance, seq) == 0) {
+				instance->stats.mcast_retx++;
+				instance->fcc_remcast_current++;
+				if (missing) {
+					rtr_range_add (pending, &pending_entries,
+						missing_seq, missing);
+					missing = 0;
+				}
 				continue;
 			}
+			if (missing == 0) {
+				missing_seq = seq;
+			}
+			missing += 1;
+		}
+		if (missing) {
+			rtr_range_add (pending, &pending_entries,
+				missing_seq, missing);
+		}
+		if (seq != end) {
+			rtr_range_add (pending, &pending_entries, seq, end - seq);
+		}
+	}
+	memcpy (ranges, pending, sizeof (struct rtr_range) * pending_entries);
+	*fcc_allowed = *fcc_allowed - instance->fcc_remcast_current;
 
-			/*
-			 * Determine if missing message is already in retransmit list
-			 */
-			found = 0;
-			for (j = 0; j < orf_token->rtr_list_entries; j++) {
-				if (instance->my_aru + i == rtr_list[j].seq) {
-					found = 1;
+	/*
+	 * Add the holes this processor has to the retransmit ranges
+	 */
+	range = orf_token->seq - instance->my_aru;
+	assert (range < QUEUE_RTR_ITEMS_SIZE_MAX);
+
+	for (i = 1; i <= range; i += hole) {
+		i += sq_first_hole (sort_queue, instance->my_aru + i,
+			range - i + 1);
+		if (i > range ||
+			sq_in_range (sort_queue, instance->my_aru + i) == 0) {
+			break;
+		}
+		hole = sq_first_present (sort_queue, instance->my_aru + i,
+			range - i + 1);
+
+		/*
+		 * Only request the messages of the hole that have been
+		 * missed miss_count_const times, as orf_token_rtr_items does
+		 */
+		missing = 0;
+		for (j = 0; j < hole; j++) {
+			seq = instance->my_aru + i + j;
+			if (sq_item_miss_count (sort_queue, seq) <
+				instance->totem_config->miss_count_const) {
+
+				if (missing) {
+					rtr_range_add (ranges,
+						&pending_entries,
+						missing_seq, missing);
+					missing = 0;
 				}
+				continue;
 			}
-			if (found == 0) {
-				/*
-				 * Missing message not found in current retransmit list so add it
-				 */
-				memcpy (&rtr_list[orf_token->rtr_list_entries].ring_id,
-					&instance->my_ring_id, sizeof (struct memb_ring_id));
-				rtr_list[orf_token->rtr_list_entries].seq = instance->my_aru + i;
-				orf_token->rtr_list_entries++;
+			if (missing == 0) {
+				missing_seq = seq;
 			}
+			missing += 1;
+		}
+		if (missing) {
+			rtr_range_add (ranges, &pending_entries,
+				missing_seq, missing);
 		}
 	}
+	orf_token->rtr_list_entries = pending_entries;
 	return (instance->fcc_remcast_current);
 }
 
+static int orf_token_rtr (
+	struct totemsrp_instance *instance,
+	struct orf_token *orf_token,
+	unsigned int *fcc_allowed)
+{
+	if (orf_token->header.encapsulated == TOKEN_FORMAT_RTR_RANGES) {
+		return (orf_token_rtr_ranges (instance, orf_token, fcc_allowed));
+	}
+	return (orf_token_rtr_items (instance, orf_token, fcc_allowed));
+}
+
 static void token_retransmit (struct totemsrp_instance *instance)
 {
 	totemrrp_token_send (instance->totemrrp_context,
@@ -2702,6 +3363,17 @@ static void timer_function_merge_detect_timeout(void *data)
 	}
 }
 
+static unsigned int orf_token_size_get (const struct orf_token *orf_token)
+{
+	if (orf_token->header.encapsulated == TOKEN_FORMAT_RTR_RANGES) {
+		return (sizeof (struct orf_token) +
+			sizeof (struct rtr_range_list) +
+			(orf_token->rtr_list_entries * sizeof (struct rtr_range)));
+	}
+	return (sizeof (struct orf_token) +
+		(orf_token->rtr_list_entries * sizeof (struct rtr_item)));
+}
+
 /*
  * Send orf_token to next member (requires orf_token)
  */
@@ -2713,8 +3385,7 @@ static int token_send (
 	int res = 0;
 	unsigned int orf_token_size;
 
-	orf_token_size = sizeof (struct orf_token) +
-		(orf_token->rtr_list_entries * sizeof (struct rtr_item));
+	orf_token_size = orf_token_size_get (orf_token);
 
 	memcpy (instance->orf_token_retransmit, orf_token, orf_token_size);
 	instance->orf_token_retransmit_size = orf_token_size;
@@ -2763,41 +3434,109 @@ static int token_hold_cancel_send (struct totemsrp_instance *instance)
 	return (0);
 }
 
+/*
+ * Remember the token format a processor advertised in its join message
+ */
+static void token_format_set (
+	struct totemsrp_instance *instance,
+	unsigned int nodeid,
+	unsigned char format)
+{
+	int i;
+
+	for (i = 0; i < instance->token_formats_entries; i++) {
+		if (instance->token_formats[i].nodeid == nodeid) {
+			instance->token_formats[i].format = format;
+			return;
+		}
+	}
+	/*
+	 * Forgetting everyone is safe, anyone unknown gets the old format
+	 */
+	if (instance->token_formats_entries == PROCESSOR_COUNT_MAX) {
+		instance->token_formats_entries = 0;
+	}
+	instance->token_formats[instance->token_formats_entries].nodeid = nodeid;
+	instance->token_formats[instance->token_formats_entries].format = format;
+	instance->token_formats_entries += 1;
+}
+
+/*
+ * Highest token format every member of the new ring understands
+ */
+static unsigned char token_format_negotiate (
+	struct totemsrp_instance *instance)
+{
+	unsigned char format = TOKEN_FORMAT_MAX;
+	unsigned char member_format;
+	unsigned int nodeid;
+	int i, j;
+
+	for (i = 0; i < instance->my_new_memb_entries; i++) {
+		nodeid = instance->my_new_memb_list[i].addr[0].nodeid;
+		if (nodeid == instance->my_id.addr[0].nodeid) {
+			continue;
+		}
+		member_format = TOKEN_FORMAT_RTR_ITEMS;
+		for (j = 0; j < instance->token_formats_entries; j++) {
+			if (instance->token_formats[j].nodeid == nodeid) {
+				member_format = instance->token_formats[j].format;
+				break;
+			}
+		}
+		if (member_format < format) {
+			format = member_format;
+		}
+	}
+	return (format);
+}
+
 static int orf_token_send_initial (struct totemsrp_instance *instance)
 {
-	struct orf_token orf_token;
+	char orf_token_storage[sizeof (struct orf_token) +
+		sizeof (struct rtr_range_list)];
+	struct orf_token *orf_token = (struct orf_token *)orf_token_storage;
+	struct rtr_range_list *rtr_range_list;
 	int res;
 
-	orf_token.header.type = MESSAGE_TYPE_ORF_TOKEN;
-	orf_token.header.endian_detector = ENDIAN_LOCAL;
-	orf_token.header.encapsulated = 0;
-	orf_token.header.nodeid = instance->my_id.addr[0].nodeid;
-	assert (orf_token.header.nodeid);
-	orf_token.seq = SEQNO_START_MSG;
-	orf_token.token_seq = SEQNO_START_TOKEN;
-	orf_token.retrans_flg = 1;
+	orf_token->header.type = MESSAGE_TYPE_ORF_TOKEN;
+	orf_token->header.endian_detector = ENDIAN_LOCAL;
+	orf_token->header.encapsulated = token_format_negotiate (instance);
+	orf_token->header.nodeid = instance->my_id.addr[0].nodeid;
+	assert (orf_token->header.nodeid);
+	orf_token->seq = SEQNO_START_MSG;
+	orf_token->token_seq = SEQNO_START_TOKEN;
+	orf_token->retrans_flg = 1;
 	instance->my_set_retrans_flg = 1;
 	instance->stats.orf_token_tx++;
 
 	if (cs_queue_is_empty (&instance->retrans_message_queue) == 1) {
-		orf_token.retrans_flg = 0;
+		orf_token->retrans_flg = 0;
 		instance->my_set_retrans_flg = 0;
 	} else {
-		orf_token.retrans_flg = 1;
+		orf_token->retrans_flg = 1;
 		instance->my_set_retrans_flg = 1;
 	}
 
-	orf_token.aru = 0;
-	orf_token.aru = SEQNO_START_MSG - 1;
-	orf_token.aru_addr = instance->my_id.addr[0].nodeid;
+	orf_token->aru = 0;
+	orf_token->aru = SEQNO_START_MSG - 1;
+	orf_token->aru_addr = instance->my_id.addr[0].nodeid;
+
+	memcpy (&orf_token->ring_id, &instance->my_ring_id, sizeof (struct memb_ring_id));
+	orf_token->fcc = 0;
+	orf_token->backlog = 0;
 
-	memcpy (&orf_token.ring_id, &instance->my_ring_id, sizeof (struct memb_ring_id));
-	orf_token.fcc = 0;
-	orf_token.backlog = 0;
+	orf_token->rtr_list_entries = 0;
+	if (orf_token->header.encapsulated == TOKEN_FORMAT_RTR_RANGES) {
+		rtr_range_list = (struct rtr_range_list *)orf_token->rtr_list;
+		memcpy (&rtr_range_list->ring_id, &instance->my_ring_id,
+			sizeof (struct memb_ring_id));
+	}
 
-	orf_token.rtr_list_entries = 0;
+	log_printf (instance->totemsrp_log_level_debug,
+		"Using token format %d\n", orf_token->header.encapsulated);
 
-	res = token_send (instance, &orf_token, 1);
+	res = token_send (instance, orf_token, 1);
 
 	return (res);
 }
@@ -2951,7 +3690,7 @@ static int memb_lowest_in_config (struct totemsrp_instance *instance)
 	int i;
 	struct totem_ip_address *lowest_addr;
 
-	memb_set_subtract (token_memb, &token_memb_entries,
+	memb_set_subtract (instance, token_memb, &token_memb_entries,
 		instance->my_proc_list, instance->my_proc_list_entries,
 		instance->my_failed_list, instance->my_failed_list_entries);
 
@@ -2987,7 +3726,7 @@ static void memb_state_commit_token_create (
 	log_printf (instance->totemsrp_log_level_debug,
 		"Creating commit token because I am the rep.\n");
 
-	memb_set_subtract (token_memb, &token_memb_entries,
+	memb_set_subtract (instance, token_memb, &token_memb_entries,
 		instance->my_proc_list, instance->my_proc_list_entries,
 		instance->my_failed_list, instance->my_failed_list_entries);
 
@@ -3030,7 +3769,7 @@ static void memb_join_message_send (struct totemsrp_instance *instance)
 
 	memb_join->header.type = MESSAGE_TYPE_MEMB_JOIN;
 	memb_join->header.endian_detector = ENDIAN_LOCAL;
-	memb_join->header.encapsulated = 0;
+	memb_join->header.encapsulated = TOKEN_FORMAT_MAX;
 	memb_join->header.nodeid = instance->my_id.addr[0].nodeid;
 	assert (memb_join->header.nodeid);
 
@@ -3089,18 +3828,18 @@ static void memb_leave_message_send (struct totemsrp_instance *instance)
 	 * add us to the failed list, and remove us from
 	 * the members list
 	 */
-	memb_set_merge(
+	memb_set_merge(instance,
 		       &instance->my_id, 1,
 		       instance->my_failed_list, &instance->my_failed_list_entries);
 
-	memb_set_subtract (active_memb, &active_memb_entries,
+	memb_set_subtract (instance, active_memb, &active_memb_entries,
 			   instance->my_proc_list, instance->my_proc_list_entries,
 			   &instance->my_id, 1);
 
 
 	memb_join->header.type = MESSAGE_TYPE_MEMB_JOIN;
 	memb_join->header.endian_detector = ENDIAN_LOCAL;
-	memb_join->header.encapsulated = 0;
+	memb_join->header.encapsulated = TOKEN_FORMAT_MAX;
 	memb_join->header.nodeid = LEAVE_DUMMY_NODEID;
 
 	memb_join->ring_seq = instance->my_ring_id.seq;
@@ -3345,10 +4084,112 @@ static unsigned int backlog_get (struct totemsrp_instance *instance)
 	if (instance->memb_state == MEMB_STATE_RECOVERY) {
 		backlog = cs_queue_used (&instance->retrans_message_queue);
 	}
-	instance->stats.token[instance->stats.latest_token].backlog_calc = backlog;
+	if (instance->stats.token[instance->stats.latest_token].counted == 0) {
+		instance->stats.token[instance->stats.latest_token].backlog_calc = backlog;
+	}
 	return (backlog);
 }
 
+/*
+ * Number of messages the retransmit list of the token asks for
+ */
+static unsigned int orf_token_rtr_count (const struct orf_token *token)
+{
+	const struct rtr_range_list *rtr_range_list;
+	unsigned int count = 0;
+	int i;
+
+	if (token->header.encapsulated != TOKEN_FORMAT_RTR_RANGES) {
+		return (token->rtr_list_entries);
+	}
+	rtr_range_list = (const struct rtr_range_list *)token->rtr_list;
+	for (i = 0; i < token->rtr_list_entries; i++) {
+		count += rtr_range_list->ranges[i].count;
+	}
+	return (count);
+}
+
+/*
+ * Adaptive flow control: once per token the window grows by one message
+ * while the ring has a backlog and runs clean, and drops to three quarters
+ * when
+ * - a quarter of the window is asked for again on the token or was
+ *   retransmitted by this processor since its last token,
+ * - more than half of ARU_RANGE_MAX messages are not yet received by
+ *   every processor, past which the aru stops moving, or
+ * - a loaded token rotation takes more than half the token timeout.
+ * The odd retransmit of random loss doesn't shrink the window, a small
+ * window only makes every lost message hold back fewer others.
+ * max_messages keeps its configured ratio to the window.
+ */
+static void fcc_window_adapt (
+	struct totemsrp_instance *instance,
+	struct orf_token *token)
+{
+	struct totem_config *totem_config = instance->totem_config;
+	uint64_t now;
+	uint64_t rotation = 0;
+	uint64_t retx;
+	unsigned int window;
+	unsigned int max_messages;
+	int congested;
+
+	if (totem_config->adaptive_window == 0) {
+		instance->stats.fcc_window = totem_config->window_size;
+		instance->stats.fcc_max_messages = totem_config->max_messages;
+		return;
+	}
+
+	now = qb_util_nano_current_get ();
+	if (instance->fcc_token_timestamp) {
+		rotation = now - instance->fcc_token_timestamp;
+	}
+	instance->fcc_token_timestamp = now;
+
+	window = instance->stats.fcc_window;
+	retx = instance->stats.mcast_retx - instance->fcc_mcast_retx;
+	instance->fcc_mcast_retx = instance->stats.mcast_retx;
+
+	congested = (orf_token_rtr_count (token) * 4 > window ||
+		retx * 4 > window ||
+		token->seq - token->aru > ARU_RANGE_MAX / 2 ||
+		(token->backlog &&
+		rotation > totem_config->token_timeout * QB_TIME_NS_IN_MSEC / 2));
+
+	if (congested) {
+		window = window * 3 / 4;
+	} else
+	if (token->backlog) {
+		window += 1;
+	}
+	if (window < totem_config->window_size_min) {
+		window = totem_config->window_size_min;
+	}
+	if (window > totem_config->window_size_max) {
+		window = totem_config->window_size_max;
+	}
+
+	if (window > instance->stats.fcc_window) {
+		instance->stats.fcc_window_increases++;
+	} else
+	if (window < instance->stats.fcc_window) {
+		instance->stats.fcc_window_decreases++;
+		log_printf (instance->totemsrp_log_level_debug,
+			"Flow control window reduced to %d messages\n", window);
+	}
+	instance->stats.fcc_window = window;
+
+	max_messages = (uint64_t)totem_config->max_messages * window /
+		totem_config->window_size;
+	if (max_messages == 0) {
+		max_messages = 1;
+	}
+	if (max_messages > window) {
+		max_messages = window;
+	}
+	instance->stats.fcc_max_messages = max_messages;
+}
+
 static int fcc_calculate (
 	struct totemsrp_instance *instance,
 	struct orf_token *token)
@@ -3356,10 +4197,17 @@ static int fcc_calculate (
 	unsigned int transmits_allowed;
 	unsigned int backlog_calc;
 
-	transmits_allowed = instance->totem_config->max_messages;
+	if (instance->memb_state == MEMB_STATE_OPERATIONAL) {
+		fcc_window_adapt (instance, token);
+	}
+
+	transmits_allowed = instance->stats.fcc_max_messages;
 
-	if (transmits_allowed > instance->totem_config->window_size - token->fcc) {
-		transmits_allowed = instance->totem_config->window_size - token->fcc;
+	if (token->fcc >= instance->stats.fcc_window) {
+		transmits_allowed = 0;
+	} else
+	if (transmits_allowed > instance->stats.fcc_window - token->fcc) {
+		transmits_allowed = instance->stats.fcc_window - token->fcc;
 	}
 
 	instance->my_cbl = backlog_get (instance);
@@ -3369,7 +4217,7 @@ static int fcc_calculate (
 	 * we would result in div by zero
 	 */
 	if (token->backlog + instance->my_cbl - instance->my_pbl) {
-		backlog_calc = (instance->totem_config->window_size * instance->my_pbl) /
+		backlog_calc = (instance->stats.fcc_window * instance->my_pbl) /
 			(token->backlog + instance->my_cbl - instance->my_pbl);
 		if (backlog_calc > 0 && transmits_allowed > backlog_calc) {
 			transmits_allowed = backlog_calc;
@@ -3388,11 +4236,11 @@ static void fcc_rtr_limit (
 	unsigned int *transmits_allowed)
 {
 	int check = QUEUE_RTR_ITEMS_SIZE_MAX;
-	check -= (*transmits_allowed + instance->totem_config->window_size);
+	check -= (*transmits_allowed + instance->stats.fcc_window);
 	assert (check >= 0);
 	if (sq_lt_compare (instance->last_released +
 		QUEUE_RTR_ITEMS_SIZE_MAX - *transmits_allowed -
-		instance->totem_config->window_size,
+		instance->stats.fcc_window,
 
 			token->seq)) {
 
@@ -3466,9 +4314,16 @@ static int message_handler_orf_token (
 	 * to flush incoming messages from the kernel queue
 	 */
 	token = (struct orf_token *)token_storage;
-	memcpy (token, msg, sizeof (struct orf_token));
-	memcpy (&token->rtr_list[0], (char *)msg + sizeof (struct orf_token),
-		sizeof (struct rtr_item) * RETRANSMIT_ENTRIES_MAX);
+	if (((const struct orf_token *)msg)->header.encapsulated == TOKEN_FORMAT_RTR_RANGES) {
+		if (((const struct orf_token *)msg)->rtr_list_entries > RETRANSMIT_RANGES_MAX) {
+			return (0);
+		}
+	} else {
+		if (((const struct orf_token *)msg)->rtr_list_entries > RETRANSMIT_ENTRIES_MAX) {
+			return (0);
+		}
+	}
+	memcpy (token, msg, orf_token_size_get (msg));
 
 
 	/*
@@ -3601,7 +4456,7 @@ printf ("token seq %d\n", token->seq);
 
 			instance->failed_to_recv = 1;
 
-			memb_set_merge (&instance->my_id, 1,
+			memb_set_merge (instance, &instance->my_id, 1,
 				instance->my_failed_list,
 				&instance->my_failed_list_entries);
 
@@ -3713,6 +4568,36 @@ printf ("token seq %d\n", token->seq);
 	return (0);
 }
 
+static void deliver_batch_flush (struct totemsrp_instance *instance)
+{
+	if (instance->deliver_batch_entries == 0) {
+		return;
+	}
+	instance->totemsrp_deliver_batch_fn (instance->deliver_batch,
+		instance->deliver_batch_entries);
+	instance->deliver_batch_entries = 0;
+}
+
+static void deliver_batch_add (
+	struct totemsrp_instance *instance,
+	unsigned int nodeid,
+	const void *msg,
+	unsigned int msg_len,
+	int endian_conversion_required)
+{
+	struct totem_deliver_item *item;
+
+	item = &instance->deliver_batch[instance->deliver_batch_entries++];
+	item->nodeid = nodeid;
+	item->msg = msg;
+	item->msg_len = msg_len;
+	item->endian_conversion_required = endian_conversion_required;
+
+	if (instance->deliver_batch_entries == DELIVER_BATCH_MAX) {
+		deliver_batch_flush (instance);
+	}
+}
+
 static void messages_deliver_to_app (
 	struct totemsrp_instance *instance,
 	int skip,
@@ -3726,6 +4611,7 @@ static void messages_deliver_to_app (
 	unsigned int range = 0;
 	int endian_conversion_required;
 	unsigned int my_high_delivered_stored = 0;
+	uint64_t now = 0;
 
 
 	range = end_point - instance->my_high_delivered;
@@ -3738,6 +4624,14 @@ static void messages_deliver_to_app (
 	assert (range < QUEUE_RTR_ITEMS_SIZE_MAX);
 	my_high_delivered_stored = instance->my_high_delivered;
 
+	/*
+	 * Unless holes are being skipped, delivery stops at the first one
+	 */
+	if (skip == 0) {
+		range = sq_first_hole (&instance->regular_sort_queue,
+			my_high_delivered_stored + 1, range);
+	}
+
 	/*
 	 * Deliver messages in order from rtr queue to pending delivery queue
 	 */
@@ -3787,7 +4681,7 @@ static void messages_deliver_to_app (
 		 * Skip messages not originated in instance->my_deliver_memb
 		 */
 		if (skip &&
-			memb_set_subset (&mcast_header.system_from,
+			memb_set_subset (instance, &mcast_header.system_from,
 				1,
 				instance->my_deliver_memb_list,
 				instance->my_deliver_memb_entries) == 0) {
@@ -3804,6 +4698,31 @@ static void messages_deliver_to_app (
 			"Delivering MCAST message with seq %x to pending delivery queue\n",
 			mcast_header.seq);
 
+		if (sort_queue_item_p->recv_time) {
+			if (now == 0) {
+				now = qb_util_nano_current_get ();
+			}
+			totem_histogram_add (&instance->stats.recv_deliver_hist,
+				(now - sort_queue_item_p->recv_time) / QB_TIME_NS_IN_USEC);
+			if (sort_queue_item_p->enqueue_time) {
+				totem_histogram_add (&instance->stats.mcast_deliver_hist,
+					(now - sort_queue_item_p->enqueue_time) / QB_TIME_NS_IN_USEC);
+			}
+		}
+
+		/*
+		 * Sort queue items are only released on token receipt, so a
+		 * run of messages can be handed up in one call
+		 */
+		if (instance->totemsrp_deliver_batch_fn) {
+			deliver_batch_add (instance,
+				mcast_header.header.nodeid,
+				((char *)sort_queue_item_p->mcast) + sizeof (struct mcast),
+				sort_queue_item_p->msg_len - sizeof (struct mcast),
+				endian_conversion_required);
+			continue;
+		}
+
 		/*
 		 * Message is locally originated multicast
 		 */
@@ -3813,6 +4732,10 @@ static void messages_deliver_to_app (
 			sort_queue_item_p->msg_len - sizeof (struct mcast),
 			endian_conversion_required);
 	}
+
+	if (instance->totemsrp_deliver_batch_fn) {
+		deliver_batch_flush (instance);
+	}
 }
 
 /*
@@ -3848,6 +4771,11 @@ static int message_handler_mcast (
 		return (0);
 	}
 #endif
+#ifdef TEST_DROP_MCAST_BURST
+	if (test_burst_drop (instance, mcast_header.seq)) {
+		return (0);
+	}
+#endif
 
 	/*
 	 * If the message is foreign execute the switch below
@@ -3858,6 +4786,7 @@ static int message_handler_mcast (
 		switch (instance->memb_state) {
 		case MEMB_STATE_OPERATIONAL:
 			memb_set_merge (
+				instance,
 				&mcast_header.system_from, 1,
 				instance->my_proc_list, &instance->my_proc_list_entries);
 			memb_state_gather_enter (instance, 7);
@@ -3865,12 +4794,13 @@ static int message_handler_mcast (
 
 		case MEMB_STATE_GATHER:
 			if (!memb_set_subset (
+				instance,
 				&mcast_header.system_from,
 				1,
 				instance->my_proc_list,
 				instance->my_proc_list_entries)) {
 
-				memb_set_merge (&mcast_header.system_from, 1,
+				memb_set_merge (instance, &mcast_header.system_from, 1,
 					instance->my_proc_list, &instance->my_proc_list_entries);
 				memb_state_gather_enter (instance, 8);
 				return (0);
@@ -3908,12 +4838,14 @@ static int message_handler_mcast (
 		 * Allocate new multicast memory block
 		 */
 // TODO LEAK
-		sort_queue_item.mcast = totemsrp_buffer_alloc (instance);
+		sort_queue_item.mcast = totemsrp_buffer_alloc (instance, msg_len);
 		if (sort_queue_item.mcast == NULL) {
 			return (-1); /* error here is corrected by the algorithm */
 		}
 		memcpy (sort_queue_item.mcast, msg, msg_len);
 		sort_queue_item.msg_len = msg_len;
+		sort_queue_item.enqueue_time = 0;
+		sort_queue_item.recv_time = qb_util_nano_current_get ();
 
 		if (sq_lt_compare (instance->my_high_seq_received,
 			mcast_header.seq)) {
@@ -3962,19 +4894,20 @@ static int message_handler_memb_merge_detect (
 	 */
 	switch (instance->memb_state) {
 	case MEMB_STATE_OPERATIONAL:
-		memb_set_merge (&memb_merge_detect.system_from, 1,
+		memb_set_merge (instance, &memb_merge_detect.system_from, 1,
 			instance->my_proc_list, &instance->my_proc_list_entries);
 		memb_state_gather_enter (instance, 9);
 		break;
 
 	case MEMB_STATE_GATHER:
 		if (!memb_set_subset (
+			instance,
 			&memb_merge_detect.system_from,
 			1,
 			instance->my_proc_list,
 			instance->my_proc_list_entries)) {
 
-			memb_set_merge (&memb_merge_detect.system_from, 1,
+			memb_set_merge (instance, &memb_merge_detect.system_from, 1,
 				instance->my_proc_list, &instance->my_proc_list_entries);
 			memb_state_gather_enter (instance, 10);
 			return (0);
@@ -4012,12 +4945,12 @@ static void memb_join_process (
 	memb_set_print ("my_faillist", instance->my_failed_list, instance->my_failed_list_entries);
 -*/
 
-	if (memb_set_equal (proc_list,
+	if (memb_set_equal (instance, proc_list,
 		memb_join->proc_list_entries,
 		instance->my_proc_list,
 		instance->my_proc_list_entries) &&
 
-	memb_set_equal (failed_list,
+	memb_set_equal (instance, failed_list,
 		memb_join->failed_list_entries,
 		instance->my_failed_list,
 		instance->my_failed_list_entries)) {
@@ -4046,57 +4979,61 @@ static void memb_join_process (
 			return;
 		}
 	} else
-	if (memb_set_subset (proc_list,
+	if (memb_set_subset (instance, proc_list,
 		memb_join->proc_list_entries,
 		instance->my_proc_list,
 		instance->my_proc_list_entries) &&
 
-		memb_set_subset (failed_list,
+		memb_set_subset (instance, failed_list,
 		memb_join->failed_list_entries,
 		instance->my_failed_list,
 		instance->my_failed_list_entries)) {
 
 		return;
 	} else
-	if (memb_set_subset (&memb_join->system_from, 1,
+	if (memb_set_subset (instance, &memb_join->system_from, 1,
 		instance->my_failed_list, instance->my_failed_list_entries)) {
 
 		return;
 	} else {
-		memb_set_merge (proc_list,
+		memb_set_merge (instance, proc_list,
 			memb_join->proc_list_entries,
 			instance->my_proc_list, &instance->my_proc_list_entries);
 
 		if (memb_set_subset (
+			instance,
 			&instance->my_id, 1,
 			failed_list, memb_join->failed_list_entries)) {
 
 			memb_set_merge (
+				instance,
 				&memb_join->system_from, 1,
 				instance->my_failed_list, &instance->my_failed_list_entries);
 		} else {
 			if (memb_set_subset (
+				instance,
 				&memb_join->system_from, 1,
 				instance->my_memb_list,
 				instance->my_memb_entries)) {
 
 				if (memb_set_subset (
+					instance,
 					&memb_join->system_from, 1,
 					instance->my_failed_list,
 					instance->my_failed_list_entries) == 0) {
 
-					memb_set_merge (failed_list,
+					memb_set_merge (instance, failed_list,
 						memb_join->failed_list_entries,
 						instance->my_failed_list, &instance->my_failed_list_entries);
 				} else {
-					memb_set_subtract (fail_minus_memb,
+					memb_set_subtract (instance, fail_minus_memb,
 						&fail_minus_memb_entries,
 						failed_list,
 						memb_join->failed_list_entries,
 						instance->my_memb_list,
 						instance->my_memb_entries);
 
-					memb_set_merge (fail_minus_memb,
+					memb_set_merge (instance, fail_minus_memb,
 						fail_minus_memb_entries,
 						instance->my_failed_list,
 						&instance->my_failed_list_entries);
@@ -4122,6 +5059,7 @@ static void memb_join_endian_convert (const struct memb_join *in, struct memb_jo
 	struct srp_addr *out_failed_list;
 
 	out->header.type = in->header.type;
+	out->header.encapsulated = in->header.encapsulated;
 	out->header.endian_detector = ENDIAN_LOCAL;
 	out->header.nodeid = swab32 (in->header.nodeid);
 	srp_addr_copy_endian_convert (&out->system_from, &in->system_from);
@@ -4183,9 +5121,12 @@ static void memb_commit_token_endian_convert (const struct memb_commit_token *in
 
 static void orf_token_endian_convert (const struct orf_token *in, struct orf_token *out)
 {
+	const struct rtr_range_list *in_rtr_range_list;
+	struct rtr_range_list *out_rtr_range_list;
 	int i;
 
 	out->header.type = in->header.type;
+	out->header.encapsulated = in->header.encapsulated;
 	out->header.endian_detector = ENDIAN_LOCAL;
 	out->header.nodeid = swab32 (in->header.nodeid);
 	out->seq = swab32 (in->seq);
@@ -4198,6 +5139,23 @@ static void orf_token_endian_convert (const struct orf_token *in, struct orf_tok
 	out->backlog = swab32 (in->backlog);
 	out->retrans_flg = swab32 (in->retrans_flg);
 	out->rtr_list_entries = swab32 (in->rtr_list_entries);
+	if (in->header.encapsulated == TOKEN_FORMAT_RTR_RANGES) {
+		in_rtr_range_list = (const struct rtr_range_list *)in->rtr_list;
+		out_rtr_range_list = (struct rtr_range_list *)out->rtr_list;
+		totemip_copy_endian_convert(&out_rtr_range_list->ring_id.rep,
+			&in_rtr_range_list->ring_id.rep);
+		out_rtr_range_list->ring_id.seq =
+			swab64 (in_rtr_range_list->ring_id.seq);
+		for (i = 0; i < out->rtr_list_entries &&
+			i < RETRANSMIT_RANGES_MAX; i++) {
+
+			out_rtr_range_list->ranges[i].seq =
+				swab32 (in_rtr_range_list->ranges[i].seq);
+			out_rtr_range_list->ranges[i].count =
+				swab32 (in_rtr_range_list->ranges[i].count);
+		}
+		return;
+	}
 	for (i = 0; i < out->rtr_list_entries; i++) {
 		totemip_copy_endian_convert(&out->rtr_list[i].ring_id.rep, &in->rtr_list[i].ring_id.rep);
 		out->rtr_list[i].ring_id.seq = swab64 (in->rtr_list[i].ring_id.seq);
@@ -4261,6 +5219,10 @@ static int message_handler_memb_join (
 	if (instance->token_ring_id_seq < memb_join->ring_seq) {
 		instance->token_ring_id_seq = memb_join->ring_seq;
 	}
+
+	token_format_set (instance, memb_join->system_from.addr[0].nodeid,
+		memb_join->header.encapsulated);
+
 	switch (instance->memb_state) {
 		case MEMB_STATE_OPERATIONAL:
 			memb_join_process (instance, memb_join);
@@ -4271,7 +5233,7 @@ static int message_handler_memb_join (
 			break;
 
 		case MEMB_STATE_COMMIT:
-			if (memb_set_subset (&memb_join->system_from,
+			if (memb_set_subset (instance, &memb_join->system_from,
 				1,
 				instance->my_new_memb_list,
 				instance->my_new_memb_entries) &&
@@ -4284,7 +5246,7 @@ static int message_handler_memb_join (
 			break;
 
 		case MEMB_STATE_RECOVERY:
-			if (memb_set_subset (&memb_join->system_from,
+			if (memb_set_subset (instance, &memb_join->system_from,
 				1,
 				instance->my_new_memb_list,
 				instance->my_new_memb_entries) &&
@@ -4335,11 +5297,11 @@ static int message_handler_memb_commit_token (
 			break;
 
 		case MEMB_STATE_GATHER:
-			memb_set_subtract (sub, &sub_entries,
+			memb_set_subtract (instance, sub, &sub_entries,
 				instance->my_proc_list, instance->my_proc_list_entries,
 				instance->my_failed_list, instance->my_failed_list_entries);
 
-			if (memb_set_equal (addr,
+			if (memb_set_equal (instance, addr,
 				memb_commit_token->addr_entries,
 				sub,
 				sub_entries) &&
@@ -4490,6 +5452,17 @@ void totemsrp_net_mtu_adjust (struct totem_config *totem_config) {
 	totem_config->net_mtu -= sizeof (struct mcast);
 }
 
+void totemsrp_deliver_batch_register (
+	void *context,
+	void (*deliver_batch_fn) (
+		const struct totem_deliver_item *items,
+		unsigned int item_count))
+{
+	struct totemsrp_instance *instance = (struct totemsrp_instance *)context;
+
+	instance->totemsrp_deliver_batch_fn = deliver_batch_fn;
+}
+
 void totemsrp_service_ready_register (
 	void *context,
         void (*totem_service_ready) (void))
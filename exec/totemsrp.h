@@ -83,6 +83,13 @@ int totemsrp_mcast (
  */
 int totemsrp_avail (void *srp_context);
 
+void totemsrp_new_message_queue_requeue (
+	void *srp_context,
+	void (*requeue_fn) (
+		const void *msg,
+		unsigned int msg_len,
+		int guarantee));
+
 int totemsrp_callback_token_create (
 	void *srp_context,
 	void **handle_out,
@@ -119,6 +126,16 @@ extern int totemsrp_crypto_set (
 extern int totemsrp_ring_reenable (
 	void *srp_context);
 
+/*
+ * Deliver runs of in order messages with one call instead of calling
+ * deliver_fn per message
+ */
+void totemsrp_deliver_batch_register (
+	void *srp_context,
+	void (*deliver_batch_fn) (
+		const struct totem_deliver_item *items,
+		unsigned int item_count));
+
 void totemsrp_service_ready_register (
 	void *srp_context,
 	void (*totem_service_ready) (void));
@@ -68,6 +68,8 @@
 #include "totemudp.h"
 
 #include "crypto.h"
+#include "totemframe.h"
+#include "wthread.h"
 #include "util.h"
 
 #ifdef HAVE_LIBNSS
@@ -77,6 +79,10 @@
 #include <prerror.h>
 #endif
 
+#if defined(HAVE_LIBNSS) && defined(CKM_AES_GCM)
+#define TOTEM_AES_GCM 1
+#endif
+
 #ifndef MSG_NOSIGNAL
 #define MSG_NOSIGNAL 0
 #endif
@@ -91,6 +97,16 @@
 
 #define MESSAGE_TYPE_MCAST	1
 
+/*
+ * Maximum number of datagrams drained from a socket per poll wakeup
+ */
+#define RECV_BATCH_MAX		16
+
+/*
+ * Maximum number of multicast datagrams coalesced into one transmit batch
+ */
+#define SEND_BATCH_MAX		32
+
 #define HMAC_HASH_SIZE 20
 struct security_header {
 	unsigned char hash_digest[HMAC_HASH_SIZE]; /* The hash *MUST* be first in the data structure */
@@ -98,6 +114,17 @@ struct security_header {
 	char msg[0];
 } __attribute__((packed));
 
+/*
+ * AES-GCM frames carry only the nonce in front of the ciphertext; the
+ * 16 byte authentication tag follows it
+ */
+#define GCM_NONCE_SIZE	12
+#define GCM_TAG_SIZE	16
+struct security_header_gcm {
+	unsigned char nonce[GCM_NONCE_SIZE];
+	char msg[0];
+} __attribute__((packed));
+
 struct totemudp_mcast_thread_state {
 	unsigned char iobuf[FRAME_SIZE_MAX];
 	prng_state prng_state;
@@ -119,6 +146,12 @@ struct totemudp_instance {
 	PK11SymKey   *nss_sym_key_sign;
 #endif
 
+#ifdef TOTEM_AES_GCM
+	PK11SymKey   *nss_sym_key_gcm;
+
+	unsigned char gcm_nonce[GCM_NONCE_SIZE];
+#endif
+
 	unsigned char totemudp_private_key[1024];
 
 	unsigned int totemudp_private_key_len;
@@ -170,14 +203,52 @@ struct totemudp_instance {
 
 	void *udp_context;
 
-	char iov_buffer[FRAME_SIZE_MAX];
+	char iov_buffer[RECV_BATCH_MAX][FRAME_SIZE_MAX];
 
 	char iov_buffer_flush[FRAME_SIZE_MAX];
 
-	struct iovec totemudp_iov_recv;
+	struct iovec totemudp_iov_recv[RECV_BATCH_MAX];
+
+	struct sockaddr_storage totemudp_recv_from[RECV_BATCH_MAX];
+
+#ifdef HAVE_RECVMMSG
+	struct mmsghdr totemudp_recv_msgs[RECV_BATCH_MAX];
+#endif
 
 	struct iovec totemudp_iov_recv_flush;
 
+	char send_buffer[SEND_BATCH_MAX][FRAME_SIZE_MAX];
+
+	struct iovec totemudp_iov_send[SEND_BATCH_MAX];
+
+	void *send_frame[SEND_BATCH_MAX];
+
+	struct totemframe_pool *frame_pool;
+
+#ifdef HAVE_SENDMMSG
+	struct mmsghdr totemudp_send_msgs[SEND_BATCH_MAX];
+#endif
+
+	unsigned int send_queue_len;
+
+	struct worker_thread_group worker_thread_group;
+
+	int crypto_threads;
+
+	pthread_mutex_t crypto_mutex;
+
+	int recv_crypto_res[RECV_BATCH_MAX];
+
+	/*
+	 * Frames of the batch being delivered, frames from recv_batch_next
+	 * on were received but not delivered yet
+	 */
+	int recv_batch_frames;
+
+	int recv_batch_next;
+
+	int recv_batch_fd;
+
 	struct totemudp_socket totemudp_sockets;
 
 	struct totem_ip_address mcast_address;
@@ -206,12 +277,18 @@ struct totemudp_instance {
 
 	struct totem_config *totem_config;
 
+	totemnet_stats_t *stats;
+
 	struct totem_ip_address token_target;
 };
 
+#define WORK_ITEM_ENCRYPT	0
+#define WORK_ITEM_DECRYPT	1
+
 struct work_item {
-	const void *msg;
-	unsigned int msg_len;
+	int type;
+	unsigned int index;
+	int len;
 	struct totemudp_instance *instance;
 };
 
@@ -226,13 +303,19 @@ static struct totem_ip_address localhost;
 
 static void totemudp_instance_initialize (struct totemudp_instance *instance)
 {
+	int i;
+
 	memset (instance, 0, sizeof (struct totemudp_instance));
 
+	pthread_mutex_init (&instance->crypto_mutex, NULL);
+
 	instance->netif_state_report = NETIF_STATE_REPORT_UP | NETIF_STATE_REPORT_DOWN;
 
-	instance->totemudp_iov_recv.iov_base = instance->iov_buffer;
+	for (i = 0; i < RECV_BATCH_MAX; i++) {
+		instance->totemudp_iov_recv[i].iov_base = instance->iov_buffer[i];
+		instance->totemudp_iov_recv[i].iov_len = FRAME_SIZE_MAX;
+	}
 
-	instance->totemudp_iov_recv.iov_len = FRAME_SIZE_MAX; //sizeof (instance->iov_buffer);
 	instance->totemudp_iov_recv_flush.iov_base = instance->iov_buffer_flush;
 
 	instance->totemudp_iov_recv_flush.iov_len = FRAME_SIZE_MAX; //sizeof (instance->iov_buffer);
@@ -475,14 +558,25 @@ static int encrypt_and_sign_nss (
 	no_params.len = 0;
 
 	tmp1_outlen = tmp2_outlen = 0;
-	inbuf = copy_from_iovec(iovec, iov_len, &datalen);
-	if (!inbuf) {
-		log_printf(instance->totemudp_log_level_security, "malloc error copying buffer from iovec\n");
-		return -1;
-	}
+	if (iov_len == 2 &&
+		iovec[0].iov_len == sizeof (struct security_header)) {
+		/*
+		 * The payload is contiguous so encrypt it straight out of
+		 * the caller's frame instead of bouncing it through a copy
+		 */
+		inbuf = NULL;
+		data = iovec[1].iov_base;
+		datalen = iovec[1].iov_len;
+	} else {
+		inbuf = copy_from_iovec(iovec, iov_len, &datalen);
+		if (!inbuf) {
+			log_printf(instance->totemudp_log_level_security, "malloc error copying buffer from iovec\n");
+			return -1;
+		}
 
-	data = inbuf + sizeof (struct security_header);
-	datalen -= sizeof (struct security_header);
+		data = inbuf + sizeof (struct security_header);
+		datalen -= sizeof (struct security_header);
+	}
 
 	outdata = buf + sizeof (struct security_header);
 	header = (struct security_header *)buf;
@@ -698,6 +792,208 @@ static int authenticate_and_decrypt_nss (
 }
 #endif
 
+#ifdef TOTEM_AES_GCM
+static int init_gcm_crypto(
+	struct totemudp_instance *instance)
+{
+	PK11SlotInfo*      gcm_slot = NULL;
+	SECItem            key_item;
+	SECStatus          rv;
+
+	log_printf(instance->totemudp_log_level_notice,
+		"Initializing transmit/receive security: NSS AES256GCM (mode 2).\n");
+	rv = NSS_NoDB_Init(".");
+	if (rv != SECSuccess)
+	{
+		log_printf(instance->totemudp_log_level_security, "NSS initialization failed (err %d)\n",
+			PR_GetError());
+		return 0;
+	}
+
+	gcm_slot = PK11_GetBestSlot(CKM_AES_GCM, NULL);
+	if (gcm_slot == NULL)
+	{
+		log_printf(instance->totemudp_log_level_security, "Unable to find security slot (err %d)\n",
+			PR_GetError());
+		return 0;
+	}
+
+	/*
+	 * The key schedule is expanded once here and reused for every frame
+	 */
+	key_item.type = siBuffer;
+	key_item.data = instance->totem_config->private_key;
+	key_item.len = 32; /* Use 256 bits */
+
+	instance->nss_sym_key_gcm = PK11_ImportSymKey(gcm_slot,
+		CKM_AES_GCM,
+		PK11_OriginUnwrap, CKA_ENCRYPT|CKA_DECRYPT,
+		&key_item, NULL);
+	PK11_FreeSlot(gcm_slot);
+	if (instance->nss_sym_key_gcm == NULL)
+	{
+		log_printf(instance->totemudp_log_level_security, "Failure to import key into NSS (err %d)\n",
+			PR_GetError());
+		return 0;
+	}
+
+	/*
+	 * Start the nonce at a random point.  It is then used as a counter,
+	 * so it never repeats for this key on this node and the chance of
+	 * two nodes' ranges overlapping is negligible
+	 */
+	rv = PK11_GenerateRandom (instance->gcm_nonce, sizeof (instance->gcm_nonce));
+	if (rv != SECSuccess) {
+		/*
+		 * Every node would walk the same nonces from zero under the
+		 * shared key, which gives away both plaintext and key
+		 */
+		log_printf(instance->totemudp_log_level_security,
+			"Failure to generate a random GCM nonce (err %d)\n",
+			PR_GetError());
+		PK11_FreeSymKey(instance->nss_sym_key_gcm);
+		instance->nss_sym_key_gcm = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+static void gcm_params_set (
+	CK_GCM_PARAMS *gcm_params,
+	SECItem *param,
+	unsigned char *nonce)
+{
+	memset (gcm_params, 0, sizeof (CK_GCM_PARAMS));
+	gcm_params->pIv = nonce;
+	gcm_params->ulIvLen = GCM_NONCE_SIZE;
+#ifdef HAVE_CK_GCM_PARAMS_ULIVBITS
+	gcm_params->ulIvBits = GCM_NONCE_SIZE * 8;
+#endif
+	gcm_params->pAAD = NULL;
+	gcm_params->ulAADLen = 0;
+	gcm_params->ulTagBits = GCM_TAG_SIZE * 8;
+
+	param->type = siBuffer;
+	param->data = (unsigned char *)gcm_params;
+	param->len = sizeof (CK_GCM_PARAMS);
+}
+
+static int encrypt_and_sign_gcm (
+	struct totemudp_instance *instance,
+	unsigned char *buf,
+	size_t *buf_len,
+	const struct iovec *iovec,
+	unsigned int iov_len)
+{
+	struct security_header_gcm *header = (struct security_header_gcm *)buf;
+	CK_GCM_PARAMS      gcm_params;
+	SECItem            param;
+	SECStatus          rv;
+	unsigned char      *inbuf;
+	unsigned char      *data;
+	size_t             datalen;
+	unsigned int       outlen = 0;
+	int                i;
+
+	if (instance->nss_sym_key_gcm == NULL) {
+		return -1;
+	}
+
+	/*
+	 * iovec[0] is the space callers reserve for struct security_header,
+	 * which this engine does not use
+	 */
+	if (iov_len == 2 &&
+		iovec[0].iov_len == sizeof (struct security_header)) {
+		inbuf = NULL;
+		data = iovec[1].iov_base;
+		datalen = iovec[1].iov_len;
+	} else {
+		inbuf = copy_from_iovec(iovec, iov_len, &datalen);
+		if (!inbuf) {
+			log_printf(instance->totemudp_log_level_security, "malloc error copying buffer from iovec\n");
+			return -1;
+		}
+		data = inbuf + sizeof (struct security_header);
+		datalen -= sizeof (struct security_header);
+	}
+
+	/*
+	 * Use the current counter value as this frame's nonce and advance it
+	 */
+	pthread_mutex_lock (&instance->crypto_mutex);
+	memcpy (header->nonce, instance->gcm_nonce, GCM_NONCE_SIZE);
+	for (i = GCM_NONCE_SIZE - 1; i >= 0; i--) {
+		if (++instance->gcm_nonce[i] != 0) {
+			break;
+		}
+	}
+	pthread_mutex_unlock (&instance->crypto_mutex);
+
+	gcm_params_set (&gcm_params, &param, header->nonce);
+
+	rv = PK11_Encrypt (instance->nss_sym_key_gcm, CKM_AES_GCM, &param,
+		(unsigned char *)header->msg, &outlen,
+		FRAME_SIZE_MAX - sizeof (struct security_header_gcm) - 1,
+		data, datalen);
+	free (inbuf);
+	if (rv != SECSuccess) {
+		log_printf(instance->totemudp_log_level_security,
+			"PK11_Encrypt (AES-GCM) failed (err %d)\n",
+			PR_GetError());
+		return -1;
+	}
+
+	*buf_len = sizeof (struct security_header_gcm) + outlen;
+
+	return 0;
+}
+
+static int authenticate_and_decrypt_gcm (
+	struct totemudp_instance *instance,
+	struct iovec *iov,
+	unsigned int iov_len)
+{
+	struct security_header_gcm *header = (struct security_header_gcm *)iov[0].iov_base;
+	unsigned char outbuf[FRAME_SIZE_MAX];
+	CK_GCM_PARAMS gcm_params;
+	SECItem       param;
+	SECStatus     rv;
+	unsigned int  outlen = 0;
+
+	if (instance->nss_sym_key_gcm == NULL || iov_len != 1 ||
+		iov[0].iov_len < sizeof (struct security_header_gcm) + GCM_TAG_SIZE) {
+		return -1;
+	}
+
+	gcm_params_set (&gcm_params, &param, header->nonce);
+
+	rv = PK11_Decrypt (instance->nss_sym_key_gcm, CKM_AES_GCM, &param,
+		outbuf, &outlen, sizeof (outbuf),
+		(unsigned char *)header->msg,
+		iov[0].iov_len - sizeof (struct security_header_gcm));
+	if (rv != SECSuccess) {
+		log_printf(instance->totemudp_log_level_security,
+			"PK11_Decrypt (AES-GCM) failed (err %d)\n",
+			PR_GetError());
+		return -1;
+	}
+	if (sizeof (struct security_header) + outlen > FRAME_SIZE_MAX) {
+		return -1;
+	}
+
+	/*
+	 * Place the plaintext where callers expect it for every other
+	 * crypto type, just past a struct security_header
+	 */
+	memcpy ((unsigned char *)iov[0].iov_base + sizeof (struct security_header),
+		outbuf, outlen);
+	iov[0].iov_len = sizeof (struct security_header) + outlen;
+
+	return 0;
+}
+#endif
+
 static int encrypt_and_sign_sober (
 	struct totemudp_instance *instance,
 	unsigned char *buf,
@@ -728,7 +1024,9 @@ static int encrypt_and_sign_sober (
 	/*
 	 * Generate MAC, CIPHER, IV keys from private key
 	 */
+	pthread_mutex_lock (&instance->crypto_mutex);
 	sober128_read (header->salt, sizeof (header->salt), prng_state_in);
+	pthread_mutex_unlock (&instance->crypto_mutex);
 	sober128_start (&keygen_prng_state);
 	sober128_add_entropy (instance->totemudp_private_key,
 		instance->totemudp_private_key_len,
@@ -795,6 +1093,10 @@ static int encrypt_and_sign_worker (
 #ifdef HAVE_LIBNSS
 	if (instance->totem_config->crypto_type == TOTEM_CRYPTO_NSS)
 		return encrypt_and_sign_nss(instance, buf, buf_len, iovec, iov_len);
+#endif
+#ifdef TOTEM_AES_GCM
+	if (instance->totem_config->crypto_type == TOTEM_CRYPTO_AES_GCM)
+		return encrypt_and_sign_gcm(instance, buf, buf_len, iovec, iov_len);
 #endif
 	return -1;
 }
@@ -824,6 +1126,10 @@ static int authenticate_and_decrypt (
 #ifdef HAVE_LIBNSS
 		if (type == TOTEM_CRYPTO_NSS)
 		    res = authenticate_and_decrypt_nss(instance, iov, iov_len);
+#endif
+#ifdef TOTEM_AES_GCM
+		if (type == TOTEM_CRYPTO_AES_GCM)
+		    res = authenticate_and_decrypt_gcm(instance, iov, iov_len);
 #endif
 	}
 
@@ -839,7 +1145,7 @@ static int authenticate_and_decrypt (
 	return res;
 }
 
-static void init_crypto(
+static int init_crypto(
 	struct totemudp_instance *instance)
 {
 	/*
@@ -850,11 +1156,17 @@ static void init_crypto(
 	init_sober_crypto(instance);
 
 	if (instance->totem_config->crypto_accept == TOTEM_CRYPTO_ACCEPT_OLD)
-		return;
+		return 0;
 
 #ifdef HAVE_LIBNSS
 	init_nss_crypto(instance);
 #endif
+#ifdef TOTEM_AES_GCM
+	if (init_gcm_crypto(instance) == -1) {
+		return -1;
+	}
+#endif
+	return 0;
 }
 
 int totemudp_crypto_set (
@@ -882,6 +1194,12 @@ int totemudp_crypto_set (
 				log_printf(instance->totemudp_log_level_security,
 					"Transmit security set to: NSS AES128CBC/SHA1HMAC (mode 1)");
 				break;
+#ifdef TOTEM_AES_GCM
+			case TOTEM_CRYPTO_AES_GCM:
+				log_printf(instance->totemudp_log_level_security,
+					"Transmit security set to: NSS AES256GCM (mode 2)");
+				break;
+#endif
 			default:
 				res = -1;
 				break;
@@ -1058,6 +1376,246 @@ static inline void mcast_sendmsg (
 	}
 }
 
+/*
+ * Encrypt and sign msg into buf and append the crypto type trailer
+ */
+static void frame_encrypt (
+	struct totemudp_instance *instance,
+	unsigned char *buf,
+	size_t *buf_len,
+	const void *msg,
+	unsigned int msg_len)
+{
+	unsigned char sheader[sizeof (struct security_header)];
+	struct iovec iovec_encrypt[2];
+
+	iovec_encrypt[0].iov_base = (void *)sheader;
+	iovec_encrypt[0].iov_len = sizeof (struct security_header);
+	iovec_encrypt[1].iov_base = (void *)msg;
+	iovec_encrypt[1].iov_len = msg_len;
+
+	encrypt_and_sign_worker (
+		instance,
+		buf,
+		buf_len,
+		iovec_encrypt,
+		2);
+
+	if (instance->totem_config->crypto_accept == TOTEM_CRYPTO_ACCEPT_NEW) {
+		buf[(*buf_len)++] = instance->totem_config->crypto_type;
+	}
+	else {
+		buf[(*buf_len)++] = 0;
+	}
+}
+
+/*
+ * Authenticate and decrypt a received datagram in place.  Returns 0 when
+ * the frame may be delivered.
+ */
+static int net_authenticate_frame (
+	struct totemudp_instance *instance,
+	struct iovec *iovec,
+	int bytes_received)
+{
+	int res = 0;
+
+	if ((instance->totem_config->secauth == 1) &&
+		(bytes_received < sizeof (struct security_header))) {
+
+		log_printf (instance->totemudp_log_level_security, "Received message is too short...  ignoring %d.\n", bytes_received);
+		return (-1);
+	}
+
+	iovec->iov_len = bytes_received;
+	if (instance->totem_config->secauth == 1) {
+		/*
+		 * Authenticate and if authenticated, decrypt datagram
+		 */
+
+		res = authenticate_and_decrypt (instance, iovec, 1);
+		if (res == -1) {
+			log_printf (instance->totemudp_log_level_security, "Received message has invalid digest... ignoring.\n");
+			log_printf (instance->totemudp_log_level_security,
+				"Invalid packet data\n");
+			iovec->iov_len = FRAME_SIZE_MAX;
+			return (-1);
+		}
+	}
+	return (0);
+}
+
+/*
+ * Runs on a crypto thread.  Each work item only touches its own slot of
+ * the transmit queue or receive ring.
+ */
+static void crypto_worker_fn (void *thread_state, void *work_item_in)
+{
+	struct work_item *work_item = (struct work_item *)work_item_in;
+	struct totemudp_instance *instance = work_item->instance;
+	unsigned int index = work_item->index;
+	size_t buf_len;
+
+	if (work_item->type == WORK_ITEM_ENCRYPT) {
+		frame_encrypt (instance,
+			(unsigned char *)instance->send_buffer[index], &buf_len,
+			instance->totemudp_iov_send[index].iov_base,
+			instance->totemudp_iov_send[index].iov_len);
+		instance->totemudp_iov_send[index].iov_base = instance->send_buffer[index];
+		instance->totemudp_iov_send[index].iov_len = buf_len;
+	} else {
+		instance->recv_crypto_res[index] = net_authenticate_frame (instance,
+			&instance->totemudp_iov_recv[index], work_item->len);
+	}
+}
+
+static void crypto_work_add (
+	struct totemudp_instance *instance,
+	struct work_item *work_item)
+{
+	if (worker_thread_group_work_add (&instance->worker_thread_group,
+		work_item) != 0) {
+
+		crypto_worker_fn (NULL, work_item);
+	}
+}
+
+/*
+ * Encrypt every queued frame on the crypto threads.  The queue keeps its
+ * order, so frames still go out in the order totemsrp sent them.
+ */
+static void mcast_send_queue_encrypt (
+	struct totemudp_instance *instance)
+{
+	struct work_item work_item;
+	unsigned int i;
+
+	work_item.type = WORK_ITEM_ENCRYPT;
+	work_item.len = 0;
+	work_item.instance = instance;
+	for (i = 0; i < instance->send_queue_len; i++) {
+		work_item.index = i;
+		crypto_work_add (instance, &work_item);
+	}
+	worker_thread_group_wait (&instance->worker_thread_group);
+}
+
+static void mcast_send_queue_flush (
+	struct totemudp_instance *instance)
+{
+	struct msghdr msg_mcast;
+	struct sockaddr_storage sockaddr;
+	int addrlen;
+	unsigned int sent = 0;
+	int res;
+#ifdef HAVE_SENDMMSG
+	unsigned int i;
+#endif
+
+	if (instance->send_queue_len == 0) {
+		return;
+	}
+
+	if (instance->crypto_threads) {
+		mcast_send_queue_encrypt (instance);
+	}
+
+	totemip_totemip_to_sockaddr_convert(&instance->mcast_address,
+		instance->totem_interface->ip_port, &sockaddr, &addrlen);
+
+	memset (&msg_mcast, 0, sizeof (msg_mcast));
+	msg_mcast.msg_name = &sockaddr;
+	msg_mcast.msg_namelen = addrlen;
+	msg_mcast.msg_iovlen = 1;
+
+#ifdef HAVE_SENDMMSG
+	for (i = 0; i < instance->send_queue_len; i++) {
+		instance->totemudp_send_msgs[i].msg_hdr = msg_mcast;
+		instance->totemudp_send_msgs[i].msg_hdr.msg_iov =
+			&instance->totemudp_iov_send[i];
+		instance->totemudp_send_msgs[i].msg_len = 0;
+	}
+
+	while (sent < instance->send_queue_len) {
+		/*
+		 * Transmit multicast messages
+		 * An error here is recovered by totemsrp
+		 */
+		res = sendmmsg (instance->totemudp_sockets.mcast_send,
+			&instance->totemudp_send_msgs[sent],
+			instance->send_queue_len - sent, MSG_NOSIGNAL);
+		if (res < 0) {
+			LOGSYS_PERROR (errno, instance->totemudp_log_level_debug,
+				"sendmmsg(mcast) failed (non-critical)");
+			/*
+			 * Drop the frame the kernel refused and carry on
+			 */
+			res = 1;
+		}
+		sent += res;
+		instance->stats->tx_batches++;
+	}
+#else
+	for (sent = 0; sent < instance->send_queue_len; sent++) {
+		msg_mcast.msg_iov = &instance->totemudp_iov_send[sent];
+		res = sendmsg (instance->totemudp_sockets.mcast_send, &msg_mcast,
+			MSG_NOSIGNAL);
+		if (res < 0) {
+			LOGSYS_PERROR (errno, instance->totemudp_log_level_debug,
+				"sendmsg(mcast) failed (non-critical)");
+		}
+	}
+	instance->stats->tx_batches++;
+#endif
+	instance->stats->tx_frames += instance->send_queue_len;
+
+	for (sent = 0; sent < instance->send_queue_len; sent++) {
+		totemframe_release (instance->send_frame[sent]);
+		instance->send_frame[sent] = NULL;
+	}
+	instance->send_queue_len = 0;
+}
+
+/*
+ * Queue a frame for transmission.  With secauth the frame is encrypted
+ * into the next free slot of the transmit queue, otherwise the queue
+ * holds a reference on it, so msg must come from buffer_alloc.  The
+ * queue is handed to the kernel by mcast_send_queue_flush
+ */
+static inline void mcast_send_queue (
+	struct totemudp_instance *instance,
+	const void *msg,
+	unsigned int msg_len)
+{
+	size_t buf_len;
+	unsigned char *buf;
+
+	if (instance->send_queue_len == SEND_BATCH_MAX) {
+		mcast_send_queue_flush (instance);
+	}
+
+	buf = (unsigned char *)instance->send_buffer[instance->send_queue_len];
+
+	if (instance->totem_config->secauth == 1 &&
+		instance->crypto_threads == 0) {
+
+		frame_encrypt (instance, buf, &buf_len, msg, msg_len);
+	} else {
+		/*
+		 * Hold a reference on the caller's frame rather than copying
+		 * it.  With crypto threads it is encrypted when the queue is
+		 * flushed.
+		 */
+		totemframe_ref ((void *)msg);
+		instance->send_frame[instance->send_queue_len] = (void *)msg;
+		buf = (unsigned char *)msg;
+		buf_len = msg_len;
+	}
+
+	instance->totemudp_iov_send[instance->send_queue_len].iov_base = buf;
+	instance->totemudp_iov_send[instance->send_queue_len].iov_len = buf_len;
+	instance->send_queue_len += 1;
+}
 
 int totemudp_finalize (
 	void *udp_context)
@@ -1065,6 +1623,11 @@ int totemudp_finalize (
 	struct totemudp_instance *instance = (struct totemudp_instance *)udp_context;
 	int res = 0;
 
+	if (instance->crypto_threads) {
+		worker_thread_group_exit (&instance->worker_thread_group);
+		instance->crypto_threads = 0;
+	}
+
 	if (instance->totemudp_sockets.mcast_recv > 0) {
 		close (instance->totemudp_sockets.mcast_recv);
 	 	qb_loop_poll_del (instance->totemudp_poll_handle,
@@ -1079,38 +1642,75 @@ int totemudp_finalize (
 			instance->totemudp_sockets.token);
 	}
 
+	totemframe_pool_destroy (instance->frame_pool);
+	instance->frame_pool = NULL;
+
 	return (res);
 }
 
 /*
  * Only designed to work with a message with one iov
  */
-
-static int net_deliver_fn (
-	int fd,
-	int revents,
-	void *data)
+static void net_deliver_authenticated (
+	struct totemudp_instance *instance,
+	struct iovec *iovec)
 {
-	struct totemudp_instance *instance = (struct totemudp_instance *)data;
-	struct msghdr msg_recv;
-	struct iovec *iovec;
-	struct sockaddr_storage system_from;
-	int bytes_received;
-	int res = 0;
 	unsigned char *msg_offset;
 	unsigned int size_delv;
 	char *message_type;
 
-	if (instance->flushing == 1) {
-		iovec = &instance->totemudp_iov_recv_flush;
+	if (instance->totem_config->secauth == 1) {
+		msg_offset = (unsigned char *)iovec->iov_base +
+			sizeof (struct security_header);
+		size_delv = iovec->iov_len - sizeof (struct security_header);
 	} else {
-		iovec = &instance->totemudp_iov_recv;
+		msg_offset = (void *)iovec->iov_base;
+		size_delv = iovec->iov_len;
 	}
 
 	/*
-	 * Receive datagram
+	 * Drop all non-mcast messages (more specifically join
+	 * messages should be dropped)
 	 */
-	msg_recv.msg_name = &system_from;
+	message_type = (char *)msg_offset;
+	if (instance->flushing == 1 && *message_type != MESSAGE_TYPE_MCAST) {
+		iovec->iov_len = FRAME_SIZE_MAX;
+		return;
+	}
+
+	/*
+	 * Handle incoming message
+	 */
+	instance->totemudp_deliver_fn (
+		instance->context,
+		msg_offset,
+		size_delv);
+
+	iovec->iov_len = FRAME_SIZE_MAX;
+}
+
+static void net_deliver_frame (
+	struct totemudp_instance *instance,
+	struct iovec *iovec,
+	int bytes_received)
+{
+	if (net_authenticate_frame (instance, iovec, bytes_received) == 0) {
+		net_deliver_authenticated (instance, iovec);
+	}
+}
+
+/*
+ * Receive a single datagram into iovec.  Used while flushing, where
+ * net_deliver_fn may be reentered from inside a batch delivery.
+ */
+static int net_recv_one (
+	int fd,
+	struct iovec *iovec,
+	struct sockaddr_storage *system_from)
+{
+	struct msghdr msg_recv;
+
+	msg_recv.msg_name = system_from;
 	msg_recv.msg_namelen = sizeof (struct sockaddr_storage);
 	msg_recv.msg_iov = iovec;
 	msg_recv.msg_iovlen = 1;
@@ -1123,61 +1723,135 @@ static int net_deliver_fn (
 	msg_recv.msg_accrightslen = 0;
 #endif
 
-	bytes_received = recvmsg (fd, &msg_recv, MSG_NOSIGNAL | MSG_DONTWAIT);
-	if (bytes_received == -1) {
+	return (recvmsg (fd, &msg_recv, MSG_NOSIGNAL | MSG_DONTWAIT));
+}
+
+/*
+ * Drain up to RECV_BATCH_MAX datagrams into the receive ring.
+ * Returns the number of datagrams received and stores their lengths
+ * in bytes_received.
+ */
+static int net_recv_batch (
+	struct totemudp_instance *instance,
+	int fd,
+	int *bytes_received)
+{
+#ifdef HAVE_RECVMMSG
+	struct mmsghdr *msgs = instance->totemudp_recv_msgs;
+	int i;
+	int res;
+
+	for (i = 0; i < RECV_BATCH_MAX; i++) {
+		instance->totemudp_iov_recv[i].iov_len = FRAME_SIZE_MAX;
+		memset (&msgs[i], 0, sizeof (struct mmsghdr));
+		msgs[i].msg_hdr.msg_name = &instance->totemudp_recv_from[i];
+		msgs[i].msg_hdr.msg_namelen = sizeof (struct sockaddr_storage);
+		msgs[i].msg_hdr.msg_iov = &instance->totemudp_iov_recv[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	res = recvmmsg (fd, msgs, RECV_BATCH_MAX,
+		MSG_NOSIGNAL | MSG_DONTWAIT, NULL);
+	if (res == -1) {
+		return (0);
+	}
+	for (i = 0; i < res; i++) {
+		bytes_received[i] = msgs[i].msg_len;
+	}
+	return (res);
+#else
+	instance->totemudp_iov_recv[0].iov_len = FRAME_SIZE_MAX;
+	bytes_received[0] = net_recv_one (fd, &instance->totemudp_iov_recv[0],
+		&instance->totemudp_recv_from[0]);
+	if (bytes_received[0] == -1) {
 		return (0);
-	} else {
-		instance->stats_recv += bytes_received;
 	}
+	return (1);
+#endif
+}
 
-	if ((instance->totem_config->secauth == 1) &&
-		(bytes_received < sizeof (struct security_header))) {
+static int net_deliver_fn (
+	int fd,
+	int revents,
+	void *data)
+{
+	struct totemudp_instance *instance = (struct totemudp_instance *)data;
+	struct sockaddr_storage system_from;
+	int bytes_received[RECV_BATCH_MAX];
+	struct work_item work_item;
+	int frames;
+	int i;
 
-		log_printf (instance->totemudp_log_level_security, "Received message is too short...  ignoring %d.\n", bytes_received);
+	if (instance->flushing == 1) {
+		bytes_received[0] = net_recv_one (fd,
+			&instance->totemudp_iov_recv_flush, &system_from);
+		if (bytes_received[0] == -1) {
+			return (0);
+		}
+		instance->stats_recv += bytes_received[0];
+		net_deliver_frame (instance, &instance->totemudp_iov_recv_flush,
+			bytes_received[0]);
 		return (0);
 	}
 
-	iovec->iov_len = bytes_received;
-	if (instance->totem_config->secauth == 1) {
-		/*
-		 * Authenticate and if authenticated, decrypt datagram
-		 */
+	/*
+	 * Receive a batch of datagrams
+	 */
+	frames = net_recv_batch (instance, fd, bytes_received);
+	if (frames == 0) {
+		return (0);
+	}
 
-		res = authenticate_and_decrypt (instance, iovec, 1);
-		if (res == -1) {
-			log_printf (instance->totemudp_log_level_security, "Received message has invalid digest... ignoring.\n");
-			log_printf (instance->totemudp_log_level_security,
-				"Invalid packet data\n");
-			iovec->iov_len = FRAME_SIZE_MAX;
-			return 0;
-		}
-		msg_offset = (unsigned char *)iovec->iov_base +
-			sizeof (struct security_header);
-		size_delv = bytes_received - sizeof (struct security_header);
-	} else {
-		msg_offset = (void *)iovec->iov_base;
-		size_delv = bytes_received;
+	instance->stats->rx_batches++;
+	instance->stats->rx_frames += frames;
+	if (frames > instance->stats->rx_batch_max) {
+		instance->stats->rx_batch_max = frames;
+	}
+	for (i = 0; i < frames; i++) {
+		instance->stats_recv += bytes_received[i];
 	}
+	instance->recv_batch_frames = frames;
+	instance->recv_batch_next = 0;
+	instance->recv_batch_fd = fd;
 
 	/*
-	 * Drop all non-mcast messages (more specifically join
-	 * messages should be dropped)
+	 * With crypto threads a batch of multicast frames is authenticated
+	 * in parallel and then delivered in the order it was received.  The
+	 * token socket and single frames stay on this thread.
 	 */
-	message_type = (char *)msg_offset;
-	if (instance->flushing == 1 && *message_type != MESSAGE_TYPE_MCAST) {
-		iovec->iov_len = FRAME_SIZE_MAX;
+	if (instance->crypto_threads && frames > 1 &&
+		fd != instance->totemudp_sockets.token) {
+		work_item.type = WORK_ITEM_DECRYPT;
+		work_item.instance = instance;
+		for (i = 0; i < frames; i++) {
+			work_item.index = i;
+			work_item.len = bytes_received[i];
+			crypto_work_add (instance, &work_item);
+		}
+		worker_thread_group_wait (&instance->worker_thread_group);
+
+		while (instance->recv_batch_next < instance->recv_batch_frames) {
+			i = instance->recv_batch_next++;
+			if (instance->recv_crypto_res[i] == 0) {
+				net_deliver_authenticated (instance,
+					&instance->totemudp_iov_recv[i]);
+			}
+		}
+		instance->recv_batch_frames = 0;
 		return (0);
 	}
-	
+
 	/*
-	 * Handle incoming message
+	 * Authenticate and deliver the whole batch.  recv_mcast_empty may
+	 * drop the rest of a multicast batch while a frame is delivered.
 	 */
-	instance->totemudp_deliver_fn (
-		instance->context,
-		msg_offset,
-		size_delv);
+	while (instance->recv_batch_next < instance->recv_batch_frames) {
+		i = instance->recv_batch_next++;
+		net_deliver_frame (instance, &instance->totemudp_iov_recv[i],
+			bytes_received[i]);
+	}
+	instance->recv_batch_frames = 0;
 
-	iovec->iov_len = FRAME_SIZE_MAX;
 	return (0);
 }
 
@@ -1684,6 +2358,7 @@ int totemudp_initialize (
 	qb_loop_t *poll_handle,
 	void **udp_context,
 	struct totem_config *totem_config,
+	totemnet_stats_t *stats,
 	int interface_no,
 	void *context,
 
@@ -1709,6 +2384,19 @@ int totemudp_initialize (
 	totemudp_instance_initialize (instance);
 
 	instance->totem_config = totem_config;
+	instance->stats = stats;
+
+	/*
+	 * Enough full size frames for a full new message queue plus a
+	 * window of messages waiting in the sort queue
+	 */
+	instance->frame_pool = totemframe_pool_create (totem_config->net_mtu,
+		MESSAGE_QUEUE_MAX + totem_config->window_size,
+		&stats->frame_pool);
+	if (instance->frame_pool == NULL) {
+		free (instance);
+		return (-1);
+	}
 	/*
 	* Configure logging
 	*/
@@ -1728,14 +2416,30 @@ int totemudp_initialize (
 
 	instance->totemudp_private_key_len = totem_config->private_key_len;
 
-	init_crypto(instance);
+	if (init_crypto(instance) == -1) {
+		totemframe_pool_destroy (instance->frame_pool);
+		free (instance);
+		return (-1);
+	}
+
+	if (totem_config->threads > 0) {
+		if (worker_thread_group_init (&instance->worker_thread_group,
+			totem_config->threads, RECV_BATCH_MAX + SEND_BATCH_MAX,
+			sizeof (struct work_item), 0, NULL,
+			crypto_worker_fn) == 0) {
+
+			instance->crypto_threads = totem_config->threads;
+		} else {
+			log_printf (instance->totemudp_log_level_warning,
+				"Unable to start crypto threads, encrypting on the main thread\n");
+		}
+	}
 
 	/*
 	 * Initialize local variables for totemudp
 	 */
 	instance->totem_interface = &totem_config->interfaces[interface_no];
 	totemip_copy (&instance->mcast_address, &instance->totem_interface->mcast_addr);
-	memset (instance->iov_buffer, 0, FRAME_SIZE_MAX);
 
 	instance->totemudp_poll_handle = poll_handle;
 
@@ -1766,14 +2470,16 @@ int totemudp_initialize (
 	return (0);
 }
 
-void *totemudp_buffer_alloc (void)
+void *totemudp_buffer_alloc (void *udp_context, size_t size)
 {
-	return malloc (FRAME_SIZE_MAX);
+	struct totemudp_instance *instance = (struct totemudp_instance *)udp_context;
+
+	return totemframe_alloc (instance->frame_pool, size);
 }
 
-void totemudp_buffer_release (void *ptr)
+void totemudp_buffer_release (void *udp_context, void *ptr)
 {
-	return free (ptr);
+	totemframe_release (ptr);
 }
 
 int totemudp_processor_count_set (
@@ -1824,6 +2530,10 @@ int totemudp_recv_flush (void *udp_context)
 
 int totemudp_send_flush (void *udp_context)
 {
+	struct totemudp_instance *instance = (struct totemudp_instance *)udp_context;
+
+	mcast_send_queue_flush (instance);
+
 	return 0;
 }
 
@@ -1835,6 +2545,8 @@ int totemudp_token_send (
 	struct totemudp_instance *instance = (struct totemudp_instance *)udp_context;
 	int res = 0;
 
+	mcast_send_queue_flush (instance);
+
 	ucast_sendmsg (instance, &instance->token_target, msg, msg_len);
 
 	return (res);
@@ -1847,6 +2559,8 @@ int totemudp_mcast_flush_send (
 	struct totemudp_instance *instance = (struct totemudp_instance *)udp_context;
 	int res = 0;
 
+	mcast_send_queue_flush (instance);
+
 	mcast_sendmsg (instance, msg, msg_len);
 
 	return (res);
@@ -1860,7 +2574,13 @@ int totemudp_mcast_noflush_send (
 	struct totemudp_instance *instance = (struct totemudp_instance *)udp_context;
 	int res = 0;
 
-	mcast_sendmsg (instance, msg, msg_len);
+	if (instance->totem_config->send_coalesce ||
+		instance->crypto_threads) {
+
+		mcast_send_queue (instance, msg, msg_len);
+	} else {
+		mcast_sendmsg (instance, msg, msg_len);
+	}
 
 	return (res);
 }
@@ -1878,7 +2598,12 @@ extern int totemudp_iface_check (void *udp_context)
 extern void totemudp_net_mtu_adjust (void *udp_context, struct totem_config *totem_config)
 {
 #define UDPIP_HEADER_SIZE (20 + 8) /* 20 bytes for ip 8 bytes for udp */
-	if (totem_config->secauth == 1) {
+	if (totem_config->secauth == 1 &&
+		totem_config->crypto_accept == TOTEM_CRYPTO_ACCEPT_NEW &&
+		totem_config->crypto_type == TOTEM_CRYPTO_AES_GCM) {
+		totem_config->net_mtu -= sizeof (struct security_header_gcm) +
+			GCM_TAG_SIZE + 1 + UDPIP_HEADER_SIZE;
+	} else if (totem_config->secauth == 1) {
 		totem_config->net_mtu -= sizeof (struct security_header) +
 			UDPIP_HEADER_SIZE;
 	} else {
@@ -1949,6 +2674,17 @@ extern int totemudp_recv_mcast_empty (
 	msg_recv.msg_accrightslen = 0;
 #endif
 
+	/*
+	 * Frames left in the multicast batch being delivered were already
+	 * taken off the socket and are dropped like the ones still on it
+	 */
+	if (instance->recv_batch_fd == instance->totemudp_sockets.mcast_recv &&
+		instance->recv_batch_next < instance->recv_batch_frames) {
+
+		instance->recv_batch_next = instance->recv_batch_frames;
+		msg_processed = 1;
+	}
+
 	do {
 		ufd.fd = instance->totemudp_sockets.mcast_recv;
 		ufd.events = POLLIN;
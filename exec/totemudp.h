@@ -48,6 +48,7 @@ extern int totemudp_initialize (
 	qb_loop_t* poll_handle,
 	void **udp_context,
 	struct totem_config *totem_config,
+	totemnet_stats_t *stats,
 	int interface_no,
 	void *context,
 
@@ -63,9 +64,9 @@ extern int totemudp_initialize (
 	void (*target_set_completed) (
 		void *context));
 
-extern void *totemudp_buffer_alloc (void);
+extern void *totemudp_buffer_alloc (void *udp_context, size_t size);
 
-extern void totemudp_buffer_release (void *ptr);
+extern void totemudp_buffer_release (void *udp_context, void *ptr);
 
 extern int totemudp_processor_count_set (
 	void *udp_context,
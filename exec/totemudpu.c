@@ -36,6 +36,7 @@
 #include <config.h>
 
 #include <assert.h>
+#include <pthread.h>
 #include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -68,6 +69,8 @@
 #include "totemudpu.h"
 
 #include "crypto.h"
+#include "totemframe.h"
+#include "wthread.h"
 #include "util.h"
 
 #ifdef HAVE_LIBNSS
@@ -77,6 +80,10 @@
 #include <prerror.h>
 #endif
 
+#if defined(HAVE_LIBNSS) && defined(CKM_AES_GCM)
+#define TOTEM_AES_GCM 1
+#endif
+
 #ifndef MSG_NOSIGNAL
 #define MSG_NOSIGNAL 0
 #endif
@@ -89,6 +96,16 @@
 #define BIND_STATE_REGULAR	1
 #define BIND_STATE_LOOPBACK	2
 
+/*
+ * Maximum number of datagrams drained from a socket per poll wakeup
+ */
+#define RECV_BATCH_MAX		16
+
+/*
+ * Maximum number of multicast datagrams coalesced into one transmit batch
+ */
+#define SEND_BATCH_MAX		32
+
 #define HMAC_HASH_SIZE 20
 struct security_header {
 	unsigned char hash_digest[HMAC_HASH_SIZE]; /* The hash *MUST* be first in the data structure */
@@ -96,6 +113,17 @@ struct security_header {
 	char msg[0];
 } __attribute__((packed));
 
+/*
+ * AES-GCM frames carry only the nonce in front of the ciphertext; the
+ * 16 byte authentication tag follows it
+ */
+#define GCM_NONCE_SIZE	12
+#define GCM_TAG_SIZE	16
+struct security_header_gcm {
+	unsigned char nonce[GCM_NONCE_SIZE];
+	char msg[0];
+} __attribute__((packed));
+
 struct totemudpu_member {
 	struct list_head list;
 	struct totem_ip_address member;
@@ -112,6 +140,12 @@ struct totemudpu_instance {
 	PK11SymKey   *nss_sym_key_sign;
 #endif
 
+#ifdef TOTEM_AES_GCM
+	PK11SymKey   *nss_sym_key_gcm;
+
+	unsigned char gcm_nonce[GCM_NONCE_SIZE];
+#endif
+
 	unsigned char totemudpu_private_key[1024];
 
 	unsigned int totemudpu_private_key_len;
@@ -163,9 +197,49 @@ struct totemudpu_instance {
 
 	void *udpu_context;
 
-	char iov_buffer[FRAME_SIZE_MAX];
+	char iov_buffer[RECV_BATCH_MAX][FRAME_SIZE_MAX];
+
+	char iov_buffer_flush[FRAME_SIZE_MAX];
+
+	struct iovec totemudpu_iov_recv[RECV_BATCH_MAX];
+
+	struct sockaddr_storage totemudpu_recv_from[RECV_BATCH_MAX];
+
+#ifdef HAVE_RECVMMSG
+	struct mmsghdr totemudpu_recv_msgs[RECV_BATCH_MAX];
+#endif
+
+	struct iovec totemudpu_iov_recv_flush;
+
+	char send_buffer[SEND_BATCH_MAX][FRAME_SIZE_MAX];
+
+	struct iovec totemudpu_iov_send[SEND_BATCH_MAX];
+
+	void *send_frame[SEND_BATCH_MAX];
+
+	struct totemframe_pool *frame_pool;
+
+#ifdef HAVE_SENDMMSG
+	struct mmsghdr totemudpu_send_msgs[SEND_BATCH_MAX];
+#endif
+
+	unsigned int send_queue_len;
+
+	struct worker_thread_group worker_thread_group;
+
+	int crypto_threads;
+
+	pthread_mutex_t crypto_mutex;
+
+	int recv_crypto_res[RECV_BATCH_MAX];
+
+	/*
+	 * Frames of the batch being delivered, frames from recv_batch_next
+	 * on were received but not delivered yet
+	 */
+	int recv_batch_frames;
 
-	struct iovec totemudpu_iov_recv;
+	int recv_batch_next;
 
 	struct list_head member_list;
 
@@ -191,14 +265,20 @@ struct totemudpu_instance {
 
 	struct totem_config *totem_config;
 
+	totemnet_stats_t *stats;
+
 	struct totem_ip_address token_target;
 
 	int token_socket;
 };
 
+#define WORK_ITEM_ENCRYPT	0
+#define WORK_ITEM_DECRYPT	1
+
 struct work_item {
-	const void *msg;
-	unsigned int msg_len;
+	int type;
+	unsigned int index;
+	int len;
 	struct totemudpu_instance *instance;
 };
 
@@ -211,13 +291,22 @@ static struct totem_ip_address localhost;
 
 static void totemudpu_instance_initialize (struct totemudpu_instance *instance)
 {
+	int i;
+
 	memset (instance, 0, sizeof (struct totemudpu_instance));
 
+	pthread_mutex_init (&instance->crypto_mutex, NULL);
+
 	instance->netif_state_report = NETIF_STATE_REPORT_UP | NETIF_STATE_REPORT_DOWN;
 
-	instance->totemudpu_iov_recv.iov_base = instance->iov_buffer;
+	for (i = 0; i < RECV_BATCH_MAX; i++) {
+		instance->totemudpu_iov_recv[i].iov_base = instance->iov_buffer[i];
+		instance->totemudpu_iov_recv[i].iov_len = FRAME_SIZE_MAX;
+	}
+
+	instance->totemudpu_iov_recv_flush.iov_base = instance->iov_buffer_flush;
 
-	instance->totemudpu_iov_recv.iov_len = FRAME_SIZE_MAX; //sizeof (instance->iov_buffer);
+	instance->totemudpu_iov_recv_flush.iov_len = FRAME_SIZE_MAX; //sizeof (instance->iov_buffer);
 
 	/*
 	 * There is always atleast 1 processor
@@ -457,14 +546,25 @@ static int encrypt_and_sign_nss (
 	no_params.len = 0;
 
 	tmp1_outlen = tmp2_outlen = 0;
-	inbuf = copy_from_iovec(iovec, iov_len, &datalen);
-	if (!inbuf) {
-		log_printf(instance->totemudpu_log_level_security, "malloc error copying buffer from iovec\n");
-		return -1;
-	}
+	if (iov_len == 2 &&
+		iovec[0].iov_len == sizeof (struct security_header)) {
+		/*
+		 * The payload is contiguous so encrypt it straight out of
+		 * the caller's frame instead of bouncing it through a copy
+		 */
+		inbuf = NULL;
+		data = iovec[1].iov_base;
+		datalen = iovec[1].iov_len;
+	} else {
+		inbuf = copy_from_iovec(iovec, iov_len, &datalen);
+		if (!inbuf) {
+			log_printf(instance->totemudpu_log_level_security, "malloc error copying buffer from iovec\n");
+			return -1;
+		}
 
-	data = inbuf + sizeof (struct security_header);
-	datalen -= sizeof (struct security_header);
+		data = inbuf + sizeof (struct security_header);
+		datalen -= sizeof (struct security_header);
+	}
 
 	outdata = buf + sizeof (struct security_header);
 	header = (struct security_header *)buf;
@@ -680,6 +780,208 @@ static int authenticate_and_decrypt_nss (
 }
 #endif
 
+#ifdef TOTEM_AES_GCM
+static int init_gcm_crypto(
+	struct totemudpu_instance *instance)
+{
+	PK11SlotInfo*      gcm_slot = NULL;
+	SECItem            key_item;
+	SECStatus          rv;
+
+	log_printf(instance->totemudpu_log_level_notice,
+		"Initializing transmit/receive security: NSS AES256GCM (mode 2).\n");
+	rv = NSS_NoDB_Init(".");
+	if (rv != SECSuccess)
+	{
+		log_printf(instance->totemudpu_log_level_security, "NSS initialization failed (err %d)\n",
+			PR_GetError());
+		return 0;
+	}
+
+	gcm_slot = PK11_GetBestSlot(CKM_AES_GCM, NULL);
+	if (gcm_slot == NULL)
+	{
+		log_printf(instance->totemudpu_log_level_security, "Unable to find security slot (err %d)\n",
+			PR_GetError());
+		return 0;
+	}
+
+	/*
+	 * The key schedule is expanded once here and reused for every frame
+	 */
+	key_item.type = siBuffer;
+	key_item.data = instance->totem_config->private_key;
+	key_item.len = 32; /* Use 256 bits */
+
+	instance->nss_sym_key_gcm = PK11_ImportSymKey(gcm_slot,
+		CKM_AES_GCM,
+		PK11_OriginUnwrap, CKA_ENCRYPT|CKA_DECRYPT,
+		&key_item, NULL);
+	PK11_FreeSlot(gcm_slot);
+	if (instance->nss_sym_key_gcm == NULL)
+	{
+		log_printf(instance->totemudpu_log_level_security, "Failure to import key into NSS (err %d)\n",
+			PR_GetError());
+		return 0;
+	}
+
+	/*
+	 * Start the nonce at a random point.  It is then used as a counter,
+	 * so it never repeats for this key on this node and the chance of
+	 * two nodes' ranges overlapping is negligible
+	 */
+	rv = PK11_GenerateRandom (instance->gcm_nonce, sizeof (instance->gcm_nonce));
+	if (rv != SECSuccess) {
+		/*
+		 * Every node would walk the same nonces from zero under the
+		 * shared key, which gives away both plaintext and key
+		 */
+		log_printf(instance->totemudpu_log_level_security,
+			"Failure to generate a random GCM nonce (err %d)\n",
+			PR_GetError());
+		PK11_FreeSymKey(instance->nss_sym_key_gcm);
+		instance->nss_sym_key_gcm = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+static void gcm_params_set (
+	CK_GCM_PARAMS *gcm_params,
+	SECItem *param,
+	unsigned char *nonce)
+{
+	memset (gcm_params, 0, sizeof (CK_GCM_PARAMS));
+	gcm_params->pIv = nonce;
+	gcm_params->ulIvLen = GCM_NONCE_SIZE;
+#ifdef HAVE_CK_GCM_PARAMS_ULIVBITS
+	gcm_params->ulIvBits = GCM_NONCE_SIZE * 8;
+#endif
+	gcm_params->pAAD = NULL;
+	gcm_params->ulAADLen = 0;
+	gcm_params->ulTagBits = GCM_TAG_SIZE * 8;
+
+	param->type = siBuffer;
+	param->data = (unsigned char *)gcm_params;
+	param->len = sizeof (CK_GCM_PARAMS);
+}
+
+static int encrypt_and_sign_gcm (
+	struct totemudpu_instance *instance,
+	unsigned char *buf,
+	size_t *buf_len,
+	const struct iovec *iovec,
+	unsigned int iov_len)
+{
+	struct security_header_gcm *header = (struct security_header_gcm *)buf;
+	CK_GCM_PARAMS      gcm_params;
+	SECItem            param;
+	SECStatus          rv;
+	unsigned char      *inbuf;
+	unsigned char      *data;
+	size_t             datalen;
+	unsigned int       outlen = 0;
+	int                i;
+
+	if (instance->nss_sym_key_gcm == NULL) {
+		return -1;
+	}
+
+	/*
+	 * iovec[0] is the space callers reserve for struct security_header,
+	 * which this engine does not use
+	 */
+	if (iov_len == 2 &&
+		iovec[0].iov_len == sizeof (struct security_header)) {
+		inbuf = NULL;
+		data = iovec[1].iov_base;
+		datalen = iovec[1].iov_len;
+	} else {
+		inbuf = copy_from_iovec(iovec, iov_len, &datalen);
+		if (!inbuf) {
+			log_printf(instance->totemudpu_log_level_security, "malloc error copying buffer from iovec\n");
+			return -1;
+		}
+		data = inbuf + sizeof (struct security_header);
+		datalen -= sizeof (struct security_header);
+	}
+
+	/*
+	 * Use the current counter value as this frame's nonce and advance it
+	 */
+	pthread_mutex_lock (&instance->crypto_mutex);
+	memcpy (header->nonce, instance->gcm_nonce, GCM_NONCE_SIZE);
+	for (i = GCM_NONCE_SIZE - 1; i >= 0; i--) {
+		if (++instance->gcm_nonce[i] != 0) {
+			break;
+		}
+	}
+	pthread_mutex_unlock (&instance->crypto_mutex);
+
+	gcm_params_set (&gcm_params, &param, header->nonce);
+
+	rv = PK11_Encrypt (instance->nss_sym_key_gcm, CKM_AES_GCM, &param,
+		(unsigned char *)header->msg, &outlen,
+		FRAME_SIZE_MAX - sizeof (struct security_header_gcm) - 1,
+		data, datalen);
+	free (inbuf);
+	if (rv != SECSuccess) {
+		log_printf(instance->totemudpu_log_level_security,
+			"PK11_Encrypt (AES-GCM) failed (err %d)\n",
+			PR_GetError());
+		return -1;
+	}
+
+	*buf_len = sizeof (struct security_header_gcm) + outlen;
+
+	return 0;
+}
+
+static int authenticate_and_decrypt_gcm (
+	struct totemudpu_instance *instance,
+	struct iovec *iov,
+	unsigned int iov_len)
+{
+	struct security_header_gcm *header = (struct security_header_gcm *)iov[0].iov_base;
+	unsigned char outbuf[FRAME_SIZE_MAX];
+	CK_GCM_PARAMS gcm_params;
+	SECItem       param;
+	SECStatus     rv;
+	unsigned int  outlen = 0;
+
+	if (instance->nss_sym_key_gcm == NULL || iov_len != 1 ||
+		iov[0].iov_len < sizeof (struct security_header_gcm) + GCM_TAG_SIZE) {
+		return -1;
+	}
+
+	gcm_params_set (&gcm_params, &param, header->nonce);
+
+	rv = PK11_Decrypt (instance->nss_sym_key_gcm, CKM_AES_GCM, &param,
+		outbuf, &outlen, sizeof (outbuf),
+		(unsigned char *)header->msg,
+		iov[0].iov_len - sizeof (struct security_header_gcm));
+	if (rv != SECSuccess) {
+		log_printf(instance->totemudpu_log_level_security,
+			"PK11_Decrypt (AES-GCM) failed (err %d)\n",
+			PR_GetError());
+		return -1;
+	}
+	if (sizeof (struct security_header) + outlen > FRAME_SIZE_MAX) {
+		return -1;
+	}
+
+	/*
+	 * Place the plaintext where callers expect it for every other
+	 * crypto type, just past a struct security_header
+	 */
+	memcpy ((unsigned char *)iov[0].iov_base + sizeof (struct security_header),
+		outbuf, outlen);
+	iov[0].iov_len = sizeof (struct security_header) + outlen;
+
+	return 0;
+}
+#endif
+
 static int encrypt_and_sign_sober (
 	struct totemudpu_instance *instance,
 	unsigned char *buf,
@@ -710,7 +1012,9 @@ static int encrypt_and_sign_sober (
 	/*
 	 * Generate MAC, CIPHER, IV keys from private key
 	 */
+	pthread_mutex_lock (&instance->crypto_mutex);
 	sober128_read (header->salt, sizeof (header->salt), prng_state_in);
+	pthread_mutex_unlock (&instance->crypto_mutex);
 	sober128_start (&keygen_prng_state);
 	sober128_add_entropy (instance->totemudpu_private_key,
 		instance->totemudpu_private_key_len,
@@ -777,6 +1081,10 @@ static int encrypt_and_sign_worker (
 #ifdef HAVE_LIBNSS
 	if (instance->totem_config->crypto_type == TOTEM_CRYPTO_NSS)
 		return encrypt_and_sign_nss(instance, buf, buf_len, iovec, iov_len);
+#endif
+#ifdef TOTEM_AES_GCM
+	if (instance->totem_config->crypto_type == TOTEM_CRYPTO_AES_GCM)
+		return encrypt_and_sign_gcm(instance, buf, buf_len, iovec, iov_len);
 #endif
 	return -1;
 }
@@ -806,6 +1114,10 @@ static int authenticate_and_decrypt (
 #ifdef HAVE_LIBNSS
 		if (type == TOTEM_CRYPTO_NSS)
 		    res = authenticate_and_decrypt_nss(instance, iov, iov_len);
+#endif
+#ifdef TOTEM_AES_GCM
+		if (type == TOTEM_CRYPTO_AES_GCM)
+		    res = authenticate_and_decrypt_gcm(instance, iov, iov_len);
 #endif
 	}
 
@@ -821,7 +1133,7 @@ static int authenticate_and_decrypt (
 	return res;
 }
 
-static void init_crypto(
+static int init_crypto(
 	struct totemudpu_instance *instance)
 {
 	/*
@@ -832,11 +1144,17 @@ static void init_crypto(
 	init_sober_crypto(instance);
 
 	if (instance->totem_config->crypto_accept == TOTEM_CRYPTO_ACCEPT_OLD)
-		return;
+		return 0;
 
 #ifdef HAVE_LIBNSS
 	init_nss_crypto(instance);
 #endif
+#ifdef TOTEM_AES_GCM
+	if (init_gcm_crypto(instance) == -1) {
+		return -1;
+	}
+#endif
+	return 0;
 }
 
 int totemudpu_crypto_set (
@@ -864,6 +1182,12 @@ int totemudpu_crypto_set (
 				log_printf(instance->totemudpu_log_level_security,
 					"Transmit security set to: NSS AES128CBC/SHA1HMAC (mode 1)");
 				break;
+#ifdef TOTEM_AES_GCM
+			case TOTEM_CRYPTO_AES_GCM:
+				log_printf(instance->totemudpu_log_level_security,
+					"Transmit security set to: NSS AES256GCM (mode 2)");
+				break;
+#endif
 			default:
 				res = -1;
 				break;
@@ -1048,43 +1372,364 @@ static inline void mcast_sendmsg (
 	}
 }
 
+/*
+ * Encrypt and sign msg into buf and append the crypto type trailer
+ */
+static void frame_encrypt (
+	struct totemudpu_instance *instance,
+	unsigned char *buf,
+	size_t *buf_len,
+	const void *msg,
+	unsigned int msg_len)
+{
+	unsigned char sheader[sizeof (struct security_header)];
+	struct iovec iovec_encrypt[2];
+
+	iovec_encrypt[0].iov_base = (void *)sheader;
+	iovec_encrypt[0].iov_len = sizeof (struct security_header);
+	iovec_encrypt[1].iov_base = (void *)msg;
+	iovec_encrypt[1].iov_len = msg_len;
+
+	encrypt_and_sign_worker (
+		instance,
+		buf,
+		buf_len,
+		iovec_encrypt,
+		2);
+
+	if (instance->totem_config->crypto_accept == TOTEM_CRYPTO_ACCEPT_NEW) {
+		buf[(*buf_len)++] = instance->totem_config->crypto_type;
+	}
+	else {
+		buf[(*buf_len)++] = 0;
+	}
+}
+
+/*
+ * Authenticate and decrypt a received datagram in place.  Returns 0 when
+ * the frame may be delivered.
+ */
+static int net_authenticate_frame (
+	struct totemudpu_instance *instance,
+	struct iovec *iovec,
+	int bytes_received)
+{
+	int res = 0;
+
+	if ((instance->totem_config->secauth == 1) &&
+		(bytes_received < sizeof (struct security_header))) {
+
+		log_printf (instance->totemudpu_log_level_security, "Received message is too short...  ignoring %d.\n", bytes_received);
+		return (-1);
+	}
+
+	iovec->iov_len = bytes_received;
+	if (instance->totem_config->secauth == 1) {
+		/*
+		 * Authenticate and if authenticated, decrypt datagram
+		 */
+
+		res = authenticate_and_decrypt (instance, iovec, 1);
+		if (res == -1) {
+			log_printf (instance->totemudpu_log_level_security, "Received message has invalid digest... ignoring.\n");
+			log_printf (instance->totemudpu_log_level_security,
+				"Invalid packet data\n");
+			iovec->iov_len = FRAME_SIZE_MAX;
+			return (-1);
+		}
+	}
+	return (0);
+}
+
+/*
+ * Runs on a crypto thread.  Each work item only touches its own slot of
+ * the transmit queue or receive ring.
+ */
+static void crypto_worker_fn (void *thread_state, void *work_item_in)
+{
+	struct work_item *work_item = (struct work_item *)work_item_in;
+	struct totemudpu_instance *instance = work_item->instance;
+	unsigned int index = work_item->index;
+	size_t buf_len;
+
+	if (work_item->type == WORK_ITEM_ENCRYPT) {
+		frame_encrypt (instance,
+			(unsigned char *)instance->send_buffer[index], &buf_len,
+			instance->totemudpu_iov_send[index].iov_base,
+			instance->totemudpu_iov_send[index].iov_len);
+		instance->totemudpu_iov_send[index].iov_base = instance->send_buffer[index];
+		instance->totemudpu_iov_send[index].iov_len = buf_len;
+	} else {
+		instance->recv_crypto_res[index] = net_authenticate_frame (instance,
+			&instance->totemudpu_iov_recv[index], work_item->len);
+	}
+}
+
+static void crypto_work_add (
+	struct totemudpu_instance *instance,
+	struct work_item *work_item)
+{
+	if (worker_thread_group_work_add (&instance->worker_thread_group,
+		work_item) != 0) {
+
+		crypto_worker_fn (NULL, work_item);
+	}
+}
+
+/*
+ * Encrypt every queued frame on the crypto threads.  The queue keeps its
+ * order, so frames still go out in the order totemsrp sent them.
+ */
+static void mcast_send_queue_encrypt (
+	struct totemudpu_instance *instance)
+{
+	struct work_item work_item;
+	unsigned int i;
+
+	work_item.type = WORK_ITEM_ENCRYPT;
+	work_item.len = 0;
+	work_item.instance = instance;
+	for (i = 0; i < instance->send_queue_len; i++) {
+		work_item.index = i;
+		crypto_work_add (instance, &work_item);
+	}
+	worker_thread_group_wait (&instance->worker_thread_group);
+}
+
+/*
+ * Transmit every queued frame to each member.  With sendmmsg one system
+ * call per member carries the whole batch
+ */
+static void mcast_send_queue_flush (
+	struct totemudpu_instance *instance)
+{
+	struct msghdr msg_mcast;
+	struct sockaddr_storage sockaddr;
+	int addrlen;
+	struct list_head *list;
+	struct totemudpu_member *member;
+	unsigned int sent;
+	int res;
+#ifdef HAVE_SENDMMSG
+	unsigned int i;
+#endif
+
+	if (instance->send_queue_len == 0) {
+		return;
+	}
+
+	if (instance->crypto_threads) {
+		mcast_send_queue_encrypt (instance);
+	}
+
+	for (list = instance->member_list.next;
+		list != &instance->member_list;
+		list = list->next) {
+
+		member = list_entry (list,
+			struct totemudpu_member,
+			list);
+
+		totemip_totemip_to_sockaddr_convert(&member->member,
+			instance->totem_interface->ip_port, &sockaddr, &addrlen);
+
+		memset (&msg_mcast, 0, sizeof (msg_mcast));
+		msg_mcast.msg_name = &sockaddr;
+		msg_mcast.msg_namelen = addrlen;
+		msg_mcast.msg_iovlen = 1;
+
+#ifdef HAVE_SENDMMSG
+		for (i = 0; i < instance->send_queue_len; i++) {
+			instance->totemudpu_send_msgs[i].msg_hdr = msg_mcast;
+			instance->totemudpu_send_msgs[i].msg_hdr.msg_iov =
+				&instance->totemudpu_iov_send[i];
+			instance->totemudpu_send_msgs[i].msg_len = 0;
+		}
+
+		sent = 0;
+		while (sent < instance->send_queue_len) {
+			/*
+			 * Transmit multicast messages
+			 * An error here is recovered by totemsrp
+			 */
+			res = sendmmsg (member->fd,
+				&instance->totemudpu_send_msgs[sent],
+				instance->send_queue_len - sent, MSG_NOSIGNAL);
+			if (res < 0) {
+				LOGSYS_PERROR (errno, instance->totemudpu_log_level_debug,
+					"sendmmsg(mcast) failed (non-critical)");
+				/*
+				 * Drop the frame the kernel refused and carry on
+				 */
+				res = 1;
+			}
+			sent += res;
+			instance->stats->tx_batches++;
+		}
+#else
+		for (sent = 0; sent < instance->send_queue_len; sent++) {
+			msg_mcast.msg_iov = &instance->totemudpu_iov_send[sent];
+			res = sendmsg (member->fd, &msg_mcast, MSG_NOSIGNAL);
+			if (res < 0) {
+				LOGSYS_PERROR (errno, instance->totemudpu_log_level_debug,
+					"sendmsg(mcast) failed (non-critical)");
+			}
+		}
+		instance->stats->tx_batches++;
+#endif
+	}
+
+	instance->stats->tx_frames += instance->send_queue_len;
+
+	for (sent = 0; sent < instance->send_queue_len; sent++) {
+		totemframe_release (instance->send_frame[sent]);
+		instance->send_frame[sent] = NULL;
+	}
+	instance->send_queue_len = 0;
+}
+
+/*
+ * Queue a frame for transmission.  With secauth the frame is encrypted
+ * into the next free slot of the transmit queue, otherwise the queue
+ * holds a reference on it, so msg must come from buffer_alloc.  Encryption
+ * happens once per frame however many members there are
+ */
+static inline void mcast_send_queue (
+	struct totemudpu_instance *instance,
+	const void *msg,
+	unsigned int msg_len)
+{
+	size_t buf_len;
+	unsigned char *buf;
+
+	if (instance->send_queue_len == SEND_BATCH_MAX) {
+		mcast_send_queue_flush (instance);
+	}
+
+	buf = (unsigned char *)instance->send_buffer[instance->send_queue_len];
+
+	if (instance->totem_config->secauth == 1 &&
+		instance->crypto_threads == 0) {
+
+		frame_encrypt (instance, buf, &buf_len, msg, msg_len);
+	} else {
+		/*
+		 * Hold a reference on the caller's frame rather than copying
+		 * it.  With crypto threads it is encrypted when the queue is
+		 * flushed.
+		 */
+		totemframe_ref ((void *)msg);
+		instance->send_frame[instance->send_queue_len] = (void *)msg;
+		buf = (unsigned char *)msg;
+		buf_len = msg_len;
+	}
+
+	instance->totemudpu_iov_send[instance->send_queue_len].iov_base = buf;
+	instance->totemudpu_iov_send[instance->send_queue_len].iov_len = buf_len;
+	instance->send_queue_len += 1;
+}
+
 int totemudpu_finalize (
 	void *udpu_context)
 {
 	struct totemudpu_instance *instance = (struct totemudpu_instance *)udpu_context;
 	int res = 0;
 
+	if (instance->crypto_threads) {
+		worker_thread_group_exit (&instance->worker_thread_group);
+		instance->crypto_threads = 0;
+	}
+
 	if (instance->token_socket > 0) {
 		close (instance->token_socket);
 		qb_loop_poll_del (instance->totemudpu_poll_handle,
 			instance->token_socket);
 	}
 
+	totemframe_pool_destroy (instance->frame_pool);
+	instance->frame_pool = NULL;
+
 	return (res);
 }
 
-static int net_deliver_fn (
-	int fd,
-	int revents,
-	void *data)
+static void net_deliver_authenticated (
+	struct totemudpu_instance *instance,
+	struct iovec *iovec)
 {
-	struct totemudpu_instance *instance = (struct totemudpu_instance *)data;
-	struct msghdr msg_recv;
-	struct iovec *iovec;
-	struct sockaddr_storage system_from;
-	int bytes_received;
-	int res = 0;
 	unsigned char *msg_offset;
 	unsigned int size_delv;
 
-	iovec = &instance->totemudpu_iov_recv;
+	if (instance->totem_config->secauth == 1) {
+		msg_offset = (unsigned char *)iovec->iov_base +
+			sizeof (struct security_header);
+		size_delv = iovec->iov_len - sizeof (struct security_header);
+	} else {
+		msg_offset = (void *)iovec->iov_base;
+		size_delv = iovec->iov_len;
+	}
 
 	/*
-	 * Receive datagram
+	 * Handle incoming message
 	 */
-	msg_recv.msg_name = &system_from;
+	instance->totemudpu_deliver_fn (
+		instance->context,
+		msg_offset,
+		size_delv);
+
+	iovec->iov_len = FRAME_SIZE_MAX;
+}
+
+static void net_deliver_frame (
+	struct totemudpu_instance *instance,
+	struct iovec *iovec,
+	int bytes_received)
+{
+	if (net_authenticate_frame (instance, iovec, bytes_received) == 0) {
+		net_deliver_authenticated (instance, iovec);
+	}
+}
+
+/*
+ * Drain up to RECV_BATCH_MAX datagrams into the receive ring.
+ * Returns the number of datagrams received and stores their lengths
+ * in bytes_received.
+ */
+static int net_recv_batch (
+	struct totemudpu_instance *instance,
+	int fd,
+	int *bytes_received)
+{
+#ifdef HAVE_RECVMMSG
+	struct mmsghdr *msgs = instance->totemudpu_recv_msgs;
+	int i;
+	int res;
+
+	for (i = 0; i < RECV_BATCH_MAX; i++) {
+		instance->totemudpu_iov_recv[i].iov_len = FRAME_SIZE_MAX;
+		memset (&msgs[i], 0, sizeof (struct mmsghdr));
+		msgs[i].msg_hdr.msg_name = &instance->totemudpu_recv_from[i];
+		msgs[i].msg_hdr.msg_namelen = sizeof (struct sockaddr_storage);
+		msgs[i].msg_hdr.msg_iov = &instance->totemudpu_iov_recv[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	res = recvmmsg (fd, msgs, RECV_BATCH_MAX,
+		MSG_NOSIGNAL | MSG_DONTWAIT, NULL);
+	if (res == -1) {
+		return (0);
+	}
+	for (i = 0; i < res; i++) {
+		bytes_received[i] = msgs[i].msg_len;
+	}
+	return (res);
+#else
+	struct msghdr msg_recv;
+
+	instance->totemudpu_iov_recv[0].iov_len = FRAME_SIZE_MAX;
+
+	msg_recv.msg_name = &instance->totemudpu_recv_from[0];
 	msg_recv.msg_namelen = sizeof (struct sockaddr_storage);
-	msg_recv.msg_iov = iovec;
+	msg_recv.msg_iov = &instance->totemudpu_iov_recv[0];
 	msg_recv.msg_iovlen = 1;
 #if !defined(COROSYNC_SOLARIS)
 	msg_recv.msg_control = 0;
@@ -1095,51 +1740,81 @@ static int net_deliver_fn (
 	msg_recv.msg_accrightslen = 0;
 #endif
 
-	bytes_received = recvmsg (fd, &msg_recv, MSG_NOSIGNAL | MSG_DONTWAIT);
-	if (bytes_received == -1) {
+	bytes_received[0] = recvmsg (fd, &msg_recv, MSG_NOSIGNAL | MSG_DONTWAIT);
+	if (bytes_received[0] == -1) {
 		return (0);
-	} else {
-		instance->stats_recv += bytes_received;
 	}
+	return (1);
+#endif
+}
 
-	if ((instance->totem_config->secauth == 1) &&
-		(bytes_received < sizeof (struct security_header))) {
+static int net_deliver_fn (
+	int fd,
+	int revents,
+	void *data)
+{
+	struct totemudpu_instance *instance = (struct totemudpu_instance *)data;
+	int bytes_received[RECV_BATCH_MAX];
+	struct work_item work_item;
+	int frames;
+	int i;
 
-		log_printf (instance->totemudpu_log_level_security, "Received message is too short...  ignoring %d.\n", bytes_received);
+	/*
+	 * Receive a batch of datagrams
+	 */
+	frames = net_recv_batch (instance, fd, bytes_received);
+	if (frames == 0) {
 		return (0);
 	}
 
-	iovec->iov_len = bytes_received;
-	if (instance->totem_config->secauth == 1) {
-		/*
-		 * Authenticate and if authenticated, decrypt datagram
-		 */
+	instance->stats->rx_batches++;
+	instance->stats->rx_frames += frames;
+	if (frames > instance->stats->rx_batch_max) {
+		instance->stats->rx_batch_max = frames;
+	}
+	for (i = 0; i < frames; i++) {
+		instance->stats_recv += bytes_received[i];
+	}
+	instance->recv_batch_frames = frames;
+	instance->recv_batch_next = 0;
 
-		res = authenticate_and_decrypt (instance, iovec, 1);
-		if (res == -1) {
-			log_printf (instance->totemudpu_log_level_security, "Received message has invalid digest... ignoring.\n");
-			log_printf (instance->totemudpu_log_level_security,
-				"Invalid packet data\n");
-			iovec->iov_len = FRAME_SIZE_MAX;
-			return 0;
+	/*
+	 * With crypto threads a batch of frames is authenticated in
+	 * parallel and then delivered in the order it was received.  A
+	 * single frame, typically the token, stays on this thread.
+	 */
+	if (instance->crypto_threads && frames > 1) {
+		work_item.type = WORK_ITEM_DECRYPT;
+		work_item.instance = instance;
+		for (i = 0; i < frames; i++) {
+			work_item.index = i;
+			work_item.len = bytes_received[i];
+			crypto_work_add (instance, &work_item);
 		}
-		msg_offset = (unsigned char *)iovec->iov_base +
-			sizeof (struct security_header);
-		size_delv = bytes_received - sizeof (struct security_header);
-	} else {
-		msg_offset = (void *)iovec->iov_base;
-		size_delv = bytes_received;
+		worker_thread_group_wait (&instance->worker_thread_group);
+
+		while (instance->recv_batch_next < instance->recv_batch_frames) {
+			i = instance->recv_batch_next++;
+			if (instance->recv_crypto_res[i] == 0) {
+				net_deliver_authenticated (instance,
+					&instance->totemudpu_iov_recv[i]);
+			}
+		}
+		instance->recv_batch_frames = 0;
+		return (0);
 	}
 
 	/*
-	 * Handle incoming message
+	 * Authenticate and deliver the whole batch.  recv_mcast_empty may
+	 * drop the rest of it while a frame is delivered.
 	 */
-	instance->totemudpu_deliver_fn (
-		instance->context,
-		msg_offset,
-		size_delv);
+	while (instance->recv_batch_next < instance->recv_batch_frames) {
+		i = instance->recv_batch_next++;
+		net_deliver_frame (instance, &instance->totemudpu_iov_recv[i],
+			bytes_received[i]);
+	}
+	instance->recv_batch_frames = 0;
 
-	iovec->iov_len = FRAME_SIZE_MAX;
 	return (0);
 }
 
@@ -1396,6 +2071,7 @@ int totemudpu_initialize (
 	qb_loop_t *poll_handle,
 	void **udpu_context,
 	struct totem_config *totem_config,
+	totemnet_stats_t *stats,
 	int interface_no,
 	void *context,
 
@@ -1421,6 +2097,19 @@ int totemudpu_initialize (
 	totemudpu_instance_initialize (instance);
 
 	instance->totem_config = totem_config;
+	instance->stats = stats;
+
+	/*
+	 * Enough full size frames for a full new message queue plus a
+	 * window of messages waiting in the sort queue
+	 */
+	instance->frame_pool = totemframe_pool_create (totem_config->net_mtu,
+		MESSAGE_QUEUE_MAX + totem_config->window_size,
+		&stats->frame_pool);
+	if (instance->frame_pool == NULL) {
+		free (instance);
+		return (-1);
+	}
 	/*
 	* Configure logging
 	*/
@@ -1440,14 +2129,29 @@ int totemudpu_initialize (
 
 	instance->totemudpu_private_key_len = totem_config->private_key_len;
 
-	init_crypto(instance);
+	if (init_crypto(instance) == -1) {
+		totemframe_pool_destroy (instance->frame_pool);
+		free (instance);
+		return (-1);
+	}
+
+	if (totem_config->threads > 0) {
+		if (worker_thread_group_init (&instance->worker_thread_group,
+			totem_config->threads, RECV_BATCH_MAX + SEND_BATCH_MAX,
+			sizeof (struct work_item), 0, NULL,
+			crypto_worker_fn) == 0) {
+
+			instance->crypto_threads = totem_config->threads;
+		} else {
+			log_printf (instance->totemudpu_log_level_warning,
+				"Unable to start crypto threads, encrypting on the main thread\n");
+		}
+	}
 
 	/*
 	 * Initialize local variables for totemudpu
 	 */
 	instance->totem_interface = &totem_config->interfaces[interface_no];
-	memset (instance->iov_buffer, 0, FRAME_SIZE_MAX);
-
 	instance->totemudpu_poll_handle = poll_handle;
 
 	instance->totem_interface->bindnet.nodeid = instance->totem_config->node_id;
@@ -1477,14 +2181,16 @@ int totemudpu_initialize (
 	return (0);
 }
 
-void *totemudpu_buffer_alloc (void)
+void *totemudpu_buffer_alloc (void *udpu_context, size_t size)
 {
-	return malloc (FRAME_SIZE_MAX);
+	struct totemudpu_instance *instance = (struct totemudpu_instance *)udpu_context;
+
+	return totemframe_alloc (instance->frame_pool, size);
 }
 
-void totemudpu_buffer_release (void *ptr)
+void totemudpu_buffer_release (void *udpu_context, void *ptr)
 {
-	return free (ptr);
+	totemframe_release (ptr);
 }
 
 int totemudpu_processor_count_set (
@@ -1518,8 +2224,11 @@ int totemudpu_recv_flush (void *udpu_context)
 
 int totemudpu_send_flush (void *udpu_context)
 {
+	struct totemudpu_instance *instance = (struct totemudpu_instance *)udpu_context;
 	int res = 0;
 
+	mcast_send_queue_flush (instance);
+
 	return (res);
 }
 
@@ -1531,6 +2240,8 @@ int totemudpu_token_send (
 	struct totemudpu_instance *instance = (struct totemudpu_instance *)udpu_context;
 	int res = 0;
 
+	mcast_send_queue_flush (instance);
+
 	ucast_sendmsg (instance, &instance->token_target, msg, msg_len);
 
 	return (res);
@@ -1543,6 +2254,8 @@ int totemudpu_mcast_flush_send (
 	struct totemudpu_instance *instance = (struct totemudpu_instance *)udpu_context;
 	int res = 0;
 
+	mcast_send_queue_flush (instance);
+
 	mcast_sendmsg (instance, msg, msg_len);
 
 	return (res);
@@ -1556,7 +2269,13 @@ int totemudpu_mcast_noflush_send (
 	struct totemudpu_instance *instance = (struct totemudpu_instance *)udpu_context;
 	int res = 0;
 
-	mcast_sendmsg (instance, msg, msg_len);
+	if (instance->totem_config->send_coalesce ||
+		instance->crypto_threads) {
+
+		mcast_send_queue (instance, msg, msg_len);
+	} else {
+		mcast_sendmsg (instance, msg, msg_len);
+	}
 
 	return (res);
 }
@@ -1574,7 +2293,12 @@ extern int totemudpu_iface_check (void *udpu_context)
 extern void totemudpu_net_mtu_adjust (void *udpu_context, struct totem_config *totem_config)
 {
 #define UDPIP_HEADER_SIZE (20 + 8) /* 20 bytes for ip 8 bytes for udp */
-	if (totem_config->secauth == 1) {
+	if (totem_config->secauth == 1 &&
+		totem_config->crypto_accept == TOTEM_CRYPTO_ACCEPT_NEW &&
+		totem_config->crypto_type == TOTEM_CRYPTO_AES_GCM) {
+		totem_config->net_mtu -= sizeof (struct security_header_gcm) +
+			GCM_TAG_SIZE + 1 + UDPIP_HEADER_SIZE;
+	} else if (totem_config->secauth == 1) {
 		totem_config->net_mtu -= sizeof (struct security_header) +
 			UDPIP_HEADER_SIZE;
 	} else {
@@ -1634,7 +2358,7 @@ extern int totemudpu_recv_mcast_empty (
 	 */
 	msg_recv.msg_name = &system_from;
 	msg_recv.msg_namelen = sizeof (struct sockaddr_storage);
-	msg_recv.msg_iov = &instance->totemudpu_iov_recv;
+	msg_recv.msg_iov = &instance->totemudpu_iov_recv_flush;
 	msg_recv.msg_iovlen = 1;
 #if !defined(COROSYNC_SOLARIS)
 	msg_recv.msg_control = 0;
@@ -1645,6 +2369,15 @@ extern int totemudpu_recv_mcast_empty (
 	msg_recv.msg_accrightslen = 0;
 #endif
 
+	/*
+	 * Frames left in the batch being delivered were already taken off
+	 * the socket and are dropped like the ones still on it
+	 */
+	if (instance->recv_batch_next < instance->recv_batch_frames) {
+		instance->recv_batch_next = instance->recv_batch_frames;
+		msg_processed = 1;
+	}
+
 	do {
 		ufd.fd = instance->token_socket;
 		ufd.events = POLLIN;
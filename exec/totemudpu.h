@@ -48,6 +48,7 @@ extern int totemudpu_initialize (
 	qb_loop_t *poll_handle,
 	void **udpu_context,
 	struct totem_config *totem_config,
+	totemnet_stats_t *stats,
 	int interface_no,
 	void *context,
 
@@ -63,9 +64,9 @@ extern int totemudpu_initialize (
 	void (*target_set_completed) (
 		void *context));
 
-extern void *totemudpu_buffer_alloc (void);
+extern void *totemudpu_buffer_alloc (void *udpu_context, size_t size);
 
-extern void totemudpu_buffer_release (void *ptr);
+extern void totemudpu_buffer_release (void *udpu_context, void *ptr);
 
 extern int totemudpu_processor_count_set (
 	void *udpu_context,
@@ -0,0 +1,216 @@
+/*
+ * Copyright (c) 2012 Red Hat, Inc.
+ *
+ * All rights reserved.
+ *
+ * This software licensed under BSD license, the text of which follows:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * - Neither the name of the Red Hat, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "cs_queue.h"
+#include "wthread.h"
+
+struct worker_thread {
+	struct worker_thread_group *worker_thread_group;
+	pthread_mutex_t work_mutex;
+	pthread_cond_t new_work_cond;
+	pthread_cond_t done_work_cond;
+	pthread_t thread_id;
+	struct cs_queue queue;
+	int exiting;
+	void *thread_state;
+};
+
+static void *start_worker_thread (void *worker_thread_in)
+{
+	struct worker_thread *worker_thread = (struct worker_thread *)worker_thread_in;
+	void *data_for_worker_fn;
+
+	pthread_mutex_lock (&worker_thread->work_mutex);
+	for (;;) {
+		while (cs_queue_is_empty (&worker_thread->queue) &&
+			worker_thread->exiting == 0) {
+
+			pthread_cond_wait (&worker_thread->new_work_cond,
+				&worker_thread->work_mutex);
+		}
+		if (worker_thread->exiting) {
+			break;
+		}
+
+		/*
+		 * Drop the lock while the worker function runs so more work
+		 * can be queued.  The item stays at the head of the queue
+		 * until it has been processed.
+		 */
+		data_for_worker_fn = cs_queue_item_get (&worker_thread->queue);
+		pthread_mutex_unlock (&worker_thread->work_mutex);
+
+		worker_thread->worker_thread_group->worker_fn (
+			worker_thread->thread_state, data_for_worker_fn);
+
+		pthread_mutex_lock (&worker_thread->work_mutex);
+		cs_queue_item_remove (&worker_thread->queue);
+		if (cs_queue_is_empty (&worker_thread->queue)) {
+			pthread_cond_signal (&worker_thread->done_work_cond);
+		}
+	}
+	pthread_mutex_unlock (&worker_thread->work_mutex);
+
+	return (NULL);
+}
+
+int worker_thread_group_init (
+	struct worker_thread_group *worker_thread_group,
+	int threads,
+	int items_max,
+	int item_size,
+	int thread_state_size,
+	void (*thread_state_constructor)(void *),
+	void (*worker_fn)(void *thread_state, void *work_item))
+{
+	struct worker_thread *worker_thread;
+	int i;
+
+	worker_thread_group->threadcount = 0;
+	worker_thread_group->last_scheduled = 0;
+	worker_thread_group->worker_fn = worker_fn;
+	worker_thread_group->threads = calloc (threads,
+		sizeof (struct worker_thread));
+	if (worker_thread_group->threads == NULL) {
+		return (-1);
+	}
+
+	for (i = 0; i < threads; i++) {
+		worker_thread = &worker_thread_group->threads[i];
+		worker_thread->worker_thread_group = worker_thread_group;
+		if (thread_state_size) {
+			worker_thread->thread_state = malloc (thread_state_size);
+			if (worker_thread->thread_state == NULL) {
+				goto error_exit;
+			}
+			if (thread_state_constructor) {
+				thread_state_constructor (worker_thread->thread_state);
+			}
+		}
+		if (cs_queue_init (&worker_thread->queue, items_max, item_size, 0) != 0) {
+			free (worker_thread->thread_state);
+			goto error_exit;
+		}
+		pthread_mutex_init (&worker_thread->work_mutex, NULL);
+		pthread_cond_init (&worker_thread->new_work_cond, NULL);
+		pthread_cond_init (&worker_thread->done_work_cond, NULL);
+		if (pthread_create (&worker_thread->thread_id, NULL,
+			start_worker_thread, worker_thread) != 0) {
+
+			pthread_mutex_destroy (&worker_thread->work_mutex);
+			pthread_cond_destroy (&worker_thread->new_work_cond);
+			pthread_cond_destroy (&worker_thread->done_work_cond);
+			cs_queue_free (&worker_thread->queue);
+			free (worker_thread->thread_state);
+			goto error_exit;
+		}
+		worker_thread_group->threadcount += 1;
+	}
+	return (0);
+
+error_exit:
+	worker_thread_group_exit (worker_thread_group);
+	return (-1);
+}
+
+int worker_thread_group_work_add (
+	struct worker_thread_group *worker_thread_group,
+	void *item)
+{
+	struct worker_thread *worker_thread;
+	int schedule;
+
+	schedule = (worker_thread_group->last_scheduled + 1) %
+		(worker_thread_group->threadcount);
+	worker_thread_group->last_scheduled = schedule;
+	worker_thread = &worker_thread_group->threads[schedule];
+
+	pthread_mutex_lock (&worker_thread->work_mutex);
+	if (cs_queue_is_full (&worker_thread->queue)) {
+		pthread_mutex_unlock (&worker_thread->work_mutex);
+		return (-1);
+	}
+	cs_queue_item_add (&worker_thread->queue, item);
+	pthread_cond_signal (&worker_thread->new_work_cond);
+	pthread_mutex_unlock (&worker_thread->work_mutex);
+
+	return (0);
+}
+
+void worker_thread_group_wait (
+	struct worker_thread_group *worker_thread_group)
+{
+	struct worker_thread *worker_thread;
+	int i;
+
+	for (i = 0; i < worker_thread_group->threadcount; i++) {
+		worker_thread = &worker_thread_group->threads[i];
+		pthread_mutex_lock (&worker_thread->work_mutex);
+		while (cs_queue_is_empty (&worker_thread->queue) == 0) {
+			pthread_cond_wait (&worker_thread->done_work_cond,
+				&worker_thread->work_mutex);
+		}
+		pthread_mutex_unlock (&worker_thread->work_mutex);
+	}
+}
+
+void worker_thread_group_exit (
+	struct worker_thread_group *worker_thread_group)
+{
+	struct worker_thread *worker_thread;
+	int i;
+
+	for (i = 0; i < worker_thread_group->threadcount; i++) {
+		worker_thread = &worker_thread_group->threads[i];
+		pthread_mutex_lock (&worker_thread->work_mutex);
+		worker_thread->exiting = 1;
+		pthread_cond_signal (&worker_thread->new_work_cond);
+		pthread_mutex_unlock (&worker_thread->work_mutex);
+		pthread_join (worker_thread->thread_id, NULL);
+
+		pthread_mutex_destroy (&worker_thread->work_mutex);
+		pthread_cond_destroy (&worker_thread->new_work_cond);
+		pthread_cond_destroy (&worker_thread->done_work_cond);
+		cs_queue_free (&worker_thread->queue);
+		free (worker_thread->thread_state);
+	}
+	free (worker_thread_group->threads);
+	worker_thread_group->threads = NULL;
+	worker_thread_group->threadcount = 0;
+}
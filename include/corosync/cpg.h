@@ -96,6 +96,8 @@ struct cpg_name {
 
 #define CPG_MEMBERS_MAX 128
 
+#define CPG_MCAST_BATCH_MAX 512
+
 struct cpg_iteration_description_t {
 	struct cpg_name group;
 	uint32_t nodeid;
@@ -142,6 +144,7 @@ typedef struct {
 } cpg_model_data_t;
 
 #define CPG_MODEL_V1_DELIVER_INITIAL_TOTEM_CONF 0x01
+#define CPG_MODEL_V1_DELIVER_COALESCED 0x02
 
 typedef struct {
 	cpg_model_t model;
@@ -240,6 +243,21 @@ cs_error_t cpg_mcast_joined (
 	const struct iovec *iovec,
 	unsigned int iov_len);
 
+/**
+ * Multicast several messages to groups joined with cpg_join in one request.
+ *
+ * @param handle
+ * @param guarantee
+ * @param iovec Each entry is one message, delivered like one sent with
+ *              cpg_mcast_joined.  Either all of them are sent or none.
+ * @param msg_count Number of messages, at most CPG_MCAST_BATCH_MAX
+ */
+cs_error_t cpg_mcast_joined_batch (
+	cpg_handle_t handle,
+	cpg_guarantee_t guarantee,
+	const struct iovec *iovec,
+	unsigned int msg_count);
+
 /**
  * Get membership information from cpg
  */
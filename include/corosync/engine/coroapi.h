@@ -237,6 +237,10 @@ typedef void (*object_reload_notify_fn_t) (
 	int flush,
 	void *priv_data_pt);
 
+typedef void (*object_key_value_get_fn_t) (
+	void *value, size_t value_len,
+	void *priv_data_pt);
+
 #endif /* OBJECT_PARENT_HANDLE_DEFINED */
 
 #ifndef QUORUM_H_DEFINED
@@ -651,6 +655,29 @@ struct corosync_api_v1 {
 		qb_loop_t * handle,
 		int fd);
 
+	/*
+	 * Create a key whose value is produced by value_get_fn whenever
+	 * it is read, instead of being pushed with object_key_replace
+	 */
+	int (*object_key_create_virtual) (
+		hdb_handle_t object_handle,
+		const char *key_name,
+		size_t value_len,
+		objdb_value_types_t type,
+		object_key_value_get_fn_t value_get_fn,
+		void *priv_data_pt);
+
+	/*
+	 * Multicast msg_count messages at once, msg_iov_len[i] of the
+	 * iovecs belong to message i.  Returns -1 without sending any of
+	 * them if they don't all fit in the totem queue right now, -2 if
+	 * they are larger than totem can ever queue.
+	 */
+	int (*totem_mcast_batch) (const struct iovec *iovec,
+		const unsigned int *msg_iov_len,
+		unsigned int msg_count,
+		unsigned int guarantee);
+
 };
 
 #define SERVICE_ID_MAKE(a,b) ( ((a)<<16) | (b) )
@@ -706,6 +733,12 @@ struct corosync_service_engine {
 	int (*sync_process) (void);
 	void (*sync_activate) (void);
 	void (*sync_abort) (void);
+	/*
+	 * Optional, called after a run of messages was handed to the exec
+	 * handlers.  The messages stay valid until then, so a service may
+	 * defer work on them and do it once per run.
+	 */
+	void (*exec_deliver_batch_end_fn) (void);
 };
 
 #endif /* COROAPI_H_DEFINED */
@@ -94,6 +94,13 @@ typedef void (*object_destroy_notify_fn_t) (hdb_handle_t parent_object_handle,
 typedef void (*object_reload_notify_fn_t) (objdb_reload_notify_type_t, int flush,
 	void *priv_data_pt);
 
+/*
+ * Fills in the value of a virtual key each time it is read
+ */
+typedef void (*object_key_value_get_fn_t) (
+	void *value, size_t value_len,
+	void *priv_data_pt);
+
 struct object_valid {
 	char *object_name;
 	size_t object_len;
@@ -269,6 +276,14 @@ struct objdb_iface_ver0 {
 		void **value,
 		size_t *value_len,
 		objdb_value_types_t *type);
+
+	int (*object_key_create_virtual) (
+		hdb_handle_t object_handle,
+		const char *key_name,
+		size_t value_len,
+		objdb_value_types_t type,
+		object_key_value_get_fn_t value_get_fn,
+		void *priv_data_pt);
 };
 
 #endif /* OBJDB_H_DEFINED */
@@ -53,6 +53,9 @@ enum req_cpg_types {
 	MESSAGE_REQ_CPG_ZC_ALLOC = 9,
 	MESSAGE_REQ_CPG_ZC_FREE = 10,
 	MESSAGE_REQ_CPG_ZC_EXECUTE = 11,
+	MESSAGE_REQ_CPG_ZC_ARENA_INIT = 12,
+	MESSAGE_REQ_CPG_ZC_ARENA_EXECUTE = 13,
+	MESSAGE_REQ_CPG_MCAST_BATCH = 14,
 };
 
 enum res_cpg_types {
@@ -73,6 +76,8 @@ enum res_cpg_types {
 	MESSAGE_RES_CPG_ZC_ALLOC = 14,
 	MESSAGE_RES_CPG_ZC_FREE = 15,
 	MESSAGE_RES_CPG_ZC_EXECUTE = 16,
+	MESSAGE_RES_CPG_ZC_ARENA_INIT = 17,
+	MESSAGE_RES_CPG_DELIVER_BATCH_CALLBACK = 18,
 };
 
 enum lib_cpg_confchg_reason {
@@ -218,6 +223,26 @@ struct res_lib_cpg_local_get {
 	mar_uint32_t local_nodeid __attribute__((aligned(8)));
 };
 
+/*
+ * Requests added after the first release are only sent to daemons that
+ * handle them.  A library asks by sending MESSAGE_REQ_CPG_LOCAL_GET with
+ * the larger request below; daemons that know it answer with
+ * res_lib_cpg_local_get_features, older ones with res_lib_cpg_local_get.
+ */
+#define CPG_FEATURE_ZC_ARENA		(1 << 0)
+#define CPG_FEATURE_MCAST_BATCH		(1 << 1)
+
+struct req_lib_cpg_local_get_features {
+	struct qb_ipc_request_header header __attribute__((aligned(8)));
+	mar_uint32_t features __attribute__((aligned(8)));
+};
+
+struct res_lib_cpg_local_get_features {
+	struct qb_ipc_response_header header __attribute__((aligned(8)));
+	mar_uint32_t local_nodeid __attribute__((aligned(8)));
+	mar_uint32_t features __attribute__((aligned(8)));
+};
+
 struct req_lib_cpg_mcast {
 	struct qb_ipc_response_header header __attribute__((aligned(8)));
 	mar_uint32_t guarantee __attribute__((aligned(8)));
@@ -225,6 +250,17 @@ struct req_lib_cpg_mcast {
 	mar_uint8_t message[] __attribute__((aligned(8)));
 };
 
+/*
+ * msglens holds the length of each of the msg_count messages, which
+ * follow it back to back
+ */
+struct req_lib_cpg_mcast_batch {
+	struct qb_ipc_request_header header __attribute__((aligned(8)));
+	mar_uint32_t guarantee __attribute__((aligned(8)));
+	mar_uint32_t msg_count __attribute__((aligned(8)));
+	mar_uint32_t msglens[] __attribute__((aligned(8)));
+};
+
 struct res_lib_cpg_mcast {
 	struct qb_ipc_response_header header __attribute__((aligned(8)));
 };
@@ -241,6 +277,20 @@ struct res_lib_cpg_deliver_callback {
 	mar_uint8_t message[] __attribute__((aligned(8)));
 };
 
+/*
+ * Several deliveries to a connection that joined with
+ * CPG_MODEL_V1_DELIVER_COALESCED.  entries holds msg_count
+ * struct res_lib_cpg_deliver_callback, each followed by its message and
+ * padded to a multiple of 8 bytes.
+ */
+struct res_lib_cpg_deliver_batch_callback {
+	struct qb_ipc_response_header header __attribute__((aligned(8)));
+	mar_uint32_t msg_count __attribute__((aligned(8)));
+	mar_uint8_t entries[] __attribute__((aligned(8)));
+};
+
+#define CPG_DELIVER_BATCH_ALIGN(size) (((size) + 7) & ~7)
+
 struct res_lib_cpg_flowcontrol_callback {
 	struct qb_ipc_response_header header __attribute__((aligned(8)));
 	mar_uint32_t flow_control_state __attribute__((aligned(8)));
@@ -332,6 +382,16 @@ typedef struct {
 	uint64_t server_address __attribute__((aligned(8)));
 } mar_req_coroipcc_zc_execute_t __attribute__((aligned(8)));
 
+/*
+ * The arena is set up with a mar_req_coroipcc_zc_alloc_t request using
+ * MESSAGE_REQ_CPG_ZC_ARENA_INIT.  Buffers are then sent by the offset of
+ * their struct req_lib_cpg_mcast from the start of the arena.
+ */
+typedef struct {
+        struct qb_ipc_request_header header __attribute__((aligned(8)));
+	uint64_t offset __attribute__((aligned(8)));
+} mar_req_coroipcc_zc_arena_execute_t __attribute__((aligned(8)));
+
 struct coroipcs_zc_header {
 	int map_size;
 	uint64_t server_address;
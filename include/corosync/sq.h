@@ -37,11 +37,20 @@
 #include <errno.h>
 #include <string.h>
 
+/*
+ * Items are kept in a ring whose size is a power of two, so a sequence
+ * number maps to its slot with a mask.  Which slots hold an item is kept
+ * in a packed bitmap so runs of present items and holes can be found a
+ * word at a time instead of one sequence number at a time.
+ */
+#define SQ_BITS_PER_WORD (sizeof (unsigned long) * 8)
+
 struct sq {
 	unsigned int head;
 	unsigned int size;
+	unsigned int mask;
 	void *items;
-	unsigned int *items_inuse;
+	unsigned long *items_inuse;
 	unsigned int *items_miss_count;
 	unsigned int size_per_item;
 	unsigned int head_seqid;
@@ -91,35 +100,86 @@ static inline int sq_lte_compare (unsigned int a, unsigned int b) {
 	return (0);
 }
 
+static inline size_t sq_inuse_bytes (const struct sq *sq)
+{
+	return ((sq->size / SQ_BITS_PER_WORD) * sizeof (unsigned long));
+}
+
+static inline int sq_inuse_test (const struct sq *sq, unsigned int pos)
+{
+	return ((sq->items_inuse[pos / SQ_BITS_PER_WORD] >>
+		(pos % SQ_BITS_PER_WORD)) & 1);
+}
+
+static inline void sq_inuse_set (struct sq *sq, unsigned int pos)
+{
+	sq->items_inuse[pos / SQ_BITS_PER_WORD] |=
+		1UL << (pos % SQ_BITS_PER_WORD);
+}
+
+/*
+ * Clear count slots starting at pos, which must not wrap past the end
+ * of the ring
+ */
+static inline void sq_inuse_clear (
+	struct sq *sq,
+	unsigned int pos,
+	unsigned int count)
+{
+	unsigned int bit;
+	unsigned int bits;
+	unsigned long mask;
+
+	while (count > 0) {
+		bit = pos % SQ_BITS_PER_WORD;
+		bits = SQ_BITS_PER_WORD - bit;
+		if (bits > count) {
+			bits = count;
+		}
+		if (bits == SQ_BITS_PER_WORD) {
+			mask = ~0UL;
+		} else {
+			mask = ((1UL << bits) - 1) << bit;
+		}
+		sq->items_inuse[pos / SQ_BITS_PER_WORD] &= ~mask;
+		pos += bits;
+		count -= bits;
+	}
+}
+
 static inline int sq_init (
 	struct sq *sq,
 	int item_count,
 	int size_per_item,
 	int head_seqid)
 {
+	unsigned int size;
+
+	for (size = SQ_BITS_PER_WORD; size < item_count; size <<= 1);
+
 	sq->head = 0;
-	sq->size = item_count;
+	sq->size = size;
+	sq->mask = size - 1;
 	sq->size_per_item = size_per_item;
 	sq->head_seqid = head_seqid;
-	sq->item_count = item_count;
+	sq->item_count = size;
 	sq->pos_max = 0;
 
-	sq->items = malloc (item_count * size_per_item);
+	sq->items = malloc (size * size_per_item);
 	if (sq->items == NULL) {
 		return (-ENOMEM);
 	}
-	memset (sq->items, 0, item_count * size_per_item);
+	memset (sq->items, 0, size * size_per_item);
 
-	if ((sq->items_inuse = malloc (item_count * sizeof (unsigned int)))
-	    == NULL) {
+	if ((sq->items_inuse = malloc (sq_inuse_bytes (sq))) == NULL) {
 		return (-ENOMEM);
 	}
-	if ((sq->items_miss_count = malloc (item_count * sizeof (unsigned int)))
+	if ((sq->items_miss_count = malloc (size * sizeof (unsigned int)))
 	    == NULL) {
 		return (-ENOMEM);
 	}
-	memset (sq->items_inuse, 0, item_count * sizeof (unsigned int));
-	memset (sq->items_miss_count, 0, item_count * sizeof (unsigned int));
+	memset (sq->items_inuse, 0, sq_inuse_bytes (sq));
+	memset (sq->items_miss_count, 0, size * sizeof (unsigned int));
 	return (0);
 }
 
@@ -130,7 +190,7 @@ static inline void sq_reinit (struct sq *sq, unsigned int head_seqid)
 	sq->pos_max = 0;
 
 	memset (sq->items, 0, sq->item_count * sq->size_per_item);
-	memset (sq->items_inuse, 0, sq->item_count * sizeof (unsigned int));
+	memset (sq->items_inuse, 0, sq_inuse_bytes (sq));
 	memset (sq->items_miss_count, 0, sq->item_count * sizeof (unsigned int));
 }
 
@@ -141,7 +201,7 @@ static inline void sq_assert (const struct sq *sq, unsigned int pos)
 //	printf ("Instrument[%d] Asserting from %d to %d\n",
 //		pos, sq->pos_max, sq->size);
 	for (i = sq->pos_max + 1; i < sq->size; i++) {
-		assert (sq->items_inuse[i] == 0);
+		assert (sq_inuse_test (sq, i) == 0);
 	}
 }
 static inline void sq_copy (struct sq *sq_dest, const struct sq *sq_src)
@@ -149,6 +209,7 @@ static inline void sq_copy (struct sq *sq_dest, const struct sq *sq_src)
 	sq_assert (sq_src, 20);
 	sq_dest->head = sq_src->head;
 	sq_dest->size = sq_src->item_count;
+	sq_dest->mask = sq_src->mask;
 	sq_dest->size_per_item = sq_src->size_per_item;
 	sq_dest->head_seqid = sq_src->head_seqid;
 	sq_dest->item_count = sq_src->item_count;
@@ -156,7 +217,7 @@ static inline void sq_copy (struct sq *sq_dest, const struct sq *sq_src)
 	memcpy (sq_dest->items, sq_src->items,
 		sq_src->item_count * sq_src->size_per_item);
 	memcpy (sq_dest->items_inuse, sq_src->items_inuse,
-		sq_src->item_count * sizeof (unsigned int));
+		sq_inuse_bytes (sq_src));
 	memcpy (sq_dest->items_miss_count, sq_src->items_miss_count,
 		sq_src->item_count * sizeof (unsigned int));
 }
@@ -175,20 +236,16 @@ static inline void *sq_item_add (
 	char *sq_item;
 	unsigned int sq_position;
 
-	sq_position = (sq->head + seqid - sq->head_seqid) % sq->size;
+	sq_position = (sq->head + seqid - sq->head_seqid) & sq->mask;
 	if (sq_position > sq->pos_max) {
 		sq->pos_max = sq_position;
 	}
 
 	sq_item = sq->items;
 	sq_item += sq_position * sq->size_per_item;
-	assert(sq->items_inuse[sq_position] == 0);
+	assert(sq_inuse_test (sq, sq_position) == 0);
 	memcpy (sq_item, item, sq->size_per_item);
-	if (seqid == 0) {
-		sq->items_inuse[sq_position] = 1;
-	} else {
-		sq->items_inuse[sq_position] = seqid;
-	}
+	sq_inuse_set (sq, sq_position);
 	sq->items_miss_count[sq_position] = 0;
 
 	return (sq_item);
@@ -212,8 +269,8 @@ static inline unsigned int sq_item_inuse (
 		return 1;
 	}
 #endif
-	sq_position = (sq->head - sq->head_seqid + seq_id) % sq->size;
-	return (sq->items_inuse[sq_position] != 0);
+	sq_position = (sq->head - sq->head_seqid + seq_id) & sq->mask;
+	return (sq_inuse_test (sq, sq_position));
 }
 
 static inline unsigned int sq_item_miss_count (
@@ -222,7 +279,7 @@ static inline unsigned int sq_item_miss_count (
 {
 	unsigned int sq_position;
 
-	sq_position = (sq->head - sq->head_seqid + seq_id) % sq->size;
+	sq_position = (sq->head - sq->head_seqid + seq_id) & sq->mask;
 	sq->items_miss_count[sq_position]++;
 	return (sq->items_miss_count[sq_position]);
 }
@@ -273,18 +330,11 @@ static inline unsigned int sq_item_get (
 	if (seq_id > ADJUST_ROLLOVER_POINT) {
 		assert ((seq_id - ADJUST_ROLLOVER_POINT) <
 			((sq->head_seqid - ADJUST_ROLLOVER_POINT) + sq->size));
-
-		sq_position = ((sq->head - ADJUST_ROLLOVER_VALUE) -
-			(sq->head_seqid - ADJUST_ROLLOVER_VALUE) + seq_id) % sq->size;
 	} else {
 		assert (seq_id < (sq->head_seqid + sq->size));
-		sq_position = (sq->head - sq->head_seqid + seq_id) % sq->size;
 	}
-//printf ("seqid %x head %x head %x pos %x\n", seq_id, sq->head, sq->head_seqid, sq_position);
-//	sq_position = (sq->head - sq->head_seqid + seq_id) % sq->size;
-//printf ("sq_position = %x\n", sq_position);
-//printf ("ITEMGET %d %d %d %d\n", sq_position, sq->head, sq->head_seqid, seq_id);
-	if (sq->items_inuse[sq_position] == 0) {
+	sq_position = (sq->head - sq->head_seqid + seq_id) & sq->mask;
+	if (sq_inuse_test (sq, sq_position) == 0) {
 		return (ENOENT);
 	}
 	sq_item = sq->items;
@@ -293,24 +343,108 @@ static inline unsigned int sq_item_get (
 	return (0);
 }
 
+/*
+ * Return the offset from seq_id of the first item that is missing, looking
+ * at no more than count items and never past the end of the queue window.
+ * If every item looked at is present the number of items looked at is
+ * returned, so the caller can tell a hole from the end of the window with
+ * sq_in_range on the returned position.
+ */
+static inline unsigned int sq_first_hole (
+	const struct sq *sq,
+	unsigned int seq_id,
+	unsigned int count)
+{
+	unsigned int sq_position;
+	unsigned int offset = 0;
+	unsigned int window;
+	unsigned int bit;
+	unsigned long holes;
+
+	if (sq_in_range (sq, seq_id) == 0) {
+		return (0);
+	}
+	window = sq->head_seqid + sq->size - seq_id;
+	if (count > window) {
+		count = window;
+	}
+
+	sq_position = (sq->head - sq->head_seqid + seq_id) & sq->mask;
+	while (offset < count) {
+		bit = sq_position % SQ_BITS_PER_WORD;
+		holes = ~sq->items_inuse[sq_position / SQ_BITS_PER_WORD] >> bit;
+		if (holes != 0) {
+			offset += __builtin_ctzl (holes);
+			break;
+		}
+		offset += SQ_BITS_PER_WORD - bit;
+		sq_position = (sq_position + SQ_BITS_PER_WORD - bit) & sq->mask;
+	}
+	if (offset > count) {
+		offset = count;
+	}
+	return (offset);
+}
+
+/*
+ * Return the offset from seq_id of the first item that is present, with
+ * the same limits as sq_first_hole.  This is the length of a hole.
+ */
+static inline unsigned int sq_first_present (
+	const struct sq *sq,
+	unsigned int seq_id,
+	unsigned int count)
+{
+	unsigned int sq_position;
+	unsigned int offset = 0;
+	unsigned int window;
+	unsigned int bit;
+	unsigned long present;
+
+	if (sq_in_range (sq, seq_id) == 0) {
+		return (0);
+	}
+	window = sq->head_seqid + sq->size - seq_id;
+	if (count > window) {
+		count = window;
+	}
+
+	sq_position = (sq->head - sq->head_seqid + seq_id) & sq->mask;
+	while (offset < count) {
+		bit = sq_position % SQ_BITS_PER_WORD;
+		present = sq->items_inuse[sq_position / SQ_BITS_PER_WORD] >> bit;
+		if (present != 0) {
+			offset += __builtin_ctzl (present);
+			break;
+		}
+		offset += SQ_BITS_PER_WORD - bit;
+		sq_position = (sq_position + SQ_BITS_PER_WORD - bit) & sq->mask;
+	}
+	if (offset > count) {
+		offset = count;
+	}
+	return (offset);
+}
+
 static inline void sq_items_release (struct sq *sq, unsigned int seqid)
 {
 	unsigned int oldhead;
+	unsigned int count;
 
 	oldhead = sq->head;
+	count = seqid - sq->head_seqid + 1;
 
-	sq->head = (sq->head + seqid - sq->head_seqid + 1) % sq->size;
-	if ((oldhead + seqid - sq->head_seqid + 1) > sq->size) {
-//		printf ("releasing %d for %d\n", oldhead, sq->size - oldhead);
-//		printf ("releasing %d for %d\n", 0, sq->head);
-		memset (&sq->items_inuse[oldhead], 0, (sq->size - oldhead) * sizeof (unsigned int));
-		memset (sq->items_inuse, 0, sq->head * sizeof (unsigned int));
+	sq->head = (sq->head + count) & sq->mask;
+	if ((oldhead + count) > sq->size) {
+		sq_inuse_clear (sq, oldhead, sq->size - oldhead);
+		sq_inuse_clear (sq, 0, sq->head);
+		memset (&sq->items_miss_count[oldhead], 0,
+			(sq->size - oldhead) * sizeof (unsigned int));
+		memset (sq->items_miss_count, 0, sq->head * sizeof (unsigned int));
 	} else {
-//		printf ("releasing %d for %d\n", oldhead, seqid - sq->head_seqid + 1);
-		memset (&sq->items_inuse[oldhead], 0,
-			(seqid - sq->head_seqid + 1) * sizeof (unsigned int));
+		sq_inuse_clear (sq, oldhead, count);
 		memset (&sq->items_miss_count[oldhead], 0,
-			(seqid - sq->head_seqid + 1) * sizeof (unsigned int));
+			count * sizeof (unsigned int));
 	}
 	sq->head_seqid = seqid + 1;
 }
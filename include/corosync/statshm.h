@@ -0,0 +1,243 @@
+/*
+ * Copyright (c) 2012 Red Hat, Inc.
+ *
+ * All rights reserved.
+ *
+ * This software licensed under BSD license, the text of which follows:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * - Neither the name of the MontaVista Software, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef COROSYNC_STATSHM_H_DEFINED
+#define COROSYNC_STATSHM_H_DEFINED
+
+#include <stdint.h>
+#include <corosync/corotypes.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @defgroup statshm_corosync Shared memory statistics reader
+ * @ingroup corosync
+ *
+ * The executive publishes its runtime statistics into a shared memory
+ * segment.  Readers map it and take consistent snapshots without any
+ * IPC to the daemon.  The segment is guarded by a sequence counter that
+ * is odd while the executive is writing it.
+ *
+ * @{
+ */
+
+#define STATSHM_NAME			"/corosync-stats"
+#define STATSHM_MAGIC			0x43535453
+#define STATSHM_VERSION			4
+
+#define STATSHM_TOKEN_MAX		100
+#define STATSHM_SERVICE_MAX		64
+#define STATSHM_SERVICE_FN_MAX		64
+#define STATSHM_CONN_MAX		256
+#define STATSHM_NAME_LEN		64
+#define STATSHM_IFACE_MAX		2
+
+typedef uint64_t statshm_handle_t;
+
+struct statshm_token {
+	uint32_t rx;
+	uint32_t tx;
+	int32_t backlog_calc;
+	uint32_t pad;
+};
+
+/*
+ * Latency histogram summary, in microseconds
+ */
+struct statshm_histogram {
+	uint64_t count;
+	uint64_t min;
+	uint64_t max;
+	uint64_t mean;
+	uint64_t p50;
+	uint64_t p90;
+	uint64_t p99;
+	uint64_t p999;
+};
+
+struct statshm_srp {
+	uint64_t orf_token_tx;
+	uint64_t orf_token_rx;
+	uint64_t memb_merge_detect_tx;
+	uint64_t memb_merge_detect_rx;
+	uint64_t memb_join_tx;
+	uint64_t memb_join_rx;
+	uint64_t mcast_tx;
+	uint64_t mcast_retx;
+	uint64_t mcast_rx;
+	uint64_t memb_commit_token_tx;
+	uint64_t memb_commit_token_rx;
+	uint64_t token_hold_cancel_tx;
+	uint64_t token_hold_cancel_rx;
+	uint64_t operational_entered;
+	uint64_t operational_token_lost;
+	uint64_t gather_entered;
+	uint64_t gather_token_lost;
+	uint64_t commit_entered;
+	uint64_t commit_token_lost;
+	uint64_t recovery_entered;
+	uint64_t recovery_token_lost;
+	uint64_t consensus_timeouts;
+	uint64_t rx_msg_dropped;
+	uint64_t fcc_window_increases;
+	uint64_t fcc_window_decreases;
+	uint32_t continuous_gather;
+	uint32_t firewall_enabled_or_nic_failure;
+	uint32_t mtt_rx_token;
+	uint32_t avg_token_workload;
+	uint32_t avg_backlog_calc;
+	uint32_t fcc_window;
+	uint32_t fcc_max_messages;
+
+	struct statshm_histogram token_rotation_hist;
+	struct statshm_histogram token_hold_hist;
+	struct statshm_histogram mcast_deliver_hist;
+	struct statshm_histogram recv_deliver_hist;
+
+	/*
+	 * Token timing ring, oldest entry at earliest_token
+	 */
+	int32_t earliest_token;
+	int32_t latest_token;
+	uint32_t pad;
+	struct statshm_token token[STATSHM_TOKEN_MAX];
+};
+
+struct statshm_iface {
+	uint64_t rx_batches;
+	uint64_t rx_frames;
+	uint64_t tx_batches;
+	uint64_t tx_frames;
+	uint32_t iface_changes;
+	uint32_t rx_batch_max;
+};
+
+struct statshm_service_fn {
+	uint64_t tx;
+	uint64_t rx;
+};
+
+struct statshm_service {
+	char name[STATSHM_NAME_LEN];
+	uint32_t id;
+	uint32_t fn_count;
+	struct statshm_service_fn fn[STATSHM_SERVICE_FN_MAX];
+};
+
+struct statshm_conn {
+	char name[STATSHM_NAME_LEN];
+	int32_t client_pid;
+	uint32_t service_id;
+	uint32_t queue_size;
+	uint32_t flow_control;
+	uint64_t requests;
+	uint64_t responses;
+	uint64_t dispatched;
+	uint64_t invalid_request;
+	uint64_t overload;
+};
+
+struct statshm_segment {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size;
+
+	/*
+	 * Odd while an update is in progress
+	 */
+	volatile uint32_t seq;
+
+	uint64_t update_time;
+	uint32_t update_interval;
+	int32_t pid;
+
+	uint32_t msg_reserved;
+	uint32_t msg_queue_avail;
+	uint32_t compress_active;
+	uint32_t compress_ratio;
+	uint64_t compress_tx_msgs;
+	uint64_t compress_tx_skipped;
+	uint64_t compress_tx_bytes_in;
+	uint64_t compress_tx_bytes_out;
+	uint64_t compress_tx_cpu_ns;
+	uint64_t compress_rx_msgs;
+	uint64_t compress_rx_errors;
+	uint64_t compress_rx_cpu_ns;
+
+	struct statshm_srp srp;
+
+	uint32_t iface_count;
+	uint32_t pad;
+	struct statshm_iface iface[STATSHM_IFACE_MAX];
+
+	uint32_t service_count;
+	uint32_t conn_count;
+
+	/*
+	 * Number of connections, including the ones that did not fit
+	 * into conn[]
+	 */
+	uint32_t conn_total;
+	uint32_t pad2;
+
+	struct statshm_service service[STATSHM_SERVICE_MAX];
+	struct statshm_conn conn[STATSHM_CONN_MAX];
+};
+
+/** @} */
+
+/**
+ * Map the statistics segment of the running executive
+ */
+cs_error_t statshm_open (
+	statshm_handle_t *handle);
+
+/**
+ * Unmap the statistics segment
+ */
+cs_error_t statshm_close (
+	statshm_handle_t handle);
+
+/**
+ * Copy a consistent snapshot of the segment into @a segment.  Returns
+ * CS_ERR_TRY_AGAIN if the executive kept updating it during the copy.
+ */
+cs_error_t statshm_read (
+	statshm_handle_t handle,
+	struct statshm_segment *segment);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* COROSYNC_STATSHM_H_DEFINED */
@@ -165,11 +165,23 @@ struct totem_config {
 
 	unsigned int max_messages;
 
+	unsigned int send_coalesce;
+
+	unsigned int adaptive_window;
+
+	unsigned int window_size_min;
+
+	unsigned int window_size_max;
+
+	enum { TOTEM_COMPRESS_NONE=0, TOTEM_COMPRESS_LZ4 } compress_type;
+
+	unsigned int compress_threshold;
+
 	const char *vsf_type;
 
 	unsigned int broadcast_use;
 
-	enum { TOTEM_CRYPTO_SOBER=0, TOTEM_CRYPTO_NSS } crypto_type;
+	enum { TOTEM_CRYPTO_SOBER=0, TOTEM_CRYPTO_NSS, TOTEM_CRYPTO_AES_GCM } crypto_type;
 	enum { TOTEM_CRYPTO_ACCEPT_OLD=0, TOTEM_CRYPTO_ACCEPT_NEW } crypto_accept;
 
 	int crypto_crypt_type;
@@ -197,6 +209,17 @@ enum totem_event_type {
 	TOTEM_EVENT_NEW_MSG,
 };
 
+/*
+ * One message of a run of in order messages handed up the stack at once.
+ * msg stays valid until the batch delivery function returns.
+ */
+struct totem_deliver_item {
+	unsigned int nodeid;
+	const void *msg;
+	unsigned int msg_len;
+	int endian_conversion_required;
+};
+
 #define MEMB_RING_ID
 struct memb_ring_id {
 	struct totem_ip_address rep;
@@ -209,22 +232,54 @@ typedef struct {
 	time_t last_updated;
 } totem_stats_header_t;
 
+typedef struct {
+	uint64_t hits;
+	uint64_t misses;
+	uint32_t in_use;
+	uint32_t high_water;
+	uint32_t free;
+} totemframe_pool_stats_t;
+
 typedef struct {
 	totem_stats_header_t hdr;
 	uint32_t iface_changes;
+	uint64_t rx_batches;
+	uint64_t rx_frames;
+	uint32_t rx_batch_max;
+	uint64_t tx_batches;
+	uint64_t tx_frames;
+	totemframe_pool_stats_t frame_pool;
 } totemnet_stats_t;
 
 typedef struct {
 	totem_stats_header_t hdr;
 	totemnet_stats_t *net;
+	uint32_t interface_count;
 	char *algo_name;
 } totemrrp_stats_t;
 
 
+/*
+ * Latency histogram in microseconds, see exec/totemhist.h
+ */
+#define TOTEM_HISTOGRAM_SUB_BITS	3
+#define TOTEM_HISTOGRAM_SUB_BUCKETS	(1 << TOTEM_HISTOGRAM_SUB_BITS)
+#define TOTEM_HISTOGRAM_BUCKETS		(TOTEM_HISTOGRAM_SUB_BUCKETS * 32)
+
+typedef struct {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t min;
+	uint64_t max;
+	uint64_t buckets[TOTEM_HISTOGRAM_BUCKETS];
+} totem_histogram_t;
+
 typedef struct {
 	uint32_t rx;
 	uint32_t tx;
 	int backlog_calc;
+	uint32_t mtt_rx;
+	int counted;
 } totemsrp_token_stats_t;
 
 typedef struct {
@@ -260,6 +315,34 @@ typedef struct {
 #define TOTEM_TOKEN_STATS_MAX 100
 	totemsrp_token_stats_t token[TOTEM_TOKEN_STATS_MAX];
 
+	/*
+	 * Running totals over the counted entries of token[], updated as
+	 * tokens are forwarded and old entries are overwritten
+	 */
+	uint64_t token_mtt_rx_total;
+	uint64_t token_holdtime_total;
+	int64_t token_backlog_total;
+	uint32_t token_count;
+
+	/*
+	 * Flow control limits in effect, moved between window_size_min and
+	 * window_size_max every token when adaptive_window is enabled
+	 */
+	uint32_t fcc_window;
+	uint32_t fcc_max_messages;
+	uint64_t fcc_window_increases;
+	uint64_t fcc_window_decreases;
+
+	/*
+	 * Token receipt to receipt and receipt to forward, mcast enqueue to
+	 * delivery of the processor's own messages and receipt to delivery
+	 * of every message
+	 */
+	totem_histogram_t token_rotation_hist;
+	totem_histogram_t token_hold_hist;
+	totem_histogram_t mcast_deliver_hist;
+	totem_histogram_t recv_deliver_hist;
+
 } totemsrp_stats_t;
 
  
@@ -275,6 +358,21 @@ typedef struct {
 	totemmrp_stats_t *mrp;
 	uint32_t msg_reserved;
 	uint32_t msg_queue_avail;
+
+	/*
+	 * Compression of large messages.  compress_ratio is bytes in per
+	 * 100 bytes out and the cpu_ns counters are thread CPU time.
+	 */
+	uint32_t compress_active;
+	uint32_t compress_ratio;
+	uint64_t compress_tx_msgs;
+	uint64_t compress_tx_skipped;
+	uint64_t compress_tx_bytes_in;
+	uint64_t compress_tx_bytes_out;
+	uint64_t compress_tx_cpu_ns;
+	uint64_t compress_rx_msgs;
+	uint64_t compress_rx_errors;
+	uint64_t compress_rx_cpu_ns;
 } totempg_stats_t;
 
 #endif /* TOTEM_H_DEFINED */
@@ -98,6 +98,15 @@ extern int totempg_groups_initialize (
 
 extern int totempg_groups_finalize (void *instance);
 
+/**
+ * Called after each run of messages delivered to the instance.  Until then
+ * the message memory passed to deliver_fn stays valid, so the instance may
+ * defer work on the messages and do it once per run.
+ */
+extern int totempg_groups_deliver_batch_end_register (
+	void *instance,
+	void (*deliver_batch_end_fn) (void));
+
 extern int totempg_groups_join (
 	void *instance,
 	const struct totempg_group *groups,
@@ -114,6 +123,13 @@ extern int totempg_groups_mcast_joined (
 	unsigned int iov_len,
 	int guarantee);
 
+extern int totempg_groups_mcast_joined_batch (
+	void *instance,
+	const struct iovec *iovec,
+	const unsigned int *msg_iov_len,
+	unsigned int msg_count,
+	int guarantee);
+
 extern int totempg_groups_joined_reserve (
 	void *instance,
 	const struct iovec *iovec,
@@ -62,6 +62,35 @@
 
 #include "util.h"
 
+/*
+ * Zero copy buffers are carved out of one shared arena per connection.
+ * The library maps it and hands it to the daemon at the first
+ * cpg_zcb_alloc(), after which allocating and freeing a buffer are
+ * local operations and cpg_zcb_mcast_joined() only sends its offset.
+ *
+ * Buffer sizes are rounded up to a power of two size class.  Unused
+ * arena space is handed out by bumping zcb_arena_used, freed slots are
+ * kept on a lock free stack per class whose head carries a generation
+ * count in the upper 32 bits, so threads sharing a handle never block
+ * each other.  Slots are never split or merged; requests the arena
+ * can't satisfy get a mapping of their own, as before.
+ */
+#define CPG_ZCB_ARENA_SIZE		(8 * 1024 * 1024)
+#define CPG_ZCB_CLASS_MIN_SHIFT		10
+#define CPG_ZCB_CLASSES			12
+
+enum cpg_zcb_arena_state {
+	CPG_ZCB_ARENA_NONE = 0,
+	CPG_ZCB_ARENA_INITIALIZING,
+	CPG_ZCB_ARENA_READY,
+	CPG_ZCB_ARENA_FAILED
+};
+
+struct cpg_zcb_slot {
+	uint32_t next;		/* offset + 1 of the next free slot, 0 for none */
+	uint32_t size_class;
+} __attribute__((aligned(8)));
+
 struct cpg_inst {
 	qb_ipcc_connection_t *c;
 	int finalize;
@@ -71,6 +100,13 @@ struct cpg_inst {
 		cpg_model_v1_data_t model_v1_data;
 	};
 	struct list_head iteration_list_head;
+	int features_known;
+	uint32_t features;
+	int zcb_arena_state;
+	char *zcb_arena;
+	uint32_t zcb_arena_size;
+	uint32_t zcb_arena_used;
+	uint64_t zcb_free_head[CPG_ZCB_CLASSES];
 };
 
 DECLARE_HDB_DATABASE(cpg_handle_t_db,NULL);
@@ -100,6 +136,56 @@ coroipcc_msg_send_reply_receive (
 	return qb_to_cs_error(qb_ipcc_sendv_recv(c, iov, iov_len, res_msg, res_len, -1));
 }
 
+/*
+ * Ask the daemon once which of the newer requests it handles
+ */
+static cs_error_t cpg_features_get (
+	struct cpg_inst *cpg_inst,
+	uint32_t *features)
+{
+	struct req_lib_cpg_local_get_features req_lib_cpg_local_get_features;
+	struct res_lib_cpg_local_get_features res_lib_cpg_local_get_features;
+	struct iovec iov;
+	ssize_t res;
+
+	if (__sync_fetch_and_add (&cpg_inst->features_known, 0)) {
+		*features = cpg_inst->features;
+		return (CS_OK);
+	}
+
+	req_lib_cpg_local_get_features.header.size =
+		sizeof (struct req_lib_cpg_local_get_features);
+	req_lib_cpg_local_get_features.header.id = MESSAGE_REQ_CPG_LOCAL_GET;
+	req_lib_cpg_local_get_features.features = CPG_FEATURE_ZC_ARENA |
+		CPG_FEATURE_MCAST_BATCH;
+
+	iov.iov_base = (void *)&req_lib_cpg_local_get_features;
+	iov.iov_len = sizeof (struct req_lib_cpg_local_get_features);
+
+	memset (&res_lib_cpg_local_get_features, 0,
+		sizeof (res_lib_cpg_local_get_features));
+	res = qb_ipcc_sendv_recv (cpg_inst->c, &iov, 1,
+		&res_lib_cpg_local_get_features,
+		sizeof (res_lib_cpg_local_get_features), -1);
+	if (res < 0) {
+		return (qb_to_cs_error (res));
+	}
+	if (res_lib_cpg_local_get_features.header.error != CS_OK) {
+		return (res_lib_cpg_local_get_features.header.error);
+	}
+
+	/*
+	 * Older daemons answer with the plain res_lib_cpg_local_get
+	 */
+	*features = 0;
+	if ((size_t)res >= sizeof (struct res_lib_cpg_local_get_features)) {
+		*features = res_lib_cpg_local_get_features.features;
+	}
+	cpg_inst->features = *features;
+	__sync_bool_compare_and_swap (&cpg_inst->features_known, 0, 1);
+	return (CS_OK);
+}
+
 static void cpg_iteration_instance_finalize (struct cpg_iteration_instance_t *cpg_iteration_instance)
 {
 	list_del (&cpg_iteration_instance->list);
@@ -121,6 +207,9 @@ static void cpg_inst_finalize (struct cpg_inst *cpg_inst, hdb_handle_t handle)
 
 		cpg_iteration_instance_finalize (cpg_iteration_instance);
 	}
+	if (cpg_inst->zcb_arena_state == CPG_ZCB_ARENA_READY) {
+		munmap (cpg_inst->zcb_arena, cpg_inst->zcb_arena_size);
+	}
 	hdb_handle_destroy (&cpg_handle_t_db, handle);
 }
 
@@ -181,7 +270,8 @@ cs_error_t cpg_model_initialize (
 		switch (model) {
 		case CPG_MODEL_V1:
 			memcpy (&cpg_inst->model_v1_data, model_data, sizeof (cpg_model_v1_data_t));
-			if ((cpg_inst->model_v1_data.flags & ~(CPG_MODEL_V1_DELIVER_INITIAL_TOTEM_CONF)) != 0) {
+			if ((cpg_inst->model_v1_data.flags & ~(CPG_MODEL_V1_DELIVER_INITIAL_TOTEM_CONF |
+				CPG_MODEL_V1_DELIVER_COALESCED)) != 0) {
 				error = CS_ERR_INVALID_PARAM;
 
 				goto error_destroy;
@@ -321,7 +411,10 @@ cs_error_t cpg_dispatch (
 	struct cpg_inst *cpg_inst;
 	struct res_lib_cpg_confchg_callback *res_cpg_confchg_callback;
 	struct res_lib_cpg_deliver_callback *res_cpg_deliver_callback;
+	struct res_lib_cpg_deliver_batch_callback *res_cpg_deliver_batch_callback;
 	struct res_lib_cpg_totem_confchg_callback *res_cpg_totem_confchg_callback;
+	char *batch_entry;
+	char *batch_end;
 	struct cpg_inst cpg_inst_copy;
 	struct qb_ipc_response_header *dispatch_data;
 	struct cpg_address member_list[CPG_MEMBERS_MAX];
@@ -404,6 +497,47 @@ cs_error_t cpg_dispatch (
 					res_cpg_deliver_callback->msglen);
 				break;
 
+			case MESSAGE_RES_CPG_DELIVER_BATCH_CALLBACK:
+				if (cpg_inst_copy.model_v1_data.cpg_deliver_fn == NULL) {
+					break;
+				}
+
+				/*
+				 * The messages are delivered straight out of
+				 * dispatch_buf, all of them even for
+				 * CS_DISPATCH_ONE
+				 */
+				res_cpg_deliver_batch_callback = (struct res_lib_cpg_deliver_batch_callback *)dispatch_data;
+				batch_entry = (char *)res_cpg_deliver_batch_callback->entries;
+				batch_end = dispatch_buf + errno_res;
+
+				for (i = 0; i < res_cpg_deliver_batch_callback->msg_count; i++) {
+					res_cpg_deliver_callback = (struct res_lib_cpg_deliver_callback *)batch_entry;
+					if (batch_entry + sizeof (struct res_lib_cpg_deliver_callback) > batch_end ||
+						res_cpg_deliver_callback->msglen >
+						batch_end - batch_entry - sizeof (struct res_lib_cpg_deliver_callback)) {
+
+						error = CS_ERR_LIBRARY;
+						goto error_put;
+					}
+
+					marshall_from_mar_cpg_name_t (
+						&group_name,
+						&res_cpg_deliver_callback->group_name);
+
+					cpg_inst_copy.model_v1_data.cpg_deliver_fn (handle,
+						&group_name,
+						res_cpg_deliver_callback->nodeid,
+						res_cpg_deliver_callback->pid,
+						&res_cpg_deliver_callback->message,
+						res_cpg_deliver_callback->msglen);
+
+					batch_entry += CPG_DELIVER_BATCH_ALIGN (
+						sizeof (struct res_lib_cpg_deliver_callback) +
+						res_cpg_deliver_callback->msglen);
+				}
+				break;
+
 			case MESSAGE_RES_CPG_CONFCHG_CALLBACK:
 				if (cpg_inst_copy.model_v1_data.cpg_confchg_fn == NULL) {
 					break;
@@ -767,6 +901,181 @@ error_close_unlink:
 	return -1;
 }
 
+/*
+ * Returns 0 once the arena of this handle is usable.  Only one thread
+ * sets the arena up, others use dedicated mappings meanwhile rather than
+ * wait for it.  The arena is only asked for when the daemon handles it,
+ * and asked for again later when the daemon was busy.
+ */
+static int zcb_arena_get (struct cpg_inst *cpg_inst)
+{
+	void *buf = NULL;
+	char path[PATH_MAX];
+	mar_req_coroipcc_zc_alloc_t req_coroipcc_zc_alloc;
+	struct qb_ipc_response_header res_coroipcs_zc_alloc;
+	struct iovec iovec;
+	cs_error_t error;
+	uint32_t features;
+	int state;
+
+	state = __sync_fetch_and_add (&cpg_inst->zcb_arena_state, 0);
+	if (state == CPG_ZCB_ARENA_READY) {
+		return (0);
+	}
+	if (state != CPG_ZCB_ARENA_NONE ||
+		__sync_bool_compare_and_swap (&cpg_inst->zcb_arena_state,
+		CPG_ZCB_ARENA_NONE, CPG_ZCB_ARENA_INITIALIZING) == 0) {
+
+		return (-1);
+	}
+
+	error = cpg_features_get (cpg_inst, &features);
+	if (error != CS_OK) {
+		goto error_retry;
+	}
+	if ((features & CPG_FEATURE_ZC_ARENA) == 0) {
+		goto error_exit;
+	}
+
+	if (memory_map (path, "corosync_zerocopy-XXXXXX", &buf,
+		CPG_ZCB_ARENA_SIZE) == -1) {
+
+		goto error_exit;
+	}
+
+	req_coroipcc_zc_alloc.header.size = sizeof (mar_req_coroipcc_zc_alloc_t);
+	req_coroipcc_zc_alloc.header.id = MESSAGE_REQ_CPG_ZC_ARENA_INIT;
+	req_coroipcc_zc_alloc.map_size = CPG_ZCB_ARENA_SIZE;
+	strcpy (req_coroipcc_zc_alloc.path_to_file, path);
+
+	iovec.iov_base = (void *)&req_coroipcc_zc_alloc;
+	iovec.iov_len = sizeof (mar_req_coroipcc_zc_alloc_t);
+
+	error = coroipcc_msg_send_reply_receive (
+		cpg_inst->c,
+		&iovec,
+		1,
+		&res_coroipcs_zc_alloc,
+		sizeof (struct qb_ipc_response_header));
+
+	if (error == CS_OK) {
+		error = res_coroipcs_zc_alloc.error;
+	}
+	if (error != CS_OK ||
+		res_coroipcs_zc_alloc.id != MESSAGE_RES_CPG_ZC_ARENA_INIT) {
+
+		munmap (buf, CPG_ZCB_ARENA_SIZE);
+		unlink (path);
+		if (error == CS_ERR_TRY_AGAIN) {
+			goto error_retry;
+		}
+		goto error_exit;
+	}
+
+	cpg_inst->zcb_arena = buf;
+	cpg_inst->zcb_arena_size = CPG_ZCB_ARENA_SIZE;
+	cpg_inst->zcb_arena_used = 0;
+	__sync_bool_compare_and_swap (&cpg_inst->zcb_arena_state,
+		CPG_ZCB_ARENA_INITIALIZING, CPG_ZCB_ARENA_READY);
+	return (0);
+
+error_retry:
+	__sync_bool_compare_and_swap (&cpg_inst->zcb_arena_state,
+		CPG_ZCB_ARENA_INITIALIZING, CPG_ZCB_ARENA_NONE);
+	return (-1);
+
+error_exit:
+	__sync_bool_compare_and_swap (&cpg_inst->zcb_arena_state,
+		CPG_ZCB_ARENA_INITIALIZING, CPG_ZCB_ARENA_FAILED);
+	return (-1);
+}
+
+static inline int zcb_arena_contains (
+	const struct cpg_inst *cpg_inst,
+	const void *buffer)
+{
+	return (cpg_inst->zcb_arena_state == CPG_ZCB_ARENA_READY &&
+		(const char *)buffer >= cpg_inst->zcb_arena &&
+		(const char *)buffer < cpg_inst->zcb_arena + cpg_inst->zcb_arena_size);
+}
+
+static inline struct cpg_zcb_slot *zcb_slot_from_buffer (void *buffer)
+{
+	return ((struct cpg_zcb_slot *)((char *)buffer -
+		sizeof (struct req_lib_cpg_mcast) - sizeof (struct cpg_zcb_slot)));
+}
+
+static struct cpg_zcb_slot *zcb_arena_slot_alloc (
+	struct cpg_inst *cpg_inst,
+	size_t size)
+{
+	struct cpg_zcb_slot *slot;
+	unsigned int size_class;
+	size_t slot_size;
+	uint64_t head;
+	uint64_t new_head;
+	uint32_t used;
+
+	size += sizeof (struct cpg_zcb_slot) + sizeof (struct req_lib_cpg_mcast);
+	for (size_class = 0; size_class < CPG_ZCB_CLASSES; size_class++) {
+		slot_size = (size_t)1 << (size_class + CPG_ZCB_CLASS_MIN_SHIFT);
+		if (slot_size >= size) {
+			break;
+		}
+	}
+	if (size_class == CPG_ZCB_CLASSES) {
+		return (NULL);
+	}
+
+	/*
+	 * Reuse a freed slot of the same class.  slot->next may be read
+	 * from a slot another thread has just popped, but then the
+	 * generation count in the head has changed and the swap fails.
+	 */
+	do {
+		head = cpg_inst->zcb_free_head[size_class];
+		if ((uint32_t)head == 0) {
+			break;
+		}
+		slot = (struct cpg_zcb_slot *)(cpg_inst->zcb_arena +
+			(uint32_t)head - 1);
+		new_head = (((head >> 32) + 1) << 32) | slot->next;
+		if (__sync_bool_compare_and_swap (
+			&cpg_inst->zcb_free_head[size_class], head, new_head)) {
+
+			return (slot);
+		}
+	} while (1);
+
+	do {
+		used = cpg_inst->zcb_arena_used;
+		if (slot_size > cpg_inst->zcb_arena_size - used) {
+			return (NULL);
+		}
+	} while (__sync_bool_compare_and_swap (&cpg_inst->zcb_arena_used,
+		used, used + slot_size) == 0);
+
+	slot = (struct cpg_zcb_slot *)(cpg_inst->zcb_arena + used);
+	slot->size_class = size_class;
+	return (slot);
+}
+
+static void zcb_arena_slot_free (
+	struct cpg_inst *cpg_inst,
+	struct cpg_zcb_slot *slot)
+{
+	uint32_t offset = (char *)slot - cpg_inst->zcb_arena;
+	uint64_t head;
+	uint64_t new_head;
+
+	do {
+		head = cpg_inst->zcb_free_head[slot->size_class];
+		slot->next = (uint32_t)head;
+		new_head = (((head >> 32) + 1) << 32) | (offset + 1);
+	} while (__sync_bool_compare_and_swap (
+		&cpg_inst->zcb_free_head[slot->size_class], head, new_head) == 0);
+}
+
 cs_error_t cpg_zcb_alloc (
 	cpg_handle_t handle,
 	size_t size,
@@ -779,6 +1088,7 @@ cs_error_t cpg_zcb_alloc (
 	size_t map_size;
 	struct iovec iovec;
 	struct coroipcs_zc_header *hdr;
+	struct cpg_zcb_slot *slot;
 	cs_error_t error;
 	struct cpg_inst *cpg_inst;
 
@@ -787,6 +1097,16 @@ cs_error_t cpg_zcb_alloc (
 		return (error);
 	}
 
+	if (zcb_arena_get (cpg_inst) == 0) {
+		slot = zcb_arena_slot_alloc (cpg_inst, size);
+		if (slot != NULL) {
+			*buffer = ((char *)slot) + sizeof (struct cpg_zcb_slot) +
+				sizeof (struct req_lib_cpg_mcast);
+			hdb_handle_put (&cpg_handle_t_db, handle);
+			return (CS_OK);
+		}
+	}
+
 	map_size = size + sizeof (struct req_lib_cpg_mcast) + sizeof (struct coroipcs_zc_header);
 	assert(memory_map (path, "corosync_zerocopy-XXXXXX", &buf, map_size) != -1);
 
@@ -831,6 +1151,12 @@ cs_error_t cpg_zcb_free (
 		return (error);
 	}
 
+	if (zcb_arena_contains (cpg_inst, buffer)) {
+		zcb_arena_slot_free (cpg_inst, zcb_slot_from_buffer (buffer));
+		hdb_handle_put (&cpg_handle_t_db, handle);
+		return (CS_OK);
+	}
+
 	req_coroipcc_zc_free.header.size = sizeof (mar_req_coroipcc_zc_free_t);
 	req_coroipcc_zc_free.header.id = MESSAGE_REQ_CPG_ZC_FREE;
 	req_coroipcc_zc_free.map_size = header->map_size;
@@ -864,6 +1190,7 @@ cs_error_t cpg_zcb_mcast_joined (
 	struct req_lib_cpg_mcast *req_lib_cpg_mcast;
 	struct res_lib_cpg_mcast res_lib_cpg_mcast;
 	mar_req_coroipcc_zc_execute_t req_coroipcc_zc_execute;
+	mar_req_coroipcc_zc_arena_execute_t req_coroipcc_zc_arena_execute;
 	struct coroipcs_zc_header *hdr;
 	struct iovec iovec;
 
@@ -879,14 +1206,24 @@ cs_error_t cpg_zcb_mcast_joined (
 	req_lib_cpg_mcast->guarantee = guarantee;
 	req_lib_cpg_mcast->msglen = msg_len;
 
-	hdr = (struct coroipcs_zc_header *)(((char *)req_lib_cpg_mcast) - sizeof (struct coroipcs_zc_header));
+	if (zcb_arena_contains (cpg_inst, msg)) {
+		req_coroipcc_zc_arena_execute.header.size = sizeof (mar_req_coroipcc_zc_arena_execute_t);
+		req_coroipcc_zc_arena_execute.header.id = MESSAGE_REQ_CPG_ZC_ARENA_EXECUTE;
+		req_coroipcc_zc_arena_execute.offset =
+			(char *)req_lib_cpg_mcast - cpg_inst->zcb_arena;
 
-	req_coroipcc_zc_execute.header.size = sizeof (mar_req_coroipcc_zc_execute_t);
-	req_coroipcc_zc_execute.header.id = MESSAGE_REQ_CPG_ZC_EXECUTE;
-	req_coroipcc_zc_execute.server_address = hdr->server_address;
+		iovec.iov_base = (void *)&req_coroipcc_zc_arena_execute;
+		iovec.iov_len = sizeof (mar_req_coroipcc_zc_arena_execute_t);
+	} else {
+		hdr = (struct coroipcs_zc_header *)(((char *)req_lib_cpg_mcast) - sizeof (struct coroipcs_zc_header));
 
-	iovec.iov_base = (void *)&req_coroipcc_zc_execute;
-	iovec.iov_len = sizeof (mar_req_coroipcc_zc_execute_t);
+		req_coroipcc_zc_execute.header.size = sizeof (mar_req_coroipcc_zc_execute_t);
+		req_coroipcc_zc_execute.header.id = MESSAGE_REQ_CPG_ZC_EXECUTE;
+		req_coroipcc_zc_execute.server_address = hdr->server_address;
+
+		iovec.iov_base = (void *)&req_coroipcc_zc_execute;
+		iovec.iov_len = sizeof (mar_req_coroipcc_zc_execute_t);
+	}
 
 	error = coroipcc_msg_send_reply_receive (
 		cpg_inst->c,
@@ -947,6 +1284,79 @@ cs_error_t cpg_mcast_joined (
 	return (error);
 }
 
+cs_error_t cpg_mcast_joined_batch (
+	cpg_handle_t handle,
+	cpg_guarantee_t guarantee,
+	const struct iovec *iovec,
+	unsigned int msg_count)
+{
+	unsigned int i;
+	cs_error_t error;
+	struct cpg_inst *cpg_inst;
+	struct iovec iov[CPG_MCAST_BATCH_MAX + 2];
+	struct req_lib_cpg_mcast_batch req_lib_cpg_mcast_batch;
+	struct res_lib_cpg_mcast res_lib_cpg_mcast;
+	mar_uint32_t msglens[CPG_MCAST_BATCH_MAX];
+	uint32_t features;
+	size_t size;
+
+	if (msg_count == 0 || msg_count > CPG_MCAST_BATCH_MAX) {
+		return (CS_ERR_INVALID_PARAM);
+	}
+
+	size = sizeof (struct req_lib_cpg_mcast_batch) +
+		msg_count * sizeof (mar_uint32_t);
+	for (i = 0; i < msg_count; i++) {
+		msglens[i] = iovec[i].iov_len;
+		size += iovec[i].iov_len;
+	}
+	if (size > IPC_REQUEST_SIZE) {
+		return (CS_ERR_TOO_BIG);
+	}
+
+	error = hdb_error_to_cs (hdb_handle_get (&cpg_handle_t_db, handle, (void *)&cpg_inst));
+	if (error != CS_OK) {
+		return (error);
+	}
+
+	error = cpg_features_get (cpg_inst, &features);
+	if (error != CS_OK) {
+		goto error_exit;
+	}
+	if ((features & CPG_FEATURE_MCAST_BATCH) == 0) {
+		error = CS_ERR_NOT_SUPPORTED;
+		goto error_exit;
+	}
+
+	req_lib_cpg_mcast_batch.header.size = size;
+	req_lib_cpg_mcast_batch.header.id = MESSAGE_REQ_CPG_MCAST_BATCH;
+	req_lib_cpg_mcast_batch.guarantee = guarantee;
+	req_lib_cpg_mcast_batch.msg_count = msg_count;
+
+	iov[0].iov_base = (void *)&req_lib_cpg_mcast_batch;
+	iov[0].iov_len = sizeof (struct req_lib_cpg_mcast_batch);
+	iov[1].iov_base = (void *)msglens;
+	iov[1].iov_len = msg_count * sizeof (mar_uint32_t);
+	memcpy (&iov[2], iovec, msg_count * sizeof (struct iovec));
+
+	error = coroipcc_msg_send_reply_receive (cpg_inst->c,
+		iov,
+		msg_count + 2,
+		&res_lib_cpg_mcast,
+		sizeof (res_lib_cpg_mcast));
+
+	if (error != CS_OK) {
+		goto error_exit;
+	}
+
+	error = res_lib_cpg_mcast.header.error;
+
+error_exit:
+	hdb_handle_put (&cpg_handle_t_db, handle);
+
+	return (error);
+}
+
 cs_error_t cpg_iteration_initialize(
 	cpg_handle_t handle,
 	cpg_iteration_type_t iteration_type,
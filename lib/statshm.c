@@ -0,0 +1,200 @@
+/*
+ * Copyright (c) 2012 Red Hat, Inc.
+ *
+ * All rights reserved.
+ *
+ * This software licensed under BSD license, the text of which follows:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * - Neither the name of the MontaVista Software, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Reader side of the executive statistics segment, see exec/statshm.c
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sched.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <corosync/corotypes.h>
+#include <corosync/corodefs.h>
+#include <corosync/hdb.h>
+#include <corosync/statshm.h>
+
+#include "util.h"
+
+/*
+ * How many times to retry a copy that raced with the executive
+ */
+#define STATSHM_READ_RETRIES	64
+
+struct statshm_inst {
+	const struct statshm_segment *segment;
+	size_t size;
+};
+
+DECLARE_HDB_DATABASE(statshm_handle_t_db,NULL);
+
+cs_error_t statshm_open (
+	statshm_handle_t *handle)
+{
+	cs_error_t error;
+	struct statshm_inst *statshm_inst;
+	struct stat st;
+	void *addr;
+	int fd;
+
+	error = hdb_error_to_cs(hdb_handle_create (&statshm_handle_t_db, sizeof (struct statshm_inst), handle));
+	if (error != CS_OK) {
+		goto error_no_destroy;
+	}
+
+	error = hdb_error_to_cs(hdb_handle_get (&statshm_handle_t_db, *handle, (void *)&statshm_inst));
+	if (error != CS_OK) {
+		goto error_destroy;
+	}
+
+	fd = shm_open (STATSHM_NAME, O_RDONLY, 0);
+	if (fd == -1) {
+		error = (errno == ENOENT) ? CS_ERR_NOT_EXIST : qb_to_cs_error (-errno);
+		goto error_put_destroy;
+	}
+
+	if (fstat (fd, &st) == -1) {
+		error = qb_to_cs_error (-errno);
+		close (fd);
+		goto error_put_destroy;
+	}
+	if ((size_t)st.st_size < sizeof (struct statshm_segment)) {
+		error = CS_ERR_VERSION;
+		close (fd);
+		goto error_put_destroy;
+	}
+
+	addr = mmap (NULL, sizeof (struct statshm_segment), PROT_READ,
+		MAP_SHARED, fd, 0);
+	close (fd);
+	if (addr == MAP_FAILED) {
+		error = qb_to_cs_error (-errno);
+		goto error_put_destroy;
+	}
+
+	statshm_inst->segment = addr;
+	statshm_inst->size = sizeof (struct statshm_segment);
+
+	if (statshm_inst->segment->magic != STATSHM_MAGIC ||
+		statshm_inst->segment->version != STATSHM_VERSION ||
+		statshm_inst->segment->size != sizeof (struct statshm_segment)) {
+
+		error = CS_ERR_VERSION;
+		goto error_unmap;
+	}
+
+	(void)hdb_handle_put (&statshm_handle_t_db, *handle);
+
+	return (CS_OK);
+
+error_unmap:
+	munmap ((void *)statshm_inst->segment, statshm_inst->size);
+error_put_destroy:
+	(void)hdb_handle_put (&statshm_handle_t_db, *handle);
+error_destroy:
+	(void)hdb_handle_destroy (&statshm_handle_t_db, *handle);
+error_no_destroy:
+	return (error);
+}
+
+cs_error_t statshm_close (
+	statshm_handle_t handle)
+{
+	struct statshm_inst *statshm_inst;
+	cs_error_t error;
+
+	error = hdb_error_to_cs (hdb_handle_get (&statshm_handle_t_db, handle, (void *)&statshm_inst));
+	if (error != CS_OK) {
+		return (error);
+	}
+
+	munmap ((void *)statshm_inst->segment, statshm_inst->size);
+
+	(void)hdb_handle_destroy (&statshm_handle_t_db, handle);
+
+	(void)hdb_handle_put (&statshm_handle_t_db, handle);
+
+	return (CS_OK);
+}
+
+cs_error_t statshm_read (
+	statshm_handle_t handle,
+	struct statshm_segment *segment)
+{
+	struct statshm_inst *statshm_inst;
+	const struct statshm_segment *shared;
+	uint32_t seq_begin;
+	uint32_t seq_end;
+	cs_error_t error;
+	int retries;
+
+	if (segment == NULL) {
+		return (CS_ERR_INVALID_PARAM);
+	}
+
+	error = hdb_error_to_cs (hdb_handle_get (&statshm_handle_t_db, handle, (void *)&statshm_inst));
+	if (error != CS_OK) {
+		return (error);
+	}
+
+	shared = statshm_inst->segment;
+	error = CS_ERR_TRY_AGAIN;
+	for (retries = 0; retries < STATSHM_READ_RETRIES; retries++) {
+		seq_begin = shared->seq;
+		if (seq_begin & 1) {
+			sched_yield ();
+			continue;
+		}
+		__sync_synchronize ();
+
+		memcpy (segment, (const void *)shared, sizeof (struct statshm_segment));
+
+		__sync_synchronize ();
+		seq_end = shared->seq;
+		if (seq_begin == seq_end) {
+			error = CS_OK;
+			break;
+		}
+	}
+
+	(void)hdb_handle_put (&statshm_handle_t_db, handle);
+
+	return (error);
+}
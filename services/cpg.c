@@ -151,8 +151,15 @@ struct cpg_pd {
 	unsigned int flags;
 	int initial_totem_conf_sent;
 	struct list_head list;
+	struct list_head group_list; /* on the group_info cpd list */
 	struct list_head iteration_instance_list_head;
 	struct list_head zcb_mapped_list_head;
+	void *zcb_arena;
+	size_t zcb_arena_size;
+	unsigned int *batch_msgs;
+	unsigned int batch_msgs_entries;
+	unsigned int batch_msgs_size;
+	struct list_head batch_list; /* on cpg_batch_pd_list_head */
 };
 
 struct cpg_iteration_instance {
@@ -186,7 +193,46 @@ struct process_info {
 	mar_cpg_name_t group;
 	struct list_head list; /* on the group_info members list */
 };
-DECLARE_LIST_INIT(process_info_list_head);
+
+/*
+ * One entry per group name known to this node.  members holds the
+ * process_info of every process in the group cluster wide, sorted by
+ * nodeid and pid, and cpd_list holds the local connections which have
+ * joined (or are joining/leaving) the group, so delivery and membership
+ * lookups only touch the group in question.
+ */
+struct group_info {
+	mar_cpg_name_t group;
+	struct list_head members;
+	struct list_head cpd_list;
+	struct list_head hash_list;
+};
+
+static struct list_head *group_hash = NULL;
+
+static unsigned int group_hash_size = 0;
+
+static unsigned int group_count = 0;
+
+static unsigned int initial_totem_conf_pending = 0;
+
+/*
+ * Deliveries of the current run of messages from totem.  Every message
+ * is kept once, each connection keeps the indexes of the messages it
+ * has to get, and all of them are sent when the run ends.
+ */
+struct cpg_batch_msg {
+	struct res_lib_cpg_deliver_callback res;
+	const void *msg;
+};
+
+static struct cpg_batch_msg *cpg_batch_msgs = NULL;
+
+static unsigned int cpg_batch_msgs_entries = 0;
+
+static unsigned int cpg_batch_msgs_size = 0;
+
+DECLARE_LIST_INIT(cpg_batch_pd_list_head);
 
 struct join_list_entry {
 	uint32_t pid;
@@ -198,6 +244,8 @@ struct join_list_entry {
  */
 static int cpg_exec_init_fn (struct corosync_api_v1 *);
 
+static void cpg_exec_deliver_batch_end (void);
+
 static int cpg_lib_init_fn (void *conn);
 
 static int cpg_lib_exit_fn (void *conn);
@@ -244,6 +292,8 @@ static void message_handler_req_lib_cpg_finalize (void *conn, const void *messag
 
 static void message_handler_req_lib_cpg_mcast (void *conn, const void *message);
 
+static void message_handler_req_lib_cpg_mcast_batch (void *conn, const void *message);
+
 static void message_handler_req_lib_cpg_membership (void *conn,
 						    const void *message);
 
@@ -274,6 +324,14 @@ static void message_handler_req_lib_cpg_zc_execute (
 	void *conn,
 	const void *message);
 
+static void message_handler_req_lib_cpg_zc_arena_init (
+	void *conn,
+	const void *message);
+
+static void message_handler_req_lib_cpg_zc_arena_execute (
+	void *conn,
+	const void *message);
+
 static int cpg_node_joinleave_send (unsigned int pid, const mar_cpg_name_t *group_name, int fn, int reason);
 
 static int cpg_exec_send_downlist(void);
@@ -358,6 +416,18 @@ static struct corosync_lib_handler cpg_lib_engine[] =
 		.lib_handler_fn				= message_handler_req_lib_cpg_zc_execute,
 		.flow_control				= CS_LIB_FLOW_CONTROL_REQUIRED
 	},
+	{ /* 12 - MESSAGE_REQ_CPG_ZC_ARENA_INIT */
+		.lib_handler_fn				= message_handler_req_lib_cpg_zc_arena_init,
+		.flow_control				= CS_LIB_FLOW_CONTROL_REQUIRED
+	},
+	{ /* 13 - MESSAGE_REQ_CPG_ZC_ARENA_EXECUTE */
+		.lib_handler_fn				= message_handler_req_lib_cpg_zc_arena_execute,
+		.flow_control				= CS_LIB_FLOW_CONTROL_REQUIRED
+	},
+	{ /* 14 - MESSAGE_REQ_CPG_MCAST_BATCH */
+		.lib_handler_fn				= message_handler_req_lib_cpg_mcast_batch,
+		.flow_control				= CS_LIB_FLOW_CONTROL_REQUIRED
+	},
 
 
 };
@@ -409,7 +479,8 @@ struct corosync_service_engine cpg_service_engine = {
 	.sync_init                              = (sync_init_v1_fn_t)cpg_sync_init_v2,
 	.sync_process                           = cpg_sync_process,
 	.sync_activate                          = cpg_sync_activate,
-	.sync_abort                             = cpg_sync_abort
+	.sync_abort                             = cpg_sync_abort,
+	.exec_deliver_batch_end_fn		= cpg_exec_deliver_batch_end
 };
 
 /*
@@ -499,6 +570,133 @@ struct downlist_msg {
 
 static struct req_exec_cpg_downlist g_req_exec_cpg_downlist;
 
+static inline unsigned int group_hash_fn (
+	const mar_cpg_name_t *name,
+	unsigned int hash_size)
+{
+	unsigned int length = name->length;
+
+	if (length > CPG_MAX_NAME_LENGTH) {
+		length = CPG_MAX_NAME_LENGTH;
+	}
+	return (jhash (name->value, length, 0) & (hash_size - 1));
+}
+
+static int group_hash_resize (unsigned int new_size)
+{
+	struct list_head *new_hash;
+	struct list_head *iter, *iter_next;
+	struct group_info *gi;
+	unsigned int i;
+
+	new_hash = malloc (new_size * sizeof (struct list_head));
+	if (new_hash == NULL) {
+		return (-1);
+	}
+	for (i = 0; i < new_size; i++) {
+		list_init (&new_hash[i]);
+	}
+
+	for (i = 0; i < group_hash_size; i++) {
+		for (iter = group_hash[i].next; iter != &group_hash[i]; iter = iter_next) {
+			iter_next = iter->next;
+
+			gi = list_entry (iter, struct group_info, hash_list);
+			list_add (&gi->hash_list,
+				&new_hash[group_hash_fn (&gi->group, new_size)]);
+		}
+	}
+
+	free (group_hash);
+	group_hash = new_hash;
+	group_hash_size = new_size;
+	return (0);
+}
+
+static struct group_info *group_info_find (const mar_cpg_name_t *name)
+{
+	struct list_head *head;
+	struct list_head *iter;
+	struct group_info *gi;
+
+	head = &group_hash[group_hash_fn (name, group_hash_size)];
+	for (iter = head->next; iter != head; iter = iter->next) {
+		gi = list_entry (iter, struct group_info, hash_list);
+		if (mar_name_compare (&gi->group, name) == 0) {
+			return (gi);
+		}
+	}
+	return (NULL);
+}
+
+/*
+ * Find the group, creating an empty entry if this is the first we hear of it
+ */
+static struct group_info *group_info_get (const mar_cpg_name_t *name)
+{
+	struct group_info *gi;
+
+	gi = group_info_find (name);
+	if (gi != NULL) {
+		return (gi);
+	}
+
+	if (group_count >= group_hash_size * 2) {
+		/*
+		 * A failed resize only makes the chains longer
+		 */
+		group_hash_resize (group_hash_size * 2);
+	}
+
+	gi = malloc (sizeof (struct group_info));
+	if (gi == NULL) {
+		log_printf(LOGSYS_LEVEL_WARNING, "Unable to allocate group_info struct");
+		return (NULL);
+	}
+	memcpy (&gi->group, name, sizeof (mar_cpg_name_t));
+	list_init (&gi->members);
+	list_init (&gi->cpd_list);
+	list_add (&gi->hash_list, &group_hash[group_hash_fn (name, group_hash_size)]);
+	group_count++;
+	return (gi);
+}
+
+/*
+ * Free the group once no process is a member and no local connection refers to it
+ */
+static void group_info_release (struct group_info *gi)
+{
+	if (!list_empty (&gi->members) || !list_empty (&gi->cpd_list)) {
+		return;
+	}
+	list_del (&gi->hash_list);
+	free (gi);
+	group_count--;
+}
+
+static void cpd_group_del (struct cpg_pd *cpd)
+{
+	struct group_info *gi;
+
+	if (list_empty (&cpd->group_list)) {
+		return;
+	}
+	list_del (&cpd->group_list);
+	list_init (&cpd->group_list);
+
+	gi = group_info_find (&cpd->group_name);
+	if (gi != NULL) {
+		group_info_release (gi);
+	}
+}
+
+static void process_info_del (struct group_info *gi, struct process_info *pi)
+{
+	list_del (&pi->list);
+	free (pi);
+	group_info_release (gi);
+}
+
 static void cpg_sync_init_v2 (
 	const unsigned int *trans_list,
 	size_t trans_list_entries,
@@ -580,6 +778,195 @@ static void cpg_sync_abort (void)
 	downlist_messages_delete ();
 }
 
+static int cpg_batch_msg_add (
+	const struct res_lib_cpg_deliver_callback *res,
+	const void *msg)
+{
+	struct cpg_batch_msg *new_msgs;
+	unsigned int new_size;
+
+	if (cpg_batch_msgs_entries == cpg_batch_msgs_size) {
+		new_size = cpg_batch_msgs_size ? cpg_batch_msgs_size * 2 : 64;
+		new_msgs = realloc (cpg_batch_msgs,
+			new_size * sizeof (struct cpg_batch_msg));
+		if (new_msgs == NULL) {
+			return (-1);
+		}
+		cpg_batch_msgs = new_msgs;
+		cpg_batch_msgs_size = new_size;
+	}
+	memcpy (&cpg_batch_msgs[cpg_batch_msgs_entries].res, res,
+		sizeof (struct res_lib_cpg_deliver_callback));
+	cpg_batch_msgs[cpg_batch_msgs_entries].msg = msg;
+	return (cpg_batch_msgs_entries++);
+}
+
+static int cpd_batch_add (struct cpg_pd *cpd, unsigned int msg_index)
+{
+	unsigned int *new_msgs;
+	unsigned int new_size;
+
+	if (cpd->batch_msgs_entries == cpd->batch_msgs_size) {
+		new_size = cpd->batch_msgs_size ? cpd->batch_msgs_size * 2 : 16;
+		new_msgs = realloc (cpd->batch_msgs,
+			new_size * sizeof (unsigned int));
+		if (new_msgs == NULL) {
+			return (-1);
+		}
+		cpd->batch_msgs = new_msgs;
+		cpd->batch_msgs_size = new_size;
+	}
+	if (cpd->batch_msgs_entries == 0) {
+		list_add_tail (&cpd->batch_list, &cpg_batch_pd_list_head);
+	}
+	cpd->batch_msgs[cpd->batch_msgs_entries++] = msg_index;
+	return (0);
+}
+
+/*
+ * Largest event deliveries are coalesced into, small enough to fit the
+ * dispatch buffer of libraries built with HAVE_SMALL_MEMORY_FOOTPRINT
+ */
+#define CPG_COALESCE_BYTES_MAX	(32 * 1024)
+
+#define CPG_COALESCE_MSGS_MAX	(CPG_COALESCE_BYTES_MAX / \
+	sizeof (struct res_lib_cpg_deliver_callback))
+
+/*
+ * Sends the deliveries from first to last as one
+ * MESSAGE_RES_CPG_DELIVER_BATCH_CALLBACK event
+ */
+static void cpd_batch_send_coalesced (
+	struct cpg_pd *cpd,
+	unsigned int first,
+	unsigned int last,
+	size_t size)
+{
+	static struct iovec iovec[CPG_COALESCE_MSGS_MAX * 3 + 1];
+	static const char pad[8];
+	struct res_lib_cpg_deliver_batch_callback res;
+	struct cpg_batch_msg *batch_msg;
+	unsigned int iov_len = 0;
+	unsigned int i;
+	size_t msg_size;
+
+	res.header.id = MESSAGE_RES_CPG_DELIVER_BATCH_CALLBACK;
+	res.header.size = sizeof (res) + size;
+	res.header.error = CS_OK;
+	res.msg_count = last - first + 1;
+	iovec[iov_len].iov_base = (void *)&res;
+	iovec[iov_len++].iov_len = sizeof (res);
+
+	for (i = first; i <= last; i++) {
+		batch_msg = &cpg_batch_msgs[cpd->batch_msgs[i]];
+		msg_size = sizeof (struct res_lib_cpg_deliver_callback) +
+			batch_msg->res.msglen;
+
+		iovec[iov_len].iov_base = (void *)&batch_msg->res;
+		iovec[iov_len++].iov_len = sizeof (struct res_lib_cpg_deliver_callback);
+		iovec[iov_len].iov_base = (void *)batch_msg->msg;
+		iovec[iov_len++].iov_len = batch_msg->res.msglen;
+		if (CPG_DELIVER_BATCH_ALIGN (msg_size) != msg_size) {
+			iovec[iov_len].iov_base = (void *)pad;
+			iovec[iov_len++].iov_len =
+				CPG_DELIVER_BATCH_ALIGN (msg_size) - msg_size;
+		}
+	}
+	api->ipc_dispatch_iov_send (cpd->conn, iovec, iov_len);
+}
+
+/*
+ * Packs the held back deliveries of a connection that asked for it into
+ * as few events as possible.  A run of one, or a message too large to
+ * share an event, goes out as a plain delivery.
+ */
+static void cpd_batch_flush_coalesced (struct cpg_pd *cpd)
+{
+	struct cpg_batch_msg *batch_msg;
+	struct iovec iovec[2];
+	unsigned int first = 0;
+	unsigned int i;
+	size_t size = 0;
+	size_t msg_size;
+
+	for (i = 0; i <= cpd->batch_msgs_entries; i++) {
+		msg_size = 0;
+		if (i < cpd->batch_msgs_entries) {
+			batch_msg = &cpg_batch_msgs[cpd->batch_msgs[i]];
+			msg_size = CPG_DELIVER_BATCH_ALIGN (
+				sizeof (struct res_lib_cpg_deliver_callback) +
+				batch_msg->res.msglen);
+			if (size + msg_size <= CPG_COALESCE_BYTES_MAX -
+				sizeof (struct res_lib_cpg_deliver_batch_callback)) {
+
+				size += msg_size;
+				continue;
+			}
+		}
+
+		/*
+		 * Message i doesn't fit or there are no more, send the
+		 * ones collected so far
+		 */
+		if (i - first > 1) {
+			cpd_batch_send_coalesced (cpd, first, i - 1, size);
+		} else
+		if (i - first == 1) {
+			batch_msg = &cpg_batch_msgs[cpd->batch_msgs[first]];
+			iovec[0].iov_base = (void *)&batch_msg->res;
+			iovec[0].iov_len = sizeof (struct res_lib_cpg_deliver_callback);
+			iovec[1].iov_base = (void *)batch_msg->msg;
+			iovec[1].iov_len = batch_msg->res.msglen;
+			api->ipc_dispatch_iov_send (cpd->conn, iovec, 2);
+		}
+		first = i;
+		size = msg_size;
+	}
+}
+
+static void cpd_batch_flush (struct cpg_pd *cpd)
+{
+	struct cpg_batch_msg *batch_msg;
+	struct iovec iovec[2];
+	unsigned int i;
+
+	if (cpd->batch_msgs_entries == 0) {
+		return;
+	}
+	if (cpd->flags & CPG_MODEL_V1_DELIVER_COALESCED) {
+		cpd_batch_flush_coalesced (cpd);
+		cpd->batch_msgs_entries = 0;
+		list_del (&cpd->batch_list);
+		return;
+	}
+	for (i = 0; i < cpd->batch_msgs_entries; i++) {
+		batch_msg = &cpg_batch_msgs[cpd->batch_msgs[i]];
+		iovec[0].iov_base = (void *)&batch_msg->res;
+		iovec[0].iov_len = sizeof (struct res_lib_cpg_deliver_callback);
+		iovec[1].iov_base = (void *)batch_msg->msg;
+		iovec[1].iov_len = batch_msg->res.msglen;
+		api->ipc_dispatch_iov_send (cpd->conn, iovec, 2);
+	}
+	cpd->batch_msgs_entries = 0;
+	list_del (&cpd->batch_list);
+}
+
+/*
+ * Send the deliveries held back during the run of messages.  Also called
+ * before any other callback is sent, to keep the order clients see.
+ */
+static void cpg_exec_deliver_batch_end (void)
+{
+	struct cpg_pd *cpd;
+
+	while (!list_empty (&cpg_batch_pd_list_head)) {
+		cpd = list_entry (cpg_batch_pd_list_head.next,
+			struct cpg_pd, batch_list);
+		cpd_batch_flush (cpd);
+	}
+	cpg_batch_msgs_entries = 0;
+}
+
 static int notify_lib_totem_membership (
 	void *conn,
 	int member_list_entries,
@@ -590,6 +977,8 @@ static int notify_lib_totem_membership (
 	int size;
 	struct res_lib_cpg_totem_confchg_callback *res;
 
+	cpg_exec_deliver_batch_end ();
+
 	size = sizeof(struct res_lib_cpg_totem_confchg_callback) +
 		sizeof(mar_uint32_t) * (member_list_entries);
 	buf = alloca(size);
@@ -628,16 +1017,21 @@ static int notify_lib_joinlist(
 {
 	int size;
 	char *buf;
-	struct list_head *iter;
+	struct list_head *iter, *iter_next;
 	int count;
 	struct res_lib_cpg_confchg_callback *res;
 	mar_cpg_address_t *retgi;
+	struct group_info *gi;
+
+	cpg_exec_deliver_batch_end ();
 
 	count = 0;
 
-	for (iter = process_info_list_head.next; iter != &process_info_list_head; iter = iter->next) {
-		struct process_info *pi = list_entry (iter, struct process_info, list);
-		if (mar_name_compare (&pi->group, group_name) == 0) {
+	gi = group_info_find (group_name);
+
+	if (gi != NULL) {
+		for (iter = gi->members.next; iter != &gi->members; iter = iter->next) {
+			struct process_info *pi = list_entry (iter, struct process_info, list);
 			int i;
 			int founded = 0;
 
@@ -668,10 +1062,9 @@ static int notify_lib_joinlist(
 	res->header.error = CS_OK;
 	memcpy(&res->group_name, group_name, sizeof(mar_cpg_name_t));
 
-	for (iter = process_info_list_head.next; iter != &process_info_list_head; iter = iter->next) {
-		struct process_info *pi=list_entry (iter, struct process_info, list);
-
-		if (mar_name_compare (&pi->group, group_name) == 0) {
+	if (gi != NULL) {
+		for (iter = gi->members.next; iter != &gi->members; iter = iter->next) {
+			struct process_info *pi=list_entry (iter, struct process_info, list);
 			int i;
 			int founded = 0;
 
@@ -701,32 +1094,38 @@ static int notify_lib_joinlist(
 
 	if (conn) {
 		api->ipc_dispatch_send (conn, buf, size);
-	} else {
-		for (iter = cpg_pd_list_head.next; iter != &cpg_pd_list_head; iter = iter->next) {
-			struct cpg_pd *cpd = list_entry (iter, struct cpg_pd, list);
-			if (mar_name_compare (&cpd->group_name, group_name) == 0) {
-				assert (left_list_entries <= 1);
-				assert (joined_list_entries <= 1);
-				if (joined_list_entries) {
-					if (joined_list[0].pid == cpd->pid &&
-						joined_list[0].nodeid == api->totem_nodeid_get()) {
-						cpd->cpd_state = CPD_STATE_JOIN_COMPLETED;
-					}
+	} else if (gi != NULL) {
+		for (iter = gi->cpd_list.next; iter != &gi->cpd_list; iter = iter_next) {
+			struct cpg_pd *cpd = list_entry (iter, struct cpg_pd, group_list);
+
+			iter_next = iter->next;
+
+			assert (left_list_entries <= 1);
+			assert (joined_list_entries <= 1);
+			if (joined_list_entries) {
+				if (joined_list[0].pid == cpd->pid &&
+					joined_list[0].nodeid == api->totem_nodeid_get()) {
+					cpd->cpd_state = CPD_STATE_JOIN_COMPLETED;
 				}
-				if (cpd->cpd_state == CPD_STATE_JOIN_COMPLETED ||
-					cpd->cpd_state == CPD_STATE_LEAVE_STARTED) {
+			}
+			if (cpd->cpd_state == CPD_STATE_JOIN_COMPLETED ||
+				cpd->cpd_state == CPD_STATE_LEAVE_STARTED) {
 
-					api->ipc_dispatch_send (cpd->conn, buf, size);
-				}
-				if (left_list_entries) {
-					if (left_list[0].pid == cpd->pid &&
-						left_list[0].nodeid == api->totem_nodeid_get() &&
-						left_list[0].reason == CONFCHG_CPG_REASON_LEAVE) {
-
-						cpd->pid = 0;
-						memset (&cpd->group_name, 0, sizeof(cpd->group_name));
-						cpd->cpd_state = CPD_STATE_UNJOINED;
-					}
+				api->ipc_dispatch_send (cpd->conn, buf, size);
+			}
+			if (left_list_entries) {
+				if (left_list[0].pid == cpd->pid &&
+					left_list[0].nodeid == api->totem_nodeid_get() &&
+					left_list[0].reason == CONFCHG_CPG_REASON_LEAVE) {
+
+					/*
+					 * The caller still holds gi, so only unlink here
+					 */
+					list_del (&cpd->group_list);
+					list_init (&cpd->group_list);
+					cpd->pid = 0;
+					memset (&cpd->group_name, 0, sizeof(cpd->group_name));
+					cpd->cpd_state = CPD_STATE_UNJOINED;
 				}
 			}
 		}
@@ -736,13 +1135,16 @@ static int notify_lib_joinlist(
 	/*
 	 * Traverse thru cpds and send totem membership for cpd, where it is not send yet
 	 */
-	for (iter = cpg_pd_list_head.next; iter != &cpg_pd_list_head; iter = iter->next) {
-		struct cpg_pd *cpd = list_entry (iter, struct cpg_pd, list);
+	if (initial_totem_conf_pending) {
+		for (iter = cpg_pd_list_head.next; iter != &cpg_pd_list_head; iter = iter->next) {
+			struct cpg_pd *cpd = list_entry (iter, struct cpg_pd, list);
 
-		if ((cpd->flags & CPG_MODEL_V1_DELIVER_INITIAL_TOTEM_CONF) && (cpd->initial_totem_conf_sent == 0)) {
-			cpd->initial_totem_conf_sent = 1;
+			if ((cpd->flags & CPG_MODEL_V1_DELIVER_INITIAL_TOTEM_CONF) && (cpd->initial_totem_conf_sent == 0)) {
+				cpd->initial_totem_conf_sent = 1;
+				initial_totem_conf_pending--;
 
-			notify_lib_totem_membership (cpd->conn, my_old_member_list_entries, my_old_member_list);
+				notify_lib_totem_membership (cpd->conn, my_old_member_list_entries, my_old_member_list);
+			}
 		}
 	}
 
@@ -797,8 +1199,11 @@ static struct downlist_msg* downlist_master_choose (void)
 static void downlist_master_choose_and_send (void)
 {
 	struct downlist_msg *stored_msg;
+	struct list_head *gi_iter, *gi_iter_next;
 	struct list_head *iter;
+	struct group_info *gi;
 	mar_cpg_address_t left_list;
+	unsigned int h;
 	int i;
 
 	downlist_state = CPG_DOWNLIST_APPLYING;
@@ -811,24 +1216,32 @@ static void downlist_master_choose_and_send (void)
 	downlist_log("chosen downlist", stored_msg);
 
 	/* send events */
-	for (iter = process_info_list_head.next; iter != &process_info_list_head; ) {
-		struct process_info *pi = list_entry(iter, struct process_info, list);
-		iter = iter->next;
-
-		for (i = 0; i < stored_msg->left_nodes; i++) {
-			if (pi->nodeid == stored_msg->nodeids[i]) {
-				left_list.nodeid = pi->nodeid;
-				left_list.pid = pi->pid;
-				left_list.reason = CONFCHG_CPG_REASON_NODEDOWN;
-
-				notify_lib_joinlist(&pi->group, NULL,
-					0, NULL,
-					1, &left_list,
-					MESSAGE_RES_CPG_CONFCHG_CALLBACK);
-				list_del (&pi->list);
-				free (pi);
-				break;
+	for (h = 0; h < group_hash_size; h++) {
+		for (gi_iter = group_hash[h].next; gi_iter != &group_hash[h]; gi_iter = gi_iter_next) {
+			gi = list_entry (gi_iter, struct group_info, hash_list);
+			gi_iter_next = gi_iter->next;
+
+			for (iter = gi->members.next; iter != &gi->members; ) {
+				struct process_info *pi = list_entry(iter, struct process_info, list);
+				iter = iter->next;
+
+				for (i = 0; i < stored_msg->left_nodes; i++) {
+					if (pi->nodeid == stored_msg->nodeids[i]) {
+						left_list.nodeid = pi->nodeid;
+						left_list.pid = pi->pid;
+						left_list.reason = CONFCHG_CPG_REASON_NODEDOWN;
+
+						notify_lib_joinlist(&pi->group, NULL,
+							0, NULL,
+							1, &left_list,
+							MESSAGE_RES_CPG_CONFCHG_CALLBACK);
+						list_del (&pi->list);
+						free (pi);
+						break;
+					}
+				}
 			}
+			group_info_release (gi);
 		}
 	}
 }
@@ -858,6 +1271,11 @@ static int cpg_exec_init_fn (struct corosync_api_v1 *corosync_api)
 #endif
 	list_init (&downlist_messages_head);
 	api = corosync_api;
+
+	if (group_hash_resize (GROUP_HASH_SIZE) != 0) {
+		log_printf (LOGSYS_LEVEL_ERROR, "Unable to allocate group hash table");
+		return (-1);
+	}
 	return (0);
 }
 
@@ -881,12 +1299,26 @@ static void cpg_iteration_instance_finalize (struct cpg_iteration_instance *cpg_
 	hdb_handle_destroy (&cpg_iteration_handle_t_db, cpg_iteration_instance->handle);
 }
 
+static void cpd_initial_totem_conf_cancel (struct cpg_pd *cpd)
+{
+	if ((cpd->flags & CPG_MODEL_V1_DELIVER_INITIAL_TOTEM_CONF) &&
+		cpd->initial_totem_conf_sent == 0) {
+
+		cpd->initial_totem_conf_sent = 1;
+		initial_totem_conf_pending--;
+	}
+}
+
 static void cpg_pd_finalize (struct cpg_pd *cpd)
 {
 	struct list_head *iter, *iter_next;
 	struct cpg_iteration_instance *cpii;
 
 	zcb_all_free(cpd);
+	if (cpd->zcb_arena != NULL) {
+		munmap (cpd->zcb_arena, cpd->zcb_arena_size);
+		cpd->zcb_arena = NULL;
+	}
 	for (iter = cpd->iteration_instance_list_head.next;
 		iter != &cpd->iteration_instance_list_head;
 		iter = iter_next) {
@@ -898,7 +1330,17 @@ static void cpg_pd_finalize (struct cpg_pd *cpd)
 		cpg_iteration_instance_finalize (cpii);
 	}
 
+	cpd_initial_totem_conf_cancel (cpd);
+	if (cpd->batch_msgs_entries) {
+		list_del (&cpd->batch_list);
+		list_init (&cpd->batch_list);
+	}
+	free (cpd->batch_msgs);
+	cpd->batch_msgs = NULL;
+	cpd->batch_msgs_entries = 0;
+	cpd->batch_msgs_size = 0;
 	list_del (&cpd->list);
+	cpd_group_del (cpd);
 }
 
 static int cpg_lib_exit_fn (void *conn)
@@ -993,16 +1435,14 @@ static void exec_cpg_mcast_endian_convert (void *msg)
 	swab_mar_message_source_t (&req_exec_cpg_mcast->source);
 }
 
-static struct process_info *process_info_find(const mar_cpg_name_t *group_name, uint32_t pid, unsigned int nodeid) {
+static struct process_info *process_info_find(struct group_info *gi, uint32_t pid, unsigned int nodeid) {
 	struct list_head *iter;
 
-	for (iter = process_info_list_head.next; iter != &process_info_list_head; ) {
+	for (iter = gi->members.next; iter != &gi->members; iter = iter->next) {
 		struct process_info *pi = list_entry (iter, struct process_info, list);
-		iter = iter->next;
 
-		if (pi->pid == pid && pi->nodeid == nodeid &&
-			mar_name_compare (&pi->group, group_name) == 0) {
-				return pi;
+		if (pi->pid == pid && pi->nodeid == nodeid) {
+			return pi;
 		}
 	}
 
@@ -1015,18 +1455,24 @@ static void do_proc_join(
 	unsigned int nodeid,
 	int reason)
 {
+	struct group_info *gi;
 	struct process_info *pi;
 	struct process_info *pi_entry;
 	mar_cpg_address_t notify_info;
 	struct list_head *list;
 	struct list_head *list_to_add = NULL;
 
-	if (process_info_find (name, pid, nodeid) != NULL) {
+	gi = group_info_get (name);
+	if (gi == NULL) {
+		return;
+	}
+	if (process_info_find (gi, pid, nodeid) != NULL) {
 		return ;
  	}
 	pi = malloc (sizeof (struct process_info));
 	if (!pi) {
 		log_printf(LOGSYS_LEVEL_WARNING, "Unable to allocate process_info struct");
+		group_info_release (gi);
 		return;
 	}
 	pi->nodeid = nodeid;
@@ -1037,8 +1483,8 @@ static void do_proc_join(
 	/*
 	 * Insert new process in sorted order so synchronization works properly
 	 */
-	list_to_add = &process_info_list_head;
-	for (list = process_info_list_head.next; list != &process_info_list_head; list = list->next) {
+	list_to_add = &gi->members;
+	for (list = gi->members.next; list != &gi->members; list = list->next) {
 
 		pi_entry = list_entry(list, struct process_info, list);
 		if (pi_entry->nodeid > pi->nodeid ||
@@ -1131,8 +1577,8 @@ static void message_handler_req_exec_cpg_procleave (
 	unsigned int nodeid)
 {
 	const struct req_exec_cpg_procjoin *req_exec_cpg_procjoin = message;
+	struct group_info *gi;
 	struct process_info *pi;
-	struct list_head *iter;
 	mar_cpg_address_t notify_info;
 
 	log_printf(LOGSYS_LEVEL_DEBUG, "got procleave message from cluster node %d\n", nodeid);
@@ -1146,15 +1592,16 @@ static void message_handler_req_exec_cpg_procleave (
 		1, &notify_info,
 		MESSAGE_RES_CPG_CONFCHG_CALLBACK);
 
-	for (iter = process_info_list_head.next; iter != &process_info_list_head; ) {
-		pi = list_entry(iter, struct process_info, list);
-		iter = iter->next;
+	gi = group_info_find (&req_exec_cpg_procjoin->group_name);
+	if (gi == NULL) {
+		return;
+	}
 
-		if (pi->pid == req_exec_cpg_procjoin->pid && pi->nodeid == nodeid &&
-			mar_name_compare (&pi->group, &req_exec_cpg_procjoin->group_name)==0) {
-			list_del (&pi->list);
-			free (pi);
-		}
+	pi = process_info_find (gi, req_exec_cpg_procjoin->pid, nodeid);
+	if (pi != NULL) {
+		process_info_del (gi, pi);
+	} else {
+		group_info_release (gi);
 	}
 }
 
@@ -1191,9 +1638,11 @@ static void message_handler_req_exec_cpg_mcast (
 	struct res_lib_cpg_deliver_callback res_lib_cpg_mcast;
 	int msglen = req_exec_cpg_mcast->msglen;
 	struct list_head *iter, *pi_iter;
+	struct group_info *gi;
 	struct cpg_pd *cpd;
 	struct iovec iovec[2];
 	int known_node = 0;
+	int msg_index = -1;
 
 	res_lib_cpg_mcast.header.id = MESSAGE_RES_CPG_DELIVER_CALLBACK;
 	res_lib_cpg_mcast.header.size = sizeof(res_lib_cpg_mcast) + msglen;
@@ -1209,22 +1658,25 @@ static void message_handler_req_exec_cpg_mcast (
 	iovec[1].iov_base = (char*)message+sizeof(*req_exec_cpg_mcast);
 	iovec[1].iov_len = msglen;
 
-	for (iter = cpg_pd_list_head.next; iter != &cpg_pd_list_head; ) {
-		cpd = list_entry(iter, struct cpg_pd, list);
+	gi = group_info_find (&req_exec_cpg_mcast->group_name);
+	if (gi == NULL) {
+		return;
+	}
+
+	for (iter = gi->cpd_list.next; iter != &gi->cpd_list; ) {
+		cpd = list_entry(iter, struct cpg_pd, group_list);
 		iter = iter->next;
 
-		if ((cpd->cpd_state == CPD_STATE_LEAVE_STARTED || cpd->cpd_state == CPD_STATE_JOIN_COMPLETED)
-			&& (mar_name_compare (&cpd->group_name, &req_exec_cpg_mcast->group_name) == 0)) {
+		if (cpd->cpd_state == CPD_STATE_LEAVE_STARTED || cpd->cpd_state == CPD_STATE_JOIN_COMPLETED) {
 
 			if (!known_node) {
 				/* Try to find, if we know the node */
-				for (pi_iter = process_info_list_head.next;
-					pi_iter != &process_info_list_head; pi_iter = pi_iter->next) {
+				for (pi_iter = gi->members.next;
+					pi_iter != &gi->members; pi_iter = pi_iter->next) {
 
 					struct process_info *pi = list_entry (pi_iter, struct process_info, list);
 
-					if (pi->nodeid == nodeid &&
-						mar_name_compare (&pi->group, &req_exec_cpg_mcast->group_name) == 0) {
+					if (pi->nodeid == nodeid) {
 						known_node = 1;
 						break;
 					}
@@ -1236,7 +1688,18 @@ static void message_handler_req_exec_cpg_mcast (
 				return ;
 			}
 
-			api->ipc_dispatch_iov_send (cpd->conn, iovec, 2);
+			/*
+			 * Held back until the end of the run, see
+			 * cpg_exec_deliver_batch_end
+			 */
+			if (msg_index == -1) {
+				msg_index = cpg_batch_msg_add (&res_lib_cpg_mcast,
+					iovec[1].iov_base);
+			}
+			if (msg_index == -1 || cpd_batch_add (cpd, msg_index) != 0) {
+				cpd_batch_flush (cpd);
+				api->ipc_dispatch_iov_send (cpd->conn, iovec, 2);
+			}
 		}
 	}
 }
@@ -1260,17 +1723,25 @@ static int cpg_exec_send_downlist(void)
 static int cpg_exec_send_joinlist(void)
 {
 	int count = 0;
+	struct list_head *gi_iter;
 	struct list_head *iter;
 	struct qb_ipc_response_header *res;
  	char *buf;
 	struct join_list_entry *jle;
 	struct iovec req_exec_cpg_iovec;
+	unsigned int h;
+
+	for (h = 0; h < group_hash_size; h++) {
+		for (gi_iter = group_hash[h].next; gi_iter != &group_hash[h]; gi_iter = gi_iter->next) {
+			struct group_info *gi = list_entry (gi_iter, struct group_info, hash_list);
 
- 	for (iter = process_info_list_head.next; iter != &process_info_list_head; iter = iter->next) {
- 		struct process_info *pi = list_entry (iter, struct process_info, list);
+			for (iter = gi->members.next; iter != &gi->members; iter = iter->next) {
+				struct process_info *pi = list_entry (iter, struct process_info, list);
 
- 		if (pi->nodeid == api->totem_nodeid_get ()) {
- 			count++;
+				if (pi->nodeid == api->totem_nodeid_get ()) {
+					count++;
+				}
+			}
 		}
 	}
 
@@ -1287,13 +1758,19 @@ static int cpg_exec_send_joinlist(void)
 	jle = (struct join_list_entry *)(buf + sizeof(struct qb_ipc_response_header));
 	res = (struct qb_ipc_response_header *)buf;
 
- 	for (iter = process_info_list_head.next; iter != &process_info_list_head; iter = iter->next) {
- 		struct process_info *pi = list_entry (iter, struct process_info, list);
+	for (h = 0; h < group_hash_size; h++) {
+		for (gi_iter = group_hash[h].next; gi_iter != &group_hash[h]; gi_iter = gi_iter->next) {
+			struct group_info *gi = list_entry (gi_iter, struct group_info, hash_list);
+
+			for (iter = gi->members.next; iter != &gi->members; iter = iter->next) {
+				struct process_info *pi = list_entry (iter, struct process_info, list);
 
-		if (pi->nodeid == api->totem_nodeid_get ()) {
-			memcpy (&jle->group_name, &pi->group, sizeof (mar_cpg_name_t));
-			jle->pid = pi->pid;
-			jle++;
+				if (pi->nodeid == api->totem_nodeid_get ()) {
+					memcpy (&jle->group_name, &pi->group, sizeof (mar_cpg_name_t));
+					jle->pid = pi->pid;
+					jle++;
+				}
+			}
 		}
 	}
 
@@ -1312,9 +1789,11 @@ static int cpg_lib_init_fn (void *conn)
 	memset (cpd, 0, sizeof(struct cpg_pd));
 	cpd->conn = conn;
 	list_add (&cpd->list, &cpg_pd_list_head);
+	list_init (&cpd->group_list);
 
 	list_init (&cpd->iteration_instance_list_head);
 	list_init (&cpd->zcb_mapped_list_head);
+	list_init (&cpd->batch_list);
 
 	api->ipc_refcnt_inc (conn);
 	log_printf(LOGSYS_LEVEL_DEBUG, "lib_init_fn: conn=%p, cpd=%p\n", conn, cpd);
@@ -1329,29 +1808,26 @@ static void message_handler_req_lib_cpg_join (void *conn, const void *message)
 	struct res_lib_cpg_join res_lib_cpg_join;
 	cs_error_t error = CS_OK;
 	struct list_head *iter;
-
-	/* Test, if we don't have same pid and group name joined */
-	for (iter = cpg_pd_list_head.next; iter != &cpg_pd_list_head; iter = iter->next) {
-		struct cpg_pd *cpd_item = list_entry (iter, struct cpg_pd, list);
-
-		if (cpd_item->pid == req_lib_cpg_join->pid &&
-			mar_name_compare(&req_lib_cpg_join->group_name, &cpd_item->group_name) == 0) {
-
-			/* We have same pid and group name joined -> return error */
-			error = CS_ERR_EXIST;
-			goto response_send;
+	struct group_info *gi;
+
+	gi = group_info_find (&req_lib_cpg_join->group_name);
+	if (gi != NULL) {
+		/* Test, if we don't have same pid and group name joined */
+		for (iter = gi->cpd_list.next; iter != &gi->cpd_list; iter = iter->next) {
+			struct cpg_pd *cpd_item = list_entry (iter, struct cpg_pd, group_list);
+
+			if (cpd_item->pid == req_lib_cpg_join->pid) {
+				/* We have same pid and group name joined -> return error */
+				error = CS_ERR_EXIST;
+				goto response_send;
+			}
 		}
-	}
-
-	/*
-	 * Same check must be done in process info list, because there may be not yet delivered
-	 * leave of client.
-	 */
-	for (iter = process_info_list_head.next; iter != &process_info_list_head; iter = iter->next) {
-		struct process_info *pi = list_entry (iter, struct process_info, list);
 
-		if (pi->nodeid == api->totem_nodeid_get () && pi->pid == req_lib_cpg_join->pid &&
-		    mar_name_compare(&req_lib_cpg_join->group_name, &pi->group) == 0) {
+		/*
+		 * Same check must be done in process info list, because there may be not yet delivered
+		 * leave of client.
+		 */
+		if (process_info_find (gi, req_lib_cpg_join->pid, api->totem_nodeid_get ()) != NULL) {
 			/* We have same pid and group name joined -> return error */
 			error = CS_ERR_TRY_AGAIN;
 			goto response_send;
@@ -1360,12 +1836,23 @@ static void message_handler_req_lib_cpg_join (void *conn, const void *message)
 
 	switch (cpd->cpd_state) {
 	case CPD_STATE_UNJOINED:
+		gi = group_info_get (&req_lib_cpg_join->group_name);
+		if (gi == NULL) {
+			error = CS_ERR_NO_MEMORY;
+			break;
+		}
 		error = CS_OK;
 		cpd->cpd_state = CPD_STATE_JOIN_STARTED;
 		cpd->pid = req_lib_cpg_join->pid;
 		cpd->flags = req_lib_cpg_join->flags;
 		memcpy (&cpd->group_name, &req_lib_cpg_join->group_name,
 			sizeof (cpd->group_name));
+		list_add_tail (&cpd->group_list, &gi->cpd_list);
+		if ((cpd->flags & CPG_MODEL_V1_DELIVER_INITIAL_TOTEM_CONF) &&
+			cpd->initial_totem_conf_sent == 0) {
+
+			initial_totem_conf_pending++;
+		}
 
 		cpg_node_joinleave_send (req_lib_cpg_join->pid,
 			&req_lib_cpg_join->group_name,
@@ -1441,8 +1928,10 @@ static void message_handler_req_lib_cpg_finalize (
 	 * We will just remove cpd from list. After this call, connection will be
 	 * closed on lib side, and cpg_lib_exit_fn will be called
 	 */
+	cpd_initial_totem_conf_cancel (cpd);
 	list_del (&cpd->list);
 	list_init (&cpd->list);
+	cpd_group_del (cpd);
 
 	res_lib_cpg_finalize.header.size = sizeof (res_lib_cpg_finalize);
 	res_lib_cpg_finalize.header.id = MESSAGE_RES_CPG_FINALIZE;
@@ -1709,25 +2198,129 @@ static void message_handler_req_lib_cpg_mcast (void *conn, const void *message)
 	}
 }
 
-static void message_handler_req_lib_cpg_zc_execute (
+/*
+ * Several messages from the library in one request.  The flow control
+ * reservation made for the request covers all of them and they are
+ * handed to totem together, so either all or none are sent.
+ */
+static void message_handler_req_lib_cpg_mcast_batch (void *conn, const void *message)
+{
+	const struct req_lib_cpg_mcast_batch *req_lib_cpg_mcast_batch = message;
+	struct cpg_pd *cpd = (struct cpg_pd *)api->ipc_private_data_get (conn);
+	struct res_lib_cpg_mcast res_lib_cpg_mcast;
+	static struct req_exec_cpg_mcast req_exec_cpg_mcast[CPG_MCAST_BATCH_MAX];
+	static struct iovec req_exec_cpg_iovec[CPG_MCAST_BATCH_MAX * 2];
+	static unsigned int msg_iov_len[CPG_MCAST_BATCH_MAX];
+	unsigned int msg_count = 0;
+	const char *data;
+	size_t size;
+	unsigned int i;
+	int result;
+	cs_error_t error = CS_ERR_NOT_EXIST;
+
+	if (req_lib_cpg_mcast_batch->header.size >=
+		sizeof (struct req_lib_cpg_mcast_batch)) {
+
+		msg_count = req_lib_cpg_mcast_batch->msg_count;
+	}
+
+	log_printf(LOGSYS_LEVEL_DEBUG, "got batch mcast request of %u on %p\n",
+		msg_count, conn);
+
+	switch (cpd->cpd_state) {
+	case CPD_STATE_UNJOINED:
+		error = CS_ERR_NOT_EXIST;
+		break;
+	case CPD_STATE_LEAVE_STARTED:
+		error = CS_ERR_NOT_EXIST;
+		break;
+	case CPD_STATE_JOIN_STARTED:
+		error = CS_OK;
+		break;
+	case CPD_STATE_JOIN_COMPLETED:
+		error = CS_OK;
+		break;
+	}
+
+	if (error == CS_OK &&
+		(msg_count == 0 || msg_count > CPG_MCAST_BATCH_MAX)) {
+
+		error = CS_ERR_INVALID_PARAM;
+	}
+	/*
+	 * The message lengths must be inside the request before they are read
+	 */
+	if (error == CS_OK) {
+		size = sizeof (struct req_lib_cpg_mcast_batch) +
+			msg_count * sizeof (mar_uint32_t);
+		if (req_lib_cpg_mcast_batch->header.size < size) {
+			error = CS_ERR_INVALID_PARAM;
+		}
+	}
+	if (error == CS_OK) {
+		for (i = 0; i < msg_count; i++) {
+			size += req_lib_cpg_mcast_batch->msglens[i];
+		}
+		if (size != req_lib_cpg_mcast_batch->header.size) {
+			error = CS_ERR_INVALID_PARAM;
+		}
+	}
+
+	if (error == CS_OK) {
+		data = (const char *)&req_lib_cpg_mcast_batch->msglens[msg_count];
+		for (i = 0; i < msg_count; i++) {
+			req_exec_cpg_mcast[i].header.size = sizeof(struct req_exec_cpg_mcast) +
+				req_lib_cpg_mcast_batch->msglens[i];
+			req_exec_cpg_mcast[i].header.id = SERVICE_ID_MAKE(CPG_SERVICE,
+				MESSAGE_REQ_EXEC_CPG_MCAST);
+			req_exec_cpg_mcast[i].pid = cpd->pid;
+			req_exec_cpg_mcast[i].msglen = req_lib_cpg_mcast_batch->msglens[i];
+			api->ipc_source_set (&req_exec_cpg_mcast[i].source, conn);
+			memcpy(&req_exec_cpg_mcast[i].group_name, &cpd->group_name,
+				sizeof(mar_cpg_name_t));
+
+			req_exec_cpg_iovec[i * 2].iov_base = (char *)&req_exec_cpg_mcast[i];
+			req_exec_cpg_iovec[i * 2].iov_len = sizeof(struct req_exec_cpg_mcast);
+			req_exec_cpg_iovec[i * 2 + 1].iov_base = (char *)data;
+			req_exec_cpg_iovec[i * 2 + 1].iov_len = req_lib_cpg_mcast_batch->msglens[i];
+			msg_iov_len[i] = 2;
+
+			data += req_lib_cpg_mcast_batch->msglens[i];
+		}
+
+		result = api->totem_mcast_batch (req_exec_cpg_iovec, msg_iov_len,
+			msg_count, TOTEM_AGREED);
+		if (result == -1) {
+			error = CS_ERR_TRY_AGAIN;
+		} else if (result == -2) {
+			error = CS_ERR_TOO_BIG;
+		}
+	}
+
+	res_lib_cpg_mcast.header.size = sizeof(res_lib_cpg_mcast);
+	res_lib_cpg_mcast.header.id = MESSAGE_RES_CPG_MCAST;
+	res_lib_cpg_mcast.header.error = error;
+	api->ipc_response_send (conn, &res_lib_cpg_mcast,
+		sizeof (res_lib_cpg_mcast));
+}
+
+/*
+ * Sends a mcast request the library built in zero copy memory.  msglen
+ * has been read from that memory once and checked by the caller, as the
+ * library can still write to it.
+ */
+static void cpg_zc_mcast_send (
 	void *conn,
-	const void *message)
+	const struct req_lib_cpg_mcast *req_lib_cpg_mcast,
+	unsigned int msglen)
 {
-	mar_req_coroipcc_zc_execute_t *hdr = (mar_req_coroipcc_zc_execute_t *)message;
-	struct qb_ipc_request_header *header;
 	struct res_lib_cpg_mcast res_lib_cpg_mcast;
 	struct cpg_pd *cpd = (struct cpg_pd *)api->ipc_private_data_get (conn);
 	struct iovec req_exec_cpg_iovec[2];
 	struct req_exec_cpg_mcast req_exec_cpg_mcast;
-	struct req_lib_cpg_mcast *req_lib_cpg_mcast;
 	int result;
 	cs_error_t error = CS_ERR_NOT_EXIST;
 
-	log_printf(LOGSYS_LEVEL_DEBUG, "got ZC mcast request on %p\n", conn);
-
-	header = (struct qb_ipc_request_header *)(((char *)serveraddr2void(hdr->server_address) + sizeof (struct coroipcs_zc_header)));
-	req_lib_cpg_mcast = (struct req_lib_cpg_mcast *)header;
-
 	switch (cpd->cpd_state) {
 	case CPD_STATE_UNJOINED:
 		error = CS_ERR_NOT_EXIST;
@@ -1746,19 +2339,19 @@ static void message_handler_req_lib_cpg_zc_execute (
 	res_lib_cpg_mcast.header.size = sizeof(res_lib_cpg_mcast);
 	res_lib_cpg_mcast.header.id = MESSAGE_RES_CPG_MCAST;
 	if (error == CS_OK) {
-		req_exec_cpg_mcast.header.size = sizeof(req_exec_cpg_mcast) + req_lib_cpg_mcast->msglen;
+		req_exec_cpg_mcast.header.size = sizeof(req_exec_cpg_mcast) + msglen;
 		req_exec_cpg_mcast.header.id = SERVICE_ID_MAKE(CPG_SERVICE,
 			MESSAGE_REQ_EXEC_CPG_MCAST);
 		req_exec_cpg_mcast.pid = cpd->pid;
-		req_exec_cpg_mcast.msglen = req_lib_cpg_mcast->msglen;
+		req_exec_cpg_mcast.msglen = msglen;
 		api->ipc_source_set (&req_exec_cpg_mcast.source, conn);
 		memcpy(&req_exec_cpg_mcast.group_name, &cpd->group_name,
 			sizeof(mar_cpg_name_t));
 
 		req_exec_cpg_iovec[0].iov_base = (char *)&req_exec_cpg_mcast;
 		req_exec_cpg_iovec[0].iov_len = sizeof(req_exec_cpg_mcast);
-		req_exec_cpg_iovec[1].iov_base = (char *)header + sizeof(struct req_lib_cpg_mcast);
-		req_exec_cpg_iovec[1].iov_len = req_exec_cpg_mcast.msglen;
+		req_exec_cpg_iovec[1].iov_base = (char *)req_lib_cpg_mcast->message;
+		req_exec_cpg_iovec[1].iov_len = msglen;
 
 		result = api->totem_mcast (req_exec_cpg_iovec, 2, TOTEM_AGREED);
 		if (result == 0) {
@@ -1772,7 +2365,100 @@ static void message_handler_req_lib_cpg_zc_execute (
 
 	api->ipc_response_send (conn, &res_lib_cpg_mcast,
 		sizeof (res_lib_cpg_mcast));
+}
+
+static void message_handler_req_lib_cpg_zc_execute (
+	void *conn,
+	const void *message)
+{
+	mar_req_coroipcc_zc_execute_t *hdr = (mar_req_coroipcc_zc_execute_t *)message;
+	struct req_lib_cpg_mcast *req_lib_cpg_mcast;
+
+	log_printf(LOGSYS_LEVEL_DEBUG, "got ZC mcast request on %p\n", conn);
+
+	req_lib_cpg_mcast = (struct req_lib_cpg_mcast *)(((char *)serveraddr2void(hdr->server_address) + sizeof (struct coroipcs_zc_header)));
+
+	cpg_zc_mcast_send (conn, req_lib_cpg_mcast, req_lib_cpg_mcast->msglen);
+}
+
+/*
+ * Maps the shared arena the library carves its zero copy buffers from.
+ * This happens once per connection, after which buffers are only
+ * referred to by their offset in the arena.
+ */
+static void message_handler_req_lib_cpg_zc_arena_init (
+	void *conn,
+	const void *message)
+{
+	mar_req_coroipcc_zc_alloc_t *hdr = (mar_req_coroipcc_zc_alloc_t *)message;
+	struct qb_ipc_response_header res_header;
+	struct cpg_pd *cpd = (struct cpg_pd *)api->ipc_private_data_get (conn);
+	void *addr = NULL;
+	cs_error_t error = CS_OK;
+
+	log_printf(LOGSYS_LEVEL_DEBUG, "arena path: %s size: %zu",
+		hdr->path_to_file, hdr->map_size);
+
+	if (cpd->zcb_arena != NULL) {
+		error = CS_ERR_EXIST;
+	} else
+	if (hdr->map_size < sizeof (struct req_lib_cpg_mcast) ||
+		hdr->map_size > UINT32_MAX) {
+
+		error = CS_ERR_INVALID_PARAM;
+	} else
+	if (memory_map (hdr->path_to_file, hdr->map_size, &addr) == -1) {
+		error = CS_ERR_NO_MEMORY;
+	} else {
+		cpd->zcb_arena = addr;
+		cpd->zcb_arena_size = hdr->map_size;
+	}
 
+	res_header.size = sizeof (struct qb_ipc_response_header);
+	res_header.id = MESSAGE_RES_CPG_ZC_ARENA_INIT;
+	res_header.error = error;
+	api->ipc_response_send (conn,
+		&res_header,
+		res_header.size);
+}
+
+static void message_handler_req_lib_cpg_zc_arena_execute (
+	void *conn,
+	const void *message)
+{
+	mar_req_coroipcc_zc_arena_execute_t *hdr = (mar_req_coroipcc_zc_arena_execute_t *)message;
+	struct res_lib_cpg_mcast res_lib_cpg_mcast;
+	struct cpg_pd *cpd = (struct cpg_pd *)api->ipc_private_data_get (conn);
+	struct req_lib_cpg_mcast *req_lib_cpg_mcast;
+	uint64_t offset = hdr->offset;
+	unsigned int msglen;
+
+	log_printf(LOGSYS_LEVEL_DEBUG, "got ZC arena mcast request on %p\n", conn);
+
+	if (cpd->zcb_arena == NULL ||
+		offset > cpd->zcb_arena_size - sizeof (struct req_lib_cpg_mcast) ||
+		(offset & 7) != 0) {
+
+		goto error_invalid;
+	}
+
+	req_lib_cpg_mcast = (struct req_lib_cpg_mcast *)((char *)cpd->zcb_arena + offset);
+	msglen = req_lib_cpg_mcast->msglen;
+	if (msglen > cpd->zcb_arena_size - offset - sizeof (struct req_lib_cpg_mcast)) {
+		goto error_invalid;
+	}
+
+	cpg_zc_mcast_send (conn, req_lib_cpg_mcast, msglen);
+	return;
+
+error_invalid:
+	log_printf(LOGSYS_LEVEL_WARNING,
+		"invalid ZC arena mcast request on %p\n", conn);
+	res_lib_cpg_mcast.header.size = sizeof(res_lib_cpg_mcast);
+	res_lib_cpg_mcast.header.id = MESSAGE_RES_CPG_MCAST;
+	res_lib_cpg_mcast.header.error = CS_ERR_INVALID_PARAM;
+	api->ipc_response_send (conn, &res_lib_cpg_mcast,
+		sizeof (res_lib_cpg_mcast));
 }
 
 static void message_handler_req_lib_cpg_membership (void *conn,
@@ -1782,6 +2468,7 @@ static void message_handler_req_lib_cpg_membership (void *conn,
 		(struct req_lib_cpg_membership_get *)message;
 	struct res_lib_cpg_membership_get res_lib_cpg_membership_get;
 	struct list_head *iter;
+	struct group_info *gi;
 	int member_count = 0;
 
 	res_lib_cpg_membership_get.header.id = MESSAGE_RES_CPG_MEMBERSHIP;
@@ -1789,11 +2476,11 @@ static void message_handler_req_lib_cpg_membership (void *conn,
 	res_lib_cpg_membership_get.header.size =
 		sizeof (struct req_lib_cpg_membership_get);
 
-	for (iter = process_info_list_head.next;
-		iter != &process_info_list_head; iter = iter->next) {
+	gi = group_info_find (&req_lib_cpg_membership_get->group_name);
+	if (gi != NULL) {
+		for (iter = gi->members.next; iter != &gi->members; iter = iter->next) {
+			struct process_info *pi = list_entry (iter, struct process_info, list);
 
-		struct process_info *pi = list_entry (iter, struct process_info, list);
-		if (mar_name_compare (&pi->group, &req_lib_cpg_membership_get->group_name) == 0) {
 			res_lib_cpg_membership_get.member_list[member_count].nodeid = pi->nodeid;
 			res_lib_cpg_membership_get.member_list[member_count].pid = pi->pid;
 			member_count += 1;
@@ -1808,8 +2495,26 @@ static void message_handler_req_lib_cpg_membership (void *conn,
 static void message_handler_req_lib_cpg_local_get (void *conn,
 						   const void *message)
 {
+	const struct req_lib_cpg_local_get_features *req_lib_cpg_local_get_features = message;
+	struct res_lib_cpg_local_get_features res_lib_cpg_local_get_features;
 	struct res_lib_cpg_local_get res_lib_cpg_local_get;
 
+	if (req_lib_cpg_local_get_features->header.size >=
+		sizeof (struct req_lib_cpg_local_get_features)) {
+
+		res_lib_cpg_local_get_features.header.size =
+			sizeof (res_lib_cpg_local_get_features);
+		res_lib_cpg_local_get_features.header.id = MESSAGE_RES_CPG_LOCAL_GET;
+		res_lib_cpg_local_get_features.header.error = CS_OK;
+		res_lib_cpg_local_get_features.local_nodeid = api->totem_nodeid_get ();
+		res_lib_cpg_local_get_features.features = CPG_FEATURE_ZC_ARENA |
+			CPG_FEATURE_MCAST_BATCH;
+
+		api->ipc_response_send (conn, &res_lib_cpg_local_get_features,
+			sizeof (res_lib_cpg_local_get_features));
+		return;
+	}
+
 	res_lib_cpg_local_get.header.size = sizeof (res_lib_cpg_local_get);
 	res_lib_cpg_local_get.header.id = MESSAGE_RES_CPG_LOCAL_GET;
 	res_lib_cpg_local_get.header.error = CS_OK;
@@ -1827,8 +2532,9 @@ static void message_handler_req_lib_cpg_iteration_initialize (
 	struct cpg_pd *cpd = (struct cpg_pd *)api->ipc_private_data_get (conn);
 	hdb_handle_t cpg_iteration_handle = 0;
 	struct res_lib_cpg_iterationinitialize res_lib_cpg_iterationinitialize;
-	struct list_head *iter, *iter2;
+	struct list_head *gi_iter, *iter;
 	struct cpg_iteration_instance *cpg_iteration_instance;
+	unsigned int h;
 	cs_error_t error = CS_OK;
 	int res;
 
@@ -1862,77 +2568,44 @@ static void message_handler_req_lib_cpg_iteration_initialize (
 	/*
 	 * Create copy of process_info list "grouped by" group name
 	 */
-	for (iter = process_info_list_head.next; iter != &process_info_list_head; iter = iter->next) {
-		struct process_info *pi = list_entry (iter, struct process_info, list);
-		struct process_info *new_pi;
+	for (h = 0; h < group_hash_size; h++) {
+		for (gi_iter = group_hash[h].next; gi_iter != &group_hash[h]; gi_iter = gi_iter->next) {
+			struct group_info *gi = list_entry (gi_iter, struct group_info, hash_list);
 
-		if (req_lib_cpg_iterationinitialize->iteration_type == CPG_ITERATION_NAME_ONLY) {
-			/*
-			 * Try to find processed group name in our list new list
-			 */
-			int found = 0;
-
-			for (iter2 = cpg_iteration_instance->items_list_head.next;
-			     iter2 != &cpg_iteration_instance->items_list_head;
-			     iter2 = iter2->next) {
-				 struct process_info *pi2 = list_entry (iter2, struct process_info, list);
-
-				 if (mar_name_compare (&pi2->group, &pi->group) == 0) {
-					found = 1;
-					break;
-				 }
-			}
-
-			if (found) {
-				/*
-				 * We have this name in list -> don't add
-				 */
-				continue ;
-			}
-		} else if (req_lib_cpg_iterationinitialize->iteration_type == CPG_ITERATION_ONE_GROUP) {
-			/*
-			 * Test pi group name with request
-			 */
-			if (mar_name_compare (&pi->group, &req_lib_cpg_iterationinitialize->group_name) != 0)
+			if (req_lib_cpg_iterationinitialize->iteration_type == CPG_ITERATION_ONE_GROUP &&
+				mar_name_compare (&gi->group, &req_lib_cpg_iterationinitialize->group_name) != 0) {
 				/*
 				 * Not same -> don't add
 				 */
 				continue ;
-		}
-
-		new_pi = malloc (sizeof (struct process_info));
-		if (!new_pi) {
-			log_printf(LOGSYS_LEVEL_WARNING, "Unable to allocate process_info struct");
+			}
 
-			error = CS_ERR_NO_MEMORY;
+			for (iter = gi->members.next; iter != &gi->members; iter = iter->next) {
+				struct process_info *pi = list_entry (iter, struct process_info, list);
+				struct process_info *new_pi;
 
-			goto error_put_destroy;
-		}
+				new_pi = malloc (sizeof (struct process_info));
+				if (!new_pi) {
+					log_printf(LOGSYS_LEVEL_WARNING, "Unable to allocate process_info struct");
 
-		memcpy (new_pi, pi, sizeof (struct process_info));
-		list_init (&new_pi->list);
+					error = CS_ERR_NO_MEMORY;
 
-		if (req_lib_cpg_iterationinitialize->iteration_type == CPG_ITERATION_NAME_ONLY) {
-			/*
-			 * pid and nodeid -> undefined
-			 */
-			new_pi->pid = new_pi->nodeid = 0;
-		}
+					goto error_put_destroy;
+				}
 
-		/*
-		 * We will return list "grouped" by "group name", so try to find right place to add
-		 */
-		for (iter2 = cpg_iteration_instance->items_list_head.next;
-		     iter2 != &cpg_iteration_instance->items_list_head;
-		     iter2 = iter2->next) {
-			 struct process_info *pi2 = list_entry (iter2, struct process_info, list);
+				memcpy (new_pi, pi, sizeof (struct process_info));
+				list_init (&new_pi->list);
+				list_add_tail (&new_pi->list, &cpg_iteration_instance->items_list_head);
 
-			 if (mar_name_compare (&pi2->group, &pi->group) == 0) {
-				break;
-			 }
+				if (req_lib_cpg_iterationinitialize->iteration_type == CPG_ITERATION_NAME_ONLY) {
+					/*
+					 * pid and nodeid -> undefined, and only one entry per group
+					 */
+					new_pi->pid = new_pi->nodeid = 0;
+					break;
+				}
+			}
 		}
-
-		list_add (&new_pi->list, iter2);
 	}
 
 	/*
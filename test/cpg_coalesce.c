@@ -0,0 +1,234 @@
+/*
+ * Copyright (c) 2012 Red Hat, Inc.
+ *
+ * All rights reserved.
+ *
+ * This software licensed under BSD license, the text of which follows:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * - Neither the name of the MontaVista Software, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Pushes a run of deliveries of mixed sizes, some larger than the
+ * coalescing cap, through the delivery batching of services/cpg.c for a
+ * client that asked for coalesced deliveries and one that did not.  The
+ * events each client would receive are parsed back and checked for
+ * order, contents, their size and the 8 byte entry padding.
+ *
+ * The daemon and libqb functions cpg.c uses are replaced here.
+ */
+
+#include "cpg.c"
+
+#define MSG_COUNT		200
+#define MSG_LEN_MAX		39000
+#define EVENTS_MAX		(MSG_COUNT * 2)
+
+struct test_client {
+	struct cpg_pd cpd;
+	char *events;
+	size_t events_len;
+	size_t event_offset[EVENTS_MAX];
+	size_t event_len[EVENTS_MAX];
+	unsigned int event_count;
+};
+
+static struct test_client clients[2];
+
+static char msgs[MSG_COUNT][MSG_LEN_MAX];
+
+static unsigned int msg_lens[MSG_COUNT];
+
+static int dispatch_iov_send (void *conn,
+	const struct iovec *iov,
+	unsigned int iov_len)
+{
+	struct test_client *client = conn;
+	unsigned int i;
+
+	if (client->event_count == EVENTS_MAX) {
+		printf ("too many events\n");
+		exit (1);
+	}
+	/*
+	 * Each event starts 8 byte aligned, as in a dispatch buffer
+	 */
+	client->events_len = CPG_DELIVER_BATCH_ALIGN (client->events_len);
+	client->event_offset[client->event_count] = client->events_len;
+	for (i = 0; i < iov_len; i++) {
+		memcpy (client->events + client->events_len,
+			iov[i].iov_base, iov[i].iov_len);
+		client->events_len += iov[i].iov_len;
+	}
+	client->event_len[client->event_count] = client->events_len -
+		client->event_offset[client->event_count];
+	client->event_count++;
+	return (0);
+}
+
+static struct corosync_api_v1 test_api = {
+	.ipc_dispatch_iov_send = dispatch_iov_send
+};
+
+void lcr_component_register (struct lcr_comp *comp)
+{
+}
+
+static int delivery_check (
+	const struct res_lib_cpg_deliver_callback *res,
+	unsigned int seq)
+{
+	if (res->pid != seq || res->msglen != msg_lens[seq] ||
+		memcmp (res->message, msgs[seq], msg_lens[seq]) != 0) {
+
+		printf ("delivery %u is wrong\n", seq);
+		return (-1);
+	}
+	return (0);
+}
+
+/*
+ * Walks the events a client received and returns how many deliveries
+ * they held, or -1
+ */
+static int events_check (struct test_client *client, unsigned int *batches)
+{
+	const struct qb_ipc_response_header *header;
+	const struct res_lib_cpg_deliver_batch_callback *batch;
+	const struct res_lib_cpg_deliver_callback *res;
+	const char *entry;
+	const char *end;
+	unsigned int seq = 0;
+	unsigned int e;
+	unsigned int i;
+
+	*batches = 0;
+	for (e = 0; e < client->event_count; e++) {
+		header = (const struct qb_ipc_response_header *)
+			(client->events + client->event_offset[e]);
+		if (header->size != client->event_len[e]) {
+			printf ("event %u has size %d but %zu bytes\n",
+				e, header->size, client->event_len[e]);
+			return (-1);
+		}
+		if (header->id == MESSAGE_RES_CPG_DELIVER_CALLBACK) {
+			if (delivery_check ((const void *)header, seq) != 0) {
+				return (-1);
+			}
+			seq++;
+			continue;
+		}
+		if (header->id != MESSAGE_RES_CPG_DELIVER_BATCH_CALLBACK) {
+			printf ("event %u has id %d\n", e, header->id);
+			return (-1);
+		}
+		if (header->size > CPG_COALESCE_BYTES_MAX) {
+			printf ("event %u is larger than the cap\n", e);
+			return (-1);
+		}
+		batch = (const struct res_lib_cpg_deliver_batch_callback *)header;
+		entry = (const char *)batch->entries;
+		end = (const char *)header + header->size;
+		for (i = 0; i < batch->msg_count; i++) {
+			res = (const struct res_lib_cpg_deliver_callback *)entry;
+			if (delivery_check (res, seq) != 0) {
+				return (-1);
+			}
+			seq++;
+			entry += CPG_DELIVER_BATCH_ALIGN (
+				sizeof (struct res_lib_cpg_deliver_callback) +
+				res->msglen);
+		}
+		if (entry != end) {
+			printf ("event %u has trailing bytes\n", e);
+			return (-1);
+		}
+		*batches += 1;
+	}
+	return (seq);
+}
+
+int main (void)
+{
+	struct res_lib_cpg_deliver_callback res;
+	unsigned int batches;
+	int msg_index;
+	int delivered;
+	int i;
+	int c;
+
+	api = &test_api;
+	clients[0].cpd.flags = CPG_MODEL_V1_DELIVER_COALESCED;
+	for (c = 0; c < 2; c++) {
+		clients[c].cpd.conn = &clients[c];
+		list_init (&clients[c].cpd.batch_list);
+		clients[c].events = malloc (MSG_COUNT * (MSG_LEN_MAX + 64));
+		if (clients[c].events == NULL) {
+			printf ("out of memory\n");
+			return (1);
+		}
+	}
+
+	for (i = 0; i < MSG_COUNT; i++) {
+		msg_lens[i] = (i % 50 == 7) ? MSG_LEN_MAX : (i * 37) % 300;
+		memset (msgs[i], i, msg_lens[i]);
+
+		memset (&res, 0, sizeof (res));
+		res.header.id = MESSAGE_RES_CPG_DELIVER_CALLBACK;
+		res.header.size = sizeof (res) + msg_lens[i];
+		res.header.error = CS_OK;
+		res.msglen = msg_lens[i];
+		res.pid = i;
+
+		msg_index = cpg_batch_msg_add (&res, msgs[i]);
+		if (msg_index == -1 ||
+			cpd_batch_add (&clients[0].cpd, msg_index) != 0 ||
+			cpd_batch_add (&clients[1].cpd, msg_index) != 0) {
+
+			printf ("out of memory\n");
+			return (1);
+		}
+	}
+	cpg_exec_deliver_batch_end ();
+
+	for (c = 0; c < 2; c++) {
+		delivered = events_check (&clients[c], &batches);
+		if (delivered != MSG_COUNT) {
+			return (1);
+		}
+		printf ("%s: %d deliveries in %u events, %u of them batches\n",
+			c == 0 ? "coalesced" : "plain", delivered,
+			clients[c].event_count, batches);
+	}
+	if (clients[0].event_count >= MSG_COUNT / 10 ||
+		clients[1].event_count != MSG_COUNT) {
+
+		printf ("unexpected event count\n");
+		return (1);
+	}
+
+	printf ("ok\n");
+	return (0);
+}
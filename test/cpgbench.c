@@ -137,6 +137,55 @@ static void cpg_benchmark (
 		((float)write_count) * ((float)write_size) /  ((tv_elapsed.tv_sec + (tv_elapsed.tv_usec / 1000000.0)) * 1000000.0));
 }
 
+/*
+ * Sends write_size byte messages batch_size at a time with
+ * cpg_mcast_joined_batch
+ */
+static void cpg_batch_benchmark (
+	cpg_handle_t handle_in,
+	int write_size,
+	unsigned int batch_size)
+{
+	struct timeval tv1, tv2, tv_elapsed;
+	struct iovec iov[CPG_MCAST_BATCH_MAX];
+	unsigned int batches = 0;
+	unsigned int i;
+	unsigned int res;
+	double runtime;
+
+	alarm_notice = 0;
+	for (i = 0; i < batch_size; i++) {
+		iov[i].iov_base = data;
+		iov[i].iov_len = write_size;
+	}
+
+	write_count = 0;
+	alarm (10);
+
+	gettimeofday (&tv1, NULL);
+	do {
+		res = cpg_mcast_joined_batch (handle_in, CPG_TYPE_AGREED,
+			iov, batch_size);
+		if (res == CS_OK) {
+			batches++;
+		}
+	} while (alarm_notice == 0 && (res == CS_OK || res == CS_ERR_TRY_AGAIN));
+	gettimeofday (&tv2, NULL);
+	timersub (&tv2, &tv1, &tv_elapsed);
+
+	if (res != CS_OK && res != CS_ERR_TRY_AGAIN) {
+		printf ("cpg_mcast_joined_batch returned error %d\n", res);
+	}
+
+	runtime = tv_elapsed.tv_sec + (tv_elapsed.tv_usec / 1000000.0);
+	printf ("%4u messages per batch ", batch_size);
+	printf ("%7d messages received ", write_count);
+	printf ("%9.3f batches/s ", batches / runtime);
+	printf ("%10.3f TP/s ", write_count / runtime);
+	printf ("%7.3f MB/s.\n",
+		((float)write_count) * ((float)write_size) / (runtime * 1000000.0));
+}
+
 static void sigalrm_handler (int num)
 {
 	alarm_notice = 1;
@@ -161,16 +210,57 @@ static void* dispatch_thread (void *arg)
 	return NULL;
 }
 
-int main (void) {
+static void usage (const char *name)
+{
+	printf ("usage: %s [-b] [-C] [-s size]\n", name);
+	printf ("  -b       sweep batch sizes with cpg_mcast_joined_batch\n");
+	printf ("  -C       ask the daemon to coalesce deliveries\n");
+	printf ("  -s size  message size for the batch sweep (default 100)\n");
+}
+
+int main (int argc, char *argv[]) {
 	unsigned int size;
+	unsigned int batch_size;
+	int batch_sweep = 0;
+	int coalesce = 0;
+	cpg_model_v1_data_t model_data;
 	int i;
 	unsigned int res;
+	int opt;
+
+	size = 100;
+	while ((opt = getopt (argc, argv, "bCs:h")) != -1) {
+		switch (opt) {
+		case 'b':
+			batch_sweep = 1;
+			break;
+		case 'C':
+			coalesce = 1;
+			break;
+		case 's':
+			size = atoi (optarg);
+			break;
+		case 'h':
+		default:
+			usage (argv[0]);
+			exit (1);
+		}
+	}
 
 	qb_util_set_log_function(libqb_log_writer);
 
-	size = 64;
 	signal (SIGALRM, sigalrm_handler);
-	res = cpg_initialize (&handle, &callbacks);
+	if (coalesce) {
+		memset (&model_data, 0, sizeof (model_data));
+		model_data.model = CPG_MODEL_V1;
+		model_data.cpg_deliver_fn = cpg_bm_deliver_fn;
+		model_data.cpg_confchg_fn = cpg_bm_confchg_fn;
+		model_data.flags = CPG_MODEL_V1_DELIVER_COALESCED;
+		res = cpg_model_initialize (&handle, CPG_MODEL_V1,
+			(cpg_model_data_t *)&model_data, NULL);
+	} else {
+		res = cpg_initialize (&handle, &callbacks);
+	}
 	if (res != CS_OK) {
 		printf ("cpg_initialize failed with result %d\n", res);
 		exit (1);
@@ -183,12 +273,22 @@ int main (void) {
 		exit (1);
 	}
 
-	for (i = 0; i < 10; i++) { /* number of repetitions - up to 50k */
-		cpg_benchmark (handle, size);
-		signal (SIGALRM, sigalrm_handler);
-		size *= 8;
-		if (size >= (ONE_MEG - 100)) {
-			break;
+	if (batch_sweep) {
+		for (batch_size = 1; batch_size <= CPG_MCAST_BATCH_MAX;
+			batch_size *= 2) {
+
+			cpg_batch_benchmark (handle, size, batch_size);
+			signal (SIGALRM, sigalrm_handler);
+		}
+	} else {
+		size = 64;
+		for (i = 0; i < 10; i++) { /* number of repetitions - up to 50k */
+			cpg_benchmark (handle, size);
+			signal (SIGALRM, sigalrm_handler);
+			size *= 8;
+			if (size >= (ONE_MEG - 100)) {
+				break;
+			}
 		}
 	}
 
@@ -43,6 +43,7 @@
 #include <unistd.h>
 #include <time.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/select.h>
@@ -69,6 +70,19 @@
 
 static int alarm_notice;
 
+/*
+ * How each message gets to cpg: reuse one zero copy buffer, allocate
+ * and free a zero copy buffer per message, or copy with
+ * cpg_mcast_joined() for reference
+ */
+enum bench_mode {
+	BENCH_MODE_REUSE,
+	BENCH_MODE_ALLOC,
+	BENCH_MODE_COPY
+};
+
+static enum bench_mode bench_mode = BENCH_MODE_REUSE;
+
 static void cpg_bm_confchg_fn (
 	cpg_handle_t handle,
 	const struct cpg_name *group_name,
@@ -104,10 +118,15 @@ static void cpg_benchmark (
 	int write_size)
 {
 	struct timeval tv1, tv2, tv_elapsed;
+	struct timeval tv_alloc1, tv_alloc2, tv_alloc;
 	unsigned int res;
 	cpg_flow_control_state_t flow_control_state;
+	unsigned int alloc_count = 0;
+	void *buffer;
+	struct iovec iov;
 
 	alarm_notice = 0;
+	timerclear (&tv_alloc);
 
 	write_count = 0;
 	alarm (10);
@@ -119,11 +138,37 @@ static void cpg_benchmark (
 		 */
 		cpg_flow_control_state_get (handle, &flow_control_state);
 		if (flow_control_state == CPG_FLOW_CONTROL_DISABLED) {
+			buffer = data;
+			if (bench_mode == BENCH_MODE_ALLOC) {
+				gettimeofday (&tv_alloc1, NULL);
+				res = cpg_zcb_alloc (handle, write_size, &buffer);
+				if (res != CS_OK) {
+					printf ("cpg_zcb_alloc returned error %d\n", res);
+					exit (1);
+				}
+				gettimeofday (&tv_alloc2, NULL);
+				timersub (&tv_alloc2, &tv_alloc1, &tv_alloc2);
+				timeradd (&tv_alloc, &tv_alloc2, &tv_alloc);
+				alloc_count++;
+			}
 retry:
-			res = cpg_zcb_mcast_joined (handle, CPG_TYPE_AGREED, data, write_size);
+			if (bench_mode == BENCH_MODE_COPY) {
+				iov.iov_base = data;
+				iov.iov_len = write_size;
+				res = cpg_mcast_joined (handle, CPG_TYPE_AGREED, &iov, 1);
+			} else {
+				res = cpg_zcb_mcast_joined (handle, CPG_TYPE_AGREED, buffer, write_size);
+			}
 			if (res == CS_ERR_TRY_AGAIN) {
 				goto retry;
 			}
+			if (bench_mode == BENCH_MODE_ALLOC) {
+				gettimeofday (&tv_alloc1, NULL);
+				cpg_zcb_free (handle, buffer);
+				gettimeofday (&tv_alloc2, NULL);
+				timersub (&tv_alloc2, &tv_alloc1, &tv_alloc2);
+				timeradd (&tv_alloc, &tv_alloc2, &tv_alloc);
+			}
 		}
 		res = cpg_dispatch (handle, CS_DISPATCH_ALL);
 		if (res != CS_OK) {
@@ -140,8 +185,13 @@ retry:
 		(tv_elapsed.tv_sec + (tv_elapsed.tv_usec / 1000000.0)));
 	printf ("%9.3f TP/s ",
 		((float)write_count) /  (tv_elapsed.tv_sec + (tv_elapsed.tv_usec / 1000000.0)));
-	printf ("%7.3f MB/s.\n",
+	printf ("%7.3f MB/s",
 		((float)write_count) * ((float)write_size) /  ((tv_elapsed.tv_sec + (tv_elapsed.tv_usec / 1000000.0)) * 1000000.0));
+	if (alloc_count) {
+		printf (" %7.3f us alloc+free",
+			(tv_alloc.tv_sec * 1000000.0 + tv_alloc.tv_usec) / alloc_count);
+	}
+	printf (".\n");
 }
 
 static void sigalrm_handler (int num)
@@ -154,13 +204,34 @@ static struct cpg_name group_name = {
 	.length = 6
 };
 
-int main (void) {
+static void usage (const char *name)
+{
+	printf ("usage: %s [-a | -c]\n", name);
+	printf ("  -a  allocate and free a zero copy buffer for every message\n");
+	printf ("  -c  send with cpg_mcast_joined instead, for comparison\n");
+}
+
+int main (int argc, char *argv[]) {
 	cpg_handle_t handle;
 	unsigned int size;
 	int i;
 	unsigned int res;
+	int opt;
 
-
+	while ((opt = getopt (argc, argv, "ach")) != -1) {
+		switch (opt) {
+		case 'a':
+			bench_mode = BENCH_MODE_ALLOC;
+			break;
+		case 'c':
+			bench_mode = BENCH_MODE_COPY;
+			break;
+		case 'h':
+		default:
+			usage (argv[0]);
+			exit (1);
+		}
+	}
 
 	size = 1000;
 	signal (SIGALRM, sigalrm_handler);
@@ -169,7 +240,7 @@ int main (void) {
 		printf ("cpg_initialize failed with result %d\n", res);
 		exit (1);
 	}
-	cpg_zcb_alloc (handle, 500000, &data);
+	res = cpg_zcb_alloc (handle, 500000, &data);
 	if (res != CS_OK) {
 		printf ("cpg_zcb_alloc couldn't allocate zero copy buffer %d\n", res);
 		exit (1);
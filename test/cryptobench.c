@@ -0,0 +1,328 @@
+/*
+ * Copyright (c) 2012 Red Hat, Inc.
+ *
+ * All rights reserved.
+ *
+ * This software licensed under BSD license, the text of which follows:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * - Neither the name of the MontaVista Software, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Measures single core throughput of the totem secauth engines on one
+ * frame at a time, the way totemudp uses them
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/types.h>
+
+#include <corosync/totem/totem.h>
+
+#include "crypto.h"
+
+#ifdef HAVE_LIBNSS
+#include <nss.h>
+#include <pk11pub.h>
+#include <pkcs11.h>
+#include <prerror.h>
+#endif
+
+#ifndef timersub
+#define timersub(a, b, result)						\
+	do {								\
+		(result)->tv_sec = (a)->tv_sec - (b)->tv_sec;		\
+		(result)->tv_usec = (a)->tv_usec - (b)->tv_usec;	\
+		if ((result)->tv_usec < 0) {				\
+			--(result)->tv_sec;				\
+			(result)->tv_usec += 1000000;			\
+		}							\
+	} while (0)
+#endif /* timersub */
+
+#define SECURITY_HEADER_SIZE	36
+#define HMAC_HASH_SIZE		20
+#define GCM_NONCE_SIZE		12
+#define GCM_TAG_SIZE		16
+
+static int alarm_notice;
+
+static unsigned char private_key[128];
+
+static unsigned char plaintext[FRAME_SIZE_MAX];
+
+static unsigned char frame[FRAME_SIZE_MAX + 64];
+
+static prng_state sober_prng_state;
+
+#ifdef HAVE_LIBNSS
+static PK11SymKey *nss_sym_key;
+
+static PK11SymKey *nss_sym_key_sign;
+#endif
+
+#ifdef CKM_AES_GCM
+static PK11SymKey *gcm_sym_key;
+
+static unsigned char gcm_nonce[GCM_NONCE_SIZE];
+#endif
+
+/*
+ * Same per frame work as encrypt_and_sign_sober in exec/totemudp.c
+ */
+static int sober_encrypt (unsigned int len)
+{
+	unsigned char keys[48];
+	unsigned char *salt = &frame[HMAC_HASH_SIZE];
+	unsigned char *hmac_key = &keys[32];
+	unsigned char *cipher_key = &keys[16];
+	unsigned char *initial_vector = &keys[0];
+	prng_state keygen_prng_state;
+	prng_state stream_prng_state;
+	hmac_state hmac_st;
+	unsigned long hmac_len;
+
+	sober128_read (salt, 16, &sober_prng_state);
+	sober128_start (&keygen_prng_state);
+	sober128_add_entropy (private_key, sizeof (private_key),
+		&keygen_prng_state);
+	sober128_add_entropy (salt, 16, &keygen_prng_state);
+	sober128_read (keys, sizeof (keys), &keygen_prng_state);
+
+	sober128_start (&stream_prng_state);
+	sober128_add_entropy (cipher_key, 16, &stream_prng_state);
+	sober128_add_entropy (initial_vector, 16, &stream_prng_state);
+
+	memcpy (&frame[SECURITY_HEADER_SIZE], plaintext, len);
+	sober128_read (&frame[SECURITY_HEADER_SIZE], len, &stream_prng_state);
+
+	hmac_init (&hmac_st, DIGEST_SHA1, hmac_key, 16);
+	hmac_process (&hmac_st, &frame[HMAC_HASH_SIZE],
+		SECURITY_HEADER_SIZE - HMAC_HASH_SIZE + len);
+	hmac_len = HMAC_HASH_SIZE;
+	hmac_done (&hmac_st, frame, &hmac_len);
+
+	return (0);
+}
+
+#ifdef HAVE_LIBNSS
+/*
+ * Same per frame work as encrypt_and_sign_nss in exec/totemudp.c
+ */
+static int nss_encrypt (unsigned int len)
+{
+	PK11Context *enc_context;
+	SECItem iv_item;
+	SECItem no_params;
+	SECItem *nss_sec_param;
+	unsigned char *salt = &frame[HMAC_HASH_SIZE];
+	int tmp1_outlen = 0;
+	unsigned int tmp2_outlen = 0;
+	unsigned int digest_len = 0;
+
+	PK11_GenerateRandom (salt, 16);
+	iv_item.type = siBuffer;
+	iv_item.data = salt;
+	iv_item.len = 16;
+	nss_sec_param = PK11_ParamFromIV (CKM_AES_CBC_PAD, &iv_item);
+
+	enc_context = PK11_CreateContextBySymKey (CKM_AES_CBC_PAD,
+		CKA_ENCRYPT, nss_sym_key, nss_sec_param);
+	if (enc_context == NULL) {
+		SECITEM_FreeItem (nss_sec_param, PR_TRUE);
+		return (-1);
+	}
+	PK11_CipherOp (enc_context, &frame[SECURITY_HEADER_SIZE], &tmp1_outlen,
+		FRAME_SIZE_MAX, plaintext, len);
+	PK11_DigestFinal (enc_context, &frame[SECURITY_HEADER_SIZE + tmp1_outlen],
+		&tmp2_outlen, FRAME_SIZE_MAX - tmp1_outlen);
+	PK11_DestroyContext (enc_context, PR_TRUE);
+	SECITEM_FreeItem (nss_sec_param, PR_TRUE);
+
+	no_params.type = siBuffer;
+	no_params.data = 0;
+	no_params.len = 0;
+	enc_context = PK11_CreateContextBySymKey (CKM_SHA_1_HMAC,
+		CKA_SIGN, nss_sym_key_sign, &no_params);
+	if (enc_context == NULL) {
+		return (-1);
+	}
+	PK11_DigestBegin (enc_context);
+	PK11_DigestOp (enc_context, salt, 16 + tmp1_outlen + tmp2_outlen);
+	PK11_DigestFinal (enc_context, frame, &digest_len, HMAC_HASH_SIZE);
+	PK11_DestroyContext (enc_context, PR_TRUE);
+
+	return (0);
+}
+#endif
+
+#ifdef CKM_AES_GCM
+/*
+ * Same per frame work as encrypt_and_sign_gcm in exec/totemudp.c
+ */
+static int gcm_encrypt (unsigned int len)
+{
+	CK_GCM_PARAMS gcm_params;
+	SECItem param;
+	unsigned int outlen = 0;
+	int i;
+
+	memcpy (frame, gcm_nonce, GCM_NONCE_SIZE);
+	for (i = GCM_NONCE_SIZE - 1; i >= 0; i--) {
+		if (++gcm_nonce[i] != 0) {
+			break;
+		}
+	}
+
+	memset (&gcm_params, 0, sizeof (gcm_params));
+	gcm_params.pIv = frame;
+	gcm_params.ulIvLen = GCM_NONCE_SIZE;
+#ifdef HAVE_CK_GCM_PARAMS_ULIVBITS
+	gcm_params.ulIvBits = GCM_NONCE_SIZE * 8;
+#endif
+	gcm_params.ulTagBits = GCM_TAG_SIZE * 8;
+	param.type = siBuffer;
+	param.data = (unsigned char *)&gcm_params;
+	param.len = sizeof (gcm_params);
+
+	if (PK11_Encrypt (gcm_sym_key, CKM_AES_GCM, &param,
+		&frame[GCM_NONCE_SIZE], &outlen, sizeof (frame) - GCM_NONCE_SIZE,
+		plaintext, len) != SECSuccess) {
+
+		return (-1);
+	}
+	return (0);
+}
+#endif
+
+static void crypto_benchmark (
+	const char *name,
+	int (*encrypt_fn) (unsigned int len),
+	unsigned int len)
+{
+	struct timeval tv1, tv2, tv_elapsed;
+	unsigned int frames = 0;
+	double elapsed;
+
+	alarm_notice = 0;
+	alarm (3);
+
+	gettimeofday (&tv1, NULL);
+	do {
+		if (encrypt_fn (len) != 0) {
+			printf ("%-8s encryption failed\n", name);
+			return;
+		}
+		frames++;
+	} while (alarm_notice == 0);
+	gettimeofday (&tv2, NULL);
+	timersub (&tv2, &tv1, &tv_elapsed);
+
+	elapsed = tv_elapsed.tv_sec + (tv_elapsed.tv_usec / 1000000.0);
+	printf ("%-8s %5d bytes per frame ", name, len);
+	printf ("%10.0f frames/s ", frames / elapsed);
+	printf ("%9.3f MB/s.\n", ((double)frames * len) / (elapsed * 1000000.0));
+}
+
+static void sigalrm_handler (int num)
+{
+	alarm_notice = 1;
+}
+
+#ifdef HAVE_LIBNSS
+static PK11SymKey *nss_key_import (CK_MECHANISM_TYPE mechanism,
+	CK_ATTRIBUTE_TYPE operation)
+{
+	PK11SlotInfo *slot;
+	PK11SymKey *key;
+	SECItem key_item;
+
+	slot = PK11_GetBestSlot (mechanism, NULL);
+	if (slot == NULL) {
+		return (NULL);
+	}
+	key_item.type = siBuffer;
+	key_item.data = private_key;
+	key_item.len = 32;
+	key = PK11_ImportSymKey (slot, mechanism, PK11_OriginUnwrap,
+		operation, &key_item, NULL);
+	PK11_FreeSlot (slot);
+
+	return (key);
+}
+#endif
+
+int main (void)
+{
+	unsigned int sizes[] = {
+		64,
+		1024,
+		FRAME_SIZE_MAX - SECURITY_HEADER_SIZE - GCM_TAG_SIZE - 1 };
+	int i;
+
+	signal (SIGALRM, sigalrm_handler);
+
+	for (i = 0; i < sizeof (private_key); i++) {
+		private_key[i] = random ();
+	}
+	for (i = 0; i < sizeof (plaintext); i++) {
+		plaintext[i] = random ();
+	}
+	rng_make_prng (128, PRNG_SOBER, &sober_prng_state, NULL);
+
+#ifdef HAVE_LIBNSS
+	if (NSS_NoDB_Init (".") != SECSuccess) {
+		printf ("NSS initialization failed (err %d)\n", PR_GetError ());
+		exit (1);
+	}
+	nss_sym_key = nss_key_import (CKM_AES_CBC_PAD, CKA_ENCRYPT|CKA_DECRYPT);
+	nss_sym_key_sign = nss_key_import (CKM_SHA_1_HMAC, CKA_SIGN);
+#endif
+#ifdef CKM_AES_GCM
+	gcm_sym_key = nss_key_import (CKM_AES_GCM, CKA_ENCRYPT|CKA_DECRYPT);
+#endif
+
+	for (i = 0; i < sizeof (sizes) / sizeof (sizes[0]); i++) {
+		crypto_benchmark ("sober", sober_encrypt, sizes[i]);
+#ifdef HAVE_LIBNSS
+		if (nss_sym_key && nss_sym_key_sign) {
+			crypto_benchmark ("nss", nss_encrypt, sizes[i]);
+		}
+#endif
+#ifdef CKM_AES_GCM
+		if (gcm_sym_key) {
+			crypto_benchmark ("aes_gcm", gcm_encrypt, sizes[i]);
+		}
+#endif
+	}
+
+	return (0);
+}
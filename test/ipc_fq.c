@@ -0,0 +1,340 @@
+/*
+ * Copyright (c) 2012 Red Hat, Inc.
+ *
+ * All rights reserved.
+ *
+ * This software licensed under BSD license, the text of which follows:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * - Neither the name of the MontaVista Software, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Drives the IPC fair queue of ipc_glue.c with fake connections and a
+ * fake clock.  Two heavy clients, one of them with four times the weight,
+ * and a light client send for ten seconds: the weights must be honoured,
+ * the light client must never be deferred and every connection must see
+ * its requests in order.  Then a deferred backlog is held through sync
+ * and loss of quorum and must be delivered, complete and in order, once
+ * sending is allowed again.
+ *
+ * The libqb and daemon functions ipc_glue.c uses are replaced here.
+ */
+
+#include "ipc_glue.c"
+
+#define CONN_COUNT		3
+#define TICK_COUNT		10000
+#define HOLD_REQUESTS		200
+
+struct test_request {
+	struct qb_ipc_request_header header;
+	uint32_t conn;
+	uint32_t seq;
+};
+
+struct corosync_service_engine *ais_service[SERVICE_HANDLER_MAXIMUM_COUNT];
+int ais_service_exiting[SERVICE_HANDLER_MAXIMUM_COUNT];
+DECLARE_LIST_INIT(uidgid_list_head);
+
+static struct cs_ipcs_conn_context *conn_context[CONN_COUNT];
+
+static uint64_t handled_bytes[CONN_COUNT];
+
+static uint32_t next_seq[CONN_COUNT];
+
+static uint32_t expected_seq[CONN_COUNT];
+
+static uint64_t now_ns;
+
+static void (*timer_fn) (void *data);
+
+static int32_t refs;
+
+/*
+ * What corosync_sending_allowed answers while sync or loss of quorum is
+ * simulated
+ */
+static int sending_refused;
+
+static void request_handler (void *conn, const void *msg)
+{
+	const struct test_request *request = msg;
+
+	if ((uintptr_t)conn - 1 != request->conn) {
+		printf ("request of connection %u handled for %u\n",
+			request->conn, (unsigned int)((uintptr_t)conn - 1));
+		exit (1);
+	}
+	if (request->seq != expected_seq[request->conn]) {
+		printf ("connection %u got request %u, expected %u\n",
+			request->conn, request->seq,
+			expected_seq[request->conn]);
+		exit (1);
+	}
+	expected_seq[request->conn]++;
+	handled_bytes[request->conn] += request->header.size;
+}
+
+static struct corosync_lib_handler test_lib_engine[] = {
+	{
+		.lib_handler_fn		= request_handler,
+		.flow_control		= CS_LIB_FLOW_CONTROL_REQUIRED
+	},
+	{
+		.lib_handler_fn		= request_handler,
+		.flow_control		= CS_LIB_FLOW_CONTROL_NOT_REQUIRED
+	}
+};
+
+static struct corosync_service_engine test_service = {
+	.name			= "fair queue test",
+	.lib_engine		= test_lib_engine,
+	.lib_engine_count	= sizeof (test_lib_engine) / sizeof (struct corosync_lib_handler)
+};
+
+struct corosync_api_v1 *apidef_get (void)
+{
+	return (NULL);
+}
+
+void corosync_recheck_the_q_level (void *data)
+{
+}
+
+void totempg_queue_level_register_callback (totem_queue_level_changed_fn fn)
+{
+}
+
+qb_loop_t *cs_poll_handle_get (void)
+{
+	return (NULL);
+}
+
+int corosync_sending_allowed (
+	unsigned int service,
+	unsigned int id,
+	const void *msg,
+	void *sending_allowed_private_data)
+{
+	if (id >= ais_service[service]->lib_engine_count) {
+		return (-EINVAL);
+	}
+	if (sending_refused) {
+		return (sending_refused);
+	}
+	return (QB_TRUE);
+}
+
+void corosync_sending_allowed_release (void *sending_allowed_private_data)
+{
+}
+
+int32_t qb_ipcs_service_id_get (qb_ipcs_connection_t *c)
+{
+	return (0);
+}
+
+void *qb_ipcs_context_get (qb_ipcs_connection_t *c)
+{
+	return (conn_context[(uintptr_t)c - 1]);
+}
+
+void qb_ipcs_connection_ref (qb_ipcs_connection_t *c)
+{
+	refs++;
+}
+
+void qb_ipcs_connection_unref (qb_ipcs_connection_t *c)
+{
+	refs--;
+}
+
+ssize_t qb_ipcs_response_send (qb_ipcs_connection_t *c,
+	const void *data, size_t size)
+{
+	return (size);
+}
+
+uint64_t qb_util_nano_current_get (void)
+{
+	return (now_ns);
+}
+
+int32_t qb_loop_timer_add (qb_loop_t *l,
+	enum qb_loop_priority p,
+	uint64_t nsec_duration,
+	void *data,
+	qb_loop_timer_dispatch_fn dispatch_fn,
+	qb_loop_timer_handle *timer_handle_out)
+{
+	if (timer_fn != NULL) {
+		printf ("fair queue timer armed twice\n");
+		exit (1);
+	}
+	timer_fn = dispatch_fn;
+	return (0);
+}
+
+/*
+ * A request the fair queue refuses is retried by the client with the
+ * same sequence number
+ */
+static void request_send (uint32_t conn, uint32_t size, int32_t id)
+{
+	char buf[2000];
+	struct test_request *request = (struct test_request *)buf;
+
+	memset (buf, 0, size);
+	request->header.size = size;
+	request->header.id = id;
+	request->conn = conn;
+	request->seq = next_seq[conn];
+	if (cs_ipcs_msg_process ((qb_ipcs_connection_t *)(uintptr_t)(conn + 1),
+		buf, size) == 0) {
+
+		next_seq[conn]++;
+	}
+}
+
+static void tick (void)
+{
+	void (*fn) (void *data) = timer_fn;
+
+	now_ns += QB_TIME_NS_IN_MSEC;
+	timer_fn = NULL;
+	if (fn != NULL) {
+		fn (NULL);
+	}
+}
+
+static int fairness_test (void)
+{
+	int t;
+	int i;
+
+	for (t = 0; t < TICK_COUNT; t++) {
+		for (i = 0; i < 50; i++) {
+			request_send (0, 1000, i == 7 ? 1 : 0);
+			request_send (1, 1000, 0);
+		}
+		if (t % 2 == 0) {
+			request_send (2, 100, 0);
+		}
+		tick ();
+	}
+
+	printf ("handled bytes %llu / %llu / %llu, weighted / plain %.2f\n",
+		(unsigned long long)handled_bytes[0],
+		(unsigned long long)handled_bytes[1],
+		(unsigned long long)handled_bytes[2],
+		(double)handled_bytes[1] / handled_bytes[0]);
+
+	if (conn_context[2]->fq_deferred != 0 || expected_seq[2] != next_seq[2]) {
+		printf ("light client was held back\n");
+		return (-1);
+	}
+	if (handled_bytes[1] < 3 * handled_bytes[0]) {
+		printf ("client weight was not honoured\n");
+		return (-1);
+	}
+	if (conn_context[0]->fq_deferred_bytes > fq_queue_size + 1000) {
+		printf ("deferred queue grew past %zu bytes\n", fq_queue_size);
+		return (-1);
+	}
+
+	fq_purge (conn_context[0]);
+	fq_purge (conn_context[1]);
+	tick ();
+	if (!list_empty (&fq_active_head) || refs != 0) {
+		printf ("purged connections still queued\n");
+		return (-1);
+	}
+	expected_seq[0] = next_seq[0];
+	expected_seq[1] = next_seq[1];
+	return (0);
+}
+
+static int hold_test (void)
+{
+	struct cs_ipcs_conn_context *cnx = conn_context[0];
+	uint64_t bytes = handled_bytes[0];
+	int i;
+
+	cnx->fq_tokens = 0;
+	cnx->fq_refill_time = now_ns;
+	for (i = 0; i < HOLD_REQUESTS; i++) {
+		request_send (0, 1000, i % 10 == 5 ? 1 : 0);
+	}
+
+	for (i = 0; i < 1000; i++) {
+		sending_refused = (i < 500) ? -EINPROGRESS : -EHOSTUNREACH;
+		tick ();
+	}
+	if (handled_bytes[0] != bytes ||
+		cnx->fq_deferred_count != HOLD_REQUESTS) {
+
+		printf ("deferred requests were not held while sending was refused\n");
+		return (-1);
+	}
+
+	sending_refused = 0;
+	for (i = 0; i < TICK_COUNT && cnx->fq_deferred_count > 0; i++) {
+		tick ();
+	}
+	if (cnx->fq_deferred_count != 0 || expected_seq[0] != next_seq[0] ||
+		refs != 0) {
+
+		printf ("held requests were lost\n");
+		return (-1);
+	}
+	printf ("%u held requests delivered in order\n", HOLD_REQUESTS);
+	return (0);
+}
+
+int main (void)
+{
+	int i;
+
+	ais_service[0] = &test_service;
+	fq_rate = 100000;
+	fq_burst = CS_IPCS_FQ_BURST_MIN;
+
+	for (i = 0; i < CONN_COUNT; i++) {
+		conn_context[i] = calloc (1, sizeof (struct cs_ipcs_conn_context));
+		conn_context[i]->conn = (qb_ipcs_connection_t *)(uintptr_t)(i + 1);
+		list_init (&conn_context[i]->fq_list);
+		list_init (&conn_context[i]->fq_deferred_head);
+		conn_context[i]->fq_weight = (i == 1) ? 4 : 1;
+		conn_context[i]->fq_tokens = fq_burst * conn_context[i]->fq_weight;
+		snprintf (conn_context[i]->name, sizeof (conn_context[i]->name),
+			"client%d", i);
+	}
+
+	if (fairness_test () != 0 || hold_test () != 0) {
+		return (1);
+	}
+	printf ("ok\n");
+	return (0);
+}
@@ -0,0 +1,320 @@
+/*
+ * Copyright (c) 2012 Red Hat, Inc.
+ *
+ * All rights reserved.
+ *
+ * This software licensed under BSD license, the text of which follows:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * - Neither the name of the MontaVista Software, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Drives the outbound event queue of ipc_glue.c against a fake client
+ * whose event ring accepts a random number of events per turn of the
+ * main loop.  Events of varying length are checked for order and content
+ * as the client receives them, first with the backpressure policy, then
+ * with drop-oldest on a budget that is not a power of two, and last with
+ * the disconnect policy, which must leave no memory or reference behind.
+ *
+ * The libqb and daemon functions ipc_glue.c uses are replaced here.
+ */
+
+#include "ipc_glue.c"
+
+#define EVENT_LEN_MAX		5000
+#define ROUNDS			20000
+
+struct corosync_service_engine *ais_service[SERVICE_HANDLER_MAXIMUM_COUNT];
+int ais_service_exiting[SERVICE_HANDLER_MAXIMUM_COUNT];
+DECLARE_LIST_INIT(uidgid_list_head);
+
+static struct cs_ipcs_conn_context *context;
+
+/*
+ * Events the client's ring takes before it answers -EAGAIN
+ */
+static int room;
+
+static uint32_t expected_seq;
+
+static uint32_t received;
+
+static int32_t refs;
+
+static int disconnected;
+
+static void (*pending_fn) (void *data);
+
+static size_t event_len (uint32_t seq)
+{
+	return (sizeof (uint32_t) + (seq * 131) % EVENT_LEN_MAX);
+}
+
+static void event_check (const void *msg, size_t len)
+{
+	const unsigned char *data = msg;
+	uint32_t seq;
+	size_t i;
+
+	memcpy (&seq, msg, sizeof (seq));
+	if (seq != expected_seq) {
+		printf ("got event %u, expected %u\n", seq, expected_seq);
+		exit (1);
+	}
+	if (len != event_len (seq)) {
+		printf ("event %u has length %zu\n", seq, len);
+		exit (1);
+	}
+	for (i = sizeof (seq); i < len; i++) {
+		if (data[i] != (unsigned char)(seq + i)) {
+			printf ("event %u is corrupt at %zu\n", seq, i);
+			exit (1);
+		}
+	}
+	expected_seq++;
+	received++;
+}
+
+struct corosync_api_v1 *apidef_get (void)
+{
+	return (NULL);
+}
+
+void corosync_recheck_the_q_level (void *data)
+{
+}
+
+void totempg_queue_level_register_callback (totem_queue_level_changed_fn fn)
+{
+}
+
+qb_loop_t *cs_poll_handle_get (void)
+{
+	return (NULL);
+}
+
+int corosync_sending_allowed (
+	unsigned int service,
+	unsigned int id,
+	const void *msg,
+	void *sending_allowed_private_data)
+{
+	return (QB_TRUE);
+}
+
+void corosync_sending_allowed_release (void *sending_allowed_private_data)
+{
+}
+
+ssize_t qb_ipcs_event_sendv (qb_ipcs_connection_t *c,
+	const struct iovec *iov, size_t iov_len)
+{
+	char buf[EVENT_LEN_MAX + sizeof (uint32_t)];
+	size_t len = 0;
+	size_t i;
+
+	if (room == 0) {
+		return (-EAGAIN);
+	}
+	for (i = 0; i < iov_len; i++) {
+		memcpy (buf + len, iov[i].iov_base, iov[i].iov_len);
+		len += iov[i].iov_len;
+	}
+	room--;
+	event_check (buf, len);
+	return (len);
+}
+
+ssize_t qb_ipcs_event_send (qb_ipcs_connection_t *c,
+	const void *data, size_t size)
+{
+	if (room == 0) {
+		return (-EAGAIN);
+	}
+	room--;
+	event_check (data, size);
+	return (size);
+}
+
+void *qb_ipcs_context_get (qb_ipcs_connection_t *c)
+{
+	return (context);
+}
+
+void qb_ipcs_connection_ref (qb_ipcs_connection_t *c)
+{
+	refs++;
+}
+
+void qb_ipcs_connection_unref (qb_ipcs_connection_t *c)
+{
+	refs--;
+}
+
+void qb_ipcs_disconnect (qb_ipcs_connection_t *c)
+{
+	disconnected++;
+}
+
+static void pending_set (void (*fn) (void *data))
+{
+	if (pending_fn != NULL) {
+		printf ("flush scheduled twice\n");
+		exit (1);
+	}
+	pending_fn = fn;
+}
+
+int32_t qb_loop_job_add (qb_loop_t *l,
+	enum qb_loop_priority p,
+	void *data,
+	qb_loop_job_dispatch_fn dispatch_fn)
+{
+	pending_set (dispatch_fn);
+	return (0);
+}
+
+int32_t qb_loop_timer_add (qb_loop_t *l,
+	enum qb_loop_priority p,
+	uint64_t nsec_duration,
+	void *data,
+	qb_loop_timer_dispatch_fn dispatch_fn,
+	qb_loop_timer_handle *timer_handle_out)
+{
+	pending_set (dispatch_fn);
+	return (0);
+}
+
+static void event_send (uint32_t seq)
+{
+	unsigned char buf[EVENT_LEN_MAX + sizeof (uint32_t)];
+	struct iovec iov[2];
+	size_t len = event_len (seq);
+	size_t i;
+
+	memcpy (buf, &seq, sizeof (seq));
+	for (i = sizeof (seq); i < len; i++) {
+		buf[i] = (unsigned char)(seq + i);
+	}
+	iov[0].iov_base = buf;
+	iov[0].iov_len = sizeof (seq);
+	iov[1].iov_base = buf + sizeof (seq);
+	iov[1].iov_len = len - sizeof (seq);
+	msg_send_or_queue ((qb_ipcs_connection_t *)context, iov, 2);
+}
+
+static void pending_run (void)
+{
+	void (*fn) (void *data) = pending_fn;
+
+	pending_fn = NULL;
+	if (fn != NULL) {
+		fn (context);
+	}
+}
+
+static int drain (void)
+{
+	room = 1 << 30;
+	while (pending_fn != NULL) {
+		pending_run ();
+	}
+	return (context->outq.count == 0 && outq_stats.queued == 0 &&
+		outq_stats.memory == 0 && refs == 0);
+}
+
+int main (void)
+{
+	uint32_t seq = 0;
+	int round;
+	int burst;
+	int i;
+
+	context = calloc (1, sizeof (struct cs_ipcs_conn_context));
+	srand (1);
+
+	outq_size_max = CS_IPCS_OUTQ_SIZE_MIN;
+	for (round = 0; round < ROUNDS; round++) {
+		burst = rand () % 40;
+		for (i = 0; i < burst; i++) {
+			event_send (seq++);
+		}
+		room = (rand () % 3 == 0) ? 0 : rand () % 90;
+		pending_run ();
+		if (disconnected) {
+			printf ("disconnected after %u events\n", seq);
+			return (1);
+		}
+	}
+	if (!drain () || received != seq) {
+		printf ("backpressure: %u of %u events received\n", received, seq);
+		return (1);
+	}
+	printf ("backpressure: %u events, peak %llu bytes\n", seq,
+		(unsigned long long)outq_stats.memory_peak);
+
+	outq_policy = CS_IPCS_OUTQ_POLICY_DROP_OLDEST;
+	outq_size_max = CS_IPCS_OUTQ_SIZE_MIN + 1000 * 8;
+	room = 0;
+	for (i = 0; i < 5000; i++) {
+		event_send (seq++);
+	}
+	if (context->outq.size != outq_size_max || context->dropped == 0 ||
+		disconnected) {
+
+		printf ("drop-oldest: queue did not drop at its budget\n");
+		return (1);
+	}
+	expected_seq = seq - context->outq.count;
+	if (!drain () || expected_seq != seq || context->queued != 0) {
+		printf ("drop-oldest: queue did not drain\n");
+		return (1);
+	}
+	printf ("drop-oldest: %llu events dropped\n",
+		(unsigned long long)context->dropped);
+
+	outq_policy = CS_IPCS_OUTQ_POLICY_DISCONNECT;
+	room = 0;
+	for (i = 0; i < 5000 && !context->disconnecting; i++) {
+		event_send (seq++);
+	}
+	if (!context->disconnecting || disconnected) {
+		printf ("disconnect: connection dropped from the send path\n");
+		return (1);
+	}
+	event_send (seq++);
+	pending_run ();
+	if (disconnected != 1 || outq_stats.disconnects != 1 ||
+		outq_stats.memory != 0 || outq_stats.queued != 0 ||
+		refs != 0 || pending_fn != NULL) {
+
+		printf ("disconnect: connection not cleaned up\n");
+		return (1);
+	}
+	printf ("disconnect: ok\n");
+
+	printf ("ok\n");
+	return (0);
+}
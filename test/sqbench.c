@@ -0,0 +1,211 @@
+/*
+ * Copyright (c) 2012 Red Hat, Inc.
+ *
+ * All rights reserved.
+ *
+ * This software licensed under BSD license, the text of which follows:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * - Neither the name of the MontaVista Software, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Measures the sort queue scans totemsrp does on every token: finding the
+ * first hole after the aru and listing the holes to put on the
+ * retransmit list.  Each scan is run one sequence number at a time and
+ * with sq_first_hole, over a full queue window with 0%, 1% and 10% of the
+ * messages missing.
+ */
+
+#include <config.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include <corosync/sq.h>
+
+#ifndef timersub
+#define timersub(a, b, result)						\
+	do {								\
+		(result)->tv_sec = (a)->tv_sec - (b)->tv_sec;		\
+		(result)->tv_usec = (a)->tv_usec - (b)->tv_usec;	\
+		if ((result)->tv_usec < 0) {				\
+			--(result)->tv_sec;				\
+			(result)->tv_usec += 1000000;			\
+		}							\
+	} while (0)
+#endif /* timersub */
+
+/*
+ * Same geometry as the totemsrp sort queues
+ */
+#define QUEUE_ITEMS		16384
+#define WINDOW			(QUEUE_ITEMS - 1024)
+#define SEQ_START		0xfffff000
+
+struct item {
+	void *mcast;
+	int msg_len;
+};
+
+static int alarm_notice;
+
+static struct sq sort_queue;
+
+static volatile unsigned int result;
+
+static unsigned int aru_per_item (void)
+{
+	unsigned int i;
+	void *ptr;
+
+	for (i = 1; i <= WINDOW; i++) {
+		if (sq_item_get (&sort_queue, SEQ_START + i, &ptr) != 0) {
+			break;
+		}
+	}
+	return (i - 1);
+}
+
+static unsigned int aru_bitmap (void)
+{
+	return (sq_first_hole (&sort_queue, SEQ_START + 1, WINDOW));
+}
+
+static unsigned int holes_per_item (void)
+{
+	unsigned int holes = 0;
+	unsigned int i;
+
+	for (i = 1; i <= WINDOW; i++) {
+		if (sq_in_range (&sort_queue, SEQ_START + i) == 0) {
+			break;
+		}
+		if (sq_item_inuse (&sort_queue, SEQ_START + i) == 0) {
+			holes++;
+		}
+	}
+	return (holes);
+}
+
+static unsigned int holes_bitmap (void)
+{
+	unsigned int holes = 0;
+	unsigned int i;
+
+	for (i = 1; i <= WINDOW; i++) {
+		i += sq_first_hole (&sort_queue, SEQ_START + i, WINDOW - i + 1);
+		if (i > WINDOW || sq_in_range (&sort_queue, SEQ_START + i) == 0) {
+			break;
+		}
+		holes++;
+	}
+	return (holes);
+}
+
+static void sigalrm_handler (int num)
+{
+	alarm_notice = 1;
+}
+
+static void scan_benchmark (
+	const char *name,
+	unsigned int (*scan_fn) (void),
+	int loss)
+{
+	struct timeval tv1, tv2, tv_elapsed;
+	unsigned long long scans = 0;
+	double elapsed;
+
+	alarm_notice = 0;
+	alarm (1);
+	gettimeofday (&tv1, NULL);
+	do {
+		result = scan_fn ();
+		scans++;
+	} while (alarm_notice == 0);
+	gettimeofday (&tv2, NULL);
+	timersub (&tv2, &tv1, &tv_elapsed);
+
+	elapsed = tv_elapsed.tv_sec + (tv_elapsed.tv_usec / 1000000.0);
+	printf ("%-16s %3d%% loss ", name, loss);
+	printf ("%10.0f scans/s ", scans / elapsed);
+	printf ("%9.3f us/scan (result %u)\n",
+		(elapsed * 1000000.0) / scans, result);
+}
+
+static void queue_fill (int loss)
+{
+	struct item item;
+	unsigned int i;
+
+	sq_reinit (&sort_queue, SEQ_START + 1);
+	memset (&item, 0, sizeof (item));
+	srandom (loss);
+	for (i = 1; i <= WINDOW; i++) {
+		if ((random () % 100) < loss) {
+			continue;
+		}
+		sq_item_add (&sort_queue, &item, SEQ_START + i);
+	}
+}
+
+int main (void)
+{
+	int losses[] = { 0, 1, 10 };
+	int i;
+
+	signal (SIGALRM, sigalrm_handler);
+
+	if (sq_init (&sort_queue, QUEUE_ITEMS, sizeof (struct item),
+		SEQ_START + 1) != 0) {
+		printf ("sort queue allocation failed\n");
+		exit (1);
+	}
+
+	for (i = 0; i < sizeof (losses) / sizeof (losses[0]); i++) {
+		queue_fill (losses[i]);
+
+		if (aru_per_item () != aru_bitmap () ||
+			holes_per_item () != holes_bitmap ()) {
+
+			printf ("bitmap scan disagrees with per item scan\n");
+			exit (1);
+		}
+
+		scan_benchmark ("aru per item", aru_per_item, losses[i]);
+		scan_benchmark ("aru bitmap", aru_bitmap, losses[i]);
+		scan_benchmark ("holes per item", holes_per_item, losses[i]);
+		scan_benchmark ("holes bitmap", holes_bitmap, losses[i]);
+	}
+
+	sq_free (&sort_queue);
+
+	return (0);
+}
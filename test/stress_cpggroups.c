@@ -0,0 +1,277 @@
+/*
+ * Copyright (c) 2012 Red Hat, Inc.
+ *
+ * All rights reserved.
+ *
+ * This software licensed under BSD license, the text of which follows:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * - Neither the name of the MontaVista Software, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Join an increasing number of otherwise idle groups and measure how
+ * message delivery on one probe group is affected.  With per group
+ * lookups in the cpg service the throughput should stay flat as the
+ * group count grows.
+ *
+ * Every group needs its own connection, so the open file limit and the
+ * qb ipc shared memory must allow for the requested number of groups.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <pthread.h>
+
+#include <corosync/corotypes.h>
+#include <corosync/cpg.h>
+
+#ifndef timersub
+#define timersub(a, b, result)						\
+	do {								\
+		(result)->tv_sec = (a)->tv_sec - (b)->tv_sec;		\
+		(result)->tv_usec = (a)->tv_usec - (b)->tv_usec;	\
+		if ((result)->tv_usec < 0) {				\
+			--(result)->tv_sec;				\
+			(result)->tv_usec += 1000000;			\
+		}							\
+	} while (0)
+#endif /* timersub */
+
+#define GROUPS_MAX_DEFAULT 10000
+#define RUNTIME_DEFAULT 5
+#define WRITE_SIZE 64
+
+static cpg_handle_t probe_handle;
+
+static cpg_handle_t *group_handles;
+
+static pthread_t thread;
+
+static int alarm_notice;
+
+static unsigned int write_count;
+
+static char data[WRITE_SIZE];
+
+static void cpg_deliver_fn (
+        cpg_handle_t handle,
+        const struct cpg_name *group_name,
+        uint32_t nodeid,
+        uint32_t pid,
+        void *msg,
+        size_t msg_len)
+{
+	write_count++;
+}
+
+static void cpg_confchg_fn (
+        cpg_handle_t handle,
+        const struct cpg_name *group_name,
+        const struct cpg_address *member_list, size_t member_list_entries,
+        const struct cpg_address *left_list, size_t left_list_entries,
+        const struct cpg_address *joined_list, size_t joined_list_entries)
+{
+}
+
+static cpg_callbacks_t callbacks = {
+	.cpg_deliver_fn 	= cpg_deliver_fn,
+	.cpg_confchg_fn		= cpg_confchg_fn
+};
+
+static struct cpg_name probe_group = {
+	.value = "stress_cpggroups_probe",
+	.length = 22
+};
+
+static void sigalrm_handler (int num)
+{
+	alarm_notice = 1;
+}
+
+static void *dispatch_thread (void *arg)
+{
+	cpg_dispatch (probe_handle, CS_DISPATCH_BLOCKING);
+	return NULL;
+}
+
+static double tv_seconds (const struct timeval *tv)
+{
+	return (tv->tv_sec + (tv->tv_usec / 1000000.0));
+}
+
+static int groups_join (unsigned int from, unsigned int to)
+{
+	struct cpg_name group_name;
+	unsigned int i;
+	cs_error_t res;
+
+	for (i = from; i < to; i++) {
+		res = cpg_initialize (&group_handles[i], &callbacks);
+		if (res != CS_OK) {
+			printf ("cpg_initialize for group %u failed with result %d\n", i, res);
+			return (-1);
+		}
+
+		group_name.length = snprintf (group_name.value, CPG_MAX_NAME_LENGTH,
+			"stress_cpggroups_%u", i);
+		do {
+			res = cpg_join (group_handles[i], &group_name);
+		} while (res == CS_ERR_TRY_AGAIN);
+		if (res != CS_OK) {
+			printf ("cpg_join for group %u failed with result %d\n", i, res);
+			return (-1);
+		}
+	}
+	return (0);
+}
+
+static void probe_benchmark (unsigned int groups, unsigned int runtime)
+{
+	struct timeval tv1, tv2, tv_elapsed;
+	struct iovec iov;
+	cs_error_t res;
+
+	iov.iov_base = data;
+	iov.iov_len = WRITE_SIZE;
+
+	alarm_notice = 0;
+	write_count = 0;
+	alarm (runtime);
+
+	gettimeofday (&tv1, NULL);
+	do {
+		res = cpg_mcast_joined (probe_handle, CPG_TYPE_AGREED, &iov, 1);
+	} while (alarm_notice == 0 && (res == CS_OK || res == CS_ERR_TRY_AGAIN));
+	gettimeofday (&tv2, NULL);
+	timersub (&tv2, &tv1, &tv_elapsed);
+
+	printf ("%6u groups %8u messages received %9.3f TP/s\n",
+		groups, write_count,
+		((float)write_count) / tv_seconds (&tv_elapsed));
+}
+
+static void usage (const char *prog)
+{
+	printf ("Usage: %s [-n max groups] [-t seconds per step]\n", prog);
+}
+
+int main (int argc, char *argv[])
+{
+	struct timeval tv1, tv2, tv_elapsed;
+	struct rlimit rlimit;
+	unsigned int groups_max = GROUPS_MAX_DEFAULT;
+	unsigned int runtime = RUNTIME_DEFAULT;
+	unsigned int groups = 0;
+	unsigned int step;
+	unsigned int i;
+	cs_error_t res;
+	int opt;
+
+	while ((opt = getopt (argc, argv, "n:t:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			groups_max = atoi (optarg);
+			break;
+		case 't':
+			runtime = atoi (optarg);
+			break;
+		default:
+			usage (argv[0]);
+			exit (1);
+		}
+	}
+
+	/*
+	 * Each connection needs a handful of descriptors
+	 */
+	if (getrlimit (RLIMIT_NOFILE, &rlimit) == 0 &&
+		rlimit.rlim_cur < rlimit.rlim_max) {
+
+		rlimit.rlim_cur = rlimit.rlim_max;
+		setrlimit (RLIMIT_NOFILE, &rlimit);
+	}
+
+	group_handles = calloc (groups_max, sizeof (cpg_handle_t));
+	if (group_handles == NULL) {
+		printf ("Unable to allocate %u handles\n", groups_max);
+		exit (1);
+	}
+
+	signal (SIGALRM, sigalrm_handler);
+	res = cpg_initialize (&probe_handle, &callbacks);
+	if (res != CS_OK) {
+		printf ("cpg_initialize failed with result %d\n", res);
+		exit (1);
+	}
+	pthread_create (&thread, NULL, dispatch_thread, NULL);
+
+	res = cpg_join (probe_handle, &probe_group);
+	if (res != CS_OK) {
+		printf ("cpg_join failed with result %d\n", res);
+		exit (1);
+	}
+
+	probe_benchmark (0, runtime);
+	for (step = 10; groups < groups_max; step *= 10) {
+		if (step > groups_max) {
+			step = groups_max;
+		}
+
+		gettimeofday (&tv1, NULL);
+		if (groups_join (groups, step) != 0) {
+			break;
+		}
+		gettimeofday (&tv2, NULL);
+		timersub (&tv2, &tv1, &tv_elapsed);
+		printf ("%6u groups joined in %7.3f seconds\n",
+			step - groups, tv_seconds (&tv_elapsed));
+		groups = step;
+
+		probe_benchmark (groups, runtime);
+	}
+
+	for (i = 0; i < groups_max; i++) {
+		if (group_handles[i] != 0) {
+			cpg_finalize (group_handles[i]);
+		}
+	}
+	free (group_handles);
+
+	res = cpg_finalize (probe_handle);
+	if (res != CS_OK) {
+		printf ("cpg_finalize failed with result %d\n", res);
+		exit (1);
+	}
+	return (0);
+}
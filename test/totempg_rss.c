@@ -0,0 +1,671 @@
+/*
+ * Copyright (c) 2012 Red Hat, Inc.
+ *
+ * All rights reserved.
+ *
+ * This software licensed under BSD license, the text of which follows:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * - Neither the name of the MontaVista Software, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Drives exec/totempg.c on top of a loopback totemmrp and reports how much
+ * memory the per-node reassembly state costs as traffic comes in from many
+ * nodes and as those nodes leave the configuration.  Frames are queued per
+ * sender and delivered round robin, so fragmented messages from every node
+ * are in reassembly at the same time the way they are on a busy ring.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include <qb/qbloop.h>
+#include <corosync/totem/totem.h>
+#include <corosync/totem/totempg.h>
+
+#include "totemmrp.h"
+#include "totemsrp.h"
+
+#define NODES_DEFAULT		64
+#define SMALL_MSG_SIZE		200
+#define SMALL_MSG_COUNT		100
+#define LARGE_MSG_SIZE		(256 * 1024)
+#define MRP_AVAIL		QUEUE_FRAMES
+#define SRP_HEADER_SIZE		64
+#define QUEUE_BYTES		(32 * 1024 * 1024)
+#define QUEUE_FRAMES		65536
+#define NODES_MAX		1024
+#define BATCH_MAX		64
+#define BATCH_MSGS_MAX		65536
+#define BATCH_SEND_MAX		8
+
+static void (*mrp_deliver_fn) (
+	unsigned int nodeid,
+	const void *msg,
+	unsigned int msg_len,
+	int endian_conversion_required);
+
+static void (*mrp_confchg_fn) (
+	enum totem_configuration_type configuration_type,
+	const unsigned int *member_list, size_t member_list_entries,
+	const unsigned int *left_list, size_t left_list_entries,
+	const unsigned int *joined_list, size_t joined_list_entries,
+	const struct memb_ring_id *ring_id);
+
+static void (*mrp_deliver_batch_fn) (
+	const struct totem_deliver_item *items,
+	unsigned int item_count);
+
+static int (*mrp_token_fn) (enum totem_callback_token_type type,
+	const void *data);
+
+static unsigned int sender_nodeid;
+
+/*
+ * Queued frames live in one buffer that is touched up front, so the queue
+ * itself does not show up in the rss deltas
+ */
+struct queued_frame {
+	unsigned int nodeid;
+	unsigned int len;
+	size_t offset;
+};
+
+static unsigned char queue_data[QUEUE_BYTES];
+
+static struct queued_frame queue[QUEUE_FRAMES];
+
+static size_t queue_bytes;
+
+static unsigned int queue_frames;
+
+static unsigned int node_first[NODES_MAX + 1];
+
+static unsigned int node_last[NODES_MAX + 1];
+
+static unsigned char msg[LARGE_MSG_SIZE];
+
+static unsigned long long sent_msgs;
+
+static unsigned long long sent_bytes;
+
+static unsigned long long delivered_msgs;
+
+static unsigned long long delivered_bytes;
+
+static unsigned long long delivered_bad;
+
+static struct memb_ring_id ring_id;
+
+/*
+ * Messages delivered since the last batch end, checked again when it comes
+ * to make sure they were not overwritten in the meantime
+ */
+struct batch_msg {
+	unsigned int nodeid;
+	const unsigned char *data;
+	unsigned int len;
+};
+
+static struct batch_msg batch_msgs[BATCH_MSGS_MAX];
+
+static unsigned int batch_msgs_entries;
+
+static unsigned long long batch_ends;
+
+/*
+ * Loopback totemmrp: every mcast is delivered straight back as if it was
+ * sent by sender_nodeid
+ */
+int totemmrp_initialize (
+	qb_loop_t *poll_handle,
+	struct totem_config *totem_config,
+	totempg_stats_t *stats,
+	void (*deliver_fn) (
+		unsigned int nodeid,
+		const void *msg,
+		unsigned int msg_len,
+		int endian_conversion_required),
+	void (*confchg_fn) (
+		enum totem_configuration_type configuration_type,
+		const unsigned int *member_list, size_t member_list_entries,
+		const unsigned int *left_list, size_t left_list_entries,
+		const unsigned int *joined_list, size_t joined_list_entries,
+		const struct memb_ring_id *ring_id))
+{
+	mrp_deliver_fn = deliver_fn;
+	mrp_confchg_fn = confchg_fn;
+	return (0);
+}
+
+void totemmrp_finalize (void)
+{
+}
+
+int totemmrp_mcast (
+	struct iovec *iovec,
+	unsigned int iov_len,
+	int priority)
+{
+	struct queued_frame *frame;
+	unsigned int i;
+
+	if (queue_frames == QUEUE_FRAMES ||
+		queue_bytes + FRAME_SIZE_MAX > QUEUE_BYTES) {
+
+		fprintf (stderr, "frame queue full\n");
+		exit (1);
+	}
+	frame = &queue[queue_frames];
+	frame->nodeid = sender_nodeid;
+	frame->offset = queue_bytes;
+	frame->len = 0;
+	for (i = 0; i < iov_len; i++) {
+		memcpy (&queue_data[frame->offset + frame->len],
+			iovec[i].iov_base, iovec[i].iov_len);
+		frame->len += iovec[i].iov_len;
+	}
+	queue_bytes += frame->len;
+	queue_frames += 1;
+	return (0);
+}
+
+int totemmrp_avail (void)
+{
+	return (MRP_AVAIL);
+}
+
+/*
+ * Queued frames have not been sent yet, so all of them are handed back
+ */
+void totemmrp_new_message_queue_requeue (
+	void (*requeue_fn) (
+		const void *msg,
+		unsigned int msg_len,
+		int guarantee))
+{
+	struct queued_frame *frames;
+	unsigned char *data;
+	unsigned int frame_count;
+	unsigned int i;
+
+	frames = malloc (queue_frames * sizeof (struct queued_frame));
+	data = malloc (queue_bytes);
+	if (frames == NULL || data == NULL) {
+		fprintf (stderr, "out of memory\n");
+		exit (1);
+	}
+	memcpy (frames, queue, queue_frames * sizeof (struct queued_frame));
+	memcpy (data, queue_data, queue_bytes);
+	frame_count = queue_frames;
+	queue_frames = 0;
+	queue_bytes = 0;
+
+	for (i = 0; i < frame_count; i++) {
+		requeue_fn (&data[frames[i].offset], frames[i].len, 0);
+	}
+
+	free (data);
+	free (frames);
+}
+
+int totemmrp_callback_token_create (
+	void **handle_out,
+	enum totem_callback_token_type type,
+	int delete,
+	int (*callback_fn) (enum totem_callback_token_type type, const void *),
+	const void *data)
+{
+	mrp_token_fn = callback_fn;
+	return (0);
+}
+
+void totemmrp_callback_token_destroy (void *handle_out)
+{
+}
+
+void totemmrp_event_signal (enum totem_event_type type, int value)
+{
+}
+
+int totemmrp_ifaces_get (
+	unsigned int nodeid,
+	struct totem_ip_address *interfaces,
+	char ***status,
+	unsigned int *iface_count)
+{
+	*iface_count = 0;
+	return (0);
+}
+
+unsigned int totemmrp_my_nodeid_get (void)
+{
+	return (1);
+}
+
+int totemmrp_my_family_get (void)
+{
+	return (AF_INET);
+}
+
+int totemmrp_crypto_set (unsigned int type)
+{
+	return (0);
+}
+
+int totemmrp_ring_reenable (void)
+{
+	return (0);
+}
+
+void totemmrp_deliver_batch_register (
+	void (*deliver_batch_fn) (
+		const struct totem_deliver_item *items,
+		unsigned int item_count))
+{
+	mrp_deliver_batch_fn = deliver_batch_fn;
+}
+
+void totemmrp_service_ready_register (
+	void (*totem_service_ready) (void))
+{
+}
+
+void totemmrp_threaded_mode_enable (void)
+{
+}
+
+void totemsrp_net_mtu_adjust (struct totem_config *totem_config)
+{
+	totem_config->net_mtu -= SRP_HEADER_SIZE;
+}
+
+static void log_printf_stub (
+	int level,
+	int subsys,
+	const char *function_name,
+	const char *file_name,
+	int file_line,
+	const char *format,
+	...)
+{
+}
+
+static int msg_check (
+	unsigned int nodeid,
+	const unsigned char *data,
+	unsigned int msg_len)
+{
+	unsigned int i;
+
+	for (i = 0; i < msg_len; i++) {
+		if (data[i] != (unsigned char)(nodeid + i)) {
+			return (-1);
+		}
+	}
+	return (0);
+}
+
+static void deliver_fn (
+	unsigned int nodeid,
+	const void *m,
+	unsigned int msg_len,
+	int endian_conversion_required)
+{
+	delivered_msgs += 1;
+	delivered_bytes += msg_len;
+	if (msg_check (nodeid, m, msg_len) != 0) {
+		delivered_bad += 1;
+	}
+	if (batch_msgs_entries < BATCH_MSGS_MAX) {
+		batch_msgs[batch_msgs_entries].nodeid = nodeid;
+		batch_msgs[batch_msgs_entries].data = m;
+		batch_msgs[batch_msgs_entries].len = msg_len;
+		batch_msgs_entries++;
+	}
+}
+
+static void deliver_batch_end_fn (void)
+{
+	unsigned int i;
+
+	for (i = 0; i < batch_msgs_entries; i++) {
+		if (msg_check (batch_msgs[i].nodeid, batch_msgs[i].data,
+			batch_msgs[i].len) != 0) {
+
+			delivered_bad += 1;
+		}
+	}
+	batch_msgs_entries = 0;
+	batch_ends += 1;
+}
+
+static void confchg_fn (
+	enum totem_configuration_type configuration_type,
+	const unsigned int *member_list, size_t member_list_entries,
+	const unsigned int *left_list, size_t left_list_entries,
+	const unsigned int *joined_list, size_t joined_list_entries,
+	const struct memb_ring_id *ring_id)
+{
+}
+
+static void node_send (void *instance, unsigned int nodeid, size_t len)
+{
+	struct iovec iov;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		msg[i] = (unsigned char)(nodeid + i);
+	}
+	iov.iov_base = msg;
+	iov.iov_len = len;
+
+	if (sender_nodeid != nodeid) {
+		sender_nodeid = nodeid;
+		node_first[nodeid] = queue_frames;
+	}
+	if (totempg_groups_mcast_joined (instance, &iov, 1,
+		TOTEMPG_AGREED) != 0) {
+		fprintf (stderr, "mcast from node %u failed\n", nodeid);
+		exit (1);
+	}
+	sent_msgs += 1;
+	sent_bytes += len;
+}
+
+/*
+ * Sends count messages in one batch, every fourth of them large
+ */
+static void node_send_batch (void *instance, unsigned int nodeid,
+	unsigned int count)
+{
+	struct iovec iov[BATCH_SEND_MAX];
+	unsigned int msg_iov_len[BATCH_SEND_MAX];
+	size_t i;
+
+	for (i = 0; i < LARGE_MSG_SIZE; i++) {
+		msg[i] = (unsigned char)(nodeid + i);
+	}
+	for (i = 0; i < count; i++) {
+		iov[i].iov_base = msg;
+		iov[i].iov_len = (i % 4 == 3) ? LARGE_MSG_SIZE : SMALL_MSG_SIZE;
+		msg_iov_len[i] = 1;
+		sent_msgs += 1;
+		sent_bytes += iov[i].iov_len;
+	}
+
+	if (sender_nodeid != nodeid) {
+		sender_nodeid = nodeid;
+		node_first[nodeid] = queue_frames;
+	}
+	if (totempg_groups_mcast_joined_batch (instance, iov, msg_iov_len,
+		count, TOTEMPG_AGREED) != 0) {
+		fprintf (stderr, "batch mcast from node %u failed\n", nodeid);
+		exit (1);
+	}
+}
+
+/*
+ * Flushes the partially packed frame, as the token arriving would
+ */
+static void node_flush (void)
+{
+	mrp_token_fn (TOTEM_CALLBACK_TOKEN_RECEIVED, NULL);
+	node_last[sender_nodeid] = queue_frames;
+	sender_nodeid = 0;
+}
+
+/*
+ * Delivers one frame from each sender in turn until every queue is empty,
+ * in runs of up to BATCH_MAX frames as totemsrp does
+ */
+static void queue_drain (unsigned int nodes)
+{
+	struct totem_deliver_item items[BATCH_MAX];
+	unsigned int item_count = 0;
+	struct queued_frame *frame;
+	unsigned int nodeid;
+	int pending;
+
+	do {
+		pending = 0;
+		for (nodeid = 1; nodeid <= nodes; nodeid++) {
+			if (node_first[nodeid] == node_last[nodeid]) {
+				continue;
+			}
+			frame = &queue[node_first[nodeid]++];
+			pending = 1;
+			if (mrp_deliver_batch_fn == NULL) {
+				mrp_deliver_fn (frame->nodeid,
+					&queue_data[frame->offset], frame->len, 0);
+				continue;
+			}
+			items[item_count].nodeid = frame->nodeid;
+			items[item_count].msg = &queue_data[frame->offset];
+			items[item_count].msg_len = frame->len;
+			items[item_count].endian_conversion_required = 0;
+			if (++item_count == BATCH_MAX) {
+				mrp_deliver_batch_fn (items, item_count);
+				item_count = 0;
+			}
+		}
+	} while (pending);
+
+	if (item_count) {
+		mrp_deliver_batch_fn (items, item_count);
+	}
+
+	queue_bytes = 0;
+	queue_frames = 0;
+}
+
+/*
+ * Delivers the compression caps totempg sent for the new ring as if every
+ * member had sent them, which switches compression on
+ */
+static void caps_replay (unsigned int nodes)
+{
+	struct queued_frame *frame;
+	unsigned int nodeid;
+
+	mrp_token_fn (TOTEM_CALLBACK_TOKEN_RECEIVED, NULL);
+	if (queue_frames == 0) {
+		return;
+	}
+	frame = &queue[queue_frames - 1];
+	for (nodeid = 1; nodeid <= nodes; nodeid++) {
+		mrp_deliver_fn (nodeid, &queue_data[frame->offset],
+			frame->len, 0);
+	}
+	queue_bytes = 0;
+	queue_frames = 0;
+}
+
+static void rss_print (const char *stage)
+{
+	unsigned long size, resident;
+	long page_size = sysconf (_SC_PAGESIZE);
+	FILE *fp;
+
+	fp = fopen ("/proc/self/statm", "r");
+	if (fp == NULL) {
+		return;
+	}
+	if (fscanf (fp, "%lu %lu", &size, &resident) == 2) {
+		printf ("%-28s vsz %8lu KiB rss %8lu KiB\n", stage,
+			size * page_size / 1024,
+			resident * page_size / 1024);
+	}
+	fclose (fp);
+}
+
+int main (int argc, char *argv[])
+{
+	struct totem_config totem_config;
+	struct totempg_group group;
+	totempg_stats_t *stats;
+	unsigned int *member_list;
+	unsigned int nodes = NODES_DEFAULT;
+	unsigned int nodeid;
+	unsigned long long compress_rx_msgs;
+	void *instance;
+	int i;
+
+	if (argc > 1) {
+		nodes = atoi (argv[1]);
+		if (nodes < 2) {
+			nodes = 2;
+		}
+		if (nodes > NODES_MAX) {
+			nodes = NODES_MAX;
+		}
+	}
+
+	member_list = malloc (nodes * sizeof (unsigned int));
+	if (member_list == NULL) {
+		return (1);
+	}
+	for (nodeid = 1; nodeid <= nodes; nodeid++) {
+		member_list[nodeid - 1] = nodeid;
+	}
+
+	memset (&totem_config, 0, sizeof (totem_config));
+	totem_config.net_mtu = 1500;
+	totem_config.totem_logging_configuration.log_printf = log_printf_stub;
+#ifdef HAVE_LZ4
+	totem_config.compress_type = TOTEM_COMPRESS_LZ4;
+	totem_config.compress_threshold = 2048;
+#endif
+
+	memset (queue_data, 0, sizeof (queue_data));
+	memset (queue, 0, sizeof (queue));
+	rss_print ("start");
+
+	totempg_initialize (NULL, &totem_config);
+	totempg_groups_initialize (&instance, deliver_fn, confchg_fn);
+	totempg_groups_deliver_batch_end_register (instance,
+		deliver_batch_end_fn);
+	group.group = "rss";
+	group.group_len = 3;
+	totempg_groups_join (instance, &group, 1);
+
+	/*
+	 * Joining twice and leaving once keeps the group joined
+	 */
+	totempg_groups_join (instance, &group, 1);
+	totempg_groups_leave (instance, &group, 1);
+
+	ring_id.seq = 4;
+	mrp_confchg_fn (TOTEM_CONFIGURATION_REGULAR, member_list, nodes,
+		NULL, 0, member_list, nodes, &ring_id);
+	caps_replay (nodes);
+
+	rss_print ("initialized");
+
+	for (nodeid = 1; nodeid <= nodes; nodeid++) {
+		for (i = 0; i < SMALL_MSG_COUNT; i++) {
+			node_send (instance, nodeid, SMALL_MSG_SIZE);
+		}
+		node_flush ();
+	}
+	queue_drain (nodes);
+	rss_print ("small messages");
+
+	for (nodeid = 1; nodeid <= nodes; nodeid += 4) {
+		node_send (instance, nodeid, LARGE_MSG_SIZE);
+		node_flush ();
+	}
+	queue_drain (nodes);
+	rss_print ("fragmented messages");
+
+	for (nodeid = 1; nodeid <= nodes; nodeid++) {
+		node_send (instance, nodeid, SMALL_MSG_SIZE);
+		node_send (instance, nodeid, LARGE_MSG_SIZE);
+		node_send (instance, nodeid, SMALL_MSG_SIZE);
+		node_flush ();
+	}
+	queue_drain (nodes);
+	rss_print ("mixed messages");
+
+	for (nodeid = 1; nodeid <= nodes; nodeid += 2) {
+		node_send_batch (instance, nodeid, BATCH_SEND_MAX);
+		node_flush ();
+	}
+	queue_drain (nodes);
+	rss_print ("batched messages");
+
+	/*
+	 * Messages still queued when the ring changes go out uncompressed
+	 */
+	stats = totempg_get_stats ();
+	compress_rx_msgs = stats->compress_rx_msgs;
+	node_send (instance, 1, SMALL_MSG_SIZE);
+	node_send (instance, 1, LARGE_MSG_SIZE);
+	node_send (instance, 1, SMALL_MSG_SIZE);
+	ring_id.seq += 4;
+	mrp_confchg_fn (TOTEM_CONFIGURATION_REGULAR, member_list, nodes,
+		NULL, 0, NULL, 0, &ring_id);
+	node_flush ();
+	queue_drain (nodes);
+	if (stats->compress_rx_msgs != compress_rx_msgs) {
+		fprintf (stderr, "compressed message sent into a new ring\n");
+		delivered_bad += 1;
+	}
+	rss_print ("ring change");
+
+	ring_id.seq += 4;
+	mrp_confchg_fn (TOTEM_CONFIGURATION_REGULAR, member_list, 1,
+		&member_list[1], nodes - 1, NULL, 0, &ring_id);
+	rss_print ("nodes left");
+
+	printf ("%u nodes: sent %llu msgs %llu bytes, "
+		"delivered %llu msgs %llu bytes, %llu corrupt\n",
+		nodes, sent_msgs, sent_bytes,
+		delivered_msgs, delivered_bytes, delivered_bad);
+	printf ("%llu delivery batches\n", batch_ends);
+	stats = totempg_get_stats ();
+	if (stats->compress_tx_msgs) {
+		printf ("%llu msgs compressed, ratio %u.%02u, %llu us to compress, "
+			"%llu us to decompress\n",
+			(unsigned long long)stats->compress_tx_msgs,
+			stats->compress_ratio / 100, stats->compress_ratio % 100,
+			(unsigned long long)stats->compress_tx_cpu_ns / 1000,
+			(unsigned long long)stats->compress_rx_cpu_ns / 1000);
+	}
+
+	totempg_finalize ();
+	free (member_list);
+
+	if (delivered_msgs != sent_msgs || delivered_bytes != sent_bytes ||
+		delivered_bad != 0) {
+		return (1);
+	}
+	return (0);
+}
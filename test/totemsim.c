@@ -0,0 +1,1446 @@
+/*
+ * Copyright (c) 2012 Red Hat, Inc.
+ *
+ * All rights reserved.
+ *
+ * This software licensed under BSD license, the text of which follows:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * - Neither the name of the MontaVista Software, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Runs many totemsrp instances in one process on top of a simulated
+ * network and a virtual clock, to measure membership convergence, token
+ * rotation and ordered throughput of large rings without a lab.
+ *
+ * The totemrrp interface is replaced by a network that delivers every
+ * frame after a configurable latency and jitter (jitter reorders frames),
+ * drops frames at a configurable rate, can give every node a receive
+ * buffer that overflows when frames arrive faster than the node takes
+ * them, and can split the nodes into two
+ * partitions and heal them again.  The multicasts to one node can be
+ * dropped for a while to measure how long retransmission takes to recover
+ * the burst loss.
+ * The qb_loop timers and
+ * qb_util_nano_current_get used by totemsrp are replaced by a virtual
+ * clock that jumps from event to event, so runs are deterministic for a
+ * given seed and take as long as the work, not as long as the timeouts.
+ *
+ * totempg and totemmrp keep their state in globals, so only totemsrp is
+ * instantiated per node.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <syslog.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+
+#include <qb/qbdefs.h>
+#include <qb/qbloop.h>
+#include <qb/qbutil.h>
+
+#include <corosync/totem/totem.h>
+#include <corosync/totem/totemip.h>
+
+#include "totemrrp.h"
+#include "totemsrp.h"
+#include "totemhist.h"
+
+#ifndef timersub
+#define timersub(a, b, result)						\
+	do {								\
+		(result)->tv_sec = (a)->tv_sec - (b)->tv_sec;		\
+		(result)->tv_usec = (a)->tv_usec - (b)->tv_usec;	\
+		if ((result)->tv_usec < 0) {				\
+			--(result)->tv_sec;				\
+			(result)->tv_usec += 1000000;			\
+		}							\
+	} while (0)
+#endif /* timersub */
+
+#define SIM_NODES_DEFAULT		16
+#define SIM_LATENCY_DEFAULT		100		/* us */
+#define SIM_RATE_DEFAULT		100		/* msgs/s per node */
+#define SIM_MSG_SIZE_DEFAULT		100		/* bytes */
+#define SIM_DURATION_DEFAULT		10		/* s */
+#define SIM_START_SPREAD		10		/* ms */
+#define SIM_CONVERGE_TIMEOUT		120		/* s */
+#define SIM_TIMERS_MAX			(PROCESSOR_COUNT_MAX * 16)
+
+/*
+ * Frame header fields of totemsrp.c the network looks at
+ */
+#define SIM_MESSAGE_TYPE_MCAST		1
+#define SIM_MESSAGE_TYPE_MEMB_JOIN	3
+#define SIM_TOKEN_FORMAT_RTR_ITEMS	0
+
+enum sim_event_type {
+	SIM_EVENT_TIMER,
+	SIM_EVENT_PACKET,
+	SIM_EVENT_IFACE_UP,
+	SIM_EVENT_SEND,
+	SIM_EVENT_PARTITION,
+	SIM_EVENT_HEAL,
+	SIM_EVENT_BURST,
+	SIM_EVENT_BURST_END
+};
+
+struct sim_event {
+	uint64_t time;
+	uint64_t seq;
+	enum sim_event_type type;
+	struct sim_node *node;
+	void *data;
+	qb_loop_timer_dispatch_fn timer_fn;
+	unsigned int timer_slot;
+	int is_mcast;
+	unsigned int msg_len;
+	unsigned char msg[0];
+};
+
+struct sim_timer {
+	struct sim_event *event;
+	uint32_t generation;
+	unsigned int next_free;
+};
+
+struct sim_node {
+	unsigned int index;
+	struct totem_config totem_config;
+	struct totem_interface interface;
+	struct totem_ip_address addr;
+	totemmrp_stats_t mrp_stats;
+	void *srp_context;
+
+	/*
+	 * Registered by totemsrp through totemrrp_initialize
+	 */
+	void *rrp_context;
+	void (*deliver_fn) (
+		void *context,
+		const void *msg,
+		unsigned int msg_len);
+	void (*iface_change_fn) (
+		void *context,
+		const struct totem_ip_address *iface_addr,
+		unsigned int iface_no);
+	void (*target_set_completed) (void *context);
+
+	struct sim_node *token_target;
+	unsigned int mcasts_pending;
+	int iface_up;
+	uint64_t rx_free;
+	int partition;
+
+	/*
+	 * Measurements
+	 */
+	unsigned int members;
+	unsigned int member_list[PROCESSOR_COUNT_MAX];
+	unsigned long long ring_seq;
+	unsigned long long converge_ring_seq;
+	uint64_t gather_entered;
+	uint64_t operational_entered;
+	uint64_t orf_token_rx;
+	uint64_t gather_time;
+	uint64_t token_time;
+	int in_gather;
+	uint64_t delivered;
+};
+
+struct sim_stat {
+	uint64_t count;
+	uint64_t total;
+	uint64_t max;
+};
+
+static struct sim_node *nodes;
+
+static unsigned int node_count = SIM_NODES_DEFAULT;
+
+static struct sim_node *sim_current;
+
+static uint64_t sim_now;
+
+static uint64_t sim_event_seq;
+
+static struct sim_event **heap;
+
+static unsigned int heap_entries;
+
+static unsigned int heap_size;
+
+static struct sim_timer timers[SIM_TIMERS_MAX];
+
+static unsigned int timers_free;
+
+static uint64_t rand_state = 1;
+
+static uint64_t latency_ns = SIM_LATENCY_DEFAULT * 1000ULL;
+
+static uint64_t jitter_ns;
+
+static double loss_rate;
+
+/*
+ * Receive capacity of a node, 0 for unlimited.  A frame waits until the
+ * node took the frames before it and is dropped when rx_buffer frames
+ * are already waiting, like a full socket receive buffer.
+ */
+static uint64_t rx_frame_ns;
+
+static unsigned int rx_buffer = 100;
+
+static uint64_t rx_overflows;
+
+static unsigned int send_rate = SIM_RATE_DEFAULT;
+
+static unsigned int msg_size = SIM_MSG_SIZE_DEFAULT;
+
+static int verbose;
+
+static int traffic;
+
+static uint64_t converge_start;
+
+static const char *converge_pending;
+
+static int converge_failed;
+
+static struct sim_stat gather_stat;
+
+static struct sim_stat rotation_stat;
+
+static struct sim_stat latency_stat;
+
+static uint64_t events_dispatched;
+
+static uint64_t packets_dropped;
+
+static uint64_t msgs_sent;
+
+/*
+ * Burst loss: while burst_active every multicast sent to burst_node is
+ * dropped, retransmissions included.  The ids of the messages lost that
+ * way are kept until burst_node delivers them and the recovery is timed
+ * from the end of the burst.
+ */
+static struct sim_node *burst_node;
+
+static int burst_active;
+
+static int burst_pending;
+
+static uint64_t *burst_ids;
+
+static unsigned int burst_ids_entries;
+
+static unsigned int burst_ids_size;
+
+static unsigned int burst_lost;
+
+static unsigned char *burst_delivered;
+
+static uint64_t burst_delivered_size;
+
+static uint64_t burst_end;
+
+static uint64_t burst_orf_token_rx;
+
+static int rtr_items;
+
+static int adaptive_window;
+
+static unsigned int window_size = 50;
+
+static unsigned int window_size_min = 10;
+
+static unsigned int window_size_max = 300;
+
+static char rundir[64];
+
+static void sim_stat_add (struct sim_stat *stat, uint64_t value)
+{
+	stat->count += 1;
+	stat->total += value;
+	if (value > stat->max) {
+		stat->max = value;
+	}
+}
+
+static void sim_stat_print (const char *name, const struct sim_stat *stat)
+{
+	if (stat->count == 0) {
+		printf ("%-28s no samples\n", name);
+		return;
+	}
+	printf ("%-28s avg %10.3f ms max %10.3f ms (%llu samples)\n", name,
+		(double)stat->total / stat->count / 1000000.0,
+		(double)stat->max / 1000000.0,
+		(unsigned long long)stat->count);
+}
+
+static void sim_histogram_print (const char *name, const totem_histogram_t *hist)
+{
+	if (hist->count == 0) {
+		printf ("%-28s no samples\n", name);
+		return;
+	}
+	printf ("%-28s p50 %8llu us p99 %8llu us max %8llu us\n", name,
+		(unsigned long long)totem_histogram_percentile (hist, 500),
+		(unsigned long long)totem_histogram_percentile (hist, 990),
+		(unsigned long long)hist->max);
+}
+
+/*
+ * xorshift64*, so runs only depend on the seed
+ */
+static uint64_t sim_random (void)
+{
+	rand_state ^= rand_state >> 12;
+	rand_state ^= rand_state << 25;
+	rand_state ^= rand_state >> 27;
+	return (rand_state * 2685821657736338717ULL);
+}
+
+static int sim_event_before (const struct sim_event *a, const struct sim_event *b)
+{
+	if (a->time != b->time) {
+		return (a->time < b->time);
+	}
+	return (a->seq < b->seq);
+}
+
+static void sim_event_schedule (struct sim_event *event, uint64_t time)
+{
+	struct sim_event *tmp;
+	unsigned int i;
+
+	event->time = time;
+	event->seq = sim_event_seq++;
+
+	if (heap_entries == heap_size) {
+		heap_size = heap_size ? heap_size * 2 : 1024;
+		heap = realloc (heap, heap_size * sizeof (struct sim_event *));
+		if (heap == NULL) {
+			fprintf (stderr, "out of memory\n");
+			exit (1);
+		}
+	}
+	i = heap_entries++;
+	heap[i] = event;
+	while (i > 0 && sim_event_before (heap[i], heap[(i - 1) / 2])) {
+		tmp = heap[i];
+		heap[i] = heap[(i - 1) / 2];
+		heap[(i - 1) / 2] = tmp;
+		i = (i - 1) / 2;
+	}
+}
+
+static struct sim_event *sim_event_next (void)
+{
+	struct sim_event *event;
+	struct sim_event *tmp;
+	unsigned int i = 0;
+	unsigned int child;
+
+	if (heap_entries == 0) {
+		return (NULL);
+	}
+	event = heap[0];
+	heap[0] = heap[--heap_entries];
+	for (;;) {
+		child = i * 2 + 1;
+		if (child >= heap_entries) {
+			break;
+		}
+		if (child + 1 < heap_entries &&
+			sim_event_before (heap[child + 1], heap[child])) {
+			child += 1;
+		}
+		if (sim_event_before (heap[i], heap[child])) {
+			break;
+		}
+		tmp = heap[i];
+		heap[i] = heap[child];
+		heap[child] = tmp;
+		i = child;
+	}
+	return (event);
+}
+
+static struct sim_event *sim_event_create (
+	enum sim_event_type type,
+	struct sim_node *node,
+	unsigned int msg_len)
+{
+	struct sim_event *event;
+
+	event = malloc (sizeof (struct sim_event) + msg_len);
+	if (event == NULL) {
+		fprintf (stderr, "out of memory\n");
+		exit (1);
+	}
+	memset (event, 0, sizeof (struct sim_event));
+	event->type = type;
+	event->node = node;
+	event->msg_len = msg_len;
+	return (event);
+}
+
+/*
+ * Virtual clock used by totemsrp in place of the qb_loop timers
+ */
+uint64_t qb_util_nano_current_get (void)
+{
+	return (sim_now);
+}
+
+int32_t qb_loop_timer_add (
+	qb_loop_t *l,
+	enum qb_loop_priority p,
+	uint64_t nsec_duration,
+	void *data,
+	qb_loop_timer_dispatch_fn dispatch_fn,
+	qb_loop_timer_handle *timer_handle_out)
+{
+	struct sim_event *event;
+	unsigned int slot;
+
+	if (timers_free == 0) {
+		fprintf (stderr, "out of simulated timers\n");
+		exit (1);
+	}
+	slot = timers_free;
+	timers_free = timers[slot].next_free;
+
+	event = sim_event_create (SIM_EVENT_TIMER, sim_current, 0);
+	event->data = data;
+	event->timer_fn = dispatch_fn;
+	event->timer_slot = slot;
+	timers[slot].event = event;
+	timers[slot].generation += 1;
+
+	sim_event_schedule (event, sim_now + nsec_duration);
+
+	if (timer_handle_out) {
+		*timer_handle_out =
+			((uint64_t)timers[slot].generation << 32) | slot;
+	}
+	return (0);
+}
+
+static void sim_timer_release (unsigned int slot)
+{
+	timers[slot].event = NULL;
+	timers[slot].generation += 1;
+	timers[slot].next_free = timers_free;
+	timers_free = slot;
+}
+
+int32_t qb_loop_timer_del (qb_loop_t *l, qb_loop_timer_handle th)
+{
+	unsigned int slot = th & 0xffffffff;
+
+	if (slot == 0 || slot >= SIM_TIMERS_MAX ||
+		timers[slot].generation != (th >> 32) ||
+		timers[slot].event == NULL) {
+
+		return (-EINVAL);
+	}
+	/*
+	 * The event stays queued and is freed when it comes up
+	 */
+	timers[slot].event->timer_fn = NULL;
+	sim_timer_release (slot);
+	return (0);
+}
+
+/*
+ * Burst loss bookkeeping.  Messages carry their send time and a unique
+ * id, the frame ends with the message.
+ */
+static uint64_t sim_msg_id (const unsigned char *msg)
+{
+	uint64_t id;
+
+	memcpy (&id, msg + sizeof (uint64_t), sizeof (uint64_t));
+	return (id);
+}
+
+static int sim_burst_drop (const void *msg, unsigned int msg_len)
+{
+	const unsigned char *frame = msg;
+	uint64_t id;
+	unsigned int i;
+
+	if (frame[0] != SIM_MESSAGE_TYPE_MCAST || msg_len < msg_size) {
+		return (0);
+	}
+
+	id = sim_msg_id (frame + msg_len - msg_size);
+	if (burst_delivered[id]) {
+		return (1);
+	}
+	for (i = 0; i < burst_ids_entries; i++) {
+		if (burst_ids[i] == id) {
+			return (1);
+		}
+	}
+	if (burst_ids_entries == burst_ids_size) {
+		burst_ids_size = burst_ids_size ? burst_ids_size * 2 : 1024;
+		burst_ids = realloc (burst_ids, burst_ids_size * sizeof (uint64_t));
+		if (burst_ids == NULL) {
+			fprintf (stderr, "out of memory\n");
+			exit (1);
+		}
+	}
+	burst_ids[burst_ids_entries++] = id;
+	burst_lost += 1;
+	return (1);
+}
+
+static void sim_burst_recovered_check (void)
+{
+	if (burst_pending == 0 || burst_active || burst_ids_entries) {
+		return;
+	}
+	printf ("%-28s %14.3f ms (%u msgs, %llu tokens)\n",
+		"burst loss recovered in",
+		(double)(sim_now - burst_end) / 1000000.0, burst_lost,
+		(unsigned long long)(burst_node->mrp_stats.srp->orf_token_rx -
+			burst_orf_token_rx));
+	burst_pending = 0;
+}
+
+static void sim_burst_delivered (uint64_t id)
+{
+	unsigned int i;
+
+	burst_delivered[id] = 1;
+	for (i = 0; i < burst_ids_entries; i++) {
+		if (burst_ids[i] == id) {
+			burst_ids[i] = burst_ids[--burst_ids_entries];
+			break;
+		}
+	}
+	sim_burst_recovered_check ();
+}
+
+/*
+ * Simulated network
+ */
+static void sim_packet_send (
+	struct sim_node *from,
+	struct sim_node *to,
+	const void *msg,
+	unsigned int msg_len,
+	int is_mcast)
+{
+	struct sim_event *event;
+	uint64_t delay;
+
+	if (from->partition != to->partition) {
+		packets_dropped += 1;
+		return;
+	}
+	if (burst_active && to == burst_node && is_mcast &&
+		sim_burst_drop (msg, msg_len)) {
+
+		packets_dropped += 1;
+		return;
+	}
+	if (loss_rate > 0.0 &&
+		(sim_random () >> 11) * (1.0 / 9007199254740992.0) < loss_rate) {
+		packets_dropped += 1;
+		return;
+	}
+
+	delay = latency_ns;
+	if (jitter_ns) {
+		delay += sim_random () % jitter_ns;
+	}
+	if (rx_frame_ns) {
+		if (to->rx_free < sim_now + delay) {
+			to->rx_free = sim_now + delay;
+		}
+		if (to->rx_free - (sim_now + delay) >= rx_buffer * rx_frame_ns) {
+			packets_dropped += 1;
+			rx_overflows += 1;
+			return;
+		}
+		to->rx_free += rx_frame_ns;
+		delay = to->rx_free - sim_now;
+	}
+
+	event = sim_event_create (SIM_EVENT_PACKET, to, msg_len);
+	event->is_mcast = is_mcast;
+	memcpy (event->msg, msg, msg_len);
+	/*
+	 * Joins advertise the retransmit list formats the sender knows,
+	 * advertising only the per message list makes the ring use it
+	 */
+	if (rtr_items && event->msg[0] == SIM_MESSAGE_TYPE_MEMB_JOIN) {
+		event->msg[1] = SIM_TOKEN_FORMAT_RTR_ITEMS;
+	}
+	if (is_mcast) {
+		to->mcasts_pending += 1;
+	}
+	sim_event_schedule (event, sim_now + delay);
+}
+
+static void sim_mcast_send (
+	struct sim_node *from,
+	const void *msg,
+	unsigned int msg_len)
+{
+	unsigned int i;
+
+	for (i = 0; i < node_count; i++) {
+		sim_packet_send (from, &nodes[i], msg, msg_len, 1);
+	}
+}
+
+static struct sim_node *sim_node_find_id (unsigned int nodeid)
+{
+	if (nodeid == 0 || nodeid > node_count) {
+		return (NULL);
+	}
+	return (&nodes[nodeid - 1]);
+}
+
+static struct sim_node *sim_node_find (const struct totem_ip_address *addr)
+{
+	return (sim_node_find_id (addr->nodeid));
+}
+
+/*
+ * totemrrp interface used by totemsrp
+ */
+int totemrrp_initialize (
+	qb_loop_t *poll_handle,
+	void **rrp_context,
+	struct totem_config *totem_config,
+	totemsrp_stats_t *stats,
+	void *context,
+	void (*deliver_fn) (
+		void *context,
+		const void *msg,
+		unsigned int msg_len),
+	void (*iface_change_fn) (
+		void *context,
+		const struct totem_ip_address *iface_addr,
+		unsigned int iface_no),
+	void (*token_seqid_get) (
+		const void *msg,
+		unsigned int *seqid,
+		unsigned int *token_is),
+	unsigned int (*msgs_missing) (void),
+	void (*target_set_completed) (
+		void *context))
+{
+	struct sim_node *node = sim_current;
+	struct sim_event *event;
+
+	node->rrp_context = context;
+	node->deliver_fn = deliver_fn;
+	node->iface_change_fn = iface_change_fn;
+	node->target_set_completed = target_set_completed;
+	*rrp_context = node;
+
+	/*
+	 * Interfaces come up shortly after start, as they do with totemudp
+	 */
+	event = sim_event_create (SIM_EVENT_IFACE_UP, node, 0);
+	sim_event_schedule (event, sim_now +
+		sim_random () % (SIM_START_SPREAD * QB_TIME_NS_IN_MSEC));
+	return (0);
+}
+
+void *totemrrp_buffer_alloc (void *rrp_context, size_t size)
+{
+	return (malloc (size));
+}
+
+void totemrrp_buffer_release (void *rrp_context, void *ptr)
+{
+	free (ptr);
+}
+
+int totemrrp_processor_count_set (
+	void *rrp_context,
+	unsigned int processor_count)
+{
+	return (0);
+}
+
+int totemrrp_token_send (
+	void *rrp_context,
+	const void *msg,
+	unsigned int msg_len)
+{
+	struct sim_node *node = rrp_context;
+
+	if (node->token_target) {
+		sim_packet_send (node, node->token_target, msg, msg_len, 0);
+	}
+	return (0);
+}
+
+int totemrrp_mcast_noflush_send (
+	void *rrp_context,
+	const void *msg,
+	unsigned int msg_len)
+{
+	sim_mcast_send (rrp_context, msg, msg_len);
+	return (0);
+}
+
+int totemrrp_mcast_flush_send (
+	void *rrp_context,
+	const void *msg,
+	unsigned int msg_len)
+{
+	sim_mcast_send (rrp_context, msg, msg_len);
+	return (0);
+}
+
+int totemrrp_recv_flush (void *rrp_context)
+{
+	return (0);
+}
+
+int totemrrp_send_flush (void *rrp_context)
+{
+	return (0);
+}
+
+int totemrrp_token_target_set (
+	void *rrp_context,
+	struct totem_ip_address *target,
+	unsigned int iface_no)
+{
+	struct sim_node *node = rrp_context;
+
+	node->token_target = sim_node_find (target);
+	node->target_set_completed (node->rrp_context);
+	return (0);
+}
+
+int totemrrp_iface_check (void *rrp_context)
+{
+	return (0);
+}
+
+int totemrrp_finalize (void *rrp_context)
+{
+	return (0);
+}
+
+int totemrrp_ifaces_get (
+	void *rrp_context,
+	char ***status,
+	unsigned int *iface_count)
+{
+	static char *iface_status[] = { "ring 0 active with no faults" };
+
+	*status = iface_status;
+	*iface_count = 1;
+	return (0);
+}
+
+int totemrrp_crypto_set (void *rrp_context, unsigned int type)
+{
+	return (0);
+}
+
+int totemrrp_ring_reenable (void *rrp_context, unsigned int iface_no)
+{
+	return (0);
+}
+
+int totemrrp_mcast_recv_empty (void *rrp_context)
+{
+	struct sim_node *node = rrp_context;
+
+	return (node->mcasts_pending == 0);
+}
+
+int totemrrp_member_add (
+	void *net_context,
+	const struct totem_ip_address *member,
+	int iface_no)
+{
+	return (0);
+}
+
+int totemrrp_member_remove (
+	void *net_context,
+	const struct totem_ip_address *member,
+	int iface_no)
+{
+	return (0);
+}
+
+/*
+ * Callbacks from totemsrp, always on behalf of sim_current
+ */
+static void sim_log_printf (
+	int level,
+	int subsys,
+	const char *function_name,
+	const char *file_name,
+	int file_line,
+	const char *format,
+	...)
+{
+	va_list ap;
+
+	if (verbose == 0 || (verbose == 1 && level > LOG_NOTICE)) {
+		return;
+	}
+	printf ("%12.6f node %u: ", (double)sim_now / 1000000000.0,
+		sim_current ? sim_current->index + 1 : 0);
+	va_start (ap, format);
+	vprintf (format, ap);
+	va_end (ap);
+}
+
+/*
+ * Converged once every node installed a ring newer than the one it had
+ * when the change started, made of exactly the nodes of its partition
+ */
+static void sim_converge_check (void)
+{
+	unsigned int partition_size[2] = { 0, 0 };
+	struct sim_node *node;
+	struct sim_node *member;
+	unsigned int i;
+	unsigned int j;
+
+	if (converge_pending == NULL) {
+		return;
+	}
+	for (i = 0; i < node_count; i++) {
+		partition_size[nodes[i].partition] += 1;
+	}
+	for (i = 0; i < node_count; i++) {
+		node = &nodes[i];
+		if (node->ring_seq <= node->converge_ring_seq ||
+			node->members != partition_size[node->partition]) {
+
+			return;
+		}
+		for (j = 0; j < node->members; j++) {
+			member = sim_node_find_id (node->member_list[j]);
+			if (member == NULL ||
+				member->partition != node->partition) {
+
+				return;
+			}
+		}
+	}
+	printf ("%-28s %14.3f ms\n", converge_pending,
+		(double)(sim_now - converge_start) / 1000000.0);
+	converge_pending = NULL;
+}
+
+static void sim_confchg_fn (
+	enum totem_configuration_type configuration_type,
+	const unsigned int *member_list, size_t member_list_entries,
+	const unsigned int *left_list, size_t left_list_entries,
+	const unsigned int *joined_list, size_t joined_list_entries,
+	const struct memb_ring_id *ring_id)
+{
+	if (configuration_type != TOTEM_CONFIGURATION_REGULAR) {
+		return;
+	}
+	sim_current->members = member_list_entries;
+	memcpy (sim_current->member_list, member_list,
+		member_list_entries * sizeof (unsigned int));
+	sim_current->ring_seq = ring_id->seq;
+	sim_converge_check ();
+}
+
+static void sim_deliver_fn (
+	unsigned int nodeid,
+	const void *msg,
+	unsigned int msg_len,
+	int endian_conversion_required)
+{
+	uint64_t sent;
+
+	sim_current->delivered += 1;
+	if (msg_len >= sizeof (uint64_t)) {
+		memcpy (&sent, msg, sizeof (uint64_t));
+		sim_stat_add (&latency_stat, sim_now - sent);
+	}
+	if (sim_current == burst_node && msg_len == msg_size) {
+		sim_burst_delivered (sim_msg_id (msg));
+	}
+}
+
+/*
+ * Runs of messages arrive the way totempg gets them
+ */
+static void sim_deliver_batch_fn (
+	const struct totem_deliver_item *items,
+	unsigned int item_count)
+{
+	unsigned int i;
+
+	for (i = 0; i < item_count; i++) {
+		sim_deliver_fn (items[i].nodeid, items[i].msg, items[i].msg_len,
+			items[i].endian_conversion_required);
+	}
+}
+
+/*
+ * Samples the totemsrp counters of a node after it handled an event
+ */
+static void sim_node_sample (struct sim_node *node)
+{
+	totemsrp_stats_t *srp = node->mrp_stats.srp;
+
+	if (srp->gather_entered != node->gather_entered) {
+		node->gather_entered = srp->gather_entered;
+		if (node->in_gather == 0) {
+			node->in_gather = 1;
+			node->gather_time = sim_now;
+		}
+		node->token_time = 0;
+	}
+	if (srp->operational_entered != node->operational_entered) {
+		node->operational_entered = srp->operational_entered;
+		if (node->in_gather) {
+			sim_stat_add (&gather_stat, sim_now - node->gather_time);
+			node->in_gather = 0;
+		}
+		node->token_time = 0;
+	}
+	if (srp->orf_token_rx != node->orf_token_rx) {
+		node->orf_token_rx = srp->orf_token_rx;
+		if (traffic && node->index == 0 && node->token_time) {
+			sim_stat_add (&rotation_stat, sim_now - node->token_time);
+		}
+		node->token_time = sim_now;
+	}
+}
+
+static void sim_node_send (struct sim_node *node)
+{
+	unsigned char msg[FRAME_SIZE_MAX];
+	struct iovec iov;
+	uint64_t size;
+
+	if (totemsrp_avail (node->srp_context) == 0) {
+		return;
+	}
+	memset (msg, 0, msg_size);
+	memcpy (msg, &sim_now, sizeof (uint64_t));
+	memcpy (msg + sizeof (uint64_t), &msgs_sent, sizeof (uint64_t));
+	if (burst_node && msgs_sent >= burst_delivered_size) {
+		size = burst_delivered_size ? burst_delivered_size * 2 : 65536;
+		burst_delivered = realloc (burst_delivered, size);
+		if (burst_delivered == NULL) {
+			fprintf (stderr, "out of memory\n");
+			exit (1);
+		}
+		memset (burst_delivered + burst_delivered_size, 0,
+			size - burst_delivered_size);
+		burst_delivered_size = size;
+	}
+	msgs_sent += 1;
+	iov.iov_base = msg;
+	iov.iov_len = msg_size;
+	totemsrp_mcast (node->srp_context, &iov, 1, 0);
+}
+
+static void sim_converge_start (const char *what)
+{
+	unsigned int i;
+
+	if (converge_pending) {
+		printf ("%-28s    did not converge\n", converge_pending);
+		converge_failed = 1;
+	}
+	for (i = 0; i < node_count; i++) {
+		nodes[i].converge_ring_seq = nodes[i].ring_seq;
+	}
+	converge_start = sim_now;
+	converge_pending = what;
+}
+
+static void sim_partition (unsigned int partition_size, const char *what)
+{
+	unsigned int i;
+
+	for (i = 0; i < node_count; i++) {
+		nodes[i].partition = (i >= partition_size);
+	}
+	sim_converge_start (what);
+	sim_converge_check ();
+}
+
+static void sim_event_dispatch (struct sim_event *event)
+{
+	struct sim_node *node = event->node;
+	struct sim_event *next;
+
+	sim_now = event->time;
+	sim_current = node;
+	events_dispatched += 1;
+
+	switch (event->type) {
+	case SIM_EVENT_TIMER:
+		if (event->timer_fn) {
+			sim_timer_release (event->timer_slot);
+			event->timer_fn (event->data);
+		}
+		break;
+	case SIM_EVENT_PACKET:
+		if (event->is_mcast) {
+			node->mcasts_pending -= 1;
+		}
+		/*
+		 * Like totemudp, nothing is received before the interface is up
+		 */
+		if (node->iface_up) {
+			node->deliver_fn (node->rrp_context,
+				event->msg, event->msg_len);
+		}
+		break;
+	case SIM_EVENT_IFACE_UP:
+		node->iface_up = 1;
+		node->iface_change_fn (node->rrp_context, &node->addr, 0);
+		break;
+	case SIM_EVENT_SEND:
+		sim_node_send (node);
+		next = sim_event_create (SIM_EVENT_SEND, node, 0);
+		sim_event_schedule (next, sim_now + 1000000000ULL / send_rate);
+		break;
+	case SIM_EVENT_PARTITION:
+		sim_partition (event->msg_len, "partitioned ring formed in");
+		break;
+	case SIM_EVENT_HEAL:
+		sim_partition (node_count, "merged ring formed in");
+		break;
+	case SIM_EVENT_BURST:
+		burst_active = 1;
+		burst_pending = 1;
+		break;
+	case SIM_EVENT_BURST_END:
+		burst_active = 0;
+		burst_end = sim_now;
+		burst_orf_token_rx = burst_node->mrp_stats.srp->orf_token_rx;
+		sim_burst_recovered_check ();
+		break;
+	}
+
+	if (node) {
+		sim_node_sample (node);
+	}
+	free (event);
+	sim_current = NULL;
+}
+
+/*
+ * Runs events until the virtual clock reaches end or, if stop_converged
+ * is set, until the pending convergence is reached
+ */
+static void sim_run (uint64_t end, int stop_converged)
+{
+	struct sim_event *event;
+
+	while (heap_entries && heap[0]->time <= end) {
+		if (stop_converged && converge_pending == NULL) {
+			return;
+		}
+		event = sim_event_next ();
+		sim_event_dispatch (event);
+	}
+	sim_now = end;
+}
+
+static void sim_node_init (struct sim_node *node, unsigned int index)
+{
+	struct totem_config *totem_config = &node->totem_config;
+
+	node->index = index;
+
+	node->addr.nodeid = index + 1;
+	node->addr.family = AF_INET;
+	node->addr.addr[0] = 10;
+	node->addr.addr[1] = (index + 1) >> 16;
+	node->addr.addr[2] = (index + 1) >> 8;
+	node->addr.addr[3] = index + 1;
+
+	node->interface.bindnet = node->addr;
+	node->interface.boundto = node->addr;
+	node->interface.mcast_addr.family = AF_INET;
+	node->interface.mcast_addr.addr[0] = 239;
+	node->interface.mcast_addr.addr[3] = 1;
+	node->interface.ip_port = 5405;
+
+	/*
+	 * Same defaults as totemconfig.c
+	 */
+	totem_config->interfaces = &node->interface;
+	totem_config->interface_count = 1;
+	totem_config->node_id = index + 1;
+	totem_config->token_timeout = 1000;
+	totem_config->token_retransmits_before_loss_const = 4;
+	totem_config->token_retransmit_timeout =
+		(int)(totem_config->token_timeout / (4 + 0.2));
+	totem_config->token_hold_timeout =
+		(int)(totem_config->token_retransmit_timeout * 0.8 - 10);
+	totem_config->join_timeout = 50;
+	totem_config->consensus_timeout = 1200;
+	totem_config->merge_timeout = 200;
+	totem_config->downcheck_timeout = 1000;
+	totem_config->fail_to_recv_const = 2500;
+	totem_config->seqno_unchanged_const = 30;
+	totem_config->max_network_delay = 50;
+	totem_config->window_size = window_size;
+	totem_config->max_messages = 17;
+	totem_config->adaptive_window = adaptive_window;
+	totem_config->window_size_min = window_size_min;
+	totem_config->window_size_max = window_size_max;
+	totem_config->miss_count_const = 5;
+	totem_config->net_mtu = 1500;
+	totem_config->vsf_type = "none";
+	strcpy (totem_config->rrp_mode, "none");
+
+	totem_config->totem_logging_configuration.log_printf = sim_log_printf;
+	totem_config->totem_logging_configuration.log_level_security = LOG_WARNING;
+	totem_config->totem_logging_configuration.log_level_error = LOG_ERR;
+	totem_config->totem_logging_configuration.log_level_warning = LOG_WARNING;
+	totem_config->totem_logging_configuration.log_level_notice = LOG_NOTICE;
+	totem_config->totem_logging_configuration.log_level_debug = LOG_DEBUG;
+
+	totemsrp_net_mtu_adjust (totem_config);
+
+	sim_current = node;
+	if (totemsrp_initialize (NULL, &node->srp_context, totem_config,
+		&node->mrp_stats, sim_deliver_fn, sim_confchg_fn) != 0) {
+
+		fprintf (stderr, "totemsrp_initialize failed for node %u\n",
+			index + 1);
+		exit (1);
+	}
+	totemsrp_deliver_batch_register (node->srp_context,
+		sim_deliver_batch_fn);
+	sim_current = NULL;
+}
+
+static void sim_cleanup (void)
+{
+	char filename[PATH_MAX];
+	unsigned int i;
+
+	for (i = 0; i < node_count; i++) {
+		snprintf (filename, sizeof (filename), "%s/ringid_%s",
+			rundir, totemip_print (&nodes[i].addr));
+		unlink (filename);
+	}
+	rmdir (rundir);
+}
+
+static void usage (const char *name)
+{
+	printf ("usage: %s [options]\n", name);
+	printf ("  -n nodes         number of nodes (default %d, max %d)\n",
+		SIM_NODES_DEFAULT, PROCESSOR_COUNT_MAX);
+	printf ("  -l latency       one way latency in us (default %d)\n",
+		SIM_LATENCY_DEFAULT);
+	printf ("  -j jitter        random extra latency in us, reorders frames (default 0)\n");
+	printf ("  -L loss          percentage of frames lost (default 0)\n");
+	printf ("  -c rate[:buffer] frames per second a node receives, frames beyond a\n");
+	printf ("                   buffer of 100 waiting ones are lost (default unlimited)\n");
+	printf ("  -r rate          messages sent per second per node (default %d)\n",
+		SIM_RATE_DEFAULT);
+	printf ("  -s size          message size in bytes (default %d)\n",
+		SIM_MSG_SIZE_DEFAULT);
+	printf ("  -d duration      seconds of traffic, 0 to only form the ring (default %d)\n",
+		SIM_DURATION_DEFAULT);
+	printf ("  -p time:size     at time seconds into the traffic, split off the\n");
+	printf ("                   first size nodes from the rest\n");
+	printf ("  -H time          heal the partition at time seconds into the traffic\n");
+	printf ("  -b time:length   at time seconds into the traffic, drop the multicasts\n");
+	printf ("                   to the last node for length ms\n");
+	printf ("  -R format        retransmit list format, items or ranges (default ranges)\n");
+	printf ("  -w window        flow control window (default 50)\n");
+	printf ("  -a min:max       adapt the window between min and max messages\n");
+	printf ("  -S seed          random seed (default 1)\n");
+	printf ("  -v               log totem notices, twice for debug\n");
+}
+
+int main (int argc, char *argv[])
+{
+	struct timeval tv1, tv2, tv_join, tv_elapsed;
+	struct sim_event *event;
+	unsigned int duration = SIM_DURATION_DEFAULT;
+	double partition_at = -1.0;
+	unsigned int partition_size = 0;
+	double heal_at = -1.0;
+	double burst_at = -1.0;
+	double rx_rate;
+	unsigned int burst_length = 0;
+	uint64_t traffic_start;
+	uint64_t delivered_start;
+	uint64_t delivered;
+	unsigned int i;
+	int opt;
+
+	while ((opt = getopt (argc, argv, "n:l:j:L:c:r:s:d:p:H:b:R:w:a:S:vh")) != -1) {
+		switch (opt) {
+		case 'n':
+			node_count = atoi (optarg);
+			break;
+		case 'l':
+			latency_ns = strtoull (optarg, NULL, 10) * 1000ULL;
+			break;
+		case 'j':
+			jitter_ns = strtoull (optarg, NULL, 10) * 1000ULL;
+			break;
+		case 'L':
+			loss_rate = atof (optarg) / 100.0;
+			break;
+		case 'c':
+			if (sscanf (optarg, "%lf:%u", &rx_rate, &rx_buffer) < 1 ||
+				rx_rate <= 0.0 || rx_buffer == 0) {
+				usage (argv[0]);
+				exit (1);
+			}
+			rx_frame_ns = (uint64_t)(1000000000.0 / rx_rate);
+			break;
+		case 'r':
+			send_rate = atoi (optarg);
+			break;
+		case 's':
+			msg_size = atoi (optarg);
+			break;
+		case 'd':
+			duration = atoi (optarg);
+			break;
+		case 'p':
+			if (sscanf (optarg, "%lf:%u", &partition_at,
+				&partition_size) != 2) {
+				usage (argv[0]);
+				exit (1);
+			}
+			break;
+		case 'H':
+			heal_at = atof (optarg);
+			break;
+		case 'b':
+			if (sscanf (optarg, "%lf:%u", &burst_at,
+				&burst_length) != 2 || burst_length == 0) {
+				usage (argv[0]);
+				exit (1);
+			}
+			break;
+		case 'w':
+			window_size = atoi (optarg);
+			break;
+		case 'a':
+			if (sscanf (optarg, "%u:%u", &window_size_min,
+				&window_size_max) != 2) {
+				usage (argv[0]);
+				exit (1);
+			}
+			adaptive_window = 1;
+			break;
+		case 'R':
+			if (strcmp (optarg, "items") == 0) {
+				rtr_items = 1;
+			} else if (strcmp (optarg, "ranges") == 0) {
+				rtr_items = 0;
+			} else {
+				usage (argv[0]);
+				exit (1);
+			}
+			break;
+		case 'S':
+			rand_state = strtoull (optarg, NULL, 10);
+			if (rand_state == 0) {
+				rand_state = 1;
+			}
+			break;
+		case 'v':
+			verbose++;
+			break;
+		default:
+			usage (argv[0]);
+			exit (1);
+		}
+	}
+	if (node_count < 1 || node_count > PROCESSOR_COUNT_MAX ||
+		send_rate == 0 || msg_size < 2 * sizeof (uint64_t) ||
+		msg_size > 1000 || partition_size >= node_count ||
+		window_size == 0 || window_size_min == 0 ||
+		window_size_min > window_size_max) {
+
+		usage (argv[0]);
+		exit (1);
+	}
+
+	snprintf (rundir, sizeof (rundir), "/tmp/totemsim.XXXXXX");
+	if (mkdtemp (rundir) == NULL) {
+		perror ("mkdtemp");
+		exit (1);
+	}
+	setenv ("COROSYNC_RUN_DIR", rundir, 1);
+
+	for (i = 1; i < SIM_TIMERS_MAX; i++) {
+		timers[i].next_free = i + 1 < SIM_TIMERS_MAX ? i + 1 : 0;
+	}
+	timers_free = 1;
+
+	nodes = calloc (node_count, sizeof (struct sim_node));
+	if (nodes == NULL) {
+		fprintf (stderr, "out of memory\n");
+		exit (1);
+	}
+
+	if (burst_length) {
+		burst_node = &nodes[node_count - 1];
+	}
+
+	printf ("%u nodes, latency %llu us, jitter %llu us, loss %.2f%%, "
+		"%s retransmit lists\n",
+		node_count, (unsigned long long)latency_ns / 1000,
+		(unsigned long long)jitter_ns / 1000, loss_rate * 100.0,
+		rtr_items ? "item" : "range");
+	if (adaptive_window) {
+		printf ("window adapts from %u between %u and %u messages\n",
+			window_size, window_size_min, window_size_max);
+	} else {
+		printf ("window %u messages\n", window_size);
+	}
+
+	gettimeofday (&tv1, NULL);
+
+	sim_converge_start ("initial ring formed in");
+	for (i = 0; i < node_count; i++) {
+		sim_node_init (&nodes[i], i);
+	}
+
+	sim_run (SIM_CONVERGE_TIMEOUT * 1000000000ULL, 1);
+	if (converge_pending) {
+		printf ("%u nodes did not form a ring within %d s\n",
+			node_count, SIM_CONVERGE_TIMEOUT);
+		sim_cleanup ();
+		exit (1);
+	}
+	gettimeofday (&tv2, NULL);
+	timersub (&tv2, &tv1, &tv_join);
+
+	traffic = 1;
+	traffic_start = sim_now;
+	delivered_start = nodes[0].delivered;
+	for (i = 0; i < node_count; i++) {
+		event = sim_event_create (SIM_EVENT_SEND, &nodes[i], 0);
+		sim_event_schedule (event, sim_now +
+			sim_random () % (1000000000ULL / send_rate));
+	}
+	if (partition_at >= 0.0) {
+		event = sim_event_create (SIM_EVENT_PARTITION, NULL, 0);
+		event->msg_len = partition_size;
+		sim_event_schedule (event, traffic_start +
+			(uint64_t)(partition_at * 1000000000.0));
+	}
+	if (heal_at >= 0.0) {
+		event = sim_event_create (SIM_EVENT_HEAL, NULL, 0);
+		sim_event_schedule (event, traffic_start +
+			(uint64_t)(heal_at * 1000000000.0));
+	}
+	if (burst_length) {
+		event = sim_event_create (SIM_EVENT_BURST, NULL, 0);
+		sim_event_schedule (event, traffic_start +
+			(uint64_t)(burst_at * 1000000000.0));
+		event = sim_event_create (SIM_EVENT_BURST_END, NULL, 0);
+		sim_event_schedule (event, traffic_start +
+			(uint64_t)(burst_at * 1000000000.0) +
+			burst_length * QB_TIME_NS_IN_MSEC);
+	}
+
+	sim_run (traffic_start + duration * 1000000000ULL, 0);
+	gettimeofday (&tv2, NULL);
+	timersub (&tv2, &tv1, &tv_elapsed);
+
+	if (converge_pending) {
+		printf ("%-28s    did not converge\n", converge_pending);
+		converge_failed = 1;
+	}
+	if (burst_pending) {
+		printf ("%-28s    did not recover\n", "burst loss");
+		converge_failed = 1;
+	}
+	sim_stat_print ("gather to operational", &gather_stat);
+	sim_stat_print ("token rotation (node 1)", &rotation_stat);
+	sim_stat_print ("delivery latency", &latency_stat);
+	sim_histogram_print ("srp rotation hist (node 1)",
+		&nodes[0].mrp_stats.srp->token_rotation_hist);
+	sim_histogram_print ("srp hold hist (node 1)",
+		&nodes[0].mrp_stats.srp->token_hold_hist);
+	sim_histogram_print ("srp mcast hist (node 1)",
+		&nodes[0].mrp_stats.srp->mcast_deliver_hist);
+	sim_histogram_print ("srp recv hist (node 1)",
+		&nodes[0].mrp_stats.srp->recv_deliver_hist);
+
+	delivered = nodes[0].delivered - delivered_start;
+	if (duration > 0) {
+		printf ("%-28s %14.0f msgs/s (%u bytes)\n", "delivered (node 1)",
+			(double)delivered / duration, msg_size);
+		printf ("%-28s %14.0f msgs/s\n", "offered",
+			(double)send_rate * node_count);
+	}
+	printf ("%-28s %14u (%llu increases, %llu decreases)\n",
+		"window (node 1)", nodes[0].mrp_stats.srp->fcc_window,
+		(unsigned long long)nodes[0].mrp_stats.srp->fcc_window_increases,
+		(unsigned long long)nodes[0].mrp_stats.srp->fcc_window_decreases);
+	printf ("%-28s %14llu (%llu frames dropped, %llu overflowed)\n", "events",
+		(unsigned long long)events_dispatched,
+		(unsigned long long)packets_dropped,
+		(unsigned long long)rx_overflows);
+	printf ("%-28s %14.3f s\n", "initial ring wall clock",
+		tv_join.tv_sec + tv_join.tv_usec / 1000000.0);
+	printf ("%-28s %14.3f s\n", "wall clock",
+		tv_elapsed.tv_sec + tv_elapsed.tv_usec / 1000000.0);
+
+	sim_cleanup ();
+
+	return (converge_failed);
+}
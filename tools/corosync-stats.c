@@ -0,0 +1,290 @@
+/*
+ * Copyright (c) 2012 Red Hat, Inc.
+ *
+ * All rights reserved.
+ *
+ * This software licensed under BSD license, the text of which follows:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * - Neither the name of the MontaVista Software, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <inttypes.h>
+
+#include <corosync/corotypes.h>
+#include <corosync/statshm.h>
+
+/*
+ * Key names follow the runtime.* objects shown by corosync-objctl so the
+ * two tools can be used interchangeably by scripts
+ */
+
+static const char *key_filter = NULL;
+
+static void print_u64 (const char *object, const char *key, uint64_t value)
+{
+	char name[256];
+
+	snprintf (name, sizeof (name), "%s.%s", object, key);
+	if (key_filter && strncmp (name, key_filter, strlen (key_filter)) != 0) {
+		return;
+	}
+	printf ("%s=%"PRIu64"\n", name, value);
+}
+
+static void print_i64 (const char *object, const char *key, int64_t value)
+{
+	char name[256];
+
+	snprintf (name, sizeof (name), "%s.%s", object, key);
+	if (key_filter && strncmp (name, key_filter, strlen (key_filter)) != 0) {
+		return;
+	}
+	printf ("%s=%"PRIi64"\n", name, value);
+}
+
+static void print_histogram (const char *name,
+	const struct statshm_histogram *histogram)
+{
+	char object[64];
+
+	snprintf (object, sizeof (object),
+		"runtime.totem.pg.mrp.srp.histogram.%s", name);
+	print_u64 (object, "count", histogram->count);
+	print_u64 (object, "min", histogram->min);
+	print_u64 (object, "max", histogram->max);
+	print_u64 (object, "mean", histogram->mean);
+	print_u64 (object, "p50", histogram->p50);
+	print_u64 (object, "p90", histogram->p90);
+	print_u64 (object, "p99", histogram->p99);
+	print_u64 (object, "p999", histogram->p999);
+}
+
+#define PRINT_SRP(field) \
+	print_u64 ("runtime.totem.pg.mrp.srp", #field, seg->srp.field)
+
+static void print_srp (const struct statshm_segment *seg, int print_tokens)
+{
+	char object[64];
+	int t;
+	int i;
+
+	PRINT_SRP (orf_token_tx);
+	PRINT_SRP (orf_token_rx);
+	PRINT_SRP (memb_merge_detect_tx);
+	PRINT_SRP (memb_merge_detect_rx);
+	PRINT_SRP (memb_join_tx);
+	PRINT_SRP (memb_join_rx);
+	PRINT_SRP (mcast_tx);
+	PRINT_SRP (mcast_retx);
+	PRINT_SRP (mcast_rx);
+	PRINT_SRP (memb_commit_token_tx);
+	PRINT_SRP (memb_commit_token_rx);
+	PRINT_SRP (token_hold_cancel_tx);
+	PRINT_SRP (token_hold_cancel_rx);
+	PRINT_SRP (operational_entered);
+	PRINT_SRP (operational_token_lost);
+	PRINT_SRP (gather_entered);
+	PRINT_SRP (gather_token_lost);
+	PRINT_SRP (commit_entered);
+	PRINT_SRP (commit_token_lost);
+	PRINT_SRP (recovery_entered);
+	PRINT_SRP (recovery_token_lost);
+	PRINT_SRP (consensus_timeouts);
+	PRINT_SRP (mtt_rx_token);
+	PRINT_SRP (avg_token_workload);
+	PRINT_SRP (avg_backlog_calc);
+	PRINT_SRP (rx_msg_dropped);
+	PRINT_SRP (continuous_gather);
+	PRINT_SRP (firewall_enabled_or_nic_failure);
+	PRINT_SRP (fcc_window);
+	PRINT_SRP (fcc_max_messages);
+	PRINT_SRP (fcc_window_increases);
+	PRINT_SRP (fcc_window_decreases);
+
+	print_histogram ("token_rotation", &seg->srp.token_rotation_hist);
+	print_histogram ("token_hold", &seg->srp.token_hold_hist);
+	print_histogram ("mcast_deliver", &seg->srp.mcast_deliver_hist);
+	print_histogram ("recv_deliver", &seg->srp.recv_deliver_hist);
+
+	if (!print_tokens) {
+		return;
+	}
+
+	/*
+	 * Oldest to newest
+	 */
+	t = seg->srp.earliest_token;
+	for (i = 0; i < STATSHM_TOKEN_MAX && t != seg->srp.latest_token; i++) {
+		t = (t + 1) % STATSHM_TOKEN_MAX;
+		snprintf (object, sizeof (object),
+			"runtime.totem.pg.mrp.srp.token.%d", i);
+		print_u64 (object, "rx", seg->srp.token[t].rx);
+		print_u64 (object, "tx", seg->srp.token[t].tx);
+		print_i64 (object, "backlog_calc", seg->srp.token[t].backlog_calc);
+	}
+}
+
+static void print_segment (const struct statshm_segment *seg, int print_tokens)
+{
+	char object[256];
+	const struct statshm_service *service;
+	const struct statshm_conn *conn;
+	uint32_t i;
+	uint32_t fn;
+
+	print_u64 ("runtime.totem.pg", "msg_reserved", seg->msg_reserved);
+	print_u64 ("runtime.totem.pg", "msg_queue_avail", seg->msg_queue_avail);
+	print_u64 ("runtime.totem.pg", "compress_active", seg->compress_active);
+	print_u64 ("runtime.totem.pg", "compress_ratio", seg->compress_ratio);
+	print_u64 ("runtime.totem.pg", "compress_tx_msgs", seg->compress_tx_msgs);
+	print_u64 ("runtime.totem.pg", "compress_tx_skipped", seg->compress_tx_skipped);
+	print_u64 ("runtime.totem.pg", "compress_tx_bytes_in", seg->compress_tx_bytes_in);
+	print_u64 ("runtime.totem.pg", "compress_tx_bytes_out", seg->compress_tx_bytes_out);
+	print_u64 ("runtime.totem.pg", "compress_tx_cpu_ns", seg->compress_tx_cpu_ns);
+	print_u64 ("runtime.totem.pg", "compress_rx_msgs", seg->compress_rx_msgs);
+	print_u64 ("runtime.totem.pg", "compress_rx_errors", seg->compress_rx_errors);
+	print_u64 ("runtime.totem.pg", "compress_rx_cpu_ns", seg->compress_rx_cpu_ns);
+
+	print_srp (seg, print_tokens);
+
+	for (i = 0; i < seg->iface_count; i++) {
+		snprintf (object, sizeof (object), "runtime.totem.pg.mrp.rrp.%u", i);
+		print_u64 (object, "iface_changes", seg->iface[i].iface_changes);
+		print_u64 (object, "rx_batches", seg->iface[i].rx_batches);
+		print_u64 (object, "rx_frames", seg->iface[i].rx_frames);
+		print_u64 (object, "rx_batch_max", seg->iface[i].rx_batch_max);
+		print_u64 (object, "tx_batches", seg->iface[i].tx_batches);
+		print_u64 (object, "tx_frames", seg->iface[i].tx_frames);
+	}
+
+	for (i = 0; i < seg->service_count; i++) {
+		service = &seg->service[i];
+		for (fn = 0; fn < service->fn_count; fn++) {
+			snprintf (object, sizeof (object), "runtime.services.%s.%u",
+				service->name, fn);
+			print_u64 (object, "tx", service->fn[fn].tx);
+			print_u64 (object, "rx", service->fn[fn].rx);
+		}
+	}
+
+	for (i = 0; i < seg->conn_count; i++) {
+		conn = &seg->conn[i];
+		snprintf (object, sizeof (object), "runtime.connections.%s",
+			conn->name);
+		print_u64 (object, "service_id", conn->service_id);
+		print_i64 (object, "client_pid", conn->client_pid);
+		print_u64 (object, "requests", conn->requests);
+		print_u64 (object, "responses", conn->responses);
+		print_u64 (object, "dispatched", conn->dispatched);
+		print_u64 (object, "flow_control", conn->flow_control);
+		print_u64 (object, "queue_size", conn->queue_size);
+		print_u64 (object, "invalid_request", conn->invalid_request);
+		print_u64 (object, "overload", conn->overload);
+	}
+	if (seg->conn_total > seg->conn_count) {
+		print_u64 ("runtime.connections", "not_shown",
+			seg->conn_total - seg->conn_count);
+	}
+}
+
+static void usage_do (void)
+{
+	printf ("corosync-stats [-t] [-w interval] [key_prefix]\n\n");
+	printf ("Print the executive statistics from shared memory.\n\n");
+	printf ("options:\n");
+	printf ("\t-t\tAlso print the token timing ring.\n");
+	printf ("\t-w\tRepeat every interval seconds.\n");
+	printf ("\t-h\tPrint this help.\n\n");
+}
+
+int main (int argc, char *argv[]) {
+	const char *options = "htw:";
+	statshm_handle_t handle;
+	struct statshm_segment *seg;
+	cs_error_t result;
+	int print_tokens = 0;
+	unsigned int interval = 0;
+	int opt;
+
+	while ( (opt = getopt(argc, argv, options)) != -1 ) {
+		switch (opt) {
+		case 't':
+			print_tokens = 1;
+			break;
+		case 'w':
+			interval = strtoul (optarg, NULL, 0);
+			break;
+		case 'h':
+		default:
+			usage_do ();
+			return (opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+		}
+	}
+	if (optind < argc) {
+		key_filter = argv[optind];
+	}
+
+	seg = malloc (sizeof (struct statshm_segment));
+	if (seg == NULL) {
+		fprintf (stderr, "Could not allocate snapshot buffer\n");
+		return (EXIT_FAILURE);
+	}
+
+	/*
+	 * Map the segment again on every pass, a restarted executive
+	 * creates a new one
+	 */
+	do {
+		result = statshm_open (&handle);
+		if (result != CS_OK) {
+			fprintf (stderr, "Could not open the statistics segment %s. Error %d\n",
+				STATSHM_NAME, result);
+			break;
+		}
+		result = statshm_read (handle, seg);
+		statshm_close (handle);
+		if (result != CS_OK) {
+			fprintf (stderr, "Could not read the statistics segment. Error %d\n",
+				result);
+			break;
+		}
+		print_segment (seg, print_tokens);
+		if (interval) {
+			printf ("\n");
+			fflush (stdout);
+			sleep (interval);
+		}
+	} while (interval);
+
+	free (seg);
+
+	return (result == CS_OK ? EXIT_SUCCESS : EXIT_FAILURE);
+}